@@ -0,0 +1,585 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Run one benchmark scenario against one or more slides and report
+   throughput, latency percentiles, and a latency histogram as JSON on
+   stdout.  The scaling scenario reports one result per thread count.
+   Slides are taken from the command line, then from
+   OPENSLIDE_BENCH_SLIDES, and otherwise default to a generated synthetic
+   slide. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <glib.h>
+#include "openslide.h"
+#include "openslide-common.h"
+
+#define SLIDES_ENV_VAR "OPENSLIDE_BENCH_SLIDES"
+#define DEFAULT_SLIDE "synthetic:width=100000,height=80000,compression=jpeg"
+#define TILE_SIZE 256
+#define VIEWPORT_WIDTH 1024
+#define VIEWPORT_HEIGHT 768
+#define LOW_ZOOM_MAX 4096
+#define MIXED_HANDLES 4
+#define SCALING_LOW_ZOOM 1024
+#define HISTOGRAM_BUCKETS 32
+
+static gint iterations = 0;
+static gint seed = 1;
+static gint cache_mb = 32;
+static gint max_threads = 0;
+
+static GOptionEntry options[] = {
+  {"iterations", 'n', 0, G_OPTION_ARG_INT, &iterations,
+   "Operations to time (default: per scenario)", "COUNT"},
+  {"seed", 's', 0, G_OPTION_ARG_INT, &seed,
+   "Random seed (default: 1)", "SEED"},
+  {"cache-mb", 'c', 0, G_OPTION_ARG_INT, &cache_mb,
+   "Shared cache size for the mixed and scaling scenarios (default: 32)",
+   "MB"},
+  {"threads", 't', 0, G_OPTION_ARG_INT, &max_threads,
+   "Most reader threads for the scaling scenario (default: processors)",
+   "COUNT"},
+  {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+struct result {
+  const char *slide;
+  GArray *latencies;  // double seconds
+  double seconds;
+  uint64_t pixels;
+
+  // scaling scenario only
+  int threads;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_waits;  // contended cache lock acquisitions
+  double cache_wait_seconds;
+};
+
+struct scenario {
+  const char *name;
+  const char *description;
+  int default_iterations;
+  // run one slide, or all of them if run_all is set
+  void (*run)(const char *slide, int count, struct result *result);
+  void (*run_all)(char **slides, int count, struct result *result);
+  // run all slides with the given number of threads, for each thread count
+  void (*run_threads)(char **slides, int count, int threads,
+                      struct result *result);
+};
+
+static openslide_t *open_slide(const char *slide) {
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Couldn't open %s", slide);
+  return osr;
+}
+
+static void read_region(openslide_t *osr, uint32_t *buf,
+                        int64_t x, int64_t y, int32_t level,
+                        int64_t w, int64_t h) {
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  common_fail_on_error(osr, "Read failed");
+}
+
+// time one operation and record it
+static void record(struct result *result, GTimer *timer, uint64_t pixels) {
+  double elapsed = g_timer_elapsed(timer, NULL);
+  g_array_append_val(result->latencies, elapsed);
+  result->seconds += elapsed;
+  result->pixels += pixels;
+}
+
+// level 0 region to read from, honoring the bounds properties
+static void get_bounds(openslide_t *osr,
+                       int64_t *x, int64_t *y, int64_t *w, int64_t *h) {
+  const char *bx = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_X);
+  const char *by = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_Y);
+  const char *bw = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_WIDTH);
+  const char *bh = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_HEIGHT);
+  *x = 0;
+  *y = 0;
+  openslide_get_level0_dimensions(osr, w, h);
+  if (bx && by && bw && bh) {
+    *x = g_ascii_strtoll(bx, NULL, 10);
+    *y = g_ascii_strtoll(by, NULL, 10);
+    *w = g_ascii_strtoll(bw, NULL, 10);
+    *h = g_ascii_strtoll(bh, NULL, 10);
+  }
+}
+
+// random level 0 origin of a w x h region at level, within the bounds
+static void random_origin(openslide_t *osr, GRand *rand, int32_t level,
+                          int64_t w, int64_t h, int64_t *x, int64_t *y) {
+  int64_t bx, by, bw, bh;
+  get_bounds(osr, &bx, &by, &bw, &bh);
+  double downsample = openslide_get_level_downsample(osr, level);
+  int64_t range_w = MAX(bw - (int64_t) (w * downsample), 1);
+  int64_t range_h = MAX(bh - (int64_t) (h * downsample), 1);
+  *x = bx + (int64_t) (g_rand_double(rand) * range_w);
+  *y = by + (int64_t) (g_rand_double(rand) * range_h);
+}
+
+static void run_open(const char *slide, int count, struct result *result) {
+  g_autoptr(GTimer) timer = g_timer_new();
+  for (int i = 0; i < count; i++) {
+    g_timer_start(timer);
+    openslide_t *osr = open_slide(slide);
+    openslide_close(osr);
+    record(result, timer, 0);
+  }
+}
+
+static void run_metadata(const char *slide, int count,
+                         struct result *result) {
+  g_autoptr(openslide_t) osr = open_slide(slide);
+  g_autoptr(GTimer) timer = g_timer_new();
+  for (int i = 0; i < count; i++) {
+    g_timer_start(timer);
+    for (const char * const *name = openslide_get_property_names(osr);
+         *name; name++) {
+      openslide_get_property_value(osr, *name);
+    }
+    int32_t levels = openslide_get_level_count(osr);
+    for (int32_t level = 0; level < levels; level++) {
+      int64_t w, h;
+      openslide_get_level_dimensions(osr, level, &w, &h);
+      openslide_get_level_downsample(osr, level);
+    }
+    for (const char * const *name = openslide_get_associated_image_names(osr);
+         *name; name++) {
+      int64_t w, h;
+      openslide_get_associated_image_dimensions(osr, *name, &w, &h);
+      openslide_get_associated_image_icc_profile_size(osr, *name);
+    }
+    openslide_get_icc_profile_size(osr);
+    record(result, timer, 0);
+  }
+  common_fail_on_error(osr, "Metadata query failed");
+}
+
+static void run_sequential(const char *slide, int count,
+                           struct result *result) {
+  g_autoptr(openslide_t) osr = open_slide(slide);
+  int64_t bx, by, bw, bh;
+  get_bounds(osr, &bx, &by, &bw, &bh);
+  int64_t cols = MAX((bw + TILE_SIZE - 1) / TILE_SIZE, 1);
+  int64_t rows = MAX((bh + TILE_SIZE - 1) / TILE_SIZE, 1);
+  g_autofree uint32_t *buf = g_new(uint32_t, TILE_SIZE * TILE_SIZE);
+  g_autoptr(GTimer) timer = g_timer_new();
+  // raster order, wrapping around small slides
+  for (int i = 0; i < count; i++) {
+    int64_t tile = i % (cols * rows);
+    g_timer_start(timer);
+    read_region(osr, buf,
+                bx + (tile % cols) * TILE_SIZE, by + (tile / cols) * TILE_SIZE,
+                0, TILE_SIZE, TILE_SIZE);
+    record(result, timer, TILE_SIZE * TILE_SIZE);
+  }
+}
+
+static void run_viewport(const char *slide, int count,
+                         struct result *result) {
+  g_autoptr(openslide_t) osr = open_slide(slide);
+  g_autoptr(GRand) rand = g_rand_new_with_seed(seed);
+  int32_t levels = openslide_get_level_count(osr);
+  g_autofree uint32_t *buf = g_new(uint32_t, TILE_SIZE * TILE_SIZE);
+  g_autoptr(GTimer) timer = g_timer_new();
+  // each operation jumps to a random viewport and fetches its tiles, as a
+  // viewer would
+  for (int i = 0; i < count; i++) {
+    int32_t level = g_rand_int_range(rand, 0, levels);
+    double downsample = openslide_get_level_downsample(osr, level);
+    int64_t x, y;
+    random_origin(osr, rand, level, VIEWPORT_WIDTH, VIEWPORT_HEIGHT, &x, &y);
+    g_timer_start(timer);
+    for (int64_t ty = 0; ty < VIEWPORT_HEIGHT; ty += TILE_SIZE) {
+      for (int64_t tx = 0; tx < VIEWPORT_WIDTH; tx += TILE_SIZE) {
+        read_region(osr, buf,
+                    x + (int64_t) (tx * downsample),
+                    y + (int64_t) (ty * downsample),
+                    level, TILE_SIZE, TILE_SIZE);
+      }
+    }
+    record(result, timer, VIEWPORT_WIDTH * VIEWPORT_HEIGHT);
+  }
+}
+
+static void run_low_zoom(const char *slide, int count,
+                         struct result *result) {
+  g_autoptr(openslide_t) osr = open_slide(slide);
+  int32_t level = openslide_get_level_count(osr) - 1;
+  int64_t w, h;
+  openslide_get_level_dimensions(osr, level, &w, &h);
+  w = MIN(w, LOW_ZOOM_MAX);
+  h = MIN(h, LOW_ZOOM_MAX);
+  g_autofree uint32_t *buf = g_new(uint32_t, w * h);
+  g_autoptr(GTimer) timer = g_timer_new();
+  // a fresh handle each time, so every read starts with a cold cache
+  for (int i = 0; i < count; i++) {
+    g_autoptr(openslide_t) reader = open_slide(slide);
+    g_timer_start(timer);
+    read_region(reader, buf, 0, 0, level, w, h);
+    record(result, timer, w * h);
+  }
+}
+
+static void run_mixed(char **slides, int count, struct result *result) {
+  // several handles share one small cache.  With a single slide, open it
+  // several times so the handles still compete.
+  int slide_count = g_strv_length(slides);
+  int handle_count = MAX(slide_count, MIXED_HANDLES);
+  openslide_cache_t *cache = openslide_cache_create((size_t) cache_mb << 20);
+  g_autofree openslide_t **osrs = g_new0(openslide_t *, handle_count);
+  for (int i = 0; i < handle_count; i++) {
+    osrs[i] = open_slide(slides[i % slide_count]);
+    openslide_set_cache(osrs[i], cache);
+  }
+  openslide_cache_release(cache);
+
+  g_autoptr(GRand) rand = g_rand_new_with_seed(seed);
+  g_autofree uint32_t *buf = g_new(uint32_t, TILE_SIZE * TILE_SIZE);
+  g_autoptr(GTimer) timer = g_timer_new();
+  for (int i = 0; i < count; i++) {
+    openslide_t *osr = osrs[g_rand_int_range(rand, 0, handle_count)];
+    int32_t level =
+      g_rand_int_range(rand, 0, openslide_get_level_count(osr));
+    int64_t x, y;
+    random_origin(osr, rand, level, TILE_SIZE, TILE_SIZE, &x, &y);
+    g_timer_start(timer);
+    read_region(osr, buf, x, y, level, TILE_SIZE, TILE_SIZE);
+    record(result, timer, TILE_SIZE * TILE_SIZE);
+  }
+
+  for (int i = 0; i < handle_count; i++) {
+    openslide_close(osrs[i]);
+  }
+}
+
+struct scaling_thread {
+  openslide_t **osrs;
+  int handle_count;
+  int count;
+  int index;
+  GArray *latencies;
+  uint64_t pixels;
+};
+
+// mix viewport tiles, a sequential scan, and low-zoom reads, as a busy
+// tile server would
+static void *scaling_thread_func(void *data) {
+  struct scaling_thread *t = data;
+  g_autoptr(GRand) rand = g_rand_new_with_seed(seed + t->index);
+  g_autofree uint32_t *buf =
+    g_new(uint32_t, MAX(TILE_SIZE * TILE_SIZE,
+                        SCALING_LOW_ZOOM * SCALING_LOW_ZOOM));
+  g_autoptr(GTimer) timer = g_timer_new();
+  // each thread scans its own handle, starting from a different tile
+  openslide_t *scan_osr = t->osrs[t->index % t->handle_count];
+  int64_t bx, by, bw, bh;
+  get_bounds(scan_osr, &bx, &by, &bw, &bh);
+  int64_t cols = MAX((bw + TILE_SIZE - 1) / TILE_SIZE, 1);
+  int64_t rows = MAX((bh + TILE_SIZE - 1) / TILE_SIZE, 1);
+  int64_t scan = (int64_t) t->index * 7919 % (cols * rows);
+
+  for (int i = 0; i < t->count; i++) {
+    int kind = g_rand_int_range(rand, 0, 10);
+    uint64_t pixels;
+    g_timer_start(timer);
+    if (kind < 6) {
+      // random viewport tile
+      openslide_t *osr = t->osrs[g_rand_int_range(rand, 0, t->handle_count)];
+      int32_t level =
+        g_rand_int_range(rand, 0, openslide_get_level_count(osr));
+      int64_t x, y;
+      random_origin(osr, rand, level, TILE_SIZE, TILE_SIZE, &x, &y);
+      read_region(osr, buf, x, y, level, TILE_SIZE, TILE_SIZE);
+      pixels = TILE_SIZE * TILE_SIZE;
+    } else if (kind < 9) {
+      // next tile of the scan
+      read_region(scan_osr, buf,
+                  bx + (scan % cols) * TILE_SIZE,
+                  by + (scan / cols) * TILE_SIZE,
+                  0, TILE_SIZE, TILE_SIZE);
+      scan = (scan + 1) % (cols * rows);
+      pixels = TILE_SIZE * TILE_SIZE;
+    } else {
+      // low-zoom overview
+      openslide_t *osr = t->osrs[g_rand_int_range(rand, 0, t->handle_count)];
+      int32_t level = openslide_get_level_count(osr) - 1;
+      int64_t w, h;
+      openslide_get_level_dimensions(osr, level, &w, &h);
+      w = MIN(w, SCALING_LOW_ZOOM);
+      h = MIN(h, SCALING_LOW_ZOOM);
+      int64_t x, y;
+      random_origin(osr, rand, level, w, h, &x, &y);
+      read_region(osr, buf, x, y, level, w, h);
+      pixels = w * h;
+    }
+    double elapsed = g_timer_elapsed(timer, NULL);
+    g_array_append_val(t->latencies, elapsed);
+    t->pixels += pixels;
+  }
+  return NULL;
+}
+
+// run count operations spread over threads; if result is non-NULL, record
+// their latencies, pixels, and wall time
+static void run_scaling_pass(openslide_t **osrs, int handle_count,
+                             int count, int threads, struct result *result) {
+  g_autofree struct scaling_thread *ts =
+    g_new0(struct scaling_thread, threads);
+  g_autofree GThread **handles = g_new0(GThread *, threads);
+  g_autoptr(GTimer) timer = g_timer_new();
+  for (int i = 0; i < threads; i++) {
+    ts[i].osrs = osrs;
+    ts[i].handle_count = handle_count;
+    ts[i].count = count / threads + (i < count % threads);
+    ts[i].index = i;
+    ts[i].latencies = g_array_new(false, false, sizeof(double));
+    handles[i] = g_thread_new("reader", scaling_thread_func, &ts[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    g_thread_join(handles[i]);
+    if (result) {
+      g_array_append_vals(result->latencies, ts[i].latencies->data,
+                          ts[i].latencies->len);
+      result->pixels += ts[i].pixels;
+    }
+    g_array_free(ts[i].latencies, true);
+  }
+  if (result) {
+    // wall time, so throughput reflects the concurrency
+    result->seconds = g_timer_elapsed(timer, NULL);
+  }
+}
+
+static void run_scaling(char **slides, int count, int threads,
+                        struct result *result) {
+  int slide_count = g_strv_length(slides);
+  int handle_count = MAX(slide_count, MIXED_HANDLES);
+  openslide_cache_t *cache = openslide_cache_create((size_t) cache_mb << 20);
+  g_autofree openslide_t **osrs = g_new0(openslide_t *, handle_count);
+  for (int i = 0; i < handle_count; i++) {
+    osrs[i] = open_slide(slides[i % slide_count]);
+    openslide_set_cache(osrs[i], cache);
+  }
+
+  // the same total work at every thread count, timed without
+  // instrumentation so its overhead doesn't skew the scaling
+  run_scaling_pass(osrs, handle_count, count, threads, result);
+  openslide_cache_stats_t cstats;
+  openslide_cache_get_stats(cache, &cstats);
+  result->cache_hits = cstats.hits;
+  result->cache_misses = cstats.misses;
+  openslide_cache_release(cache);
+
+  // then repeat it from a cold cache, untimed, to count lock contention
+  cache = openslide_cache_create((size_t) cache_mb << 20);
+  for (int i = 0; i < handle_count; i++) {
+    openslide_set_cache(osrs[i], cache);
+  }
+  openslide_set_instrumentation(true);
+  openslide_reset_instrumentation_stats();
+  run_scaling_pass(osrs, handle_count, count, threads, NULL);
+  openslide_instrumentation_stats_t istats;
+  openslide_get_instrumentation_stats(&istats);
+  openslide_set_instrumentation(false);
+  result->cache_waits = istats.cache_wait.count;
+  result->cache_wait_seconds = istats.cache_wait.nanoseconds / 1e9;
+
+  for (int i = 0; i < handle_count; i++) {
+    openslide_close(osrs[i]);
+  }
+  openslide_cache_release(cache);
+}
+
+static const struct scenario scenarios[] = {
+  {"open", "open and close the slide", 50, run_open, NULL, NULL},
+  {"metadata", "query properties, levels, and associated images",
+   1000, run_metadata, NULL, NULL},
+  {"sequential", "read level 0 tiles in raster order", 2000,
+   run_sequential, NULL, NULL},
+  {"viewport", "read the tiles of random viewports", 200,
+   run_viewport, NULL, NULL},
+  {"low-zoom", "read the lowest-resolution level", 20, run_low_zoom, NULL,
+   NULL},
+  {"mixed", "read random tiles from several slides sharing a cache",
+   2000, NULL, run_mixed, NULL},
+  {"scaling", "run a mixed workload at increasing thread counts",
+   4000, NULL, NULL, run_scaling},
+  {NULL, NULL, 0, NULL, NULL, NULL}
+};
+
+static int compare_double(const void *a, const void *b) {
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+  return (da > db) - (da < db);
+}
+
+// nearest-rank percentile, in milliseconds
+static double percentile(GArray *sorted, double p) {
+  if (sorted->len == 0) {
+    return 0;
+  }
+  int64_t rank = (int64_t) (p * sorted->len + 0.999999) - 1;
+  rank = CLAMP(rank, 0, (int64_t) sorted->len - 1);
+  return 1000 * g_array_index(sorted, double, rank);
+}
+
+static void print_result(GString *out, const struct result *result) {
+  g_array_sort(result->latencies, compare_double);
+  double seconds = result->seconds;
+  double ops = result->latencies->len;
+  g_autofree char *slide = g_strescape(result->slide, NULL);
+  char value[G_ASCII_DTOSTR_BUF_SIZE];
+  g_string_append_printf(out, "    {\"slide\": \"%s\", \"operations\": %u",
+                         slide, result->latencies->len);
+  #define field(name, v) g_string_append_printf(out, ", \"" name "\": %s", \
+    g_ascii_formatd(value, sizeof(value), "%.6g", v))
+  field("seconds", seconds);
+  field("ops_per_sec", seconds > 0 ? ops / seconds : 0);
+  field("mpixels_per_sec", seconds > 0 ? result->pixels / seconds / 1e6 : 0);
+  field("p50_ms", percentile(result->latencies, 0.50));
+  field("p99_ms", percentile(result->latencies, 0.99));
+  if (result->threads) {
+    g_string_append_printf(out, ", \"threads\": %d"
+                           ", \"cache_hits\": %"PRIu64
+                           ", \"cache_misses\": %"PRIu64
+                           ", \"cache_lock_waits\": %"PRIu64,
+                           result->threads, result->cache_hits,
+                           result->cache_misses, result->cache_waits);
+    field("cache_lock_wait_ms", 1000 * result->cache_wait_seconds);
+  }
+  #undef field
+
+  // operations by latency, in power-of-two microsecond buckets
+  uint64_t buckets[HISTOGRAM_BUCKETS] = {0};
+  for (guint i = 0; i < result->latencies->len; i++) {
+    double us = 1e6 * g_array_index(result->latencies, double, i);
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && us >= (double) (1 << bucket)) {
+      bucket++;
+    }
+    buckets[bucket]++;
+  }
+  g_string_append(out, ", \"histogram_us\": {");
+  bool first = true;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (buckets[i]) {
+      // keyed by upper bound; the last bucket is unbounded
+      g_string_append_printf(out, "%s\"%s%u\": %"PRIu64, first ? "" : ", ",
+                             i == HISTOGRAM_BUCKETS - 1 ? ">=" : "<",
+                             1u << (i == HISTOGRAM_BUCKETS - 1 ? i - 1 : i),
+                             buckets[i]);
+      first = false;
+    }
+  }
+  g_string_append(out, "}}");
+}
+
+int main(int argc, char **argv) {
+  GError *tmp_err = NULL;
+
+  // Parse arguments
+  g_autoptr(GOptionContext) ctx =
+    g_option_context_new("SCENARIO [SLIDE...] - benchmark OpenSlide");
+  g_option_context_add_main_entries(ctx, options, NULL);
+  g_autoptr(GString) summary = g_string_new("Scenarios:");
+  for (const struct scenario *s = scenarios; s->name; s++) {
+    g_string_append_printf(summary, "\n  %-12s%s", s->name, s->description);
+  }
+  g_option_context_set_summary(ctx, summary->str);
+  if (!common_parse_options(ctx, &argc, &argv, &tmp_err)) {
+    fprintf(stderr, "%s\n", tmp_err->message);
+    g_clear_error(&tmp_err);
+    return 2;
+  }
+  if (argc < 2) {
+    common_warn("No scenario specified");
+    return 2;
+  }
+  const struct scenario *scenario = scenarios;
+  while (scenario->name && !g_str_equal(scenario->name, argv[1])) {
+    scenario++;
+  }
+  if (!scenario->name) {
+    common_fail("No such scenario: %s", argv[1]);
+  }
+  if (cache_mb < 1) {
+    common_fail("Cache size must be positive");
+  }
+  int count = iterations > 0 ? iterations : scenario->default_iterations;
+
+  // Collect slides
+  g_auto(GStrv) slides = NULL;
+  const char *env = g_getenv(SLIDES_ENV_VAR);
+  if (argc > 2) {
+    slides = g_strdupv(argv + 2);
+  } else if (env && *env) {
+    slides = g_strsplit(env, G_SEARCHPATH_SEPARATOR_S, 0);
+  } else {
+    // generated slide; requires OPENSLIDE_DEBUG=synthetic
+    slides = g_new0(char *, 2);
+    slides[0] = g_strdup(DEFAULT_SLIDE);
+  }
+
+  // Run
+  g_autoptr(GString) out = g_string_new(NULL);
+  g_string_append_printf(out, "{\n  \"scenario\": \"%s\",\n"
+                         "  \"version\": \"%s\",\n  \"results\": [\n",
+                         scenario->name, openslide_get_version());
+  // thread counts for the scaling scenario: powers of two, then the most
+  g_autoptr(GArray) thread_counts = g_array_new(false, false, sizeof(int));
+  int most = max_threads > 0 ? max_threads : g_get_num_processors();
+  for (int t = 1; t < most; t *= 2) {
+    g_array_append_val(thread_counts, t);
+  }
+  g_array_append_val(thread_counts, most);
+
+  int runs = scenario->run_threads ? (int) thread_counts->len :
+             scenario->run_all ? 1 : g_strv_length(slides);
+  for (int i = 0; i < runs; i++) {
+    struct result result = {
+      .slide = scenario->run_all || scenario->run_threads ?
+               "mixed" : slides[i],
+      .latencies = g_array_new(false, false, sizeof(double)),
+    };
+    if (scenario->run_threads) {
+      result.threads = g_array_index(thread_counts, int, i);
+      scenario->run_threads(slides, count, result.threads, &result);
+    } else if (scenario->run_all) {
+      scenario->run_all(slides, count, &result);
+    } else {
+      scenario->run(slides[i], count, &result);
+    }
+    print_result(out, &result);
+    g_string_append(out, i + 1 < runs ? ",\n" : "\n");
+    g_array_free(result.latencies, true);
+  }
+  g_string_append(out, "  ]\n}\n");
+  fputs(out->str, stdout);
+
+  return 0;
+}
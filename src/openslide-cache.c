@@ -22,7 +22,54 @@
 
 #include "openslide-private.h"
 
+#include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
+
+// The cache is split into shards, each with its own lock, hash table, and
+// eviction order, so that threads touching different tiles rarely
+// contend.  Keys are assigned to shards by hash.  The capacity applies to
+// the cache as a whole: the total size is tracked atomically, and a put
+// first evicts from the tail of its own shard, then from the other shards
+// if its own is empty.  Concurrent puts may briefly overshoot the capacity
+// by the sizes of the entries they are inserting.
+//
+// Eviction follows GreedyDual-Size.  Each entry records how long it took
+// to produce: the time from the cache miss on the calling thread to the
+// put.  Its priority is the shard's inflation value plus cost / size, and
+// is refreshed on every hit.  The entry with the lowest priority is
+// evicted, and the inflation value rises to its priority, so entries that
+// are costly to rebuild outlive cheap ones while unused entries still age
+// out.  With equal costs this degrades to LRU.
+//
+// An optional second tier keeps evicted entries zstd-compressed, in
+// per-shard LRU lists under a separate global capacity.  A miss in the
+// main tier that hits the compressed tier inflates the entry back into the
+// main tier.  Entries are compressed after the shard lock is dropped.
+//
+// An optional persistent tier stores level tiles in a directory, one
+// zstd-compressed file per tile, keyed by the slide's quickhash so the
+// directory can be shared by processes reading the same slide.  A miss in
+// both memory tiers checks the directory before the caller decodes the
+// tile; new entries are written from the worker pool.  Files are replaced
+// atomically, so concurrent writers are harmless.  Nothing is ever pruned.
+//
+// Each binding can have a byte quota and a priority class.  A put that
+// would take a binding over its quota first evicts that binding's own
+// lowest-priority entries.  Entries in the low priority class sort before
+// all normal entries, so they are evicted first regardless of cost.
+#define SHARD_BITS 6
+#define SHARD_COUNT (1 << SHARD_BITS)
+
+// the buffer pool holds up to this fraction of the cache capacity
+#define POOL_FRACTION 8
+
+// smallest tile worth storing as a single pixel
+#define UNIFORM_MIN_SIZE 1024
+
+// bump when the layout of cached tile data changes
+#define PERSISTENT_VERSION "v1"
+static const char PERSISTENT_MAGIC[8] = "OSTILE1";
 
 // hash table key
 struct _openslide_cache_key {
@@ -34,9 +81,16 @@ struct _openslide_cache_key {
 
 // hash table value
 struct _openslide_cache_value {
-  GList *link;            // direct pointer to the node in the list
+  GSequenceIter *iter;    // direct pointer to the node in the eviction order
   struct _openslide_cache_key *key; // for removing keys when aged out
-  openslide_cache_t *cache; // sadly, for total_bytes and the list
+  struct cache_shard *shard; // sadly, for the eviction order
+  openslide_cache_t *cache;  // and for total_size
+  struct cache_usage *usage; // and for the binding's size
+
+  int priority_class;  // openslide_cache_priority_t
+  uint64_t cost;     // microseconds to produce the entry
+  double priority;   // GreedyDual-Size H value
+  uint64_t stamp;    // breaks ties by age
 
   struct _openslide_cache_entry *entry;  // may outlive the value
 };
@@ -46,19 +100,115 @@ struct _openslide_cache_entry {
   gint refcount;  // atomic ops only
   void *data;
   uint64_t size;
+  struct buffer_pool *pool;  // receives data when freed, or NULL
+  uint64_t expanded_size;  // if nonzero, a uniform tile stored as one pixel
 };
 
-struct _openslide_cache {
+// free tile buffers of one size
+struct pool_class {
+  uint64_t size;
+  GPtrArray *buffers;
+};
+
+// buffers of freed entries, recycled for the next tiles decoded into the
+// cache.  shared with the entries, since they can outlive the cache.
+struct buffer_pool {
+  gint refcount;  // atomic ops only
+  GMutex lock;
+  GHashTable *classes;  // uint64_t size -> struct pool_class
+  uint64_t size;        // bytes in the pool
+  uint64_t capacity;    // immutable
+};
+
+// compressed hash table value
+struct compressed_value {
+  GList *link;
+  struct _openslide_cache_key *key;
+  struct cache_shard *shard;
+  openslide_cache_t *cache;
+
+  void *data;
+  uint64_t compressed_size;
+  uint64_t size;
+  uint64_t cost;
+};
+
+// space used by a binding's entries in its current cache.  shared with the
+// entries, since they can outlive the binding.
+struct cache_usage {
+  gint refcount;  // atomic ops only
+  gsize size;     // atomic ops only
+  gsize quota;    // atomic ops only; 0 for unlimited
+  gint priority_class;  // atomic ops only
+};
+
+// header of a persistent tile file, followed by the payload.  the payload
+// is zstd-compressed unless payload_size == size.
+struct persistent_header {
+  char magic[8];
+  uint64_t size;          // little-endian
+  uint64_t payload_size;  // little-endian
+};
+
+// a plane with an identity outside this process: a level or one of its
+// scaled planes
+struct persistent_plane {
+  char *name;
+  uint64_t tile_size;  // bytes in each of its tiles
+};
+
+// an entry waiting to be written to the persistent tier
+struct persistent_write {
+  char *path;
+  struct _openslide_cache_entry *entry;
+};
+
+// an evicted entry waiting to be compressed
+struct spill {
+  struct _openslide_cache_key key;
+  struct _openslide_cache_entry *entry;
+  uint64_t cost;
+};
+
+// statistics kept by each shard, under its lock
+struct shard_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t insertions;
+  uint64_t evictions;
+  uint64_t rejected;
+  uint64_t compressed_hits;
+  uint64_t persistent_hits;
+};
+
+struct cache_shard {
   GMutex mutex;
-  GQueue *list;
+  struct shard_stats stats;
+  GSequence *order;    // of values, lowest priority first
   GHashTable *hashtable;
+  double inflation;    // GreedyDual-Size L value
+  uint64_t clock;
+
+  GQueue *compressed_list; // of compressed values, most recent first
+  GHashTable *compressed;
+};
+
+struct _openslide_cache {
+  struct cache_shard shards[SHARD_COUNT];
+  struct buffer_pool *pool;
 
+  GMutex mutex;  // for the fields below it
   int refcount;
   bool released;
   uint64_t next_binding_id;
 
-  uint64_t capacity;
-  uint64_t total_size;
+  struct _openslide_persistent_dir persistent_dir;
+
+  uint64_t capacity;     // immutable
+  gsize total_size;      // atomic ops only
+
+  gsize compressed_capacity;  // atomic ops only; 0 to disable
+  gsize compressed_size;      // atomic ops only
 
   gint warned_overlarge_entry;
 };
@@ -66,34 +216,272 @@ struct _openslide_cache {
 // connection between a cache (possibly shared between multiple slide handles)
 // and a specific slide handle
 struct _openslide_cache_binding {
-  GMutex mutex;
+  GRWLock lock;  // writers only replace the cache
   openslide_cache_t *cache;
   uint64_t id;  // unique id assigned by cache upon bind
+  struct cache_usage *usage;  // replaced with the cache
+
+  // identity for the persistent tier; immutable once set
+  char *persistent_id;
+  GHashTable *persistent_planes;  // plane -> struct persistent_plane
+
+  // statistics for this slide handle; atomic ops only
+  gsize hits;
+  gsize misses;
+  gsize insertions;
+  gsize rejected;
+  gsize compressed_hits;
+  gsize persistent_hits;
 };
 
-// eviction
-// mutex must be held
-static void possibly_evict(openslide_cache_t *cache, uint64_t incoming_size) {
-  uint64_t size = cache->total_size + incoming_size;
-  uint64_t target = cache->capacity;
-  g_assert(size > cache->total_size);
-
-  while(size > target) {
-    // get key of last element
-    struct _openslide_cache_value *value = g_queue_peek_tail(cache->list);
-    if (value == NULL) {
-      return; // cache is empty
+static void count(gsize *counter) {
+  g_atomic_pointer_add(counter, 1);
+}
+
+// time of the last cache miss on this thread, for measuring the cost of
+// the entry the caller then puts
+static GPrivate miss_time = G_PRIVATE_INIT(g_free);
+
+static void record_miss(void) {
+  gint64 *t = g_private_get(&miss_time);
+  if (!t) {
+    t = g_new(gint64, 1);
+    g_private_set(&miss_time, t);
+  }
+  *t = g_get_monotonic_time();
+}
+
+static uint64_t get_put_cost(void) {
+  gint64 *t = g_private_get(&miss_time);
+  if (!t) {
+    return 0;
+  }
+  return MAX(g_get_monotonic_time() - *t, 0);
+}
+
+static void pool_class_free(gpointer data) {
+  struct pool_class *class = data;
+  for (guint i = 0; i < class->buffers->len; i++) {
+    g_free(class->buffers->pdata[i]);
+  }
+  g_ptr_array_free(class->buffers, true);
+  g_free(class);
+}
+
+// the innermost report on this thread, if any
+static GPrivate current_report;
+
+void _openslide_cache_report_push(struct _openslide_cache_report *report) {
+  memset(report, 0, sizeof(*report));
+  report->prev = g_private_get(&current_report);
+  g_private_set(&current_report, report);
+}
+
+void _openslide_cache_report_pop(struct _openslide_cache_report *report) {
+  g_assert(g_private_get(&current_report) == report);
+  g_private_set(&current_report, report->prev);
+}
+
+static void report_tile(bool uniform, uint32_t color, uint64_t size) {
+  struct _openslide_cache_report *report = g_private_get(&current_report);
+  if (report) {
+    report->tiles++;
+    report->uniform = uniform;
+    report->color = color;
+    report->size = size;
+  }
+}
+
+// stops at the first pixel that differs, which for tissue is usually early
+static bool is_uniform(const void *data, uint64_t size, uint32_t *color) {
+  if (size < UNIFORM_MIN_SIZE || size % 4) {
+    return false;
+  }
+  const uint32_t *p = data;
+  uint64_t count = size / 4;
+  for (uint64_t i = 1; i < count; i++) {
+    if (p[i] != p[0]) {
+      return false;
     }
-    struct _openslide_cache_key *key = value->key;
+  }
+  *color = p[0];
+  return true;
+}
 
-    //g_debug("EVICT: size: %d", value->entry->size);
+static struct buffer_pool *pool_new(uint64_t capacity) {
+  struct buffer_pool *pool = g_new0(struct buffer_pool, 1);
+  pool->refcount = 1;
+  g_mutex_init(&pool->lock);
+  pool->classes = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                        NULL, pool_class_free);
+  pool->capacity = capacity;
+  return pool;
+}
 
-    size -= value->entry->size;
+static struct buffer_pool *pool_ref(struct buffer_pool *pool) {
+  g_atomic_int_inc(&pool->refcount);
+  return pool;
+}
 
-    // remove from hashtable, this will trigger removal from everything
-    bool result = g_hash_table_remove(cache->hashtable, key);
-    g_assert(result);
+static void pool_unref(struct buffer_pool *pool) {
+  if (g_atomic_int_dec_and_test(&pool->refcount)) {
+    g_hash_table_destroy(pool->classes);
+    g_mutex_clear(&pool->lock);
+    g_free(pool);
+  }
+}
+
+// a miss registers the size, so buffers of that size are kept when freed
+static void *pool_take(struct buffer_pool *pool, uint64_t size) {
+  void *buf = NULL;
+  g_mutex_lock(&pool->lock);
+  struct pool_class *class = g_hash_table_lookup(pool->classes, &size);
+  if (!class) {
+    class = g_new0(struct pool_class, 1);
+    class->size = size;
+    class->buffers = g_ptr_array_new();
+    g_hash_table_insert(pool->classes, &class->size, class);
+  } else if (class->buffers->len) {
+    buf = g_ptr_array_remove_index_fast(class->buffers,
+                                        class->buffers->len - 1);
+    pool->size -= size;
+  }
+  g_mutex_unlock(&pool->lock);
+  return buf;
+}
+
+// takes ownership of buf.  buffers of sizes no one has asked for are
+// freed, since they would only take up room.
+static void pool_give(struct buffer_pool *pool, void *buf, uint64_t size) {
+  g_mutex_lock(&pool->lock);
+  struct pool_class *class = g_hash_table_lookup(pool->classes, &size);
+  if (!class || pool->size + size > pool->capacity) {
+    g_mutex_unlock(&pool->lock);
+    g_free(buf);
+    return;
+  }
+  g_ptr_array_add(class->buffers, buf);
+  pool->size += size;
+  g_mutex_unlock(&pool->lock);
+}
+
+static struct cache_usage *usage_new(gsize quota, gint priority_class) {
+  struct cache_usage *usage = g_new0(struct cache_usage, 1);
+  usage->refcount = 1;
+  usage->quota = quota;
+  usage->priority_class = priority_class;
+  return usage;
+}
+
+static void usage_unref(struct cache_usage *usage) {
+  if (g_atomic_int_dec_and_test(&usage->refcount)) {
+    g_free(usage);
+  }
+}
+
+static uint64_t get_usage_size(struct cache_usage *usage) {
+  return (gsize) g_atomic_pointer_get(&usage->size);
+}
+
+static gint value_compare(gconstpointer a, gconstpointer b,
+                          gpointer data G_GNUC_UNUSED) {
+  const struct _openslide_cache_value *va = a;
+  const struct _openslide_cache_value *vb = b;
+  if (va->priority_class != vb->priority_class) {
+    return va->priority_class == OPENSLIDE_CACHE_PRIORITY_LOW ? -1 : 1;
+  }
+  if (va->priority != vb->priority) {
+    return va->priority < vb->priority ? -1 : 1;
+  }
+  if (va->stamp != vb->stamp) {
+    return va->stamp < vb->stamp ? -1 : 1;
+  }
+  return 0;
+}
+
+// shard mutex must be held
+static void set_priority(struct cache_shard *shard,
+                         struct _openslide_cache_value *value) {
+  value->priority_class = g_atomic_int_get(&value->usage->priority_class);
+  value->priority = shard->inflation +
+                    (double) MAX(value->cost, 1) / MAX(value->entry->size, 1);
+  value->stamp = ++shard->clock;
+}
+
+static uint64_t get_total_size(openslide_cache_t *cache) {
+  return (gsize) g_atomic_pointer_get(&cache->total_size);
+}
+
+// shard mutex must be held.  if spills is not NULL, the evicted entry is
+// added to it for the compressed tier.
+static void evict(struct cache_shard *shard,
+                  struct _openslide_cache_value *value,
+                  GArray *spills) {
+  shard->stats.evictions++;
+
+  // uniform tiles are already smaller than they would be compressed
+  if (spills && !value->entry->expanded_size) {
+    struct spill spill = {
+      .key = *value->key,
+      .entry = value->entry,
+      .cost = value->cost,
+    };
+    g_atomic_int_inc(&value->entry->refcount);
+    g_array_append_val(spills, spill);
   }
+
+  //g_debug("EVICT: size: %d", value->entry->size);
+
+  // remove from hashtable, this will trigger removal from everything
+  bool result = g_hash_table_remove(shard->hashtable, value->key);
+  g_assert(result);
+}
+
+// eviction
+// shard mutex must be held.  returns false if the shard ran out of
+// entries before the incoming entry would fit.  if spills is not NULL,
+// evicted entries are added to it for the compressed tier.
+static bool possibly_evict(openslide_cache_t *cache,
+                           struct cache_shard *shard,
+                           uint64_t incoming_size,
+                           GArray *spills) {
+  while (get_total_size(cache) + incoming_size > cache->capacity) {
+    // get lowest-priority element
+    GSequenceIter *iter = g_sequence_get_begin_iter(shard->order);
+    if (g_sequence_iter_is_end(iter)) {
+      return false; // shard is empty
+    }
+    struct _openslide_cache_value *value = g_sequence_get(iter);
+    shard->inflation = MAX(shard->inflation, value->priority);
+    evict(shard, value, spills);
+  }
+  return true;
+}
+
+// evict the binding's own entries until the incoming entry fits in its
+// quota.  shard mutex must be held.  returns false if the shard ran out of
+// the binding's entries first.
+static bool possibly_evict_own(struct cache_shard *shard,
+                               struct cache_usage *usage,
+                               uint64_t incoming_size,
+                               GArray *spills) {
+  uint64_t quota = (gsize) g_atomic_pointer_get(&usage->quota);
+  GSequenceIter *iter = g_sequence_get_begin_iter(shard->order);
+  while (quota && get_usage_size(usage) + incoming_size > quota) {
+    // find our lowest-priority element
+    while (!g_sequence_iter_is_end(iter) &&
+           ((struct _openslide_cache_value *) g_sequence_get(iter))->usage !=
+           usage) {
+      iter = g_sequence_iter_next(iter);
+    }
+    if (g_sequence_iter_is_end(iter)) {
+      return false;
+    }
+    struct _openslide_cache_value *value = g_sequence_get(iter);
+    iter = g_sequence_iter_next(iter);
+    evict(shard, value, spills);
+  }
+  return true;
 }
 
 
@@ -118,15 +506,35 @@ static gboolean key_equal_func(gconstpointer a,
     (c_a->y == c_b->y);
 }
 
+static struct cache_shard *get_shard(openslide_cache_t *cache,
+                                     const struct _openslide_cache_key *key) {
+  // take the high bits of a multiplicative hash, so neighboring tiles
+  // land in different shards
+  uint32_t h = (uint32_t) hash_func(key) * 2654435769u;
+  return &cache->shards[h >> (32 - SHARD_BITS)];
+}
+
+// lock a shard, timing the wait if it's contended
+static void lock_shard(struct cache_shard *shard) {
+  if (g_mutex_trylock(&shard->mutex)) {
+    return;
+  }
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_CACHE_WAIT);
+  g_mutex_lock(&shard->mutex);
+  _openslide_phase_end(_OPENSLIDE_PHASE_CACHE_WAIT, phase, 0);
+}
+
 static void hash_destroy_value(gpointer data) {
   struct _openslide_cache_value *value = data;
 
-  // remove the item from the list
-  g_queue_delete_link(value->cache->list, value->link);
+  // remove the item from the eviction order
+  g_sequence_remove(value->iter);
 
   // decrement the total size
-  g_assert(value->entry->size <= value->cache->total_size);
-  value->cache->total_size -= value->entry->size;
+  g_assert(value->entry->size <= get_total_size(value->cache));
+  g_atomic_pointer_add(&value->cache->total_size, -(gssize) value->entry->size);
+  g_atomic_pointer_add(&value->usage->size, -(gssize) value->entry->size);
+  usage_unref(value->usage);
 
   // unref the entry
   _openslide_cache_entry_unref(value->entry);
@@ -135,27 +543,102 @@ static void hash_destroy_value(gpointer data) {
   g_free(value);
 }
 
+static void compressed_destroy_value(gpointer data) {
+  struct compressed_value *value = data;
+
+  g_queue_delete_link(value->shard->compressed_list, value->link);
+  g_atomic_pointer_add(&value->cache->compressed_size,
+                       -(gssize) value->compressed_size);
+  g_free(value->data);
+  g_free(value);
+}
+
+// shard mutex must be held.  returns false if the shard ran out of
+// entries before the incoming size would fit.
+static bool possibly_evict_compressed(openslide_cache_t *cache,
+                                      struct cache_shard *shard,
+                                      uint64_t incoming_size) {
+  while ((gsize) g_atomic_pointer_get(&cache->compressed_size) +
+         incoming_size >
+         (gsize) g_atomic_pointer_get(&cache->compressed_capacity)) {
+    struct compressed_value *value =
+      g_queue_peek_tail(shard->compressed_list);
+    if (value == NULL) {
+      return false;
+    }
+    bool result = g_hash_table_remove(shard->compressed, value->key);
+    g_assert(result);
+  }
+  return true;
+}
+
+// compress evicted entries into the second tier.  no locks held.
+static void store_spills(openslide_cache_t *cache, GArray *spills) {
+  for (guint i = 0; i < spills->len; i++) {
+    struct spill *spill = &g_array_index(spills, struct spill, i);
+    struct _openslide_cache_entry *entry = spill->entry;
+
+    int64_t compressed_size;
+    void *data = _openslide_zstd_compress_buffer(entry->data, entry->size,
+                                                 &compressed_size);
+    if (data) {
+      struct cache_shard *shard = get_shard(cache, &spill->key);
+      lock_shard(shard);
+      if (possibly_evict_compressed(cache, shard, compressed_size)) {
+        struct compressed_value *value = g_new(struct compressed_value, 1);
+        value->key = g_new(struct _openslide_cache_key, 1);
+        *value->key = spill->key;
+        value->shard = shard;
+        value->cache = cache;
+        value->data = data;
+        value->compressed_size = compressed_size;
+        value->size = entry->size;
+        value->cost = spill->cost;
+        g_atomic_pointer_add(&cache->compressed_size, compressed_size);
+        g_queue_push_head(shard->compressed_list, value);
+        value->link = g_queue_peek_head_link(shard->compressed_list);
+        g_hash_table_replace(shard->compressed, value->key, value);
+      } else {
+        // no room in this shard
+        g_free(data);
+      }
+      g_mutex_unlock(&shard->mutex);
+    }
+    _openslide_cache_entry_unref(entry);
+  }
+}
+
 openslide_cache_t *_openslide_cache_create(uint64_t capacity_in_bytes) {
   openslide_cache_t *cache = g_new0(openslide_cache_t, 1);
 
+  // init shards
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    g_mutex_init(&shard->mutex);
+    shard->order = g_sequence_new(NULL);
+    shard->hashtable = g_hash_table_new_full(hash_func,
+                                             key_equal_func,
+                                             g_free,
+                                             hash_destroy_value);
+    shard->compressed_list = g_queue_new();
+    shard->compressed = g_hash_table_new_full(hash_func,
+                                              key_equal_func,
+                                              g_free,
+                                              compressed_destroy_value);
+  }
+
   // init mutex
   g_mutex_init(&cache->mutex);
 
-  // init queue
-  cache->list = g_queue_new();
-
-  // init hashtable
-  cache->hashtable = g_hash_table_new_full(hash_func,
-					   key_equal_func,
-					   g_free,
-					   hash_destroy_value);
-
   // init refcount
   cache->refcount = 1;
 
   // init byte_capacity
   cache->capacity = capacity_in_bytes;
 
+  // init buffer pool
+  cache->pool = pool_new(capacity_in_bytes / POOL_FRACTION);
+
   return cache;
 }
 
@@ -172,15 +655,23 @@ static void cache_unref(openslide_cache_t *cache) {
     g_mutex_unlock(&cache->mutex);
     return;
   }
-  // clear hashtable (auto-deletes all data)
-  g_hash_table_unref(cache->hashtable);
   g_mutex_unlock(&cache->mutex);
 
-  // clear list
-  g_queue_free(cache->list);
-
-  // free mutex
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    // clear hashtable (auto-deletes all data)
+    g_hash_table_unref(shard->hashtable);
+    // clear eviction order
+    g_sequence_free(shard->order);
+    // clear compressed tier
+    g_hash_table_unref(shard->compressed);
+    g_queue_free(shard->compressed_list);
+    // free mutex
+    g_mutex_clear(&shard->mutex);
+  }
   g_mutex_clear(&cache->mutex);
+  _openslide_persistent_dir_clear(&cache->persistent_dir);
+  pool_unref(cache->pool);
 
   // destroy struct
   g_free(cache);
@@ -199,9 +690,10 @@ void _openslide_cache_release(openslide_cache_t *cache) {
 struct _openslide_cache_binding *_openslide_cache_binding_create(uint64_t capacity_in_bytes) {
   struct _openslide_cache_binding *cb =
     g_new0(struct _openslide_cache_binding, 1);
-  g_mutex_init(&cb->mutex);
+  g_rw_lock_init(&cb->lock);
   cb->cache = _openslide_cache_create(capacity_in_bytes);
   cb->id = cb->cache->next_binding_id++;
+  cb->usage = usage_new(0, OPENSLIDE_CACHE_PRIORITY_NORMAL);
   return cb;
 }
 
@@ -213,94 +705,419 @@ void _openslide_cache_binding_set(struct _openslide_cache_binding *cb,
   uint64_t id = cache->next_binding_id++;
   g_mutex_unlock(&cache->mutex);
 
-  g_mutex_lock(&cb->mutex);
+  g_rw_lock_writer_lock(&cb->lock);
   openslide_cache_t *old = cb->cache;
+  struct cache_usage *old_usage = cb->usage;
   cb->cache = cache;
   cb->id = id;
-  g_mutex_unlock(&cb->mutex);
+  // entries left in the old cache keep the old usage
+  cb->usage = usage_new((gsize) g_atomic_pointer_get(&old_usage->quota),
+                        g_atomic_int_get(&old_usage->priority_class));
+  g_rw_lock_writer_unlock(&cb->lock);
 
+  usage_unref(old_usage);
   cache_unref(old);
 }
 
 void _openslide_cache_binding_destroy(struct _openslide_cache_binding *cb) {
-  g_mutex_lock(&cb->mutex);
+  g_rw_lock_writer_lock(&cb->lock);
   cache_unref(cb->cache);
-  g_mutex_unlock(&cb->mutex);
+  usage_unref(cb->usage);
+  g_rw_lock_writer_unlock(&cb->lock);
 
-  g_mutex_clear(&cb->mutex);
+  g_rw_lock_clear(&cb->lock);
+  g_free(cb->persistent_id);
+  if (cb->persistent_planes) {
+    g_hash_table_destroy(cb->persistent_planes);
+  }
   g_free(cb);
 }
 
+static void persistent_plane_free(void *data) {
+  struct persistent_plane *pp = data;
+  g_free(pp->name);
+  g_free(pp);
+}
+
+void _openslide_cache_binding_set_identity(struct _openslide_cache_binding *cb,
+                                           const char *quickhash,
+                                           struct _openslide_level **levels,
+                                           int32_t level_count) {
+  g_free(cb->persistent_id);
+  cb->persistent_id = g_strdup(quickhash);
+  if (cb->persistent_planes) {
+    g_hash_table_destroy(cb->persistent_planes);
+  }
+  cb->persistent_planes = g_hash_table_new_full(g_direct_hash,
+                                                g_direct_equal, NULL,
+                                                persistent_plane_free);
+  // only levels with a tile geometry, and their scaled planes
+  for (int32_t i = 0; i < level_count; i++) {
+    struct _openslide_level *l = levels[i];
+    if (l->tile_w <= 0 || l->tile_h <= 0) {
+      continue;
+    }
+    struct persistent_plane *pp = g_new(struct persistent_plane, 1);
+    pp->name = g_strdup_printf("%d", i);
+    pp->tile_size = l->tile_w * l->tile_h * 4;
+    g_hash_table_insert(cb->persistent_planes, l, pp);
+    for (int32_t scale = 2; scale <= 8; scale *= 2) {
+      pp = g_new(struct persistent_plane, 1);
+      pp->name = g_strdup_printf("%d-%d", i, scale);
+      pp->tile_size = (l->tile_w / scale) * (l->tile_h / scale) * 4;
+      g_hash_table_insert(cb->persistent_planes,
+                          _openslide_level_get_scaled_plane(l, scale), pp);
+    }
+  }
+}
+
+void _openslide_cache_binding_set_quota(struct _openslide_cache_binding *cb,
+                                        uint64_t quota_in_bytes) {
+  g_rw_lock_reader_lock(&cb->lock);
+  g_atomic_pointer_set(&cb->usage->quota, quota_in_bytes);
+  g_rw_lock_reader_unlock(&cb->lock);
+}
+
+void _openslide_cache_binding_set_priority(struct _openslide_cache_binding *cb,
+                                           openslide_cache_priority_t priority) {
+  g_rw_lock_reader_lock(&cb->lock);
+  g_atomic_int_set(&cb->usage->priority_class, priority);
+  g_rw_lock_reader_unlock(&cb->lock);
+}
+
+uint64_t _openslide_cache_binding_get_capacity(struct _openslide_cache_binding *cb) {
+  g_rw_lock_reader_lock(&cb->lock);
+  uint64_t capacity = cb->cache->capacity;
+  g_rw_lock_reader_unlock(&cb->lock);
+  return capacity;
+}
+
 // put and get
 
 // the cache retains one reference, and the caller gets another one.  the
 // entry must be unreffed when the caller is done with it.
-void _openslide_cache_put(struct _openslide_cache_binding *cb,
-			  void *plane,
-			  int64_t x,
-			  int64_t y,
-			  void *data,
-			  uint64_t size_in_bytes,
-			  struct _openslide_cache_entry **_entry) {
-  // always create cache entry for caller's reference
+struct _openslide_cache_entry *_openslide_cache_entry_new(void *data,
+                                                          uint64_t size_in_bytes) {
   struct _openslide_cache_entry *entry =
       g_new(struct _openslide_cache_entry, 1);
   // one ref for the caller
   g_atomic_int_set(&entry->refcount, 1);
   entry->data = data;
   entry->size = size_in_bytes;
-  *_entry = entry;
+  entry->pool = NULL;
+  entry->expanded_size = 0;
+  return entry;
+}
 
-  // get cache and lock
-  g_mutex_lock(&cb->mutex);
-  openslide_cache_t *cache = cb->cache;
-  g_mutex_lock(&cache->mutex);
+// fill a tile from a uniform entry, consuming the caller's reference to it
+static struct _openslide_cache_entry *expand_uniform(openslide_cache_t *cache,
+                                                     struct _openslide_cache_entry *compact) {
+  uint64_t size = compact->expanded_size;
+  uint32_t color = *(uint32_t *) compact->data;
+  _openslide_cache_entry_unref(compact);
+
+  uint32_t *buf = pool_take(cache->pool, size);
+  if (!buf) {
+    buf = g_malloc(size);
+  }
+  if (color) {
+    for (uint64_t i = 0; i < size / 4; i++) {
+      buf[i] = color;
+    }
+  } else {
+    memset(buf, 0, size);
+  }
+  struct _openslide_cache_entry *entry = _openslide_cache_entry_new(buf, size);
+  entry->pool = pool_ref(cache->pool);
+  return entry;
+}
+
+// the buffer can be freed with g_free() or passed to _openslide_cache_put()
+void *_openslide_cache_alloc(struct _openslide_cache_binding *cb,
+                             uint64_t size_in_bytes) {
+  g_rw_lock_reader_lock(&cb->lock);
+  void *buf = pool_take(cb->cache->pool, size_in_bytes);
+  g_rw_lock_reader_unlock(&cb->lock);
+  if (!buf) {
+    buf = g_malloc(size_in_bytes);
+  }
+  return buf;
+}
+
+// insert an entry, taking ownership of the key.  the caller must hold a
+// reader lock on the binding.  returns false if the entry was rejected.
+static bool cache_insert(openslide_cache_t *cache,
+                         struct cache_usage *usage,
+                         struct _openslide_cache_key *key,
+                         struct _openslide_cache_entry *entry,
+                         uint64_t cost) {
+  uint64_t size_in_bytes = entry->size;
+  uint64_t quota = (gsize) g_atomic_pointer_get(&usage->quota);
+
+  // recycle the data when the entry is freed, unless it's a compacted
+  // uniform tile
+  if (!entry->pool && !entry->expanded_size) {
+    entry->pool = pool_ref(cache->pool);
+  }
 
   // don't try to put anything in the cache that cannot possibly fit
-  if (size_in_bytes > cache->capacity) {
+  if (size_in_bytes > cache->capacity || (quota && size_in_bytes > quota)) {
     //g_debug("refused %p", entry);
-    g_mutex_unlock(&cache->mutex);
     _openslide_performance_warn_once(&cache->warned_overlarge_entry,
                                      "Rejecting overlarge cache entry of "
                                      "size %"PRIu64" bytes", size_in_bytes);
-    g_mutex_unlock(&cb->mutex);
-    return;
+    struct cache_shard *shard = get_shard(cache, key);
+    lock_shard(shard);
+    shard->stats.rejected++;
+    g_mutex_unlock(&shard->mutex);
+    g_free(key);
+    return false;
   }
 
-  possibly_evict(cache, size_in_bytes); // already checks for wraparound
+  g_autoptr(GArray) spills = NULL;
+  if (g_atomic_pointer_get(&cache->compressed_capacity)) {
+    spills = g_array_new(false, false, sizeof(struct spill));
+  }
 
-  // create key
-  struct _openslide_cache_key *key = g_new(struct _openslide_cache_key, 1);
-  key->binding_id = cb->id;
-  key->plane = plane;
-  key->x = x;
-  key->y = y;
+  // lock shard
+  struct cache_shard *shard = get_shard(cache, key);
+  lock_shard(shard);
+
+  // stay within our quota
+  if (!possibly_evict_own(shard, usage, size_in_bytes, spills)) {
+    g_mutex_unlock(&shard->mutex);
+    for (int i = 1; i < SHARD_COUNT; i++) {
+      struct cache_shard *other =
+        &cache->shards[(shard - cache->shards + i) % SHARD_COUNT];
+      lock_shard(other);
+      bool done = possibly_evict_own(other, usage, size_in_bytes, spills);
+      g_mutex_unlock(&other->mutex);
+      if (done) {
+        break;
+      }
+    }
+    lock_shard(shard);
+  }
+
+  // make room in the cache
+  if (!possibly_evict(cache, shard, size_in_bytes, spills)) {
+    // our shard is empty; evict from the others, one lock at a time
+    g_mutex_unlock(&shard->mutex);
+    for (int i = 1; i < SHARD_COUNT; i++) {
+      struct cache_shard *other =
+        &cache->shards[(shard - cache->shards + i) % SHARD_COUNT];
+      lock_shard(other);
+      bool done = possibly_evict(cache, other, size_in_bytes, spills);
+      g_mutex_unlock(&other->mutex);
+      if (done) {
+        break;
+      }
+    }
+    lock_shard(shard);
+  }
 
   // create value
   struct _openslide_cache_value *value =
     g_new(struct _openslide_cache_value, 1);
   value->key = key;
+  value->shard = shard;
   value->cache = cache;
+  value->usage = usage;
+  value->cost = cost;
   value->entry = entry;
+  g_atomic_int_inc(&usage->refcount);
 
-  // insert at head of queue
-  g_queue_push_head(cache->list, value);
-  value->link = g_queue_peek_head_link(cache->list);
+  // increase size before the value can be destroyed
+  g_atomic_pointer_add(&cache->total_size, size_in_bytes);
+  g_atomic_pointer_add(&usage->size, size_in_bytes);
 
-  // insert into hash table
-  g_hash_table_replace(cache->hashtable, key, value);
+  // insert into eviction order
+  set_priority(shard, value);
+  value->iter = g_sequence_insert_sorted(shard->order, value,
+                                         value_compare, NULL);
 
-  // increase size
-  cache->total_size += size_in_bytes;
+  // insert into hash table
+  g_hash_table_replace(shard->hashtable, key, value);
 
   // another ref for the cache
   g_atomic_int_inc(&entry->refcount);
+  shard->stats.insertions++;
 
   // unlock
-  g_mutex_unlock(&cache->mutex);
-  g_mutex_unlock(&cb->mutex);
+  g_mutex_unlock(&shard->mutex);
+
+  if (spills) {
+    store_spills(cache, spills);
+  }
 
   //g_debug("insert %p", entry);
+  return true;
+}
+
+// returns the path of the persistent file for a key, or NULL if the key
+// can't be persisted.  *tile_size_OUT is the size its tiles must have.
+// the caller must hold a reader lock on the binding.
+static char *persistent_path(struct _openslide_cache_binding *cb,
+                             void *plane, int64_t x, int64_t y,
+                             uint64_t *tile_size_OUT) {
+  if (!cb->persistent_id) {
+    return NULL;
+  }
+  // valid until the cache is freed
+  const char *dir = _openslide_persistent_dir_get(&cb->cache->persistent_dir);
+  if (!dir) {
+    return NULL;
+  }
+  const struct persistent_plane *pp =
+    g_hash_table_lookup(cb->persistent_planes, plane);
+  if (!pp) {
+    return NULL;
+  }
+
+  *tile_size_OUT = pp->tile_size;
+  g_autofree char *file = g_strdup_printf("%"PRId64"_%"PRId64, x, y);
+  return g_build_filename(dir, PERSISTENT_VERSION, cb->persistent_id,
+                          pp->name, file, NULL);
+}
+
+// returns NULL on any failure.  files that are corrupt, or whose tiles
+// aren't of the expected size, are deleted.
+static void *persistent_read(const char *path, uint64_t size) {
+  struct persistent_header hdr;
+  size_t len;
+  g_autofree char *buf = _openslide_persistent_read(path, PERSISTENT_MAGIC,
+                                                    sizeof(hdr), &len);
+  void *data = NULL;
+  if (buf) {
+    memcpy(&hdr, buf, sizeof(hdr));
+    uint64_t payload_size = GUINT64_FROM_LE(hdr.payload_size);
+    if (GUINT64_FROM_LE(hdr.size) == size &&
+        payload_size == len - sizeof(hdr) && payload_size <= size) {
+      if (payload_size == size) {
+        data = g_memdup(buf + sizeof(hdr), size);
+      } else {
+        data = _openslide_zstd_decompress_buffer(buf + sizeof(hdr),
+                                                 payload_size, size, NULL);
+      }
+    }
+  }
+  if (!data) {
+    g_unlink(path);
+  }
+  return data;
+}
+
+static void persistent_write_task(void *data) {
+  struct persistent_write *w = data;
+  struct _openslide_cache_entry *entry = w->entry;
+
+  if (!g_file_test(w->path, G_FILE_TEST_EXISTS)) {
+    int64_t payload_size;
+    g_autofree void *payload =
+      _openslide_zstd_compress_buffer(entry->data, entry->size, &payload_size);
+    if (!payload) {
+      payload_size = entry->size;
+    }
+    struct persistent_header hdr = {
+      .size = GUINT64_TO_LE(entry->size),
+      .payload_size = GUINT64_TO_LE(payload_size),
+    };
+    memcpy(hdr.magic, PERSISTENT_MAGIC, sizeof(hdr.magic));
+    // errors aren't reported; the tier is best-effort
+    _openslide_persistent_write(w->path, &hdr, sizeof(hdr),
+                                payload ? payload : entry->data,
+                                payload_size, NULL);
+  }
+
+  _openslide_cache_entry_unref(entry);
+  g_free(w->path);
+  g_free(w);
+}
+
+void _openslide_cache_put(struct _openslide_cache_binding *cb,
+			  void *plane,
+			  int64_t x,
+			  int64_t y,
+			  void *data,
+			  uint64_t size_in_bytes,
+			  struct _openslide_cache_entry **_entry) {
+  // always create cache entry for caller's reference
+  struct _openslide_cache_entry *entry =
+    _openslide_cache_entry_new(data, size_in_bytes);
+  *_entry = entry;
+
+  uint64_t cost = get_put_cost();
+
+  // store uniform tiles as a single pixel
+  uint32_t color = 0;
+  bool uniform = is_uniform(data, size_in_bytes, &color);
+  report_tile(uniform, color, size_in_bytes);
+  struct _openslide_cache_entry *cached = entry;
+  if (uniform) {
+    uint32_t *pixel = g_new(uint32_t, 1);
+    *pixel = color;
+    cached = _openslide_cache_entry_new(pixel, sizeof(*pixel));
+    cached->expanded_size = size_in_bytes;
+  }
+
+  // create key
+  struct _openslide_cache_key *key = g_new(struct _openslide_cache_key, 1);
+  key->plane = plane;
+  key->x = x;
+  key->y = y;
+
+  g_rw_lock_reader_lock(&cb->lock);
+  key->binding_id = cb->id;
+  if (uniform) {
+    // the caller's copy isn't cached, but can still be recycled
+    entry->pool = pool_ref(cb->cache->pool);
+  }
+  if (cache_insert(cb->cache, cb->usage, key, cached, cost)) {
+    count(&cb->insertions);
+  } else {
+    count(&cb->rejected);
+  }
+  uint64_t tile_size;
+  char *path = persistent_path(cb, plane, x, y, &tile_size);
+  g_rw_lock_reader_unlock(&cb->lock);
+  if (path && size_in_bytes != tile_size) {
+    // it would be rejected when read back
+    g_clear_pointer(&path, g_free);
+  }
+  if (cached != entry) {
+    _openslide_cache_entry_unref(cached);
+  }
+
+  if (path) {
+    struct persistent_write *w = g_new(struct persistent_write, 1);
+    w->path = path;
+    w->entry = entry;
+    g_atomic_int_inc(&entry->refcount);
+    _openslide_worker_submit(persistent_write_task, w);
+  }
+}
+
+// shard mutex must be held.  on a hit, removes the entry from the
+// compressed tier and returns it; the caller must free it with
+// compressed_free().
+static struct compressed_value *compressed_take(struct cache_shard *shard,
+                                                struct _openslide_cache_key *key) {
+  struct compressed_value *value = g_hash_table_lookup(shard->compressed, key);
+  if (!value) {
+    return NULL;
+  }
+  // we now own value->key
+  g_hash_table_steal(shard->compressed, key);
+  g_queue_delete_link(shard->compressed_list, value->link);
+  g_atomic_pointer_add(&value->cache->compressed_size,
+                       -(gssize) value->compressed_size);
+  return value;
+}
+
+static void compressed_free(struct compressed_value *value) {
+  g_free(value->key);
+  g_free(value->data);
+  g_free(value);
 }
 
 // entry must be unreffed when the caller is done with the data
@@ -309,10 +1126,9 @@ void *_openslide_cache_get(struct _openslide_cache_binding *cb,
 			   int64_t x,
 			   int64_t y,
 			   struct _openslide_cache_entry **_entry) {
-  // get cache and lock
-  g_mutex_lock(&cb->mutex);
+  // get cache
+  g_rw_lock_reader_lock(&cb->lock);
   openslide_cache_t *cache = cb->cache;
-  g_mutex_lock(&cache->mutex);
 
   // create key
   struct _openslide_cache_key key = {
@@ -322,43 +1138,141 @@ void *_openslide_cache_get(struct _openslide_cache_binding *cb,
     .y = y
   };
 
+  // lock shard
+  struct cache_shard *shard = get_shard(cache, &key);
+  lock_shard(shard);
+
   // lookup key, maybe return NULL
-  struct _openslide_cache_value *value = g_hash_table_lookup(cache->hashtable,
+  struct _openslide_cache_value *value = g_hash_table_lookup(shard->hashtable,
 							     &key);
   if (value == NULL) {
-    g_mutex_unlock(&cache->mutex);
-    g_mutex_unlock(&cb->mutex);
+    struct compressed_value *cvalue = compressed_take(shard, &key);
+    g_mutex_unlock(&shard->mutex);
+    if (cvalue) {
+      // inflate into the main tier
+      void *data = _openslide_zstd_decompress_buffer(cvalue->data,
+                                                     cvalue->compressed_size,
+                                                     cvalue->size, NULL);
+      if (data) {
+        struct _openslide_cache_entry *entry =
+          _openslide_cache_entry_new(data, cvalue->size);
+        cache_insert(cache, cb->usage, g_steal_pointer(&cvalue->key), entry,
+                     cvalue->cost);
+        compressed_free(cvalue);
+        lock_shard(shard);
+        shard->stats.hits++;
+        shard->stats.compressed_hits++;
+        g_mutex_unlock(&shard->mutex);
+        g_rw_lock_reader_unlock(&cb->lock);
+        count(&cb->hits);
+        _openslide_read_stats_add_cache_hit();
+        count(&cb->compressed_hits);
+        report_tile(false, 0, entry->size);
+        *_entry = entry;
+        return data;
+      }
+      compressed_free(cvalue);
+    }
+
+    // try the persistent tier
+    uint64_t size;
+    g_autofree char *path = persistent_path(cb, plane, x, y, &size);
+    if (path) {
+      gint64 start = g_get_monotonic_time();
+      void *data = persistent_read(path, size);
+      if (data) {
+        struct _openslide_cache_entry *entry =
+          _openslide_cache_entry_new(data, size);
+        struct _openslide_cache_key *new_key =
+          g_new(struct _openslide_cache_key, 1);
+        *new_key = key;
+        cache_insert(cache, cb->usage, new_key, entry,
+                     MAX(g_get_monotonic_time() - start, 0));
+        lock_shard(shard);
+        shard->stats.hits++;
+        shard->stats.persistent_hits++;
+        g_mutex_unlock(&shard->mutex);
+        g_rw_lock_reader_unlock(&cb->lock);
+        count(&cb->hits);
+        _openslide_read_stats_add_cache_hit();
+        count(&cb->persistent_hits);
+        report_tile(false, 0, size);
+        *_entry = entry;
+        return data;
+      }
+    }
+
+    lock_shard(shard);
+    shard->stats.misses++;
+    g_mutex_unlock(&shard->mutex);
+    g_rw_lock_reader_unlock(&cb->lock);
+    count(&cb->misses);
+    record_miss();
+    _openslide_read_stats_add_cache_miss();
     *_entry = NULL;
     return NULL;
   }
 
-  // if found, move to front of list
-  GList *link = value->link;
-  g_queue_unlink(cache->list, link);
-  g_queue_push_head_link(cache->list, link);
+  // if found, refresh priority
+  set_priority(shard, value);
+  g_sequence_sort_changed(value->iter, value_compare, NULL);
 
   // acquire entry reference for the caller
   struct _openslide_cache_entry *entry = value->entry;
   g_atomic_int_inc(&entry->refcount);
+  shard->stats.hits++;
 
   //g_debug("cache hit! %p %"PRIu64" %p %"PRId64" %"PRId64, (void *) entry, cb->id, (void *) plane, x, y);
 
   // unlock
-  g_mutex_unlock(&cache->mutex);
-  g_mutex_unlock(&cb->mutex);
+  g_mutex_unlock(&shard->mutex);
+  bool uniform = entry->expanded_size;
+  uint32_t color = uniform ? *(uint32_t *) entry->data : 0;
+  if (uniform) {
+    entry = expand_uniform(cache, entry);
+  }
+  g_rw_lock_reader_unlock(&cb->lock);
+  count(&cb->hits);
+  _openslide_read_stats_add_cache_hit();
+  report_tile(uniform, color, entry->size);
 
   // return data
   *_entry = entry;
   return entry->data;
 }
 
+bool _openslide_cache_contains(struct _openslide_cache_binding *cb,
+                               void *plane,
+                               int64_t x,
+                               int64_t y) {
+  g_rw_lock_reader_lock(&cb->lock);
+  struct _openslide_cache_key key = {
+    .binding_id = cb->id,
+    .plane = plane,
+    .x = x,
+    .y = y
+  };
+  struct cache_shard *shard = get_shard(cb->cache, &key);
+  g_mutex_lock(&shard->mutex);
+  bool found = g_hash_table_contains(shard->hashtable, &key) ||
+               g_hash_table_contains(shard->compressed, &key);
+  g_mutex_unlock(&shard->mutex);
+  g_rw_lock_reader_unlock(&cb->lock);
+  return found;
+}
+
 // value unref
 void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry) {
   //g_debug("unref %p, refs %d", entry, g_atomic_int_get(&entry->refcount));
 
   if (g_atomic_int_dec_and_test(&entry->refcount)) {
-    // free the data
-    g_free(entry->data);
+    // recycle or free the data
+    if (entry->pool) {
+      pool_give(entry->pool, entry->data, entry->size);
+      pool_unref(entry->pool);
+    } else {
+      g_free(entry->data);
+    }
 
     // free the entry
     g_free(entry);
@@ -366,3 +1280,58 @@ void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry) {
     //g_debug("free %p", entry);
   }
 }
+
+void _openslide_cache_set_compressed_capacity(openslide_cache_t *cache,
+                                              uint64_t capacity_in_bytes) {
+  g_atomic_pointer_set(&cache->compressed_capacity, capacity_in_bytes);
+
+  // trim
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    lock_shard(shard);
+    possibly_evict_compressed(cache, shard, 0);
+    g_mutex_unlock(&shard->mutex);
+  }
+}
+
+void _openslide_cache_set_persistent_dir(openslide_cache_t *cache,
+                                         const char *path) {
+  _openslide_persistent_dir_set(&cache->persistent_dir, path);
+}
+
+void _openslide_cache_get_stats(openslide_cache_t *cache,
+                                openslide_cache_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    lock_shard(shard);
+    stats->hits += shard->stats.hits;
+    stats->misses += shard->stats.misses;
+    stats->insertions += shard->stats.insertions;
+    stats->evictions += shard->stats.evictions;
+    stats->rejected += shard->stats.rejected;
+    stats->compressed_hits += shard->stats.compressed_hits;
+    stats->persistent_hits += shard->stats.persistent_hits;
+    stats->entries += g_hash_table_size(shard->hashtable);
+    stats->compressed_entries += g_hash_table_size(shard->compressed);
+    g_mutex_unlock(&shard->mutex);
+  }
+  stats->bytes = get_total_size(cache);
+  stats->compressed_bytes =
+    (gsize) g_atomic_pointer_get(&cache->compressed_size);
+}
+
+void _openslide_cache_binding_get_stats(struct _openslide_cache_binding *cb,
+                                        openslide_cache_stats_t *stats) {
+  g_rw_lock_reader_lock(&cb->lock);
+  _openslide_cache_get_stats(cb->cache, stats);
+  g_rw_lock_reader_unlock(&cb->lock);
+
+  // replace the event counts with our own
+  stats->hits = (gsize) g_atomic_pointer_get(&cb->hits);
+  stats->misses = (gsize) g_atomic_pointer_get(&cb->misses);
+  stats->insertions = (gsize) g_atomic_pointer_get(&cb->insertions);
+  stats->rejected = (gsize) g_atomic_pointer_get(&cb->rejected);
+  stats->compressed_hits = (gsize) g_atomic_pointer_get(&cb->compressed_hits);
+  stats->persistent_hits = (gsize) g_atomic_pointer_get(&cb->persistent_hits);
+}
@@ -0,0 +1,310 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <glib.h>
+
+#ifdef HAVE_LCMS2
+#include <lcms2.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Color management.  The transform from the slide's ICC profile to sRGB
+// is run through lcms2 once, on a grid of sample colors, and pixels are
+// then converted by trilinear interpolation in the resulting 3D LUT.
+// With AVX2, opaque pixels are interpolated 8 at a time, gathering from
+// the same LUT with bit-identical results.
+
+#define GRID 33  // LUT points per axis
+
+struct _openslide_color_transform {
+  // position of each 8-bit input value on a LUT axis.  32-bit, so they
+  // can be gathered.
+  int32_t index[256];
+  int32_t weight[256];  // of the next point, out of 256
+  // 16-bit sRGB output at each grid point
+  uint16_t lut[GRID][GRID][GRID][3];
+  uint16_t pad;  // 32-bit gathers of the last entry read past it
+};
+
+#ifdef HAVE_LCMS2
+static cmsHTRANSFORM create_transform(const void *profile, int64_t profile_size,
+                                      GError **err) {
+  cmsHPROFILE src = cmsOpenProfileFromMem(profile, profile_size);
+  if (!src) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't parse ICC profile");
+    return NULL;
+  }
+  if (cmsGetColorSpace(src) != cmsSigRgbData) {
+    cmsCloseProfile(src);
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "ICC profile is not for RGB data");
+    return NULL;
+  }
+  cmsHPROFILE dst = cmsCreate_sRGBProfile();
+  cmsHTRANSFORM xform = NULL;
+  if (dst) {
+    xform = cmsCreateTransform(src, TYPE_RGB_16, dst, TYPE_RGB_16,
+                               INTENT_PERCEPTUAL, 0);
+    cmsCloseProfile(dst);
+  }
+  cmsCloseProfile(src);
+  if (!xform) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't create color transform");
+  }
+  return xform;
+}
+
+static bool sample_transform(struct _openslide_color_transform *ct,
+                             const void *profile, int64_t profile_size,
+                             GError **err) {
+  cmsHTRANSFORM xform = create_transform(profile, profile_size, err);
+  if (!xform) {
+    return false;
+  }
+
+  g_autofree uint16_t *grid = g_new(uint16_t, GRID * GRID * GRID * 3);
+  uint16_t *p = grid;
+  for (int r = 0; r < GRID; r++) {
+    for (int g = 0; g < GRID; g++) {
+      for (int b = 0; b < GRID; b++) {
+        *p++ = (r * 65535 + (GRID - 1) / 2) / (GRID - 1);
+        *p++ = (g * 65535 + (GRID - 1) / 2) / (GRID - 1);
+        *p++ = (b * 65535 + (GRID - 1) / 2) / (GRID - 1);
+      }
+    }
+  }
+  cmsDoTransform(xform, grid, ct->lut, GRID * GRID * GRID);
+  cmsDeleteTransform(xform);
+  return true;
+}
+#endif
+
+struct _openslide_color_transform *
+_openslide_color_transform_new(const void *profile, int64_t profile_size,
+                               GError **err) {
+#ifdef HAVE_LCMS2
+  g_autofree struct _openslide_color_transform *ct =
+    g_new(struct _openslide_color_transform, 1);
+  for (int v = 0; v < 256; v++) {
+    // 8.8 fixed point position on the axis
+    int pos = (v * (GRID - 1) * 256 + 127) / 255;
+    int index = MIN(pos >> 8, GRID - 2);
+    ct->index[v] = index;
+    ct->weight[v] = pos - index * 256;
+  }
+  if (!sample_transform(ct, profile, profile_size, err)) {
+    return NULL;
+  }
+  return g_steal_pointer(&ct);
+#else
+  (void) profile;
+  (void) profile_size;
+  g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+              "OpenSlide was built without color management support");
+  return NULL;
+#endif
+}
+
+static inline uint32_t lerp(uint32_t a, uint32_t b, uint32_t w) {
+  return (a * (256 - w) + b * w) >> 8;
+}
+
+static uint32_t lookup(const struct _openslide_color_transform *ct,
+                       uint32_t r, uint32_t g, uint32_t b) {
+  int ri = ct->index[r];
+  int gi = ct->index[g];
+  int bi = ct->index[b];
+  uint32_t rw = ct->weight[r];
+  uint32_t gw = ct->weight[g];
+  uint32_t bw = ct->weight[b];
+  uint32_t out = 0;
+  for (int c = 0; c < 3; c++) {
+    uint32_t v00 = lerp(ct->lut[ri][gi][bi][c],
+                        ct->lut[ri][gi][bi + 1][c], bw);
+    uint32_t v01 = lerp(ct->lut[ri][gi + 1][bi][c],
+                        ct->lut[ri][gi + 1][bi + 1][c], bw);
+    uint32_t v10 = lerp(ct->lut[ri + 1][gi][bi][c],
+                        ct->lut[ri + 1][gi][bi + 1][c], bw);
+    uint32_t v11 = lerp(ct->lut[ri + 1][gi + 1][bi][c],
+                        ct->lut[ri + 1][gi + 1][bi + 1][c], bw);
+    uint32_t v = lerp(lerp(v00, v01, gw), lerp(v10, v11, gw), rw);
+    // rescale to 8 bits, rounding
+    out = (out << 8) | ((v * 255 + 32895) >> 16);
+  }
+  return out;
+}
+
+static void apply_scalar(const struct _openslide_color_transform *ct,
+                         uint32_t *pixels, int64_t count) {
+  // runs of one color are common, especially in the background
+  uint32_t last_in = 0;
+  uint32_t last_out = 0;
+  for (int64_t i = 0; i < count; i++) {
+    uint32_t p = pixels[i];
+    uint32_t a = p >> 24;
+    if (!a) {
+      continue;
+    }
+    if (p == last_in) {
+      pixels[i] = last_out;
+      continue;
+    }
+    uint32_t r = (p >> 16) & 0xff;
+    uint32_t g = (p >> 8) & 0xff;
+    uint32_t b = p & 0xff;
+    uint32_t out;
+    if (a == 255) {
+      out = 0xff000000 | lookup(ct, r, g, b);
+    } else {
+      // the LUT is for straight color
+      uint32_t rgb = lookup(ct, MIN(r * 255 / a, 255), MIN(g * 255 / a, 255),
+                            MIN(b * 255 / a, 255));
+      out = a << 24 |
+            (((rgb >> 16) & 0xff) * a + 127) / 255 << 16 |
+            (((rgb >> 8) & 0xff) * a + 127) / 255 << 8 |
+            ((rgb & 0xff) * a + 127) / 255;
+    }
+    last_in = p;
+    last_out = out;
+    pixels[i] = out;
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET
+static inline __m256i lerp_avx2(__m256i a, __m256i b, __m256i w) {
+  __m256i inv = _mm256_sub_epi32(_mm256_set1_epi32(256), w);
+  return _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(a, inv),
+                                            _mm256_mullo_epi32(b, w)), 8);
+}
+
+// LUT entries at 16-bit element offsets
+AVX2_TARGET
+static inline __m256i gather_lut(const struct _openslide_color_transform *ct,
+                                 __m256i offset) {
+  return _mm256_and_si256(
+    _mm256_i32gather_epi32((const int *) ct->lut, offset, 2),
+    _mm256_set1_epi32(0xffff));
+}
+
+// interpolate along the blue axis from the entries at offset
+AVX2_TARGET
+static inline __m256i lerp_b_avx2(const struct _openslide_color_transform *ct,
+                                  __m256i offset, __m256i bw) {
+  return lerp_avx2(gather_lut(ct, offset),
+                   gather_lut(ct, _mm256_add_epi32(offset,
+                                                   _mm256_set1_epi32(3))),
+                   bw);
+}
+
+// translucent pixels, and blocks of one color, which the scalar code does
+// with one lookup, are left to apply_scalar()
+AVX2_TARGET
+static void apply_avx2(const struct _openslide_color_transform *ct,
+                       uint32_t *pixels, int64_t count) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);
+  const __m256i g_step = _mm256_set1_epi32(GRID * 3);
+  const __m256i r_step = _mm256_set1_epi32(GRID * GRID * 3);
+  int64_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i *) (pixels + i));
+    __m256i opaque = _mm256_cmpeq_epi32(_mm256_and_si256(p, alpha), alpha);
+    __m256i same = _mm256_cmpeq_epi32(p, _mm256_set1_epi32(pixels[i]));
+    if (_mm256_movemask_epi8(opaque) != -1 ||
+        _mm256_movemask_epi8(same) == -1) {
+      apply_scalar(ct, pixels + i, 8);
+      continue;
+    }
+
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 16), mask);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 8), mask);
+    __m256i b = _mm256_and_si256(p, mask);
+    __m256i rw = _mm256_i32gather_epi32(ct->weight, r, 4);
+    __m256i gw = _mm256_i32gather_epi32(ct->weight, g, 4);
+    __m256i bw = _mm256_i32gather_epi32(ct->weight, b, 4);
+    __m256i base = _mm256_add_epi32(
+      _mm256_add_epi32(
+        _mm256_mullo_epi32(_mm256_i32gather_epi32(ct->index, r, 4), r_step),
+        _mm256_mullo_epi32(_mm256_i32gather_epi32(ct->index, g, 4), g_step)),
+      _mm256_mullo_epi32(_mm256_i32gather_epi32(ct->index, b, 4),
+                         _mm256_set1_epi32(3)));
+
+    __m256i out = _mm256_setzero_si256();
+    for (int c = 0; c < 3; c++) {
+      __m256i o00 = _mm256_add_epi32(base, _mm256_set1_epi32(c));
+      __m256i o01 = _mm256_add_epi32(o00, g_step);
+      __m256i o10 = _mm256_add_epi32(o00, r_step);
+      __m256i o11 = _mm256_add_epi32(o10, g_step);
+      __m256i v = lerp_avx2(lerp_avx2(lerp_b_avx2(ct, o00, bw),
+                                      lerp_b_avx2(ct, o01, bw), gw),
+                            lerp_avx2(lerp_b_avx2(ct, o10, bw),
+                                      lerp_b_avx2(ct, o11, bw), gw),
+                            rw);
+      // rescale to 8 bits, rounding
+      v = _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_mullo_epi32(v, _mm256_set1_epi32(255)),
+                         _mm256_set1_epi32(32895)), 16);
+      out = _mm256_or_si256(_mm256_slli_epi32(out, 8), v);
+    }
+    _mm256_storeu_si256((__m256i *) (pixels + i), _mm256_or_si256(out, alpha));
+  }
+  apply_scalar(ct, pixels + i, count - i);
+}
+
+static void *detect_avx2(void *arg G_GNUC_UNUSED) {
+  if (_openslide_debug(OPENSLIDE_DEBUG_SCALAR)) {
+    return GINT_TO_POINTER(0);
+  }
+  __builtin_cpu_init();
+  return GINT_TO_POINTER(__builtin_cpu_supports("avx2") ? 1 : 0);
+}
+
+#endif
+
+void _openslide_color_transform_apply(const struct _openslide_color_transform *ct,
+                                      uint32_t *pixels, int64_t count) {
+#ifdef HAVE_X86_SIMD
+  static GOnce once = G_ONCE_INIT;
+  if (g_once(&once, detect_avx2, NULL)) {
+    apply_avx2(ct, pixels, count);
+    return;
+  }
+#endif
+  apply_scalar(ct, pixels, count);
+}
+
+void _openslide_color_transform_free(struct _openslide_color_transform *ct) {
+  g_free(ct);
+}
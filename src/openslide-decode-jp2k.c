@@ -21,6 +21,8 @@
  *
  */
 
+#include <config.h>
+
 #include <string.h>
 
 #include "openslide-private.h"
@@ -32,6 +34,12 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(opj_codec_t, opj_destroy_codec)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(opj_image_t, opj_image_destroy)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(opj_stream_t, opj_stream_destroy)
 
+// tiles smaller than this aren't worth starting decoder threads for
+#define MIN_THREADED_PIXELS (512 * 512)
+
+static gint max_threads;     // 0 = automatic
+static gint active_decodes;
+
 struct buffer_state {
   const uint8_t *data;
   int32_t offset;
@@ -75,30 +83,11 @@ static void unpack_argb(enum _openslide_jp2k_colorspace space,
       c0_sub_y == 1 && c1_sub_y == 1 && c2_sub_y == 1) {
     // Aperio 33003
     for (int32_t y = 0; y < h; y++) {
-      int32_t c0_row_base = y * comps[0].w;
-      int32_t c1_row_base = y * comps[1].w;
-      int32_t c2_row_base = y * comps[2].w;
-      int32_t x;
-      for (x = 0; x < w - 1; x += 2) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + (x / 2)];
-        uint8_t c2 = comps[2].data[c2_row_base + (x / 2)];
-        int16_t R_chroma = _openslide_R_Cr[c2];
-        int16_t G_chroma = (_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16;
-        int16_t B_chroma = _openslide_B_Cb[c1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
-        c0 = comps[0].data[c0_row_base + x + 1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
-      }
-      if (x < w) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + (x / 2)];
-        uint8_t c2 = comps[2].data[c2_row_base + (x / 2)];
-        int16_t R_chroma = _openslide_R_Cr[c2];
-        int16_t G_chroma = (_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16;
-        int16_t B_chroma = _openslide_B_Cb[c1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
-      }
+      _openslide_simd_ycbcr422_32_to_argb32(comps[0].data + y * comps[0].w,
+                                            comps[1].data + y * comps[1].w,
+                                            comps[2].data + y * comps[2].w,
+                                            dest, w);
+      dest += w;
     }
 
   } else if (space == OPENSLIDE_JP2K_YCBCR) {
@@ -131,15 +120,11 @@ static void unpack_argb(enum _openslide_jp2k_colorspace space,
              c0_sub_y == 1 && c1_sub_y == 1 && c2_sub_y == 1) {
     // Aperio 33005
     for (int32_t y = 0; y < h; y++) {
-      int32_t c0_row_base = y * comps[0].w;
-      int32_t c1_row_base = y * comps[1].w;
-      int32_t c2_row_base = y * comps[2].w;
-      for (int32_t x = 0; x < w; x++) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + x];
-        uint8_t c2 = comps[2].data[c2_row_base + x];
-        write_pixel_rgb(dest++, c0, c1, c2);
-      }
+      _openslide_simd_planar32_to_argb32(comps[0].data + y * comps[0].w,
+                                         comps[1].data + y * comps[1].w,
+                                         comps[2].data + y * comps[2].w,
+                                         dest, w);
+      dest += w;
     }
 
   } else if (space == OPENSLIDE_JP2K_RGB) {
@@ -219,13 +204,63 @@ static OPJ_BOOL seek_callback(OPJ_OFF_T offset, void *data) {
   return OPJ_TRUE;
 }
 
-bool _openslide_jp2k_decode_buffer(uint32_t *dest,
-                                   int32_t w, int32_t h,
-                                   const void *data, int32_t datalen,
-                                   enum _openslide_jp2k_colorspace space,
-                                   GError **err) {
+void _openslide_jp2k_set_max_threads(int32_t threads) {
+  g_atomic_int_set(&max_threads, MAX(threads, 0));
+}
+
+#ifdef HAVE_OPJ_CODEC_SET_THREADS
+// Split the processors among the decodes currently running, so that
+// concurrent readers don't oversubscribe the machine.
+static int32_t get_decode_threads(int32_t w, int32_t h) {
+  if ((int64_t) w * h < MIN_THREADED_PIXELS || !opj_has_thread_support()) {
+    return 1;
+  }
+  int32_t procs = g_get_num_processors();
+  int32_t limit = g_atomic_int_get(&max_threads);
+  if (!limit) {
+    limit = procs;
+  }
+  int32_t active = MAX(g_atomic_int_get(&active_decodes), 1);
+  return CLAMP(procs / active, 1, limit);
+}
+#endif
+
+static void downsample(const uint32_t *src, int32_t w, int32_t h,
+                       uint32_t *dest, int32_t scale) {
+  int32_t dw = (w + scale - 1) / scale;
+  int32_t dh = (h + scale - 1) / scale;
+  for (int32_t dy = 0; dy < dh; dy++) {
+    int32_t rows = MIN(scale, h - dy * scale);
+    for (int32_t dx = 0; dx < dw; dx++) {
+      int32_t cols = MIN(scale, w - dx * scale);
+      uint32_t sum[4] = {0};
+      for (int32_t y = 0; y < rows; y++) {
+        const uint32_t *p = src + (int64_t) (dy * scale + y) * w + dx * scale;
+        for (int32_t x = 0; x < cols; x++) {
+          for (int i = 0; i < 4; i++) {
+            sum[i] += (p[x] >> (8 * i)) & 0xff;
+          }
+        }
+      }
+      uint32_t n = rows * cols;
+      uint32_t pixel = 0;
+      for (int i = 0; i < 4; i++) {
+        pixel |= ((sum[i] + n / 2) / n) << (8 * i);
+      }
+      *dest++ = pixel;
+    }
+  }
+}
+
+static bool decode(uint32_t *dest,
+                   int32_t w, int32_t h,
+                   const void *data, int32_t datalen,
+                   enum _openslide_jp2k_colorspace space,
+                   int32_t scale,
+                   GError **err) {
   g_assert(data != NULL);
   g_assert(datalen >= 0);
+  g_assert(scale >= 1 && (scale & (scale - 1)) == 0);
 
   // init stream
   g_autoptr(opj_stream_t) stream = opj_stream_create(datalen, true);
@@ -244,6 +279,13 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   opj_dparameters_t parameters;
   opj_set_default_decoder_parameters(&parameters);
   opj_setup_decoder(codec, &parameters);
+#ifdef HAVE_OPJ_CODEC_SET_THREADS
+  int32_t threads = get_decode_threads(w / scale, h / scale);
+  if (threads > 1) {
+    // on failure, decode single-threaded
+    opj_codec_set_threads(codec, threads);
+  }
+#endif
 
   // enable error handlers
   // note: don't use info_handler, it outputs lots of junk
@@ -279,6 +321,19 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   }
   // TODO more checks?
 
+  // skip the highest resolution levels if the codestream has enough of
+  // them; otherwise decode at full size and scale down afterward
+  int32_t reduce = 0;
+  while ((1 << reduce) < scale) {
+    reduce++;
+  }
+  if (reduce && !opj_set_decoded_resolution_factor(codec, reduce)) {
+    g_clear_error(&tmp_err);
+    reduce = 0;
+  }
+  int32_t decode_w = (w + (1 << reduce) - 1) >> reduce;
+  int32_t decode_h = (h + (1 << reduce) - 1) >> reduce;
+
   // decode
   if (!opj_decode(codec, stream, image)) {
     if (tmp_err) {
@@ -290,9 +345,52 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
     return false;
   }
   g_clear_error(&tmp_err);  // clear any spurious message
+  if (image->comps[0].w != (OPJ_UINT32) decode_w ||
+      image->comps[0].h != (OPJ_UINT32) decode_h) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Dimensional mismatch decoding JP2K, "
+                "expected %dx%d, got %ux%u",
+                decode_w, decode_h, image->comps[0].w, image->comps[0].h);
+    return false;
+  }
 
   // copy pixels
-  unpack_argb(space, image->comps, dest, w, h);
+  if ((1 << reduce) == scale) {
+    unpack_argb(space, image->comps, dest, decode_w, decode_h);
+  } else {
+    g_autofree uint32_t *full = g_try_malloc((size_t) w * h * 4);
+    if (!full) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't allocate %dx%d JP2K buffer", w, h);
+      return false;
+    }
+    unpack_argb(space, image->comps, full, w, h);
+    downsample(full, w, h, dest, scale);
+  }
 
   return true;
 }
+
+bool _openslide_jp2k_decode_buffer(uint32_t *dest,
+                                   int32_t w, int32_t h,
+                                   const void *data, int32_t datalen,
+                                   enum _openslide_jp2k_colorspace space,
+                                   GError **err) {
+  return _openslide_jp2k_decode_buffer_scaled(dest, w, h, data, datalen,
+                                              space, 1, err);
+}
+
+bool _openslide_jp2k_decode_buffer_scaled(uint32_t *dest,
+                                          int32_t w, int32_t h,
+                                          const void *data, int32_t datalen,
+                                          enum _openslide_jp2k_colorspace space,
+                                          int32_t scale,
+                                          GError **err) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+  g_atomic_int_inc(&active_decodes);
+  bool ok = decode(dest, w, h, data, datalen, space, scale, err);
+  g_atomic_int_add(&active_decodes, -1);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase,
+                       ok ? (uint64_t) w * h * 4 : 0);
+  return ok;
+}
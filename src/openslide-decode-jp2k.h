@@ -38,4 +38,17 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
                                    enum _openslide_jp2k_colorspace space,
                                    GError **err);
 
+// decode at 1/scale of full size, scale being a power of two.  w and h
+// are the full dimensions; dest receives ceil(w / scale) x ceil(h / scale)
+// pixels.
+bool _openslide_jp2k_decode_buffer_scaled(uint32_t *dest,
+                                          int32_t w, int32_t h,
+                                          const void *data, int32_t datalen,
+                                          enum _openslide_jp2k_colorspace space,
+                                          int32_t scale,
+                                          GError **err);
+
+// 0 = automatic
+void _openslide_jp2k_set_max_threads(int32_t threads);
+
 #endif
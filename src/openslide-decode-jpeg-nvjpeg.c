@@ -0,0 +1,184 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+#include "openslide-decode-jpeg.h"
+
+#include <glib.h>
+#include <cuda_runtime_api.h>
+#include <nvjpeg.h>
+
+// JPEG decoding on NVIDIA GPUs.  Each thread decoding tiles gets its own
+// decoder state and CUDA stream, so the worker threads of a batch read
+// keep several decodes in flight on the GPU at once.
+
+struct thread_state {
+  nvjpegJpegState_t state;
+  cudaStream_t stream;
+  uint8_t *device;   // decoded pixels
+  uint8_t *host;     // pinned copy of the decoded pixels
+  size_t size;
+};
+
+static nvjpegHandle_t handle;
+
+static void thread_state_free(void *data) {
+  struct thread_state *ts = data;
+  if (!ts) {
+    return;
+  }
+  cudaFree(ts->device);
+  cudaFreeHost(ts->host);
+  if (ts->stream) {
+    cudaStreamDestroy(ts->stream);
+  }
+  if (ts->state) {
+    nvjpegJpegStateDestroy(ts->state);
+  }
+  g_free(ts);
+}
+
+static GPrivate thread_state_key = G_PRIVATE_INIT(thread_state_free);
+
+static struct thread_state *get_thread_state(void) {
+  struct thread_state *ts = g_private_get(&thread_state_key);
+  if (ts) {
+    return ts;
+  }
+  ts = g_new0(struct thread_state, 1);
+  if (nvjpegJpegStateCreate(handle, &ts->state) != NVJPEG_STATUS_SUCCESS ||
+      cudaStreamCreateWithFlags(&ts->stream,
+                                cudaStreamNonBlocking) != cudaSuccess) {
+    thread_state_free(ts);
+    return NULL;
+  }
+  g_private_set(&thread_state_key, ts);
+  return ts;
+}
+
+static bool ensure_buffers(struct thread_state *ts, size_t size) {
+  if (ts->size >= size) {
+    return true;
+  }
+  cudaFree(ts->device);
+  cudaFreeHost(ts->host);
+  ts->device = NULL;
+  ts->host = NULL;
+  ts->size = 0;
+  if (cudaMalloc((void **) &ts->device, size) != cudaSuccess ||
+      cudaMallocHost((void **) &ts->host, size) != cudaSuccess) {
+    return false;
+  }
+  ts->size = size;
+  return true;
+}
+
+static bool nvjpeg_init(void) {
+  int devices = 0;
+  if (cudaGetDeviceCount(&devices) != cudaSuccess || devices == 0) {
+    return false;
+  }
+  nvjpegStatus_t status = nvjpegCreateSimple(&handle);
+  if (status != NVJPEG_STATUS_SUCCESS) {
+    if (_openslide_debug(OPENSLIDE_DEBUG_DECODING)) {
+      g_warning("Couldn't initialize nvJPEG: status %d", status);
+    }
+    return false;
+  }
+  return true;
+}
+
+static bool nvjpeg_decode(const void *buf, uint32_t len,
+                          J_COLOR_SPACE space,
+                          uint32_t *dest,
+                          int32_t w, int32_t h) {
+  int components;
+  nvjpegChromaSubsampling_t subsampling;
+  int widths[NVJPEG_MAX_COMPONENT];
+  int heights[NVJPEG_MAX_COMPONENT];
+  if (nvjpegGetImageInfo(handle, buf, len, &components, &subsampling,
+                         widths, heights) != NVJPEG_STATUS_SUCCESS ||
+      components != 3 || widths[0] != w || heights[0] != h) {
+    return false;
+  }
+
+  // RGB JPEGs tagged by their container skip color conversion, so decode
+  // the components unchanged.  nvJPEG returns those at their stored
+  // resolution, so only handle unsubsampled ones.
+  nvjpegOutputFormat_t format;
+  if (space == JCS_RGB) {
+    if (subsampling != NVJPEG_CSS_444) {
+      return false;
+    }
+    format = NVJPEG_OUTPUT_UNCHANGED;
+  } else if (space == JCS_UNKNOWN || space == JCS_YCbCr) {
+    format = NVJPEG_OUTPUT_RGBI;
+  } else {
+    return false;
+  }
+
+  struct thread_state *ts = get_thread_state();
+  size_t plane = (size_t) w * h;
+  if (!ts || !ensure_buffers(ts, plane * 3)) {
+    return false;
+  }
+
+  nvjpegImage_t image = {{0}};
+  if (format == NVJPEG_OUTPUT_RGBI) {
+    image.channel[0] = ts->device;
+    image.pitch[0] = (size_t) w * 3;
+  } else {
+    for (int i = 0; i < 3; i++) {
+      image.channel[i] = ts->device + i * plane;
+      image.pitch[i] = w;
+    }
+  }
+
+  nvjpegStatus_t status = nvjpegDecode(handle, ts->state, buf, len, format,
+                                       &image, ts->stream);
+  if (status != NVJPEG_STATUS_SUCCESS) {
+    if (_openslide_debug(OPENSLIDE_DEBUG_DECODING)) {
+      g_warning("nvJPEG decode failed: status %d", status);
+    }
+    return false;
+  }
+  if (cudaMemcpyAsync(ts->host, ts->device, plane * 3,
+                      cudaMemcpyDeviceToHost, ts->stream) != cudaSuccess ||
+      cudaStreamSynchronize(ts->stream) != cudaSuccess) {
+    return false;
+  }
+
+  if (format == NVJPEG_OUTPUT_RGBI) {
+    _openslide_simd_rgb24_to_argb32(ts->host, dest, plane);
+  } else {
+    _openslide_simd_planar8_to_argb32(ts->host, ts->host + plane,
+                                      ts->host + 2 * plane, dest, plane);
+  }
+  return true;
+}
+
+const struct _openslide_jpeg_decoder _openslide_jpeg_decoder_nvjpeg = {
+  .name = "nvjpeg",
+  .init = nvjpeg_init,
+  .decode = nvjpeg_decode,
+};
@@ -21,6 +21,8 @@
  *
  */
 
+#include <config.h>
+
 #include "openslide-private.h"
 #include "openslide-decode-jpeg.h"
 
@@ -28,6 +30,7 @@
 #include <setjmp.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <jpeglib.h>
 #include <jerror.h>
 
@@ -53,6 +56,9 @@ static const uint8_t one_pixel_rgb_jpeg[] = {
   0x00, 0x00, 0x3f, 0x00, 0x7f, 0x3f, 0x9f, 0xdf, 0xff, 0xd9
 };
 
+// columns decoded on each side of a cropped region, at least one iMCU
+#define JPEG_CROP_MARGIN 16
+
 static GOnce jcs_alpha_extensions_detector = G_ONCE_INIT;
 
 struct openslide_jpeg_error_mgr {
@@ -66,10 +72,32 @@ struct _openslide_jpeg_decompress {
   struct openslide_jpeg_error_mgr jerr;
   JSAMPROW rows[MAX_SAMP_FACTOR];
   bool allocated;
+  bool created;  // jpeg_create_decompress() has been called
+
+  // from _openslide_jpeg_decompress_get(); returned to the thread cache
+  // rather than freed
+  bool pooled;
+  // copy of the abbreviated-datastream tables currently loaded, or NULL
+  void *tables;
+  uint32_t tables_len;
+  // tables were loaded for the next datastream
+  bool tables_loaded;
+  // has read a datastream, whose tables libjpeg keeps
+  bool used;
+  // decode phase, ended by _openslide_jpeg_decompress_destroy() since
+  // libjpeg errors longjmp past the end of decoding
+  int64_t phase;
+  uint64_t phase_bytes;
 };
 
+static void decompress_free(void *data);
+
+// each thread keeps one idle decompressor for reuse
+static GPrivate thread_decompress = G_PRIVATE_INIT(decompress_free);
+
 struct associated_image {
   struct _openslide_associated_image base;
+  char *name;
   char *filename;
   int64_t offset;
 };
@@ -140,27 +168,119 @@ struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_create(struct jpeg
   return dc;
 }
 
+// Like _openslide_jpeg_decompress_create(), but reuses this thread's idle
+// decompressor if there is one, avoiding the setup cost for small tiles.
+// Only supply data with _openslide_jpeg_decompress_set_source().
+// _openslide_jpeg_decompress_destroy() returns it to the thread.
+struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_get(struct jpeg_decompress_struct **out_cinfo) {
+  struct _openslide_jpeg_decompress *dc = g_private_get(&thread_decompress);
+  if (dc) {
+    g_private_set(&thread_decompress, NULL);
+  } else {
+    dc = g_new0(struct _openslide_jpeg_decompress, 1);
+    dc->pooled = true;
+  }
+  *out_cinfo = &dc->cinfo;
+  return dc;
+}
+
 // after setjmp(), initialize error handler and start decompressing
 void _openslide_jpeg_decompress_init(struct _openslide_jpeg_decompress *dc,
                                      jmp_buf *env) {
+  dc->jerr.env = env;
+  if (dc->created) {
+    return;
+  }
   jpeg_std_error(&dc->jerr.base);
   dc->jerr.base.error_exit = my_error_exit;
   dc->jerr.base.output_message = my_output_message;
   dc->jerr.base.emit_message = my_emit_message;
-  dc->jerr.env = env;
   dc->cinfo.err = (struct jpeg_error_mgr *) &dc->jerr;
   jpeg_create_decompress(&dc->cinfo);
+  dc->created = true;
 }
 
-bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
-                                    // uint8_t * if grayscale, else uint32_t *
-                                    void *_dest,
-                                    bool grayscale,
-                                    int32_t w, int32_t h,
-                                    GError **err) {
-  struct jpeg_decompress_struct *cinfo = &dc->cinfo;
+// does the datastream define its own quantization or Huffman tables?
+static bool has_tables(const uint8_t *buf, size_t len) {
+  size_t pos = 2;  // skip SOI
+  while (pos + 4 <= len) {
+    if (buf[pos] != 0xFF) {
+      // corrupt; assume the worst
+      return true;
+    }
+    uint8_t marker = buf[pos + 1];
+    if (marker == 0xFF) {
+      // fill byte
+      pos++;
+      continue;
+    }
+    if (marker == 0xDB || marker == 0xC4) {
+      // DQT, DHT
+      return true;
+    }
+    if (marker == 0xDA || marker == 0xD9) {
+      // SOS, EOI
+      return false;
+    }
+    pos += 2 + (buf[pos + 2] << 8 | buf[pos + 3]);
+  }
+  return true;
+}
+
+// forget the tables of earlier datastreams, which libjpeg would otherwise
+// silently reuse for a datastream that lacks its own
+static void reset_tables(struct _openslide_jpeg_decompress *dc) {
+  if (dc->used) {
+    // keeps the error manager
+    jpeg_destroy_decompress(&dc->cinfo);
+    jpeg_create_decompress(&dc->cinfo);
+    dc->used = false;
+  }
+  g_clear_pointer(&dc->tables, g_free);
+}
+
+// after _openslide_jpeg_decompress_init(), load the tables for an
+// abbreviated datastream, unless they're already loaded
+bool _openslide_jpeg_decompress_load_tables(struct _openslide_jpeg_decompress *dc,
+                                            const void *tables,
+                                            uint32_t tables_len,
+                                            GError **err) {
+  dc->tables_loaded = true;
+  if (dc->tables && dc->tables_len == tables_len &&
+      !memcmp(dc->tables, tables, tables_len)) {
+    return true;
+  }
+  reset_tables(dc);
+  dc->used = true;
+  _openslide_jpeg_mem_src(&dc->cinfo, tables, tables_len);
+  if (jpeg_read_header(&dc->cinfo, false) != JPEG_HEADER_TABLES_ONLY) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't load JPEG tables");
+    return false;
+  }
+  dc->tables = g_memdup(tables, tables_len);
+  dc->tables_len = tables_len;
+  return true;
+}
 
-  // set color space
+// after _openslide_jpeg_decompress_init(), read from a buffer
+void _openslide_jpeg_decompress_set_source(struct _openslide_jpeg_decompress *dc,
+                                           const void *buf, uint32_t len) {
+  if (has_tables(buf, len)) {
+    // decoding will replace the loaded tables
+    g_clear_pointer(&dc->tables, g_free);
+  } else if (!dc->tables_loaded) {
+    // an abbreviated datastream must fail as it would with a new
+    // decompressor, rather than use the tables of an unrelated one
+    reset_tables(dc);
+  }
+  dc->tables_loaded = false;
+  dc->used = true;
+  _openslide_jpeg_mem_src(&dc->cinfo, buf, len);
+}
+
+static void set_out_color_space(struct jpeg_decompress_struct *cinfo,
+                                bool grayscale) {
   bool alpha_extensions = GPOINTER_TO_INT(g_once(&jcs_alpha_extensions_detector,
                                                  detect_jcs_alpha_extensions,
                                                  NULL));
@@ -168,7 +288,26 @@ bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
     grayscale ? JCS_GRAYSCALE :
     !alpha_extensions ? JCS_RGB :
     G_BYTE_ORDER == G_LITTLE_ENDIAN ? JCS_EXT_BGRA : JCS_EXT_ARGB;
+}
+
+static void begin_phase(struct _openslide_jpeg_decompress *dc,
+                        uint64_t bytes) {
+  if (!dc->phase) {
+    dc->phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+    dc->phase_bytes = bytes;
+  }
+}
 
+bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
+                                    // uint8_t * if grayscale, else uint32_t *
+                                    void *_dest,
+                                    bool grayscale,
+                                    int32_t w, int32_t h,
+                                    GError **err) {
+  struct jpeg_decompress_struct *cinfo = &dc->cinfo;
+  begin_phase(dc, (uint64_t) w * h * (grayscale ? 1 : 4));
+
+  set_out_color_space(cinfo, grayscale);
   jpeg_start_decompress(cinfo);
 
   // ensure buffer dimensions are correct
@@ -241,32 +380,122 @@ bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
   return true;
 }
 
+bool _openslide_jpeg_decompress_run_region(struct _openslide_jpeg_decompress *dc,
+                                           uint32_t *dest,
+                                           int32_t w, int32_t h,
+                                           int32_t x, int32_t y,
+                                           int32_t region_w, int32_t region_h,
+                                           GError **err) {
+  struct jpeg_decompress_struct *cinfo = &dc->cinfo;
+  g_assert(x >= 0 && y >= 0 && region_w > 0 && region_h > 0);
+  g_assert(x + region_w <= w && y + region_h <= h);
+  begin_phase(dc, (uint64_t) region_w * region_h * 4);
+
+  set_out_color_space(cinfo, false);
+  jpeg_start_decompress(cinfo);
+
+  // ensure buffer dimensions are correct
+  int32_t width = cinfo->output_width;
+  int32_t height = cinfo->output_height;
+  if (w != width || h != height) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Dimensional mismatch reading JPEG, "
+                "expected %dx%d, got %dx%d",
+                w, h, width, height);
+    return false;
+  }
+
+  // verify we haven't run already
+  g_assert(dc->rows[0] == NULL);
+
+  // skip the columns and rows outside the region.  Fancy upsampling
+  // treats the cropped columns as image edges, so leave a margin on both
+  // sides; libjpeg then widens the left side to an iMCU boundary.
+#ifdef HAVE_JPEG_CROP_SCANLINE
+  JDIMENSION crop_x = MAX(x - JPEG_CROP_MARGIN, 0);
+  JDIMENSION crop_w = MIN(x + region_w + JPEG_CROP_MARGIN, w) - crop_x;
+  jpeg_crop_scanline(cinfo, &crop_x, &crop_w);
+  if (y) {
+    jpeg_skip_scanlines(cinfo, y);
+  }
+#else
+  JDIMENSION crop_x = 0;
+#endif
+  int32_t skip_x = x - crop_x;
+
+  int components = cinfo->output_components;
+  dc->allocated = true;
+  dc->rows[0] = g_malloc(sizeof(JSAMPLE) * cinfo->output_width * components);
+  while (cinfo->output_scanline < (JDIMENSION) (y + region_h)) {
+    JDIMENSION row = cinfo->output_scanline;
+    jpeg_read_scanlines(cinfo, dc->rows, 1);
+    if (row < (JDIMENSION) y) {
+      continue;
+    }
+    const JSAMPLE *src = dc->rows[0] + skip_x * components;
+    if (cinfo->out_color_space == JCS_RGB) {
+      _openslide_simd_rgb24_to_argb32(src, dest, region_w);
+    } else {
+      memcpy(dest, src, region_w * 4);
+    }
+    dest += region_w;
+  }
+  return true;
+}
+
 void _openslide_jpeg_propagate_error(GError **err,
                                      struct _openslide_jpeg_decompress *dc) {
   g_propagate_error(err, dc->jerr.err);
   dc->jerr.err = NULL;
 }
 
-void _openslide_jpeg_decompress_destroy(struct _openslide_jpeg_decompress *dc) {
-  jpeg_destroy_decompress(&dc->cinfo);
-  g_assert(dc->jerr.err == NULL);
+static void free_rows(struct _openslide_jpeg_decompress *dc) {
   if (dc->allocated) {
     for (uint32_t row = 0; row < G_N_ELEMENTS(dc->rows); row++) {
       g_free(dc->rows[row]);
     }
+    dc->allocated = false;
   }
+  memset(dc->rows, 0, sizeof(dc->rows));
+}
+
+static void decompress_free(void *data) {
+  struct _openslide_jpeg_decompress *dc = data;
+  if (dc->created) {
+    jpeg_destroy_decompress(&dc->cinfo);
+  }
+  free_rows(dc);
+  g_free(dc->tables);
   g_free(dc);
 }
 
+void _openslide_jpeg_decompress_destroy(struct _openslide_jpeg_decompress *dc) {
+  g_assert(dc->jerr.err == NULL);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, dc->phase, dc->phase_bytes);
+  dc->phase = 0;
+  if (dc->pooled && dc->created && !g_private_get(&thread_decompress)) {
+    // reset for the next image, keeping loaded tables
+    jpeg_abort_decompress(&dc->cinfo);
+    free_rows(dc);
+    dc->tables_loaded = false;
+    dc->jerr.env = NULL;
+    g_private_set(&thread_decompress, dc);
+    return;
+  }
+  decompress_free(dc);
+}
+
 static bool jpeg_get_dimensions(struct _openslide_file *f,  // or:
                                 const void *buf, uint32_t buflen,
                                 int32_t *w, int32_t *h,
                                 GError **err) {
   jmp_buf env;
 
+  // the thread's cached decompressor only supports buffers
   struct jpeg_decompress_struct *cinfo;
   g_auto(_openslide_jpeg_decompress) dc =
-    _openslide_jpeg_decompress_create(&cinfo);
+    f ? _openslide_jpeg_decompress_create(&cinfo) :
+        _openslide_jpeg_decompress_get(&cinfo);
 
   if (setjmp(env) == 0) {
     _openslide_jpeg_decompress_init(dc, &env);
@@ -274,7 +503,7 @@ static bool jpeg_get_dimensions(struct _openslide_file *f,  // or:
     if (f) {
       _openslide_jpeg_stdio_src(cinfo, f);
     } else {
-      _openslide_jpeg_mem_src(cinfo, buf, buflen);
+      _openslide_jpeg_decompress_set_source(dc, buf, buflen);
     }
 
     if (jpeg_read_header(cinfo, true) != JPEG_HEADER_OK) {
@@ -323,17 +552,136 @@ bool _openslide_jpeg_decode_buffer_dimensions(const void *buf, uint32_t len,
   return jpeg_get_dimensions(NULL, buf, len, w, h, err);
 }
 
+// accelerated decoders, in order of preference
+static const struct _openslide_jpeg_decoder *decoders[] = {
+#ifdef HAVE_NVJPEG
+  &_openslide_jpeg_decoder_nvjpeg,
+#endif
+  NULL
+};
+
+static void *select_decoder(void *arg G_GNUC_UNUSED) {
+  for (const struct _openslide_jpeg_decoder **d = decoders; *d; d++) {
+    if ((*d)->init()) {
+      return (void *) *d;
+    }
+  }
+  return NULL;
+}
+
+// does the stream have an APPn marker with this identifier before SOS?
+static bool has_app_marker(const uint8_t *b, uint32_t len,
+                           uint8_t marker, const char *ident) {
+  size_t ident_len = strlen(ident) + 1;
+  for (uint32_t i = 2; i + 4 <= len && b[i] == 0xFF; ) {
+    if (b[i + 1] == 0xDA) {
+      break;
+    }
+    uint32_t seg_len = b[i + 2] << 8 | b[i + 3];
+    if (b[i + 1] == marker && seg_len >= ident_len + 2 &&
+        i + 4 + ident_len <= len && !memcmp(b + i + 4, ident, ident_len)) {
+      return true;
+    }
+    i += 2 + seg_len;
+  }
+  return false;
+}
+
+uint8_t *_openslide_jpeg_make_interchange(const void *buf, uint32_t len,
+                                          const void *tables,
+                                          uint32_t tables_len,
+                                          bool rgb,
+                                          uint32_t *out_len) {
+  // Adobe APP14 marker with transform 0: components are RGB
+  static const uint8_t adobe_rgb[] = {
+    0xFF, 0xEE, 0x00, 0x0E, 'A', 'd', 'o', 'b', 'e', 0x00,
+    0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0x00,
+  };
+
+  const uint8_t *b = buf;
+  const uint8_t *t = tables;
+  if (len < 4 || b[0] != 0xFF || b[1] != 0xD8) {
+    return NULL;
+  }
+  // drop the SOI and EOI of the tables, and the SOI of the image
+  if (t && (tables_len < 4 || t[0] != 0xFF || t[1] != 0xD8 ||
+            t[tables_len - 2] != 0xFF || t[tables_len - 1] != 0xD9)) {
+    return NULL;
+  }
+  uint32_t t_len = t ? tables_len - 4 : 0;
+  uint32_t marker_len = 0;
+  if (rgb && !has_app_marker(b, len, 0xEE, "Adobe")) {
+    if (has_app_marker(b, len, 0xE0, "JFIF")) {
+      // decoders would take the samples as YCbCr
+      return NULL;
+    }
+    marker_len = sizeof(adobe_rgb);
+  }
+
+  *out_len = 2 + marker_len + t_len + len - 2;
+  uint8_t *out = g_malloc(*out_len);
+  uint8_t *p = out;
+  memcpy(p, b, 2);
+  p += 2;
+  memcpy(p, adobe_rgb, marker_len);
+  p += marker_len;
+  if (t) {
+    memcpy(p, t + 2, t_len);
+    p += t_len;
+  }
+  memcpy(p, b + 2, len - 2);
+  return out;
+}
+
+bool _openslide_jpeg_decode_accel(const void *buf, uint32_t len,
+                                  const void *tables, uint32_t tables_len,
+                                  J_COLOR_SPACE space,
+                                  uint32_t *dest,
+                                  int32_t w, int32_t h) {
+  static GOnce once = G_ONCE_INIT;
+  const struct _openslide_jpeg_decoder *decoder =
+    g_once(&once, select_decoder, NULL);
+  if (!decoder) {
+    return false;
+  }
+
+  // accelerated decoders want an interchange stream
+  g_autofree uint8_t *joined = NULL;
+  if (tables) {
+    joined = _openslide_jpeg_make_interchange(buf, len, tables, tables_len,
+                                              false, &len);
+    if (!joined) {
+      return false;
+    }
+    buf = joined;
+  }
+
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+  bool ok = decoder->decode(buf, len, space, dest, w, h);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase,
+                       ok ? (uint64_t) w * h * 4 : 0);
+  return ok;
+}
+
 static bool jpeg_decode(struct _openslide_file *f,  // or:
                         const void *buf, uint32_t buflen,
                         J_COLOR_SPACE space,
                         void *dest, bool grayscale,
                         int32_t w, int32_t h,
                         GError **err) {
+  if (!f && !grayscale &&
+      _openslide_jpeg_decode_accel(buf, buflen, NULL, 0, space,
+                                   dest, w, h)) {
+    return true;
+  }
+
   jmp_buf env;
 
+  // the thread's cached decompressor only supports buffers
   struct jpeg_decompress_struct *cinfo;
   g_auto(_openslide_jpeg_decompress) dc =
-    _openslide_jpeg_decompress_create(&cinfo);
+    f ? _openslide_jpeg_decompress_create(&cinfo) :
+        _openslide_jpeg_decompress_get(&cinfo);
 
   if (setjmp(env) == 0) {
     _openslide_jpeg_decompress_init(dc, &env);
@@ -342,7 +690,7 @@ static bool jpeg_decode(struct _openslide_file *f,  // or:
     if (f) {
       _openslide_jpeg_stdio_src(cinfo, f);
     } else {
-      _openslide_jpeg_mem_src(cinfo, buf, buflen);
+      _openslide_jpeg_decompress_set_source(dc, buf, buflen);
     }
 
     // read header
@@ -424,6 +772,109 @@ bool _openslide_jpeg_decode_buffer_gray(const void *buf, uint32_t len,
   return jpeg_decode(NULL, buf, len, JCS_UNKNOWN, dest, true, w, h, err);
 }
 
+struct jpeg_compress {
+  struct jpeg_compress_struct cinfo;
+  struct openslide_jpeg_error_mgr jerr;
+  struct jpeg_destination_mgr dest;
+  GByteArray *out;
+  uint8_t *row;
+  bool created;
+};
+
+#define ENCODE_BUFSIZE 4096
+
+static void encode_init_destination(j_compress_ptr cinfo) {
+  struct jpeg_compress *jc = (struct jpeg_compress *) cinfo;
+  g_byte_array_set_size(jc->out, ENCODE_BUFSIZE);
+  jc->dest.next_output_byte = jc->out->data;
+  jc->dest.free_in_buffer = ENCODE_BUFSIZE;
+}
+
+static boolean encode_empty_output_buffer(j_compress_ptr cinfo) {
+  struct jpeg_compress *jc = (struct jpeg_compress *) cinfo;
+  // libjpeg requires the whole buffer to be flushed
+  uint32_t used = jc->out->len;
+  g_byte_array_set_size(jc->out, used * 2);
+  jc->dest.next_output_byte = jc->out->data + used;
+  jc->dest.free_in_buffer = jc->out->len - used;
+  return true;
+}
+
+static void encode_term_destination(j_compress_ptr cinfo) {
+  struct jpeg_compress *jc = (struct jpeg_compress *) cinfo;
+  g_byte_array_set_size(jc->out, jc->out->len - jc->dest.free_in_buffer);
+}
+
+static void jpeg_compress_free(struct jpeg_compress *jc) {
+  if (jc->created) {
+    jpeg_destroy_compress(&jc->cinfo);
+  }
+  if (jc->out) {
+    g_byte_array_free(jc->out, true);
+  }
+  g_free(jc->row);
+  g_free(jc);
+}
+
+typedef struct jpeg_compress * volatile jpeg_compress;
+G_DEFINE_AUTO_CLEANUP_FREE_FUNC(jpeg_compress, jpeg_compress_free, NULL)
+
+uint8_t *_openslide_jpeg_encode_buffer(const uint32_t *src,
+                                       int32_t w, int32_t h,
+                                       int quality,
+                                       uint32_t *out_len,
+                                       GError **err) {
+  g_auto(jpeg_compress) jc = g_new0(struct jpeg_compress, 1);
+  jc->out = g_byte_array_new();
+  jc->row = g_malloc(w * 3);
+  jmp_buf env;
+
+  if (setjmp(env) == 0) {
+    jpeg_std_error(&jc->jerr.base);
+    jc->jerr.base.error_exit = my_error_exit;
+    jc->jerr.base.output_message = my_output_message;
+    jc->jerr.base.emit_message = my_emit_message;
+    jc->jerr.env = &env;
+    jc->cinfo.err = (struct jpeg_error_mgr *) &jc->jerr;
+    jpeg_create_compress(&jc->cinfo);
+    jc->created = true;
+
+    jc->dest.init_destination = encode_init_destination;
+    jc->dest.empty_output_buffer = encode_empty_output_buffer;
+    jc->dest.term_destination = encode_term_destination;
+    jc->cinfo.dest = &jc->dest;
+
+    jc->cinfo.image_width = w;
+    jc->cinfo.image_height = h;
+    jc->cinfo.input_components = 3;
+    jc->cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&jc->cinfo);
+    jpeg_set_quality(&jc->cinfo, quality, true);
+    jpeg_start_compress(&jc->cinfo, true);
+
+    // samples are opaque; alpha is dropped
+    while (jc->cinfo.next_scanline < jc->cinfo.image_height) {
+      const uint32_t *p = src + (int64_t) jc->cinfo.next_scanline * w;
+      for (int32_t x = 0; x < w; x++) {
+        jc->row[x * 3] = p[x] >> 16;
+        jc->row[x * 3 + 1] = p[x] >> 8;
+        jc->row[x * 3 + 2] = p[x];
+      }
+      JSAMPROW row = jc->row;
+      jpeg_write_scanlines(&jc->cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&jc->cinfo);
+
+    *out_len = jc->out->len;
+    return g_byte_array_free(g_steal_pointer(&jc->out), false);
+  } else {
+    // setjmp returned again
+    g_propagate_error(err, jc->jerr.err);
+    jc->jerr.err = NULL;
+    return NULL;
+  }
+}
+
 static bool get_associated_image_data(struct _openslide_associated_image *_img,
                                       uint32_t *dest,
                                       GError **err) {
@@ -438,6 +889,7 @@ static bool get_associated_image_data(struct _openslide_associated_image *_img,
 static void destroy_associated_image(struct _openslide_associated_image *_img) {
   struct associated_image *img = (struct associated_image *) _img;
 
+  g_free(img->name);
   g_free(img->filename);
   g_free(img);
 }
@@ -447,24 +899,54 @@ static const struct _openslide_associated_image_ops jpeg_associated_ops = {
   .destroy = destroy_associated_image,
 };
 
+static bool read_associated_image_dimensions(struct _openslide_associated_image *_img,
+                                             GError **err) {
+  struct associated_image *img = (struct associated_image *) _img;
+  int32_t w, h;
+  if (!_openslide_jpeg_read_dimensions(img->filename, img->offset,
+                                       &w, &h, err)) {
+    g_prefix_error(err, "Can't read %s associated image: ", img->name);
+    return false;
+  }
+  img->base.w = w;
+  img->base.h = h;
+  return true;
+}
+
+static const struct _openslide_associated_image_ops jpeg_lazy_associated_ops = {
+  .read_dimensions = read_associated_image_dimensions,
+  .get_argb_data = get_associated_image_data,
+  .destroy = destroy_associated_image,
+};
+
 bool _openslide_jpeg_add_associated_image(openslide_t *osr,
 					  const char *name,
 					  const char *filename,
 					  int64_t offset,
 					  GError **err) {
-  int32_t w, h;
-  if (!_openslide_jpeg_read_dimensions(filename, offset, &w, &h, err)) {
-    g_prefix_error(err, "Can't read %s associated image: ", name);
-    return false;
-  }
-
   struct associated_image *img = g_new0(struct associated_image, 1);
-  img->base.ops = &jpeg_associated_ops;
-  img->base.w = w;
-  img->base.h = h;
+  img->name = g_strdup(name);
   img->filename = g_strdup(filename);
   img->offset = offset;
 
+  // reading the header means opening another file; when properties are
+  // lazy, wait until the dimensions are needed
+  if (_openslide_lazy_properties()) {
+    img->base.ops = &jpeg_lazy_associated_ops;
+    img->base.w = -1;
+    img->base.h = -1;
+  } else {
+    int32_t w, h;
+    if (!_openslide_jpeg_read_dimensions(filename, offset, &w, &h, err)) {
+      g_prefix_error(err, "Can't read %s associated image: ", name);
+      destroy_associated_image(&img->base);
+      return false;
+    }
+    img->base.ops = &jpeg_associated_ops;
+    img->base.w = w;
+    img->base.h = h;
+  }
+
   g_hash_table_insert(osr->associated_images, g_strdup(name), img);
 
   return true;
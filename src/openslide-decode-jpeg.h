@@ -70,12 +70,58 @@ bool _openslide_jpeg_decode_buffer_gray(const void *buf, uint32_t len,
                                         int32_t w, int32_t h,
                                         GError **err);
 
+// encode opaque ARGB pixels as a baseline YCbCr JPEG, for synthetic slides
+uint8_t *_openslide_jpeg_encode_buffer(const uint32_t *src,
+                                       int32_t w, int32_t h,
+                                       int quality,
+                                       uint32_t *out_len,
+                                       GError **err);
+
 bool _openslide_jpeg_add_associated_image(openslide_t *osr,
                                           const char *name,
                                           const char *filename,
                                           int64_t offset,
                                           GError **err);
 
+/*
+ * Pluggable decoders for complete RGB JPEG streams, such as GPU decoders.
+ * libjpeg remains the reference implementation; any image an accelerated
+ * decoder declines or fails to decode is decoded with libjpeg instead, so
+ * decoders don't report errors.
+ */
+struct _openslide_jpeg_decoder {
+  const char *name;
+  // false if the decoder is unusable on this system
+  bool (*init)(void);
+  // space is JCS_UNKNOWN to take the color space from the stream
+  bool (*decode)(const void *buf, uint32_t len,
+                 J_COLOR_SPACE space,
+                 uint32_t *dest,
+                 int32_t w, int32_t h);
+};
+
+#ifdef HAVE_NVJPEG
+extern const struct _openslide_jpeg_decoder _openslide_jpeg_decoder_nvjpeg;
+#endif
+
+// false if there's no accelerated decoder or it couldn't decode the image.
+// tables are optional.
+bool _openslide_jpeg_decode_accel(const void *buf, uint32_t len,
+                                  const void *tables, uint32_t tables_len,
+                                  J_COLOR_SPACE space,
+                                  uint32_t *dest,
+                                  int32_t w, int32_t h);
+
+// Make a standalone interchange stream from an image and optional
+// abbreviated-format tables.  If rgb, an Adobe marker tells decoders the
+// samples aren't YCbCr.  Returns NULL if the stream is malformed or can't
+// be marked as RGB.
+uint8_t *_openslide_jpeg_make_interchange(const void *buf, uint32_t len,
+                                          const void *tables,
+                                          uint32_t tables_len,
+                                          bool rgb,
+                                          uint32_t *out_len);
+
 /*
  * On Windows, we cannot fopen a file and pass it to another DLL that does fread.
  * So we need to compile all our freading into the OpenSlide DLL directly.
@@ -95,9 +141,19 @@ void _openslide_jpeg_mem_src (j_decompress_ptr cinfo,
  */
 struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_create(struct jpeg_decompress_struct **out_cinfo);
 
+struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_get(struct jpeg_decompress_struct **out_cinfo);
+
 void _openslide_jpeg_decompress_init(struct _openslide_jpeg_decompress *dc,
                                      jmp_buf *env);
 
+bool _openslide_jpeg_decompress_load_tables(struct _openslide_jpeg_decompress *dc,
+                                            const void *tables,
+                                            uint32_t tables_len,
+                                            GError **err);
+
+void _openslide_jpeg_decompress_set_source(struct _openslide_jpeg_decompress *dc,
+                                           const void *buf, uint32_t len);
+
 bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
                                     // uint8_t * if grayscale, else uint32_t *
                                     void *dest,
@@ -105,6 +161,15 @@ bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
                                     int32_t w, int32_t h,
                                     GError **err);
 
+// decode only the region_w x region_h rectangle at (x, y) of a w x h
+// image into dest
+bool _openslide_jpeg_decompress_run_region(struct _openslide_jpeg_decompress *dc,
+                                           uint32_t *dest,
+                                           int32_t w, int32_t h,
+                                           int32_t x, int32_t y,
+                                           int32_t region_w, int32_t region_h,
+                                           GError **err);
+
 void _openslide_jpeg_propagate_error(GError **err,
                                      struct _openslide_jpeg_decompress *dc);
 
@@ -0,0 +1,116 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide-private.h"
+#include "openslide-decode-jxr.h"
+
+#include <glib.h>
+#include <JXRGlue.h>
+
+// JPEG XR support through jxrlib, for Zeiss CZI subblocks
+
+static void stream_close(struct WMPStream *stream) {
+  stream->Close(&stream);
+}
+typedef struct WMPStream jxr_stream;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(jxr_stream, stream_close)
+
+// the decoder doesn't own its stream
+static void decoder_release(PKImageDecode *decoder) {
+  decoder->Release(&decoder);
+}
+typedef PKImageDecode jxr_decoder;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(jxr_decoder, decoder_release)
+
+static bool jxr_decode(uint32_t *dest,
+                       int32_t w, int32_t h,
+                       const void *data, int64_t datalen,
+                       GError **err) {
+  // jxrlib doesn't modify the buffer but takes it non-const
+  g_autoptr(jxr_stream) stream = NULL;
+  ERR rc = CreateWS_Memory(&stream, (void *) data, datalen);
+  if (Failed(rc)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't create JPEG XR stream: %d", (int) rc);
+    return false;
+  }
+  g_autoptr(jxr_decoder) decoder = NULL;
+  rc = PKImageDecode_Create_WMP(&decoder);
+  if (!Failed(rc)) {
+    rc = decoder->Initialize(decoder, stream);
+  }
+  if (Failed(rc)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't initialize JPEG XR decoder: %d", (int) rc);
+    return false;
+  }
+
+  I32 iw, ih;
+  decoder->GetSize(decoder, &iw, &ih);
+  if (iw != w || ih != h) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Dimensional mismatch reading JPEG XR, "
+                "expected %dx%d, got %dx%d", w, h, (int) iw, (int) ih);
+    return false;
+  }
+  PKPixelFormatGUID format;
+  decoder->GetPixelFormat(decoder, &format);
+  bool bgr = IsEqualGUID(&format, &GUID_PKPixelFormat24bppBGR);
+  if (!bgr && !IsEqualGUID(&format, &GUID_PKPixelFormat24bppRGB)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Unsupported JPEG XR pixel format");
+    return false;
+  }
+
+  // decode in the native format, then convert in one pass
+  int64_t pixel_count = (int64_t) w * h;
+  g_autofree uint8_t *pixels = g_try_malloc(pixel_count * 3);
+  if (!pixels) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't allocate %"PRId64" bytes for JPEG XR decode",
+                pixel_count * 3);
+    return false;
+  }
+  PKRect rect = {0, 0, w, h};
+  rc = decoder->Copy(decoder, &rect, pixels, w * 3);
+  if (Failed(rc)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't decode JPEG XR image: %d", (int) rc);
+    return false;
+  }
+  if (bgr) {
+    _openslide_simd_bgr24_to_argb32(pixels, dest, pixel_count);
+  } else {
+    _openslide_simd_rgb24_to_argb32(pixels, dest, pixel_count);
+  }
+  return true;
+}
+
+bool _openslide_jxr_decode_buffer(uint32_t *dest,
+                                  int32_t w, int32_t h,
+                                  const void *data, int64_t datalen,
+                                  GError **err) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+  bool ok = jxr_decode(dest, w, h, data, datalen, err);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase,
+                       ok ? (uint64_t) w * h * 4 : 0);
+  return ok;
+}
@@ -0,0 +1,38 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef OPENSLIDE_OPENSLIDE_DECODE_JXR_H_
+#define OPENSLIDE_OPENSLIDE_DECODE_JXR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+/* JPEG XR support; only built if jxrlib is available (HAVE_JXR) */
+
+// decode a 24-bit RGB or BGR image into w x h ARGB pixels
+bool _openslide_jxr_decode_buffer(uint32_t *dest,
+                                  int32_t w, int32_t h,
+                                  const void *data, int64_t datalen,
+                                  GError **err);
+
+#endif
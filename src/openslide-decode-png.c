@@ -98,9 +98,9 @@ static struct png_ctx *png_ctx_new(uint32_t *dest,
   return ret;
 }
 
-static bool png_read(png_rw_ptr read_callback, void *callback_data,
-                     uint32_t *dest, int64_t w, int64_t h,
-                     GError **err) {
+static bool png_decode(png_rw_ptr read_callback, void *callback_data,
+                       uint32_t *dest, int64_t w, int64_t h,
+                       GError **err) {
   // allocate context
   g_auto(png_ctx) ctx = png_ctx_new(dest, w, h, err);
   if (ctx == NULL) {
@@ -185,6 +185,16 @@ static bool png_read(png_rw_ptr read_callback, void *callback_data,
   return true;
 }
 
+static bool png_read(png_rw_ptr read_callback, void *callback_data,
+                     uint32_t *dest, int64_t w, int64_t h,
+                     GError **err) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+  bool ok = png_decode(read_callback, callback_data, dest, w, h, err);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase,
+                       ok ? (uint64_t) w * h * 4 : 0);
+  return ok;
+}
+
 static void file_read_callback(png_struct *png, png_byte *buf, png_size_t len) {
   struct _openslide_file *f = png_get_io_ptr(png);
   if (!_openslide_fread_exact(f, buf, len, NULL)) {
@@ -26,6 +26,9 @@
 #include "openslide-private.h"
 
 #define BUSY_TIMEOUT 500  // ms
+// map read-only databases, so reading a blob doesn't copy it through the
+// page cache; SQLite clamps this to its compiled-in maximum
+#define MMAP_SIZE (1LL << 30)
 
 /* Can only use API supported in SQLite 3.26.0 for RHEL 8 compatibility */
 
@@ -77,16 +80,28 @@ static sqlite3 *do_open(const char *filename, int flags, GError **err) {
 }
 
 sqlite3 *_openslide_sqlite_open(const char *filename, GError **err) {
-  // ":" filename prefix is reserved.
-  // "file:" prefix invokes URI filename interpretation if enabled, which
-  // might have been done globally.
-  g_autofree char *path = NULL;
-  if (g_str_has_prefix(filename, ":") || g_str_has_prefix(filename, "file:")) {
-    path = g_strdup_printf("./%s", filename);
-  } else {
-    path = g_strdup(filename);
+  // Open through a URI with immutable=1, since slides don't change while
+  // they're open.  SQLite then skips file locking and change detection.
+  // Escaping the path also keeps SQLite from interpreting a ":" prefix or
+  // URI parameters in the filename.
+  g_autofree char *path = g_strdup(filename);
+#ifdef _WIN32
+  g_strdelimit(path, "\\", '/');
+#endif
+  g_autofree char *escaped = g_uri_escape_string(path, "/:", false);
+  const char *prefix = "file:";
+  if (g_path_is_absolute(path)) {
+    // empty authority, so a leading "//" isn't taken for a host
+    prefix = path[0] == '/' ? "file://" : "file:///";
+  }
+  g_autofree char *uri = g_strdup_printf("%s%s?immutable=1", prefix, escaped);
+  sqlite3 *db = do_open(uri, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, err);
+  if (db) {
+    // not fatal
+    g_autofree char *sql =
+      g_strdup_printf("PRAGMA mmap_size = %lld", MMAP_SIZE);
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
   }
-  sqlite3 *db = do_open(path, SQLITE_OPEN_READONLY, err);
   return db;
 }
 
@@ -38,15 +38,46 @@
 
 #include "openslide-hash.h"
 
-#define HANDLE_CACHE_MAX 32
+// Each handle cache starts with room for the configured number of idle
+// handles and grows to the largest number of handles that have been in use
+// at once, so a pool sized for its readers stops closing and reopening
+// handles.  Idle handles have no open file, so growth only costs memory.
+#define HANDLE_CACHE_DEFAULT_SIZE 32
+#define HANDLE_CACHE_GROWTH_MAX 1024
+// tile data separated by at most this many bytes is fetched in one read
+#define TILE_MERGE_GAP (64 << 10)
+
+// Tile offsets, byte counts, and JPEG tables of a directory, copied from
+// libtiff when a level is initialized.  Raw tiles are read with positional
+// reads from one file shared by all handles, so reading a tile never has
+// to switch libtiff to the tile's directory, which makes libtiff reparse
+// the directory.
+struct _openslide_tiff_tiles {
+  int64_t count;
+  uint64_t *offsets;
+  uint64_t *sizes;
+  void *jpeg_tables;
+  uint32_t jpeg_tables_len;
+};
 
 struct _openslide_tiffcache {
   char *filename;
   GQueue *cache;
   GMutex lock;
+  GHashTable *tiles;  // tdir_t -> struct _openslide_tiff_tiles
+  struct _openslide_file *file;  // shared by raw reads; opened on demand
   int outstanding;
+  int max_idle;     // grows with outstanding
+  uint64_t opens;
+  uint64_t reuses;
 };
 
+static gint handle_cache_size = HANDLE_CACHE_DEFAULT_SIZE;  // atomic ops only
+
+// process-wide counters; atomic ops only
+static gsize handle_opens;
+static gsize handle_reuses;
+
 // not thread-safe, like libtiff
 struct tiff_file_handle {
   struct _openslide_tiffcache *tc;
@@ -63,6 +94,13 @@ struct associated_image {
   tdir_t icc_directory;
 };
 
+static tsize_t tiff_do_read(thandle_t th, tdata_t buf, tsize_t size);
+
+#ifndef COMPRESSION_ZSTD
+// libtiff < 4.0.10
+#define COMPRESSION_ZSTD 50000
+#endif
+
 #define SET_DIR_OR_FAIL(tiff, i)					\
   do {									\
     if (!_openslide_tiff_set_dir(tiff, i, err)) {			\
@@ -95,6 +133,127 @@ bool _openslide_tiff_set_dir(TIFF *tiff,
   return true;
 }
 
+static void tiles_free(gpointer data) {
+  struct _openslide_tiff_tiles *tiles = data;
+  g_free(tiles->offsets);
+  g_free(tiles->sizes);
+  g_free(tiles->jpeg_tables);
+  g_free(tiles);
+}
+
+// get the shared tile locations of the current directory, creating them
+// if necessary.  sets *tiles_OUT to NULL for handles not from a tiffcache.
+static bool get_tiles(TIFF *tiff, tdir_t dir, bool jpeg,
+                      const struct _openslide_tiff_tiles **tiles_OUT,
+                      GError **err) {
+  *tiles_OUT = NULL;
+  if (TIFFGetReadProc(tiff) != tiff_do_read) {
+    return true;
+  }
+  struct tiff_file_handle *hdl = TIFFClientdata(tiff);
+  struct _openslide_tiffcache *tc = hdl->tc;
+
+  g_mutex_lock(&tc->lock);
+  struct _openslide_tiff_tiles *tiles =
+    g_hash_table_lookup(tc->tiles, GUINT_TO_POINTER(dir));
+  g_mutex_unlock(&tc->lock);
+  if (tiles) {
+    *tiles_OUT = tiles;
+    return true;
+  }
+
+  toff_t *offsets, *sizes;
+  if (!TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets) ||
+      !TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes)) {
+    _openslide_tiff_error(err, tiff, "Cannot get tile locations");
+    return false;
+  }
+  tiles = g_new0(struct _openslide_tiff_tiles, 1);
+  tiles->count = TIFFNumberOfTiles(tiff);
+  tiles->offsets = g_memdup(offsets, tiles->count * sizeof(*offsets));
+  tiles->sizes = g_memdup(sizes, tiles->count * sizeof(*sizes));
+  void *tables;
+  uint32_t tables_len;
+  if (jpeg && TIFFGetField(tiff, TIFFTAG_JPEGTABLES, &tables_len, &tables)) {
+    tiles->jpeg_tables = g_memdup(tables, tables_len);
+    tiles->jpeg_tables_len = tables_len;
+  }
+
+  g_mutex_lock(&tc->lock);
+  struct _openslide_tiff_tiles *existing =
+    g_hash_table_lookup(tc->tiles, GUINT_TO_POINTER(dir));
+  if (existing) {
+    tiles_free(tiles);
+    tiles = existing;
+  } else {
+    g_hash_table_insert(tc->tiles, GUINT_TO_POINTER(dir), tiles);
+  }
+  g_mutex_unlock(&tc->lock);
+
+  *tiles_OUT = tiles;
+  return true;
+}
+
+static bool tiff_ensure_open(struct tiff_file_handle *hdl, GError **err) {
+  // Open the file handle on first use.  cached_tiff_put will close it so it
+  // doesn't stay open across API calls.  Also ensures FD_CLOEXEC is set.
+  if (!hdl->f) {
+    g_autoptr(_openslide_file) f = _openslide_fopen(hdl->tc->filename, err);
+    if (!f) {
+      return false;
+    }
+    // restore file position
+    if (!_openslide_fseek(f, hdl->offset, SEEK_SET, err)) {
+      return false;
+    }
+    hdl->f = g_steal_pointer(&f);
+  }
+  return true;
+}
+
+static struct _openslide_file *get_shared_file(TIFF *tiff, GError **err) {
+  struct tiff_file_handle *hdl = TIFFClientdata(tiff);
+  struct _openslide_tiffcache *tc = hdl->tc;
+  g_mutex_lock(&tc->lock);
+  if (!tc->file) {
+    tc->file = _openslide_fopen_mapped(tc->filename, err);
+  }
+  struct _openslide_file *f = tc->file;
+  g_mutex_unlock(&tc->lock);
+  return f;
+}
+
+// read bytes through the cache's shared file, bypassing libtiff
+static bool tiff_read_raw(TIFF *tiff, uint64_t offset,
+                          void *buf, uint64_t len,
+                          GError **err) {
+  struct _openslide_file *f = get_shared_file(tiff, err);
+  if (!f) {
+    return false;
+  }
+  if (!_openslide_fpread_exact(f, buf, len, offset, err)) {
+    g_prefix_error(err, "Cannot read raw tile: ");
+    return false;
+  }
+  return true;
+}
+
+// tiffl->tiles must be set
+static bool get_tile_no(struct _openslide_tiff_level *tiffl,
+                        int64_t tile_col, int64_t tile_row,
+                        int64_t *tile_no,
+                        GError **err) {
+  *tile_no = tile_row * tiffl->tiles_across + tile_col;
+  if (tile_col < 0 || tile_col >= tiffl->tiles_across ||
+      tile_row < 0 || *tile_no >= tiffl->tiles->count) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Invalid tile %"PRId64", %"PRId64" in directory %d",
+                tile_col, tile_row, tiffl->dir);
+    return false;
+  }
+  return true;
+}
+
 bool _openslide_tiff_level_init(TIFF *tiff,
                                 tdir_t dir,
                                 struct _openslide_level *level,
@@ -129,6 +288,28 @@ bool _openslide_tiff_level_init(TIFF *tiff,
     samples_per_pixel == 3;
   //g_debug("directory %d, read_direct %d", dir, read_direct);
 
+  // losslessly-compressed RGB tiles can be decoded without libtiff too
+  uint16_t predictor = PREDICTOR_NONE;
+  TIFFGetField(tiff, TIFFTAG_PREDICTOR, &predictor);
+  bool read_raw =
+    (compression == COMPRESSION_NONE ||
+     compression == COMPRESSION_LZW ||
+     compression == COMPRESSION_ADOBE_DEFLATE ||
+     compression == COMPRESSION_DEFLATE ||
+     compression == COMPRESSION_ZSTD) &&
+    (predictor == PREDICTOR_NONE || predictor == PREDICTOR_HORIZONTAL) &&
+    planar_config == PLANARCONFIG_CONTIG &&
+    photometric == PHOTOMETRIC_RGB &&
+    bits_per_sample == 8 &&
+    samples_per_pixel == 3;
+
+  // share tile locations between handles
+  const struct _openslide_tiff_tiles *tiles = NULL;
+  if (tiffl && planar_config == PLANARCONFIG_CONTIG &&
+      !get_tiles(tiff, dir, compression == COMPRESSION_JPEG, &tiles, err)) {
+    return false;
+  }
+
   // safe now, start writing
   if (level) {
     level->w = iw;
@@ -136,6 +317,8 @@ bool _openslide_tiff_level_init(TIFF *tiff,
     // tile size hints
     level->tile_w = tw;
     level->tile_h = th;
+    // libjpeg can decode at reduced size
+    level->scaled_tiles = read_direct && tw % 8 == 0 && th % 8 == 0;
   }
 
   if (tiffl) {
@@ -150,7 +333,11 @@ bool _openslide_tiff_level_init(TIFF *tiff,
     tiffl->tiles_down = (ih / th) + !!(ih % th);
 
     tiffl->tile_read_direct = read_direct;
+    tiffl->tile_read_raw = read_raw;
+    tiffl->compression = compression;
+    tiffl->predictor = predictor;
     tiffl->photometric = photometric;
+    tiffl->tiles = tiles;
   }
 
   return true;
@@ -210,33 +397,46 @@ static bool tiff_read_region(TIFF *tiff,
   return success;
 }
 
+// part of a tile
+struct tile_region {
+  int32_t x;
+  int32_t y;
+  int32_t w;
+  int32_t h;
+};
+
 static bool decode_jpeg(const void *buf, uint32_t buflen,
                         const void *tables, uint32_t tables_len,  // optional
                         J_COLOR_SPACE space,
+                        int32_t scale,
+                        const struct tile_region *region,  // optional
                         uint32_t *dest,
                         int32_t w, int32_t h,
                         GError **err) {
+  if (scale == 1 && !region &&
+      _openslide_jpeg_decode_accel(buf, buflen, tables, tables_len, space,
+                                   dest, w, h)) {
+    return true;
+  }
+
   jmp_buf env;
 
   struct jpeg_decompress_struct *cinfo;
   g_auto(_openslide_jpeg_decompress) dc =
-    _openslide_jpeg_decompress_create(&cinfo);
+    _openslide_jpeg_decompress_get(&cinfo);
 
   if (setjmp(env) == 0) {
     _openslide_jpeg_decompress_init(dc, &env);
 
-    // load JPEG tables
-    if (tables) {
-      _openslide_jpeg_mem_src(cinfo, tables, tables_len);
-      if (jpeg_read_header(cinfo, false) != JPEG_HEADER_TABLES_ONLY) {
-        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                    "Couldn't load JPEG tables");
-        return false;
-      }
+    // load JPEG tables, if this thread's decompressor doesn't have them
+    if (tables &&
+        !_openslide_jpeg_decompress_load_tables(dc, tables, tables_len,
+                                                err)) {
+      return false;
     }
 
     // set up I/O
-    _openslide_jpeg_mem_src(cinfo, buf, buflen);
+    _openslide_jpeg_decompress_set_source(dc, buf, buflen);
 
     // read header
     if (jpeg_read_header(cinfo, true) != JPEG_HEADER_OK) {
@@ -248,7 +448,17 @@ static bool decode_jpeg(const void *buf, uint32_t buflen,
     // set color space from TIFF photometric tag (for Aperio)
     cinfo->jpeg_color_space = space;
 
+    // DCT scaling
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale;
+
     // decompress
+    if (region) {
+      return _openslide_jpeg_decompress_run_region(dc, dest, w, h,
+                                                   region->x, region->y,
+                                                   region->w, region->h,
+                                                   err);
+    }
     if (!_openslide_jpeg_decompress_run(dc, dest, false, w, h, err)) {
       return false;
     }
@@ -260,13 +470,129 @@ static bool decode_jpeg(const void *buf, uint32_t buflen,
   }
 }
 
+static bool read_tile_jpeg(struct _openslide_tiff_level *tiffl,
+                           TIFF *tiff,
+                           uint32_t *dest,
+                           int64_t tile_col, int64_t tile_row,
+                           int32_t scale,
+                           const struct tile_region *region,  // optional
+                           GError **err) {
+  // read tables
+  void *tables;
+  uint32_t tables_len;
+  if (tiffl->tiles) {
+    tables = tiffl->tiles->jpeg_tables;
+    tables_len = tiffl->tiles->jpeg_tables_len;
+  } else if (!TIFFGetField(tiff, TIFFTAG_JPEGTABLES, &tables_len, &tables)) {
+    // no separate tables
+    tables = NULL;
+    tables_len = 0;
+  }
+
+  // read data, or point into the file mapping
+  g_autofree void *buf = NULL;
+  const void *data = NULL;
+  int32_t buflen = 0;
+  if (tiffl->tiles) {
+    int64_t tile_no;
+    if (!get_tile_no(tiffl, tile_col, tile_row, &tile_no, err)) {
+      return false;
+    }
+    struct _openslide_file *f = get_shared_file(tiff, err);
+    if (!f) {
+      return false;
+    }
+    uint64_t size = tiffl->tiles->sizes[tile_no];
+    if (size <= INT32_MAX) {
+      data = _openslide_fmap_range(f, tiffl->tiles->offsets[tile_no], size);
+      buflen = size;
+    }
+  }
+  if (!data) {
+    if (!_openslide_tiff_read_tile_data(tiffl, tiff,
+                                        &buf, &buflen,
+                                        tile_col, tile_row,
+                                        err)) {
+      return false;
+    }
+    data = buf;
+  }
+
+  // decompress
+  return decode_jpeg(data, buflen, tables, tables_len,
+                     tiffl->photometric == PHOTOMETRIC_YCBCR ? JCS_YCbCr : JCS_RGB,
+                     scale, region,
+                     dest,
+                     tiffl->tile_w / scale, tiffl->tile_h / scale,
+                     err);
+}
+
+static bool read_tile_raw(struct _openslide_tiff_level *tiffl,
+                          TIFF *tiff,
+                          uint32_t *dest,
+                          int64_t tile_col, int64_t tile_row,
+                          GError **err) {
+  g_autofree void *buf = NULL;
+  int32_t buflen;
+  if (!_openslide_tiff_read_tile_data(tiffl, tiff, &buf, &buflen,
+                                      tile_col, tile_row, err)) {
+    return false;
+  }
+
+  int64_t pixels = tiffl->tile_w * tiffl->tile_h;
+  int64_t size = pixels * 3;
+  g_autofree uint8_t *pixbuf = NULL;
+  switch (tiffl->compression) {
+  case COMPRESSION_NONE:
+    if (buflen < size) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Short tile: %d/%"PRId64" bytes", buflen, size);
+      return false;
+    }
+    pixbuf = g_steal_pointer(&buf);
+    break;
+  case COMPRESSION_LZW:
+    pixbuf = _openslide_lzw_decompress_buffer(buf, buflen, size, err);
+    break;
+  case COMPRESSION_ADOBE_DEFLATE:
+  case COMPRESSION_DEFLATE:
+    pixbuf = _openslide_inflate_buffer(buf, buflen, size, err);
+    break;
+  case COMPRESSION_ZSTD:
+    pixbuf = _openslide_zstd_decompress_buffer(buf, buflen, size, err);
+    break;
+  default:
+    g_assert_not_reached();
+  }
+  if (!pixbuf) {
+    g_prefix_error(err, "Cannot decode tile in directory %d: ", tiffl->dir);
+    return false;
+  }
+
+  // undo horizontal differencing
+  if (tiffl->predictor == PREDICTOR_HORIZONTAL) {
+    int64_t stride = tiffl->tile_w * 3;
+    for (int64_t y = 0; y < tiffl->tile_h; y++) {
+      uint8_t *row = pixbuf + y * stride;
+      for (int64_t x = 3; x < stride; x++) {
+        row[x] += row[x - 3];
+      }
+    }
+  }
+
+  _openslide_simd_rgb24_to_argb32(pixbuf, dest, pixels);
+  return true;
+}
+
 bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
                                TIFF *tiff,
                                uint32_t *dest,
                                int64_t tile_col, int64_t tile_row,
                                GError **err) {
-  // set directory
-  SET_DIR_OR_FAIL(tiff, tiffl->dir);
+  // set directory, unless we can avoid libtiff entirely
+  if (!(tiffl->tile_read_direct || tiffl->tile_read_raw) || !tiffl->tiles) {
+    SET_DIR_OR_FAIL(tiff, tiffl->dir);
+  }
 
   if (tiffl->tile_read_direct) {
     // Fast path: read raw data, decode through libjpeg
@@ -275,41 +601,74 @@ bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
     // to BGRA, we convert to ARGB.  If we can bypass libtiff when
     // decoding JPEG tiles, we can reduce this to one optimized pass in
     // libjpeg-turbo.
-
-    // read tables
-    void *tables;
-    uint32_t tables_len;
-    if (!TIFFGetField(tiff, TIFFTAG_JPEGTABLES, &tables_len, &tables)) {
-      // no separate tables
-      tables = NULL;
-      tables_len = 0;
-    }
-
-    // read data
-    g_autofree void *buf = NULL;
-    int32_t buflen;
-    if (!_openslide_tiff_read_tile_data(tiffl, tiff,
-                                        &buf, &buflen,
-                                        tile_col, tile_row,
-                                        err)) {
-      return false;
-    }
-
-    // decompress
-    return decode_jpeg(buf, buflen, tables, tables_len,
-                       tiffl->photometric == PHOTOMETRIC_YCBCR ? JCS_YCbCr : JCS_RGB,
-                       dest,
-                       tiffl->tile_w, tiffl->tile_h,
-                       err);
+    return read_tile_jpeg(tiffl, tiff, dest, tile_col, tile_row, 1, NULL,
+                          err);
+  } else if (tiffl->tile_read_raw) {
+    // Lossless compression: read raw data, decompress and unpack it
+    // ourselves, so the decode doesn't hold a libtiff handle's codec state
+    return read_tile_raw(tiffl, tiff, dest, tile_col, tile_row, err);
   } else {
     // Fallback: read tile through libtiff
     _openslide_performance_warn_once(&tiffl->warned_read_indirect,
                                      "Using slow libtiff read path for "
                                      "directory %d", tiffl->dir);
-    return tiff_read_region(tiff, dest,
-                            tile_col * tiffl->tile_w, tile_row * tiffl->tile_h,
-                            tiffl->tile_w, tiffl->tile_h, err);
+    int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+    bool ok = tiff_read_region(tiff, dest,
+                               tile_col * tiffl->tile_w,
+                               tile_row * tiffl->tile_h,
+                               tiffl->tile_w, tiffl->tile_h, err);
+    _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase,
+                         ok ? (uint64_t) tiffl->tile_w * tiffl->tile_h * 4 : 0);
+    return ok;
+  }
+}
+
+bool _openslide_tiff_read_tile_scaled(struct _openslide_tiff_level *tiffl,
+                                      TIFF *tiff,
+                                      uint32_t *dest,
+                                      int64_t tile_col, int64_t tile_row,
+                                      int32_t scale,
+                                      GError **err) {
+  g_assert(tiffl->tile_read_direct);
+  g_assert(tiffl->tile_w % scale == 0 && tiffl->tile_h % scale == 0);
+
+  // set directory
+  if (!tiffl->tiles) {
+    SET_DIR_OR_FAIL(tiff, tiffl->dir);
+  }
+
+  if (!read_tile_jpeg(tiffl, tiff, dest, tile_col, tile_row, scale, NULL,
+                      err)) {
+    return false;
   }
+
+  // clip to the scaled image dimensions
+  int64_t sw = (tiffl->image_w + scale - 1) / scale;
+  int64_t sh = (tiffl->image_h + scale - 1) / scale;
+  int64_t stw = tiffl->tile_w / scale;
+  int64_t sth = tiffl->tile_h / scale;
+  return _openslide_clip_tile(dest, stw, sth,
+                              sw - tile_col * stw, sh - tile_row * sth,
+                              err);
+}
+
+bool _openslide_tiff_read_tile_region(struct _openslide_tiff_level *tiffl,
+                                      TIFF *tiff,
+                                      uint32_t *dest,
+                                      int64_t tile_col, int64_t tile_row,
+                                      int32_t x, int32_t y,
+                                      int32_t w, int32_t h,
+                                      GError **err) {
+  g_assert(tiffl->tile_read_direct);
+
+  // set directory
+  if (!tiffl->tiles) {
+    SET_DIR_OR_FAIL(tiff, tiffl->dir);
+  }
+
+  struct tile_region region = {x, y, w, h};
+  return read_tile_jpeg(tiffl, tiff, dest, tile_col, tile_row, 1, &region,
+                        err);
 }
 
 bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
@@ -317,6 +676,27 @@ bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
                                     void **_buf, int32_t *_len,
                                     int64_t tile_col, int64_t tile_row,
                                     GError **err) {
+  if (tiffl->tiles) {
+    int64_t tile_no;
+    if (!get_tile_no(tiffl, tile_col, tile_row, &tile_no, err)) {
+      return false;
+    }
+    uint64_t tile_size = tiffl->tiles->sizes[tile_no];
+    if (tile_size > INT32_MAX) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Tile too large: %"PRIu64" bytes", tile_size);
+      return false;
+    }
+    g_autofree void *buf = g_malloc(tile_size);
+    if (!tiff_read_raw(tiff, tiffl->tiles->offsets[tile_no],
+                       buf, tile_size, err)) {
+      return false;
+    }
+    *_buf = g_steal_pointer(&buf);
+    *_len = tile_size;
+    return true;
+  }
+
   // set directory
   SET_DIR_OR_FAIL(tiff, tiffl->dir);
 
@@ -350,6 +730,104 @@ bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
   return true;
 }
 
+bool _openslide_tiff_read_jpeg_stream(struct _openslide_tiff_level *tiffl,
+                                      TIFF *tiff,
+                                      void **_buf, int32_t *_len,
+                                      int64_t tile_col, int64_t tile_row,
+                                      GError **err) {
+  *_buf = NULL;
+  *_len = 0;
+  if (!tiffl->tile_read_direct) {
+    return true;
+  }
+
+  g_autofree void *data = NULL;
+  int32_t len;
+  if (!_openslide_tiff_read_tile_data(tiffl, tiff, &data, &len,
+                                      tile_col, tile_row, err)) {
+    return false;
+  }
+
+  // without shared tile locations, the directory is now set
+  void *tables;
+  uint32_t tables_len;
+  if (tiffl->tiles) {
+    tables = tiffl->tiles->jpeg_tables;
+    tables_len = tiffl->tiles->jpeg_tables_len;
+  } else if (!TIFFGetField(tiff, TIFFTAG_JPEGTABLES, &tables_len, &tables)) {
+    tables = NULL;
+    tables_len = 0;
+  }
+
+  uint32_t out_len;
+  uint8_t *out =
+    _openslide_jpeg_make_interchange(data, len, tables, tables_len,
+                                     tiffl->photometric == PHOTOMETRIC_RGB,
+                                     &out_len);
+  if (out && out_len <= INT32_MAX) {
+    *_buf = out;
+    *_len = out_len;
+  } else {
+    g_free(out);
+  }
+  return true;
+}
+
+static int compare_ranges(const void *a, const void *b) {
+  const struct _openslide_file_range *ra = a;
+  const struct _openslide_file_range *rb = b;
+  if (ra->offset != rb->offset) {
+    return ra->offset < rb->offset ? -1 : 1;
+  }
+  return 0;
+}
+
+void _openslide_tiff_prefetch_tile_data(struct _openslide_tiff_level *tiffl,
+                                        TIFF *tiff,
+                                        const struct _openslide_tile_position *tiles,
+                                        int64_t count) {
+  if (!tiffl->tiles || count < 2) {
+    return;
+  }
+  struct _openslide_file *f = get_shared_file(tiff, NULL);
+  if (!f) {
+    return;
+  }
+
+  // sort the tiles' data by offset, then merge ranges separated by small
+  // gaps, since fetching the gap is cheaper than another request
+  g_autofree struct _openslide_file_range *ranges =
+    g_new(struct _openslide_file_range, count);
+  int64_t range_count = 0;
+  for (int64_t i = 0; i < count; i++) {
+    int64_t tile_no;
+    if (!get_tile_no(tiffl, tiles[i].col, tiles[i].row, &tile_no, NULL) ||
+        !tiffl->tiles->sizes[tile_no]) {
+      continue;
+    }
+    ranges[range_count++] = (struct _openslide_file_range) {
+      .offset = tiffl->tiles->offsets[tile_no],
+      .size = tiffl->tiles->sizes[tile_no],
+    };
+  }
+  if (!range_count) {
+    return;
+  }
+  qsort(ranges, range_count, sizeof(*ranges), compare_ranges);
+  int64_t merged = 1;
+  for (int64_t i = 1; i < range_count; i++) {
+    struct _openslide_file_range *prev = &ranges[merged - 1];
+    uint64_t prev_end = prev->offset + prev->size;
+    if (ranges[i].offset <= prev_end + TILE_MERGE_GAP) {
+      prev->size = MAX(prev_end, ranges[i].offset + ranges[i].size) -
+                   prev->offset;
+    } else {
+      ranges[merged++] = ranges[i];
+    }
+  }
+  _openslide_fprefetch(f, ranges, merged);
+}
+
 // sets out-argument to indicate whether the tile data is zero bytes long
 // returns false on error
 bool _openslide_tiff_check_missing_tile(struct _openslide_tiff_level *tiffl,
@@ -357,6 +835,15 @@ bool _openslide_tiff_check_missing_tile(struct _openslide_tiff_level *tiffl,
                                         int64_t tile_col, int64_t tile_row,
                                         bool *is_missing,
                                         GError **err) {
+  if (tiffl->tiles) {
+    int64_t tile_no;
+    if (!get_tile_no(tiffl, tile_col, tile_row, &tile_no, err)) {
+      return false;
+    }
+    *is_missing = tiffl->tiles->sizes[tile_no] == 0;
+    return true;
+  }
+
   // set directory
   if (!_openslide_tiff_set_dir(tiff, tiffl->dir, err)) {
     return false;
@@ -576,18 +1063,8 @@ void _openslide_tiff_error(GError **err, TIFF *tiff, const char *fmt, ...) {
 static tsize_t tiff_do_read(thandle_t th, tdata_t buf, tsize_t size) {
   struct tiff_file_handle *hdl = th;
 
-  // Open the file handle on first use.  cached_tiff_put will close it so it
-  // doesn't stay open across API calls.  Also ensures FD_CLOEXEC is set.
-  if (!hdl->f) {
-    g_autoptr(_openslide_file) f = _openslide_fopen(hdl->tc->filename, NULL);
-    if (!f) {
-      return 0;
-    }
-    // restore file position
-    if (!_openslide_fseek(f, hdl->offset, SEEK_SET, NULL)) {
-      return 0;
-    }
-    hdl->f = g_steal_pointer(&f);
+  if (!tiff_ensure_open(hdl, NULL)) {
+    return 0;
   }
   int64_t rsize = _openslide_fread(hdl->f, buf, size, NULL);
   hdl->offset += rsize;
@@ -711,7 +1188,10 @@ struct _openslide_tiffcache *_openslide_tiffcache_create(const char *filename) {
   struct _openslide_tiffcache *tc = g_new0(struct _openslide_tiffcache, 1);
   tc->filename = g_strdup(filename);
   tc->cache = g_queue_new();
+  tc->tiles = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                    NULL, tiles_free);
   g_mutex_init(&tc->lock);
+  tc->max_idle = g_atomic_int_get(&handle_cache_size);
   return tc;
 }
 
@@ -720,8 +1200,18 @@ struct _openslide_cached_tiff _openslide_tiffcache_get(struct _openslide_tiffcac
   //g_debug("get TIFF");
   g_mutex_lock(&tc->lock);
   tc->outstanding++;
+  if (tc->outstanding > tc->max_idle) {
+    tc->max_idle = MAX(tc->max_idle,
+                       MIN(tc->outstanding, HANDLE_CACHE_GROWTH_MAX));
+  }
   TIFF *tiff = g_queue_pop_head(tc->cache);
+  if (tiff) {
+    tc->reuses++;
+  } else {
+    tc->opens++;
+  }
   g_mutex_unlock(&tc->lock);
+  g_atomic_pointer_add(tiff ? &handle_reuses : &handle_opens, 1);
 
   if (tiff == NULL) {
     //g_debug("create TIFF");
@@ -752,7 +1242,7 @@ void _openslide_cached_tiff_put(struct _openslide_cached_tiff *ct) {
   g_mutex_lock(&tc->lock);
   g_assert(tc->outstanding);
   tc->outstanding--;
-  if (g_queue_get_length(tc->cache) < HANDLE_CACHE_MAX) {
+  if (g_queue_get_length(tc->cache) < (guint) tc->max_idle) {
     tiff_clear_error(hdl);
     if (hdl->f) {
       _openslide_fclose(g_steal_pointer(&hdl->f));
@@ -773,8 +1263,28 @@ void _openslide_tiffcache_destroy(struct _openslide_tiffcache *tc) {
   }
   g_assert(tc->outstanding == 0);
   g_mutex_unlock(&tc->lock);
+  _openslide_performance_warn_once(NULL,
+                                   "TIFF handle cache for %s: %"PRIu64" "
+                                   "opens, %"PRIu64" reuses, %d handles",
+                                   tc->filename, tc->opens, tc->reuses,
+                                   tc->max_idle);
   g_queue_free(tc->cache);
+  g_hash_table_destroy(tc->tiles);
+  if (tc->file) {
+    _openslide_fclose(tc->file);
+  }
   g_mutex_clear(&tc->lock);
   g_free(tc->filename);
   g_free(tc);
 }
+
+void _openslide_tiffcache_set_default_size(int32_t handles) {
+  g_atomic_int_set(&handle_cache_size,
+                   handles > 0 ? MIN(handles, HANDLE_CACHE_GROWTH_MAX)
+                               : HANDLE_CACHE_DEFAULT_SIZE);
+}
+
+void _openslide_tiffcache_get_counters(uint64_t *opens, uint64_t *reuses) {
+  *opens = (gsize) g_atomic_pointer_get(&handle_opens);
+  *reuses = (gsize) g_atomic_pointer_get(&handle_reuses);
+}
@@ -40,11 +40,18 @@ struct _openslide_tiff_level {
   int64_t tiles_across;
   int64_t tiles_down;
 
-  bool tile_read_direct;
+  bool tile_read_direct;  // JPEG
+  bool tile_read_raw;     // uncompressed, LZW, Deflate, or zstd RGB
   gint warned_read_indirect;
   uint16_t photometric;
+  uint16_t compression;
+  uint16_t predictor;
+
+  // tile locations shared by all handles, or NULL to ask libtiff
+  const struct _openslide_tiff_tiles *tiles;
 };
 
+struct _openslide_tiff_tiles;
 struct _openslide_tiffcache;
 
 struct _openslide_cached_tiff {
@@ -69,12 +76,46 @@ bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
                                int64_t tile_col, int64_t tile_row,
                                GError **err);
 
+// decode a JPEG tile at 1/scale size and clip it.  only for levels with
+// the scaled_tiles hint.
+bool _openslide_tiff_read_tile_scaled(struct _openslide_tiff_level *tiffl,
+                                      TIFF *tiff,
+                                      uint32_t *dest,
+                                      int64_t tile_col, int64_t tile_row,
+                                      int32_t scale,
+                                      GError **err);
+
+// decode the w x h rectangle at (x, y) of a JPEG tile, which must lie
+// within the tile.  only for levels with tile_read_direct.
+bool _openslide_tiff_read_tile_region(struct _openslide_tiff_level *tiffl,
+                                      TIFF *tiff,
+                                      uint32_t *dest,
+                                      int64_t tile_col, int64_t tile_row,
+                                      int32_t x, int32_t y,
+                                      int32_t w, int32_t h,
+                                      GError **err);
+
 bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
                                     TIFF *tiff,
                                     void **buf, int32_t *len,
                                     int64_t tile_col, int64_t tile_row,
                                     GError **err);
 
+// read a JPEG tile as a standalone interchange stream.  *buf is NULL if
+// the level's tiles can't be passed through.
+bool _openslide_tiff_read_jpeg_stream(struct _openslide_tiff_level *tiffl,
+                                      TIFF *tiff,
+                                      void **buf, int32_t *len,
+                                      int64_t tile_col, int64_t tile_row,
+                                      GError **err);
+
+// hint that the tiles' compressed data is about to be read, so it can be
+// fetched with merged reads.  only for handles from a tiffcache.
+void _openslide_tiff_prefetch_tile_data(struct _openslide_tiff_level *tiffl,
+                                        TIFF *tiff,
+                                        const struct _openslide_tile_position *tiles,
+                                        int64_t count);
+
 bool _openslide_tiff_clip_tile(struct _openslide_tiff_level *tiffl,
                                uint32_t *tiledata,
                                int64_t tile_col, int64_t tile_row,
@@ -119,6 +160,12 @@ void _openslide_cached_tiff_put(struct _openslide_cached_tiff *ct);
 
 void _openslide_tiffcache_destroy(struct _openslide_tiffcache *tc);
 
+// initial number of idle handles for caches created afterward; 0 to reset
+void _openslide_tiffcache_set_default_size(int32_t handles);
+
+// process-wide handle opens and reuses
+void _openslide_tiffcache_get_counters(uint64_t *opens, uint64_t *reuses);
+
 typedef struct _openslide_tiffcache _openslide_tiffcache;
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(_openslide_tiffcache,
                               _openslide_tiffcache_destroy)
@@ -94,16 +94,10 @@ static void fix_byte_order(void *data, int32_t size, int64_t count,
   }
 }
 
-// only sets *ok on failure
-static uint64_t read_uint(struct _openslide_file *f, int32_t size,
-                          bool big_endian, bool *ok) {
-  g_assert(ok != NULL);
-
+static uint64_t parse_uint(const uint8_t *data, int32_t size,
+                           bool big_endian) {
   uint8_t buf[size];
-  if (!_openslide_fread_exact(f, buf, size, NULL)) {
-    *ok = false;
-    return 0;
-  }
+  memcpy(buf, data, size);
   fix_byte_order(buf, sizeof(buf), 1, big_endian);
   switch (size) {
   case 1: {
@@ -131,6 +125,19 @@ static uint64_t read_uint(struct _openslide_file *f, int32_t size,
   }
 }
 
+// only sets *ok on failure
+static uint64_t read_uint(struct _openslide_file *f, int32_t size,
+                          bool big_endian, bool *ok) {
+  g_assert(ok != NULL);
+
+  uint8_t buf[size];
+  if (!_openslide_fread_exact(f, buf, size, NULL)) {
+    *ok = false;
+    return 0;
+  }
+  return parse_uint(buf, size, big_endian);
+}
+
 static uint32_t get_value_size(uint16_t type, uint64_t *count) {
   switch (type) {
   case TIFF_BYTE:
@@ -313,9 +320,12 @@ static bool set_item_values(struct tiff_item *item,
 static bool populate_item(struct _openslide_tifflike *tl,
                           struct tiff_item *item,
                           GError **err) {
-  g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
-    g_mutex_locker_new(&tl->value_lock);
-  if (item->offset == NO_OFFSET) {
+  // don't hold the lock during I/O, so threads reading different values
+  // don't serialize
+  g_mutex_lock(&tl->value_lock);
+  uint64_t offset = item->offset;
+  g_mutex_unlock(&tl->value_lock);
+  if (offset == NO_OFFSET) {
     return true;
   }
 
@@ -336,17 +346,19 @@ static bool populate_item(struct _openslide_tifflike *tl,
     return false;
   }
 
-  //g_debug("reading tiff value: len: %"PRIu64", offset %"PRIu64, len, item->offset);
-  if (!_openslide_fseek(f, item->offset, SEEK_SET, err)) {
-    g_prefix_error(err, "Couldn't seek to read TIFF value: ");
-    return false;
-  }
-  if (!_openslide_fread_exact(f, buf, len, err)) {
+  //g_debug("reading tiff value: len: %"PRIu64", offset %"PRIu64, len, offset);
+  if (!_openslide_fpread_exact(f, buf, len, offset, err)) {
     g_prefix_error(err, "Couldn't read TIFF value: ");
     return false;
   }
 
   fix_byte_order(buf, value_size, count, tl->big_endian);
+  g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
+    g_mutex_locker_new(&tl->value_lock);
+  if (item->offset == NO_OFFSET) {
+    // another thread got here first
+    return true;
+  }
   if (!set_item_values(item, buf, err)) {
     return false;
   }
@@ -421,23 +433,47 @@ static struct tiff_directory *read_directory(struct _openslide_file *f,
   //  g_debug("dircount: %"PRIu64, dircount);
 
 
+  // read the whole directory at once: the entries, the next directory
+  // offset, and for NDPI the high-order value/offset extensions
+  size_t entry_size = bigtiff ? 20 : 12;
+  size_t next_size = (bigtiff || ndpi) ? 8 : 4;
+  size_t extension_size = ndpi ? 4 : 0;
+  int64_t file_size = _openslide_fsize(f, err);
+  if (file_size == -1) {
+    return NULL;
+  }
+  uint64_t start = off + (bigtiff ? 8 : 2);
+  if (start > (uint64_t) file_size ||
+      dircount > ((uint64_t) file_size - start) /
+                 (entry_size + extension_size)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Directory extends past end of file");
+    return NULL;
+  }
+  size_t len = dircount * (entry_size + extension_size) + next_size;
+  g_autofree uint8_t *buf = g_try_malloc(len);
+  if (!buf) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot allocate TIFF directory");
+    return NULL;
+  }
+  if (!_openslide_fread_exact(f, buf, len, err)) {
+    g_prefix_error(err, "Cannot read directory: ");
+    return NULL;
+  }
+
   // initial checks passed, initialize the directory
   g_autoptr(tiff_directory) d = g_new0(struct tiff_directory, 1);
   d->items = g_hash_table_new_full(g_direct_hash, g_direct_equal,
                                    NULL, tiff_item_destroy);
   d->offset = off;
 
-  // read all directory entries
+  // parse all directory entries
   for (uint64_t n = 0; n < dircount; n++) {
-    uint16_t tag = read_uint(f, 2, big_endian, &ok);
-    uint16_t type = read_uint(f, 2, big_endian, &ok);
-    uint64_t count = read_uint(f, bigtiff ? 8 : 4, big_endian, &ok);
-
-    if (!ok) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Cannot read tag, type, and count");
-      return NULL;
-    }
+    const uint8_t *entry = buf + n * entry_size;
+    uint16_t tag = parse_uint(entry, 2, big_endian);
+    uint16_t type = parse_uint(entry + 2, 2, big_endian);
+    uint64_t count = parse_uint(entry + 4, bigtiff ? 8 : 4, big_endian);
 
     //    g_debug(" tag: %d, type: %d, count: %"PRId64, tag, type, count);
 
@@ -462,14 +498,10 @@ static struct tiff_directory *read_directory(struct _openslide_file *f,
       return NULL;
     }
 
-    // read in the value/offset
-    uint8_t value[(bigtiff || ndpi) ? 8 : 4];
+    // the value/offset
+    uint8_t value[8] = {0};
     size_t read_size = (bigtiff ? 8 : 4);
-
-    if (!_openslide_fread_exact(f, value, read_size, err)) {
-      g_prefix_error(err, "Cannot read value/offset: ");
-      return NULL;
-    }
+    memcpy(value, entry + (bigtiff ? 12 : 8), read_size);
 
     bool is_value = (value_size * count <= read_size);
 
@@ -477,18 +509,7 @@ static struct tiff_directory *read_directory(struct _openslide_file *f,
     // of the IFD
     // append this to the current value/offset
     if (ndpi) {
-      // seek to value/offset extension
-      if (!_openslide_fseek(f, off + (12L * dircount) + (4L * n) + 10L,
-                            SEEK_SET, err)) {
-        g_prefix_error(err, "Cannot seek to value/offset extension: ");
-        return NULL;
-      }
-
-      // read in the value/offset extension
-      if (!_openslide_fread_exact(f, value + 4, 4, err)) {
-        g_prefix_error(err, "Cannot read value/offset extension: ");
-        return NULL;
-      }
+      memcpy(value + 4, buf + dircount * entry_size + next_size + 4 * n, 4);
 
       // if the value/offset contains the value and the extension is
       // nonzero, update the value size and item type
@@ -497,12 +518,6 @@ static struct tiff_directory *read_directory(struct _openslide_file *f,
         value_size = 8;
         item->type = TIFF_LONG8;
       }
-
-      // seek back to the tag's position in the IFD
-      if (!_openslide_fseek(f, off + (12L * (n + 1)) + 2L, SEEK_SET, err)) {
-        g_prefix_error(err, "Seeking back to IFD failed: ");
-        return NULL;
-      }
     }
 
     // does value/offset contain the value?
@@ -527,15 +542,8 @@ static struct tiff_directory *read_directory(struct _openslide_file *f,
     }
   }
 
-  // read the next dir offset
-  uint64_t nextdiroff = read_uint(f, (bigtiff || ndpi) ? 8 : 4,
-                                  big_endian, &ok);
-  if (!ok) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Cannot read next directory offset");
-    return NULL;
-  }
-  *diroff = nextdiroff;
+  // the next dir offset
+  *diroff = parse_uint(buf + dircount * entry_size, next_size, big_endian);
 
   // success
   return g_steal_pointer(&d);
@@ -1108,14 +1116,13 @@ static bool hash_tiff_level(struct _openslide_hash *hash,
   }
 
   // hash raw data of each tile/strip
+  g_autofree struct _openslide_file_range *ranges =
+    g_new(struct _openslide_file_range, count);
   for (int64_t i = 0; i < count; i++) {
-    if (!_openslide_hash_file_part(hash, tl->filename, offsets[i], lengths[i],
-                                   err)) {
-      return false;
-    }
+    ranges[i].offset = offsets[i];
+    ranges[i].size = lengths[i];
   }
-
-  return true;
+  return _openslide_hash_file_parts(hash, tl->filename, ranges, count, err);
 }
 
 bool _openslide_tifflike_init_properties_and_hash(openslide_t *osr,
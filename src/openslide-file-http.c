@@ -0,0 +1,797 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+// Read-only files fetched with HTTP/1.1 range requests, e.g. from
+// S3-compatible object storage via presigned URLs.
+//
+// Every _openslide_file for a URL shares one resource, which holds a block
+// cache and a pool of keep-alive connections.  Reads are rounded out to
+// whole blocks, runs of adjacent missing blocks are coalesced into a
+// single request, and separate runs are fetched in parallel on the worker
+// pool.  Large reads bypass the cache and are split into parallel
+// requests.  A few recently closed resources are kept, since format
+// detection and libtiff reopen the same file many times.
+
+#define BLOCK_SIZE (256 << 10)
+#define MAX_BLOCKS 64               // per resource
+#define LARGE_READ (4 * BLOCK_SIZE)
+#define LARGE_READ_CHUNK (1 << 20)
+#define MAX_IDLE_CONNECTIONS 8      // per resource
+#define MAX_IDLE_RESOURCES 4
+#define MAX_REDIRECTS 5
+#define TIMEOUT_SECONDS 60
+
+struct http_conn {
+  GSocketConnection *conn;
+  GDataInputStream *in;
+};
+
+struct http_block {
+  GList link;
+  int64_t index;
+  size_t len;
+  uint8_t data[];
+};
+
+struct http_resource {
+  char *key;        // URL as opened
+  char *url;        // after redirects
+  bool tls;
+  char *authority;
+  char *target;
+  int64_t size;
+  int refcount;     // protected by registry_lock
+
+  GMutex lock;
+  GQueue conns;     // idle struct http_conn
+  GHashTable *blocks;
+  GQueue lru;       // struct http_block, most recent first
+};
+
+struct http_response {
+  int status;
+  int64_t content_length;
+  int64_t range_start;
+  int64_t range_total;
+  bool close;
+  bool chunked;
+  char *location;
+};
+
+static GMutex registry_lock;
+static GHashTable *registry;     // key -> struct http_resource
+static GQueue idle_resources;
+
+static void conn_free(struct http_conn *c) {
+  if (c->in) {
+    g_object_unref(c->in);
+  }
+  if (c->conn) {
+    g_object_unref(c->conn);
+  }
+  g_free(c);
+}
+
+static void response_clear(struct http_response *resp) {
+  g_free(resp->location);
+}
+
+static void block_free(void *data) {
+  g_free(data);
+}
+
+static void resource_free(struct http_resource *res) {
+  struct http_conn *c;
+  while ((c = g_queue_pop_head(&res->conns)) != NULL) {
+    conn_free(c);
+  }
+  if (res->blocks) {
+    g_hash_table_destroy(res->blocks);
+  }
+  g_mutex_clear(&res->lock);
+  g_free(res->key);
+  g_free(res->url);
+  g_free(res->authority);
+  g_free(res->target);
+  g_free(res);
+}
+
+bool _openslide_http_is_url(const char *path) {
+  return !g_ascii_strncasecmp(path, "http://", 7) ||
+         !g_ascii_strncasecmp(path, "https://", 8);
+}
+
+static bool parse_url(struct http_resource *res, const char *url,
+                      GError **err) {
+  const char *rest;
+  if (!g_ascii_strncasecmp(url, "http://", 7)) {
+    res->tls = false;
+    rest = url + 7;
+  } else if (!g_ascii_strncasecmp(url, "https://", 8)) {
+    res->tls = true;
+    rest = url + 8;
+  } else {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Unsupported URL: %s", url);
+    return false;
+  }
+  size_t authority_len = strcspn(rest, "/?#");
+  if (!authority_len) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "No host in URL: %s", url);
+    return false;
+  }
+  g_autofree char *authority = g_strndup(rest, authority_len);
+  if (strchr(authority, '@')) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Credentials in URLs are not supported: %s", url);
+    return false;
+  }
+  const char *target = rest + authority_len;
+  size_t target_len = strcspn(target, "#");
+  g_free(res->authority);
+  g_free(res->target);
+  res->authority = g_steal_pointer(&authority);
+  if (target[0] == '/') {
+    res->target = g_strndup(target, target_len);
+  } else {
+    g_autofree char *query = g_strndup(target, target_len);
+    res->target = g_strdup_printf("/%s", query);
+  }
+  g_free(res->url);
+  res->url = g_strdup(url);
+  return true;
+}
+
+// resolve a redirect target against the current URL, per RFC 3986
+// section 5.2
+static char *resolve_location(struct http_resource *res,
+                              const char *location) {
+  const char *scheme = res->tls ? "https" : "http";
+  g_autofree char *location_scheme = g_uri_parse_scheme(location);
+  if (location_scheme) {
+    return g_strdup(location);
+  }
+  if (g_str_has_prefix(location, "//")) {
+    return g_strdup_printf("%s:%s", scheme, location);
+  }
+  if (location[0] == '/') {
+    return g_strdup_printf("%s://%s%s", scheme, res->authority, location);
+  }
+
+  // relative to the directory of the current target
+  size_t path_len = strcspn(res->target, "?");
+  if (!location[0] || location[0] == '?' || location[0] == '#') {
+    return g_strdup_printf("%s://%s%.*s%s", scheme, res->authority,
+                           (int) path_len, res->target, location);
+  }
+  size_t dir_len = g_strrstr_len(res->target, path_len, "/") - res->target;
+  size_t ref_len = strcspn(location, "?#");
+  g_autofree char *merged = g_strdup_printf("%.*s/%.*s",
+                                            (int) dir_len, res->target,
+                                            (int) ref_len, location);
+  // remove dot segments
+  g_auto(GStrv) segments = g_strsplit(merged + 1, "/", -1);
+  guint count = g_strv_length(segments);
+  g_autoptr(GPtrArray) kept = g_ptr_array_new();
+  for (guint i = 0; i < count; i++) {
+    const char *seg = segments[i];
+    if (strcmp(seg, ".") && strcmp(seg, "..")) {
+      g_ptr_array_add(kept, (void *) seg);
+      continue;
+    }
+    if (!strcmp(seg, "..") && kept->len) {
+      g_ptr_array_remove_index(kept, kept->len - 1);
+    }
+    if (i == count - 1) {
+      // "a/.." is the directory "/"
+      g_ptr_array_add(kept, "");
+    }
+  }
+  GString *url = g_string_new(NULL);
+  g_string_append_printf(url, "%s://%s", scheme, res->authority);
+  for (guint i = 0; i < kept->len; i++) {
+    g_string_append_printf(url, "/%s", (const char *) kept->pdata[i]);
+  }
+  if (!kept->len) {
+    g_string_append_c(url, '/');
+  }
+  g_string_append(url, location + ref_len);
+  return g_string_free(url, false);
+}
+
+static struct http_conn *conn_new(struct http_resource *res, GError **err) {
+  g_autoptr(GSocketConnectable) addr =
+    g_network_address_parse(res->authority, res->tls ? 443 : 80, err);
+  if (!addr) {
+    g_prefix_error(err, "Couldn't parse host %s: ", res->authority);
+    return NULL;
+  }
+  g_autoptr(GSocketClient) client = g_socket_client_new();
+  g_socket_client_set_tls(client, res->tls);
+  g_socket_client_set_timeout(client, TIMEOUT_SECONDS);
+  GSocketConnection *conn = g_socket_client_connect(client, addr, NULL, err);
+  if (!conn) {
+    g_prefix_error(err, "Couldn't connect to %s: ", res->authority);
+    return NULL;
+  }
+  struct http_conn *c = g_new0(struct http_conn, 1);
+  c->conn = conn;
+  c->in = g_data_input_stream_new(
+    g_io_stream_get_input_stream(G_IO_STREAM(conn)));
+  g_data_input_stream_set_newline_type(c->in,
+                                       G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+  g_buffered_input_stream_set_buffer_size(G_BUFFERED_INPUT_STREAM(c->in),
+                                          64 << 10);
+  return c;
+}
+
+static struct http_conn *conn_get(struct http_resource *res, bool *reused,
+                                  GError **err) {
+  g_mutex_lock(&res->lock);
+  struct http_conn *c = g_queue_pop_head(&res->conns);
+  g_mutex_unlock(&res->lock);
+  *reused = c != NULL;
+  if (c) {
+    return c;
+  }
+  return conn_new(res, err);
+}
+
+static void conn_put(struct http_resource *res, struct http_conn *c) {
+  g_mutex_lock(&res->lock);
+  if (res->conns.length < MAX_IDLE_CONNECTIONS) {
+    g_queue_push_head(&res->conns, c);
+    c = NULL;
+  }
+  g_mutex_unlock(&res->lock);
+  if (c) {
+    conn_free(c);
+  }
+}
+
+static bool send_request(struct http_resource *res, struct http_conn *c,
+                         int64_t start, int64_t end, GError **err) {
+  g_autofree char *req =
+    g_strdup_printf("GET %s HTTP/1.1\r\n"
+                    "Host: %s\r\n"
+                    "Range: bytes=%"PRId64"-%"PRId64"\r\n"
+                    "User-Agent: OpenSlide/" SUFFIXED_VERSION "\r\n"
+                    "Accept-Encoding: identity\r\n"
+                    "\r\n",
+                    res->target, res->authority, start, end);
+  GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(c->conn));
+  return g_output_stream_write_all(out, req, strlen(req), NULL, NULL, err);
+}
+
+static bool header_is(const char *line, const char *name,
+                      const char **value) {
+  size_t len = strlen(name);
+  if (g_ascii_strncasecmp(line, name, len) || line[len] != ':') {
+    return false;
+  }
+  *value = line + len + 1;
+  while (**value == ' ' || **value == '\t') {
+    (*value)++;
+  }
+  return true;
+}
+
+// "bytes a-b/total" or "bytes */total"; total may be "*"
+static void parse_content_range(const char *value,
+                                struct http_response *resp) {
+  if (g_ascii_strncasecmp(value, "bytes ", 6)) {
+    return;
+  }
+  value += 6;
+  char *end;
+  if (g_ascii_isdigit(*value)) {
+    resp->range_start = g_ascii_strtoll(value, &end, 10);
+  } else {
+    end = (char *) value;
+  }
+  const char *slash = strchr(end, '/');
+  if (slash && g_ascii_isdigit(slash[1])) {
+    resp->range_total = g_ascii_strtoll(slash + 1, NULL, 10);
+  }
+}
+
+static bool read_response_head(struct http_conn *c,
+                               struct http_response *resp,
+                               GError **err) {
+  *resp = (struct http_response) {
+    .content_length = -1,
+    .range_start = -1,
+    .range_total = -1,
+  };
+
+  GError *tmp_err = NULL;
+  g_autofree char *status =
+    g_data_input_stream_read_line(c->in, NULL, NULL, &tmp_err);
+  if (!status) {
+    if (tmp_err) {
+      g_propagate_error(err, tmp_err);
+    } else {
+      g_set_error(err, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                  "Connection closed by server");
+    }
+    return false;
+  }
+  int minor;
+  if (sscanf(status, "HTTP/1.%d %d", &minor, &resp->status) != 2) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Bad HTTP status line: %s", status);
+    return false;
+  }
+  resp->close = minor < 1;
+
+  while (true) {
+    g_autofree char *line =
+      g_data_input_stream_read_line(c->in, NULL, NULL, &tmp_err);
+    if (!line) {
+      if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+      } else {
+        g_set_error(err, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                    "Connection closed in HTTP headers");
+      }
+      return false;
+    }
+    if (!line[0]) {
+      break;
+    }
+    const char *value;
+    if (header_is(line, "Content-Length", &value)) {
+      resp->content_length = g_ascii_strtoll(value, NULL, 10);
+    } else if (header_is(line, "Content-Range", &value)) {
+      parse_content_range(value, resp);
+    } else if (header_is(line, "Connection", &value)) {
+      if (!g_ascii_strcasecmp(value, "close")) {
+        resp->close = true;
+      }
+    } else if (header_is(line, "Transfer-Encoding", &value)) {
+      if (g_ascii_strcasecmp(value, "identity")) {
+        resp->chunked = true;
+      }
+    } else if (header_is(line, "Location", &value)) {
+      g_free(resp->location);
+      resp->location = g_strdup(value);
+    }
+  }
+  return true;
+}
+
+static bool read_body(struct http_conn *c, void *buf, size_t len,
+                      GError **err) {
+  gsize count;
+  if (!g_input_stream_read_all(G_INPUT_STREAM(c->in), buf, len, &count,
+                               NULL, err)) {
+    return false;
+  }
+  if (count < len) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Short HTTP response body: %"PRIu64" < %"PRIu64,
+                (uint64_t) count, (uint64_t) len);
+    return false;
+  }
+  return true;
+}
+
+// Fetch [offset, offset + len) into buf.  The range must be within the
+// file.  A stale keep-alive connection is retried once on a fresh one.
+static bool get_range(struct http_resource *res, void *buf,
+                      int64_t offset, size_t len, GError **err) {
+  for (int attempt = 0; ; attempt++) {
+    GError *tmp_err = NULL;
+    bool reused;
+    struct http_conn *c = conn_get(res, &reused, err);
+    if (!c) {
+      return false;
+    }
+    struct http_response resp = {0};
+    if (!send_request(res, c, offset, offset + len - 1, &tmp_err) ||
+        !read_response_head(c, &resp, &tmp_err)) {
+      response_clear(&resp);
+      conn_free(c);
+      if (reused && attempt == 0) {
+        g_clear_error(&tmp_err);
+        continue;
+      }
+      g_propagate_prefixed_error(err, tmp_err, "Couldn't read %s: ",
+                                 res->url);
+      return false;
+    }
+
+    bool ok = false;
+    if (resp.status != 206) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't read %s: HTTP status %d", res->url, resp.status);
+    } else if (resp.chunked || resp.content_length != (int64_t) len ||
+               resp.range_start != offset) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't read %s: unexpected response to range request",
+                  res->url);
+    } else if (!read_body(c, buf, len, err)) {
+      g_prefix_error(err, "Couldn't read %s: ", res->url);
+    } else {
+      ok = true;
+    }
+    if (ok && !resp.close) {
+      conn_put(res, c);
+    } else {
+      conn_free(c);
+    }
+    response_clear(&resp);
+    return ok;
+  }
+}
+
+static void cache_block(struct http_resource *res, int64_t index,
+                        const void *data, size_t len) {
+  struct http_block *blk = g_malloc(sizeof(*blk) + len);
+  memset(&blk->link, 0, sizeof(blk->link));
+  blk->link.data = blk;
+  blk->index = index;
+  blk->len = len;
+  memcpy(blk->data, data, len);
+
+  g_mutex_lock(&res->lock);
+  if (g_hash_table_contains(res->blocks, &index)) {
+    // another thread beat us to it
+    g_mutex_unlock(&res->lock);
+    g_free(blk);
+    return;
+  }
+  g_hash_table_insert(res->blocks, &blk->index, blk);
+  g_queue_push_head_link(&res->lru, &blk->link);
+  while (res->lru.length > MAX_BLOCKS) {
+    struct http_block *old = g_queue_pop_tail_link(&res->lru)->data;
+    g_hash_table_remove(res->blocks, &old->index);
+  }
+  g_mutex_unlock(&res->lock);
+}
+
+// copy the overlap of the source range into the destination range
+static void copy_overlap(void *dst, int64_t dst_offset, size_t dst_len,
+                         const void *src, int64_t src_offset,
+                         size_t src_len) {
+  int64_t start = MAX(dst_offset, src_offset);
+  int64_t end = MIN(dst_offset + (int64_t) dst_len,
+                    src_offset + (int64_t) src_len);
+  if (start < end) {
+    memcpy((uint8_t *) dst + (start - dst_offset),
+           (const uint8_t *) src + (start - src_offset), end - start);
+  }
+}
+
+struct block_run {
+  int64_t first;
+  int64_t count;
+};
+
+struct read_ctx {
+  struct http_resource *res;
+  void *buf;
+  int64_t offset;
+  size_t size;
+  struct block_run *runs;
+};
+
+static bool fetch_run(int64_t i, void *arg, GError **err) {
+  struct read_ctx *ctx = arg;
+  struct http_resource *res = ctx->res;
+  struct block_run *run = &ctx->runs[i];
+
+  if (!_openslide_worker_check_cancelled(err)) {
+    return false;
+  }
+  int64_t start = run->first * BLOCK_SIZE;
+  int64_t end = MIN(start + run->count * BLOCK_SIZE, res->size);
+  g_autofree uint8_t *data = g_malloc(end - start);
+  if (!get_range(res, data, start, end - start, err)) {
+    return false;
+  }
+  if (ctx->buf) {
+    copy_overlap(ctx->buf, ctx->offset, ctx->size, data, start, end - start);
+  }
+  for (int64_t j = 0; j < run->count; j++) {
+    int64_t block_start = start + j * BLOCK_SIZE;
+    cache_block(res, run->first + j, data + j * BLOCK_SIZE,
+                MIN(BLOCK_SIZE, end - block_start));
+  }
+  return true;
+}
+
+static bool fetch_chunk(int64_t i, void *arg, GError **err) {
+  struct read_ctx *ctx = arg;
+
+  if (!_openslide_worker_check_cancelled(err)) {
+    return false;
+  }
+  size_t start = i * LARGE_READ_CHUNK;
+  size_t len = MIN((size_t) LARGE_READ_CHUNK, ctx->size - start);
+  return get_range(ctx->res, (uint8_t *) ctx->buf + start,
+                   ctx->offset + start, len, err);
+}
+
+static size_t http_read_at(void *handle, void *buf, size_t size,
+                           int64_t offset, GError **err) {
+  struct http_resource *res = handle;
+  if (offset < 0 || offset >= res->size || !size) {
+    return 0;
+  }
+  size = MIN((uint64_t) size, (uint64_t) (res->size - offset));
+  struct read_ctx ctx = {
+    .res = res,
+    .buf = buf,
+    .offset = offset,
+    .size = size,
+  };
+
+  if (size > LARGE_READ) {
+    int64_t chunks = (size + LARGE_READ_CHUNK - 1) / LARGE_READ_CHUNK;
+    if (!_openslide_worker_run_batch(chunks, fetch_chunk, &ctx, err)) {
+      return 0;
+    }
+    return size;
+  }
+
+  // copy cached blocks and collect runs of missing ones
+  int64_t first = offset / BLOCK_SIZE;
+  int64_t last = (offset + size - 1) / BLOCK_SIZE;
+  g_autofree struct block_run *runs =
+    g_new0(struct block_run, last - first + 1);
+  int64_t run_count = 0;
+  g_mutex_lock(&res->lock);
+  for (int64_t index = first; index <= last; index++) {
+    struct http_block *blk = g_hash_table_lookup(res->blocks, &index);
+    if (blk) {
+      copy_overlap(buf, offset, size, blk->data, index * BLOCK_SIZE,
+                   blk->len);
+      g_queue_unlink(&res->lru, &blk->link);
+      g_queue_push_head_link(&res->lru, &blk->link);
+    } else if (run_count &&
+               runs[run_count - 1].first + runs[run_count - 1].count ==
+               index) {
+      runs[run_count - 1].count++;
+    } else {
+      runs[run_count++] = (struct block_run) {index, 1};
+    }
+  }
+  g_mutex_unlock(&res->lock);
+
+  ctx.runs = runs;
+  if (!_openslide_worker_run_batch(run_count, fetch_run, &ctx, err)) {
+    return 0;
+  }
+  return size;
+}
+
+// fetch the missing blocks of the ranges into the cache, up to half the
+// cache so the blocks don't evict each other before they're read
+static void http_prefetch(void *handle,
+                          const struct _openslide_file_range *ranges,
+                          int64_t count) {
+  struct http_resource *res = handle;
+  g_autoptr(GArray) runs = g_array_new(false, false,
+                                       sizeof(struct block_run));
+  int64_t missing = 0;
+  int64_t next = 0;  // first block not yet considered
+  g_mutex_lock(&res->lock);
+  for (int64_t i = 0; i < count && missing < MAX_BLOCKS / 2; i++) {
+    const struct _openslide_file_range *r = &ranges[i];
+    if (!r->size || r->offset >= (uint64_t) res->size) {
+      continue;
+    }
+    uint64_t end = MIN(r->offset + r->size, (uint64_t) res->size);
+    int64_t first = MAX((int64_t) (r->offset / BLOCK_SIZE), next);
+    int64_t last = (end - 1) / BLOCK_SIZE;
+    for (int64_t index = first;
+         index <= last && missing < MAX_BLOCKS / 2;
+         index++) {
+      if (g_hash_table_contains(res->blocks, &index)) {
+        continue;
+      }
+      struct block_run *run = runs->len ?
+        &g_array_index(runs, struct block_run, runs->len - 1) : NULL;
+      if (run && run->first + run->count == index) {
+        run->count++;
+      } else {
+        struct block_run new_run = {index, 1};
+        g_array_append_val(runs, new_run);
+      }
+      missing++;
+    }
+    next = MAX(next, last + 1);
+  }
+  g_mutex_unlock(&res->lock);
+
+  struct read_ctx ctx = {
+    .res = res,
+    .runs = (struct block_run *) runs->data,
+  };
+  g_autoptr(GError) tmp_err = NULL;
+  // only a hint; the reads will report errors
+  _openslide_worker_run_batch(runs->len, fetch_run, &ctx, &tmp_err);
+}
+
+static int64_t http_size(void *handle) {
+  struct http_resource *res = handle;
+  return res->size;
+}
+
+static void resource_unref(struct http_resource *res) {
+  struct http_resource *evicted = NULL;
+  g_mutex_lock(&registry_lock);
+  if (--res->refcount == 0) {
+    g_queue_push_head(&idle_resources, res);
+    if (idle_resources.length > MAX_IDLE_RESOURCES) {
+      evicted = g_queue_pop_tail(&idle_resources);
+      g_hash_table_remove(registry, evicted->key);
+    }
+  }
+  g_mutex_unlock(&registry_lock);
+  if (evicted) {
+    resource_free(evicted);
+  }
+}
+
+static void http_close(void *handle) {
+  resource_unref(handle);
+}
+
+static const struct _openslide_file_ops http_ops = {
+  .read_at = http_read_at,
+  .size = http_size,
+  .close = http_close,
+  .prefetch = http_prefetch,
+};
+
+// follow redirects, learn the file size, and cache the first block
+static bool resource_connect(struct http_resource *res, GError **err) {
+  if (!parse_url(res, res->key, err)) {
+    return false;
+  }
+  for (int redirects = 0; ; redirects++) {
+    struct http_conn *c = conn_new(res, err);
+    if (!c) {
+      return false;
+    }
+    struct http_response resp = {0};
+    if (!send_request(res, c, 0, BLOCK_SIZE - 1, err) ||
+        !read_response_head(c, &resp, err)) {
+      response_clear(&resp);
+      conn_free(c);
+      g_prefix_error(err, "Couldn't open %s: ", res->url);
+      return false;
+    }
+
+    if (resp.status >= 300 && resp.status < 400 && resp.location) {
+      conn_free(c);
+      if (redirects >= MAX_REDIRECTS) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Couldn't open %s: too many redirects", res->key);
+        response_clear(&resp);
+        return false;
+      }
+      g_autofree char *location = resolve_location(res, resp.location);
+      response_clear(&resp);
+      if (!parse_url(res, location, err)) {
+        g_prefix_error(err, "Couldn't open %s: ", res->key);
+        return false;
+      }
+      continue;
+    }
+
+    bool ok = false;
+    if (resp.status == 416 && resp.range_total == 0) {
+      // empty file
+      res->size = 0;
+      resp.close = true;
+      ok = true;
+    } else if (resp.status == 404) {
+      g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                  "Couldn't open %s: HTTP status 404", res->url);
+    } else if (resp.status == 200) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't open %s: server doesn't support range requests",
+                  res->url);
+    } else if (resp.status != 206) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't open %s: HTTP status %d", res->url, resp.status);
+    } else if (resp.chunked || resp.range_start != 0 ||
+               resp.range_total < 0 ||
+               resp.content_length != MIN(resp.range_total, BLOCK_SIZE)) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't open %s: unexpected response to range request",
+                  res->url);
+    } else {
+      res->size = resp.range_total;
+      g_autofree uint8_t *data = g_malloc(resp.content_length);
+      if (read_body(c, data, resp.content_length, err)) {
+        cache_block(res, 0, data, resp.content_length);
+        ok = true;
+      } else {
+        g_prefix_error(err, "Couldn't open %s: ", res->url);
+      }
+    }
+    if (ok && !resp.close) {
+      conn_put(res, c);
+    } else {
+      conn_free(c);
+    }
+    response_clear(&resp);
+    return ok;
+  }
+}
+
+struct _openslide_file *_openslide_http_fopen(const char *url,
+                                              GError **err) {
+  g_mutex_lock(&registry_lock);
+  if (!registry) {
+    registry = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+  struct http_resource *res = g_hash_table_lookup(registry, url);
+  if (res) {
+    if (res->refcount++ == 0) {
+      g_queue_remove(&idle_resources, res);
+    }
+    g_mutex_unlock(&registry_lock);
+    return _openslide_fopen_ops(url, &http_ops, res);
+  }
+  g_mutex_unlock(&registry_lock);
+
+  // connect without holding the registry lock
+  res = g_new0(struct http_resource, 1);
+  res->key = g_strdup(url);
+  res->refcount = 1;
+  g_mutex_init(&res->lock);
+  res->blocks = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                      NULL, block_free);
+  if (!resource_connect(res, err)) {
+    resource_free(res);
+    return NULL;
+  }
+
+  g_mutex_lock(&registry_lock);
+  struct http_resource *existing = g_hash_table_lookup(registry, url);
+  if (existing) {
+    // another thread opened it concurrently
+    if (existing->refcount++ == 0) {
+      g_queue_remove(&idle_resources, existing);
+    }
+    g_mutex_unlock(&registry_lock);
+    resource_free(res);
+    return _openslide_fopen_ops(url, &http_ops, existing);
+  }
+  g_hash_table_insert(registry, res->key, res);
+  g_mutex_unlock(&registry_lock);
+  return _openslide_fopen_ops(url, &http_ops, res);
+}
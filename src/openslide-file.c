@@ -30,16 +30,45 @@
 #include <errno.h>
 #include <glib.h>
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
 #include <unistd.h>
 #include <fcntl.h>
 #endif
 
+// Stream reads of local files go through a small per-file cache of
+// aligned blocks, so metadata parsers doing many tiny reads and seeks
+// issue a handful of large reads instead.  Positional reads don't use the
+// cache, since they can be made from several threads at once.
+#define BLOCK_SIZE (64 << 10)
+#define MAX_BLOCKS 8
+
+struct block {
+  int64_t index;     // -1 if unused
+  uint64_t last_use;
+  size_t len;        // < BLOCK_SIZE at EOF
+  uint8_t *data;
+};
+
 struct _openslide_file {
   FILE *fp;
   char *path;
+  GMappedFile *map;  // or NULL; see _openslide_fopen_mapped()
+
+  // non-local files have ops instead of fp
+  const struct _openslide_file_ops *ops;
+  void *handle;
+
+  int64_t pos;       // stream position
+  int64_t size;      // -1 until known
+  struct block *blocks;  // lazily allocated, MAX_BLOCKS
+  uint64_t clock;
 };
 
+static gint mapping_enabled;  // atomic ops only
+
 struct _openslide_dir {
   GDir *dir;
   char *path;
@@ -92,8 +121,23 @@ static FILE *do_fopen(const char *path, const char *mode, GError **err) {
   return f;
 }
 
+struct _openslide_file *_openslide_fopen_ops(const char *path,
+                                            const struct _openslide_file_ops *ops,
+                                            void *handle) {
+  struct _openslide_file *file = g_new0(struct _openslide_file, 1);
+  file->path = g_strdup(path);
+  file->ops = ops;
+  file->handle = handle;
+  file->size = -1;
+  return file;
+}
+
 struct _openslide_file *_openslide_fopen(const char *path, GError **err)
 {
+  if (_openslide_http_is_url(path)) {
+    return _openslide_http_fopen(path, err);
+  }
+
   g_autoptr(FILE) f = do_fopen(path, "rb" FOPEN_CLOEXEC_FLAG, err);
   if (f == NULL) {
     return NULL;
@@ -122,28 +166,92 @@ struct _openslide_file *_openslide_fopen(const char *path, GError **err)
   struct _openslide_file *file = g_new0(struct _openslide_file, 1);
   file->fp = g_steal_pointer(&f);
   file->path = g_strdup(path);
+  file->size = -1;
   return file;
 }
 
+static struct block *get_block(struct _openslide_file *file, int64_t index,
+                               GError **err) {
+  if (!file->blocks) {
+    file->blocks = g_new0(struct block, MAX_BLOCKS);
+    for (int i = 0; i < MAX_BLOCKS; i++) {
+      file->blocks[i].index = -1;
+    }
+  }
+  struct block *victim = &file->blocks[0];
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    struct block *b = &file->blocks[i];
+    if (b->index == index) {
+      b->last_use = ++file->clock;
+      return b;
+    }
+    if (b->last_use < victim->last_use) {
+      victim = b;
+    }
+  }
+
+  if (!victim->data) {
+    victim->data = g_malloc(BLOCK_SIZE);
+  }
+  victim->index = -1;
+  GError *tmp_err = NULL;
+  victim->len = _openslide_fpread(file, victim->data, BLOCK_SIZE,
+                                  index * BLOCK_SIZE, &tmp_err);
+  if (tmp_err) {
+    g_propagate_error(err, tmp_err);
+    return NULL;
+  }
+  victim->index = index;
+  victim->last_use = ++file->clock;
+  return victim;
+}
+
 // returns 0/NULL on EOF and 0/non-NULL on I/O error
-size_t _openslide_fread(struct _openslide_file *file, void *buf, size_t size,
-                        GError **err) {
-  char *bufp = buf;
+static size_t read_cached(struct _openslide_file *file, void *buf,
+                          size_t size, int64_t offset, GError **err) {
+  if (size >= BLOCK_SIZE || file->map) {
+    // nothing to gain
+    return _openslide_fpread(file, buf, size, offset, err);
+  }
+  uint8_t *bufp = buf;
   size_t total = 0;
   while (total < size) {
-    size_t count = fread(bufp + total, 1, size - total, file->fp);  // ci-allow
-    if (count == 0) {
+    int64_t pos = offset + total;
+    GError *tmp_err = NULL;
+    struct block *b = get_block(file, pos / BLOCK_SIZE, &tmp_err);
+    if (!b) {
+      if (total == 0) {
+        g_propagate_error(err, tmp_err);
+      } else {
+        g_clear_error(&tmp_err);
+      }
+      break;
+    }
+    size_t block_offset = pos % BLOCK_SIZE;
+    if (block_offset >= b->len) {
+      // EOF
       break;
     }
+    size_t count = MIN(size - total, b->len - block_offset);
+    memcpy(bufp + total, b->data + block_offset, count);
     total += count;
   }
-  if (total == 0 && ferror(file->fp)) {
-    g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_IO,
-                "I/O error reading file %s", file->path);
-  }
   return total;
 }
 
+// returns 0/NULL on EOF and 0/non-NULL on I/O error
+size_t _openslide_fread(struct _openslide_file *file, void *buf, size_t size,
+                        GError **err) {
+  size_t count;
+  if (file->ops) {
+    count = _openslide_fpread(file, buf, size, file->pos, err);
+  } else {
+    count = read_cached(file, buf, size, file->pos, err);
+  }
+  file->pos += count;
+  return count;
+}
+
 bool _openslide_fread_exact(struct _openslide_file *file,
                             void *buf, size_t size, GError **err) {
   GError *tmp_err = NULL;
@@ -160,52 +268,218 @@ bool _openslide_fread_exact(struct _openslide_file *file,
   return true;
 }
 
-bool _openslide_fseek(struct _openslide_file *file, off_t offset, int whence,
-                      GError **err) {
-  if (fseeko(file->fp, offset, whence)) {  // ci-allow
-    io_error(err, "Couldn't seek file %s", file->path);
+void _openslide_set_file_mapping(bool enabled) {
+  g_atomic_int_set(&mapping_enabled, enabled);
+}
+
+// Map the whole file for positional reads and zero-copy access, if mapping
+// is enabled.  If mapping is disabled or fails, this is _openslide_fopen().
+struct _openslide_file *_openslide_fopen_mapped(const char *path,
+                                                GError **err) {
+  g_autoptr(_openslide_file) file = _openslide_fopen(path, err);
+  if (file == NULL) {
+    return NULL;
+  }
+  if (file->fp && g_atomic_int_get(&mapping_enabled)) {
+    // failure isn't fatal; e.g. empty files can't be mapped
+    file->map = g_mapped_file_new(path, false, NULL);
+  }
+  return g_steal_pointer(&file);
+}
+
+// returns a pointer to the range for the lifetime of the file, or NULL if
+// the file isn't mapped or the range is out of bounds
+const void *_openslide_fmap_range(struct _openslide_file *file,
+                                  off_t offset, size_t size) {
+  if (!file->map || offset < 0) {
+    return NULL;
+  }
+  uint64_t map_size = g_mapped_file_get_length(file->map);
+  if ((uint64_t) offset > map_size || size > map_size - offset) {
+    return NULL;
+  }
+  return g_mapped_file_get_contents(file->map) + offset;
+}
+
+static size_t fpread(struct _openslide_file *file, void *buf, size_t size,
+                     off_t offset, GError **err) {
+  if (file->ops) {
+    return file->ops->read_at(file->handle, buf, size, offset, err);
+  }
+  if (file->map) {
+    uint64_t map_size = g_mapped_file_get_length(file->map);
+    if (offset < 0 || (uint64_t) offset >= map_size) {
+      return 0;
+    }
+    size_t count = MIN(size, map_size - offset);
+    memcpy(buf, g_mapped_file_get_contents(file->map) + offset, count);
+    return count;
+  }
+
+  char *bufp = buf;
+  size_t total = 0;
+#ifdef _WIN32
+  HANDLE h = (HANDLE) _get_osfhandle(_fileno(file->fp));
+  while (total < size) {
+    uint64_t pos = offset + total;
+    OVERLAPPED ov = {
+      .Offset = (DWORD) pos,
+      .OffsetHigh = (DWORD) (pos >> 32),
+    };
+    DWORD count;
+    if (!ReadFile(h, bufp + total, (DWORD) MIN(size - total, 1 << 30),
+                  &count, &ov)) {
+      if (GetLastError() != ERROR_HANDLE_EOF && total == 0) {
+        g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_IO,
+                    "I/O error reading file %s", file->path);
+      }
+      break;
+    }
+    if (count == 0) {
+      break;
+    }
+    total += count;
+  }
+#else
+  int fd = fileno(file->fp);
+  while (total < size) {
+    ssize_t count = pread(fd, bufp + total, size - total, offset + total);
+    if (count == -1 && errno == EINTR) {
+      continue;
+    }
+    if (count == -1 && total == 0) {
+      io_error(err, "I/O error reading file %s", file->path);
+    }
+    if (count <= 0) {
+      break;
+    }
+    total += count;
+  }
+#endif
+  return total;
+}
+
+// read at an absolute offset without using the stream position, so
+// threads can share the file
+// returns 0/NULL on EOF and 0/non-NULL on I/O error
+size_t _openslide_fpread(struct _openslide_file *file, void *buf, size_t size,
+                         off_t offset, GError **err) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_IO);
+  size_t count = fpread(file, buf, size, offset, err);
+  _openslide_phase_end(_OPENSLIDE_PHASE_IO, phase, count);
+  return count;
+}
+
+bool _openslide_fpread_exact(struct _openslide_file *file,
+                             void *buf, size_t size, off_t offset,
+                             GError **err) {
+  GError *tmp_err = NULL;
+  size_t count = _openslide_fpread(file, buf, size, offset, &tmp_err);
+  if (tmp_err) {
+    g_propagate_error(err, tmp_err);
+    return false;
+  } else if (count < size) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Short read of file %s at %"PRId64": %"PRIu64" < %"PRIu64,
+                file->path, (int64_t) offset, (uint64_t) count,
+                (uint64_t) size);
     return false;
   }
   return true;
 }
 
-off_t _openslide_ftell(struct _openslide_file *file, GError **err) {
-  off_t ret = ftello(file->fp);  // ci-allow
-  if (ret == -1) {
-    io_error(err, "Couldn't get offset of %s", file->path);
+// Remote files fetch the ranges into their cache.  Local files ask the
+// kernel to read the ranges ahead, which helps network filesystems.
+void _openslide_fprefetch(struct _openslide_file *file,
+                          const struct _openslide_file_range *ranges,
+                          int64_t count) {
+  if (file->ops) {
+    if (file->ops->prefetch) {
+      file->ops->prefetch(file->handle, ranges, count);
+    }
+    return;
   }
-  return ret;
+#ifdef HAVE_POSIX_FADVISE
+  int fd = fileno(file->fp);
+  for (int64_t i = 0; i < count; i++) {
+    posix_fadvise(fd, ranges[i].offset, ranges[i].size, POSIX_FADV_WILLNEED);
+  }
+#endif
 }
 
-off_t _openslide_fsize(struct _openslide_file *file, GError **err) {
-  off_t orig = _openslide_ftell(file, err);
-  if (orig == -1) {
-    g_prefix_error(err, "Couldn't get size: ");
-    return -1;
+// the stream position is our own; the FILE is only used for its descriptor
+bool _openslide_fseek(struct _openslide_file *file, off_t offset, int whence,
+                      GError **err) {
+  int64_t size = 0;
+  if (whence == SEEK_END) {
+    size = _openslide_fsize(file, err);
+    if (size == -1) {
+      g_prefix_error(err, "Couldn't seek file %s: ", file->path);
+      return false;
+    }
   }
-  if (!_openslide_fseek(file, 0, SEEK_END, err)) {
-    g_prefix_error(err, "Couldn't get size: ");
-    return -1;
+  int64_t pos = _openslide_compute_seek(file->pos, size, offset, whence);
+  if (pos < 0) {
+    g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "Couldn't seek file %s: negative offset", file->path);
+    return false;
   }
-  off_t ret = _openslide_ftell(file, err);
-  if (ret == -1) {
-    g_prefix_error(err, "Couldn't get size: ");
-    return -1;
+  file->pos = pos;
+  return true;
+}
+
+off_t _openslide_ftell(struct _openslide_file *file,
+                       GError **err G_GNUC_UNUSED) {
+  return file->pos;
+}
+
+off_t _openslide_fsize(struct _openslide_file *file, GError **err) {
+  if (file->size != -1) {
+    return file->size;
   }
-  if (!_openslide_fseek(file, orig, SEEK_SET, err)) {
-    g_prefix_error(err, "Couldn't get size: ");
-    return -1;
+  if (file->ops) {
+    file->size = file->ops->size(file->handle);
+  } else if (file->map) {
+    file->size = g_mapped_file_get_length(file->map);
+  } else {
+    if (fseeko(file->fp, 0, SEEK_END)) {  // ci-allow
+      io_error(err, "Couldn't get size of %s", file->path);
+      return -1;
+    }
+    off_t ret = ftello(file->fp);  // ci-allow
+    if (ret == -1) {
+      io_error(err, "Couldn't get size of %s", file->path);
+      return -1;
+    }
+    file->size = ret;
   }
-  return ret;
+  return file->size;
 }
 
 void _openslide_fclose(struct _openslide_file *file) {
-  fclose(file->fp);  // ci-allow
+  if (file->map) {
+    g_mapped_file_unref(file->map);
+  }
+  if (file->ops) {
+    file->ops->close(file->handle);
+  } else {
+    fclose(file->fp);  // ci-allow
+  }
+  if (file->blocks) {
+    for (int i = 0; i < MAX_BLOCKS; i++) {
+      g_free(file->blocks[i].data);
+    }
+    g_free(file->blocks);
+  }
   g_free(file->path);
   g_free(file);
 }
 
 bool _openslide_fexists(const char *path, GError **err G_GNUC_UNUSED) {
+  if (_openslide_http_is_url(path)) {
+    g_autoptr(_openslide_file) f = _openslide_fopen(path, NULL);
+    return f != NULL;
+  }
   return g_file_test(path, G_FILE_TEST_EXISTS);  // ci-allow
 }
 
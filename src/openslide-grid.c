@@ -27,6 +27,13 @@
 #include "openslide-private.h"
 
 #define RANGE_BIN_SIZE_MULTIPLIER 3
+// a tilemap is indexed with a dense array if it isn't much larger than
+// the tile count
+#define TILEMAP_DENSE_MIN_ENTRIES 65536
+#define TILEMAP_DENSE_ENTRIES_PER_TILE 4
+// uniform tiles remembered per simple grid, about 3 MB.  when the set
+// fills it's emptied, and refilled by the tiles read after.
+#define UNIFORM_TILES_MAX 65536
 #define COLOR_TILE 0.6, 0,   0,   0.3
 #define COLOR_BIN  0,   0,   0.6, 0.15
 
@@ -86,15 +93,44 @@ struct simple_grid {
   int64_t tiles_across;
   int64_t tiles_down;
   _openslide_grid_simple_read_fn read_tile;
+
+  // tiles found to be a single color, painted without reading them.
+  // a set of struct uniform_tile, keyed by the index in the first field,
+  // of at most UNIFORM_TILES_MAX entries.
+  GRWLock uniform_lock;
+  GHashTable *uniform_tiles;
+};
+
+struct uniform_tile {
+  int64_t index;
+  uint32_t color;  // premultiplied ARGB; opaque or fully transparent
 };
 
+// Tiles are stored in flat arrays rather than as individual allocations,
+// since slides can have millions of them.  A tilemap indexes its tiles on
+// first use, since callers don't say when they're done adding tiles.  A
+// range grid's bins are built by _openslide_grid_range_finish_adding_tiles().
 struct tilemap_grid {
   struct _openslide_grid base;
 
-  GHashTable *tiles;
+  GArray *tiles;  // struct tilemap_tile, in insertion order
   _openslide_grid_tilemap_read_fn read_tile;
   GDestroyNotify destroy_tile;
 
+  // range of tile positions
+  int64_t min_col;
+  int64_t min_row;
+  int64_t max_col;
+  int64_t max_row;
+
+  // If dense, the index has an entry for each position in the range,
+  // holding the tile index plus one, or 0 for no tile.  Otherwise it holds
+  // the index of the last tile added at each position, sorted by position.
+  gsize index_ready;
+  bool index_dense;
+  uint32_t *index;
+  uint32_t index_len;
+
   // outer boundaries of grid
   double top;
   double bottom;
@@ -110,7 +146,6 @@ struct tilemap_grid {
 };
 
 struct tilemap_tile {
-  struct tilemap_grid *grid;
   void *data;
 
   int64_t col;
@@ -129,9 +164,13 @@ struct range_grid {
   int bin_width;
   int bin_height;
 
-  GPtrArray *tiles;
-  GHashTable *bins_init;  // address -> GPtrArray<tile>
-  GHashTable *bins_runtime;  // address -> [tile]
+  GArray *tiles;  // struct range_tile
+  // while adding tiles, the bins each tile overlaps
+  GArray *bin_entries;  // struct range_bin_entry
+  // afterward, the nonempty bins sorted by address, and their tiles
+  struct range_bin *bins;
+  uint32_t bin_count;
+  uint32_t *bin_tiles;
 
   _openslide_grid_range_read_fn read_tile;
   GDestroyNotify destroy_tile;
@@ -143,9 +182,17 @@ struct range_grid {
   double right;
 };
 
-struct range_bin_address {
+struct range_bin_entry {
+  int64_t col;
+  int64_t row;
+  uint32_t tile;
+};
+
+struct range_bin {
   int64_t col;
   int64_t row;
+  uint32_t start;  // in bin_tiles
+  uint32_t count;
 };
 
 struct range_tile {
@@ -257,6 +304,9 @@ static bool read_tiles(cairo_t *cr,
       double translate_x = ((tile_x - region->start_tile_x) *
                             grid->tile_advance_x) - region->offset_x;
       //      g_debug("read_tiles %"PRId64" %"PRId64, tile_x, tile_y);
+      if (!_openslide_worker_check_cancelled(err)) {
+        return false;
+      }
       cairo_translate(cr, translate_x, translate_y);
       if (!callback(grid, region, cr, level, tile_x, tile_y, arg, err)) {
         return false;
@@ -302,6 +352,64 @@ static void simple_get_bounds(struct _openslide_grid *_grid,
   bounds->h = grid->tiles_down * grid->base.tile_advance_y;
 }
 
+static bool simple_get_uniform_tile(struct simple_grid *grid,
+                                    int64_t tile_col, int64_t tile_row,
+                                    uint32_t *color) {
+  int64_t index = tile_row * grid->tiles_across + tile_col;
+  g_rw_lock_reader_lock(&grid->uniform_lock);
+  struct uniform_tile *tile = g_hash_table_lookup(grid->uniform_tiles,
+                                                  &index);
+  if (tile) {
+    *color = tile->color;
+  }
+  g_rw_lock_reader_unlock(&grid->uniform_lock);
+  return tile != NULL;
+}
+
+// remember the tile if read_tile() drew nothing but one uniform cache
+// entry covering the tile
+static void simple_check_uniform_tile(struct simple_grid *grid,
+                                      int64_t tile_col, int64_t tile_row,
+                                      const struct _openslide_cache_report *report) {
+  uint32_t alpha = report->color >> 24;
+  uint64_t tile_size = (uint64_t) grid->base.tile_advance_x *
+                       grid->base.tile_advance_y * 4;
+  if (report->tiles != 1 || !report->uniform ||
+      report->size != tile_size ||
+      !(alpha == 255 || report->color == 0)) {
+    return;
+  }
+  struct uniform_tile *tile = g_new(struct uniform_tile, 1);
+  tile->index = tile_row * grid->tiles_across + tile_col;
+  tile->color = report->color;
+  g_rw_lock_writer_lock(&grid->uniform_lock);
+  if (g_hash_table_size(grid->uniform_tiles) >= UNIFORM_TILES_MAX) {
+    g_hash_table_remove_all(grid->uniform_tiles);
+  }
+  g_hash_table_add(grid->uniform_tiles, tile);
+  g_rw_lock_writer_unlock(&grid->uniform_lock);
+}
+
+// Paint a uniform tile as a rectangle.  Only exact when tile pixels map
+// onto device pixels; otherwise the tile must be drawn normally.
+static bool paint_uniform_tile(cairo_t *cr, double w, double h,
+                               uint32_t color) {
+  cairo_matrix_t m;
+  cairo_get_matrix(cr, &m);
+  if (m.xx != 1 || m.yy != 1 || m.xy != 0 || m.yx != 0 ||
+      m.x0 != floor(m.x0) || m.y0 != floor(m.y0)) {
+    return false;
+  }
+  cairo_set_source_rgba(cr,
+                        ((color >> 16) & 0xff) / 255.0,
+                        ((color >> 8) & 0xff) / 255.0,
+                        (color & 0xff) / 255.0,
+                        (color >> 24) / 255.0);
+  cairo_rectangle(cr, 0, 0, w, h);
+  cairo_fill(cr);
+  return true;
+}
+
 static bool simple_read_tile(struct _openslide_grid *_grid,
                              struct region *region G_GNUC_UNUSED,
                              cairo_t *cr,
@@ -311,8 +419,24 @@ static bool simple_read_tile(struct _openslide_grid *_grid,
                              GError **err) {
   struct simple_grid *grid = (struct simple_grid *) _grid;
 
-  if (!grid->read_tile(grid->base.osr, cr, level,
-                       tile_col, tile_row, arg, err)) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_COMPOSITE);
+  uint64_t mark = _openslide_phase_mark();
+  uint32_t color;
+  bool ok = true;
+  if (!simple_get_uniform_tile(grid, tile_col, tile_row, &color) ||
+      !paint_uniform_tile(cr, grid->base.tile_advance_x,
+                          grid->base.tile_advance_y, color)) {
+    struct _openslide_cache_report report;
+    _openslide_cache_report_push(&report);
+    ok = grid->read_tile(grid->base.osr, cr, level,
+                         tile_col, tile_row, arg, err);
+    _openslide_cache_report_pop(&report);
+    if (ok) {
+      simple_check_uniform_tile(grid, tile_col, tile_row, &report);
+    }
+  }
+  _openslide_phase_end_exclusive(_OPENSLIDE_PHASE_COMPOSITE, phase, mark);
+  if (!ok) {
     return false;
   }
   if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
@@ -368,6 +492,8 @@ static bool simple_paint_region(struct _openslide_grid *_grid,
 static void simple_destroy(struct _openslide_grid *_grid) {
   struct simple_grid *grid = (struct simple_grid *) _grid;
 
+  g_hash_table_destroy(grid->uniform_tiles);
+  g_rw_lock_clear(&grid->uniform_lock);
   g_free(grid);
 }
 
@@ -391,31 +517,121 @@ struct _openslide_grid *_openslide_grid_create_simple(openslide_t *osr,
   grid->tiles_across = tiles_across;
   grid->tiles_down = tiles_down;
   grid->read_tile = read_tile;
+  g_rw_lock_init(&grid->uniform_lock);
+  grid->uniform_tiles = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                              g_free, NULL);
   return (struct _openslide_grid *) grid;
 }
 
 
 
-static guint tilemap_tile_hash_func(gconstpointer key) {
-  const struct tilemap_tile *tile = key;
+static int compare_positions(int64_t col_a, int64_t row_a,
+                             int64_t col_b, int64_t row_b) {
+  if (row_a != row_b) {
+    return row_a < row_b ? -1 : 1;
+  } else if (col_a != col_b) {
+    return col_a < col_b ? -1 : 1;
+  } else {
+    return 0;
+  }
+}
 
-  // assume 32-bit hash
-  return (guint) ((34369 * (uint64_t) tile->row) + ((uint64_t) tile->col));
+static int tilemap_compare_index(gconstpointer a, gconstpointer b,
+                                 gpointer data) {
+  const struct tilemap_tile *tiles = data;
+  uint32_t index_a = *(const uint32_t *) a;
+  uint32_t index_b = *(const uint32_t *) b;
+  const struct tilemap_tile *tile_a = &tiles[index_a];
+  const struct tilemap_tile *tile_b = &tiles[index_b];
+
+  int ret = compare_positions(tile_a->col, tile_a->row,
+                              tile_b->col, tile_b->row);
+  if (ret) {
+    return ret;
+  }
+  // a tile replaces earlier tiles at its position; sort it first
+  return index_a < index_b ? 1 : index_a > index_b ? -1 : 0;
 }
 
-static gboolean tilemap_tile_hash_key_equal(gconstpointer a, gconstpointer b) {
-  const struct tilemap_tile *c_a = a;
-  const struct tilemap_tile *c_b = b;
+static void tilemap_build_index(struct tilemap_grid *grid) {
+  uint32_t count = grid->tiles->len;
+  if (!count) {
+    return;
+  }
+  const struct tilemap_tile *tiles = (struct tilemap_tile *) grid->tiles->data;
+
+  uint64_t cols = grid->max_col - grid->min_col + 1;
+  uint64_t rows = grid->max_row - grid->min_row + 1;
+  uint64_t max_entries = MAX((uint64_t) count * TILEMAP_DENSE_ENTRIES_PER_TILE,
+                             TILEMAP_DENSE_MIN_ENTRIES);
+  if (rows <= max_entries / cols) {
+    grid->index_dense = true;
+    grid->index_len = cols * rows;
+    grid->index = g_new0(uint32_t, grid->index_len);
+    for (uint32_t i = 0; i < count; i++) {
+      const struct tilemap_tile *tile = &tiles[i];
+      grid->index[(tile->row - grid->min_row) * cols +
+                  (tile->col - grid->min_col)] = i + 1;
+    }
+    return;
+  }
 
-  return (c_a->col == c_b->col) && (c_a->row == c_b->row);
+  grid->index = g_new(uint32_t, count);
+  for (uint32_t i = 0; i < count; i++) {
+    grid->index[i] = i;
+  }
+  g_qsort_with_data(grid->index, count, sizeof(uint32_t),
+                    tilemap_compare_index, (gpointer) tiles);
+  // drop replaced tiles
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const struct tilemap_tile *tile = &tiles[grid->index[i]];
+    if (len) {
+      const struct tilemap_tile *prev = &tiles[grid->index[len - 1]];
+      if (!compare_positions(tile->col, tile->row, prev->col, prev->row)) {
+        continue;
+      }
+    }
+    grid->index[len++] = grid->index[i];
+  }
+  grid->index_len = len;
 }
 
-static void tilemap_tile_hash_destroy_value(gpointer data) {
-  struct tilemap_tile *tile = data;
-  if (tile->grid->destroy_tile && tile->data) {
-    tile->grid->destroy_tile(tile->data);
+static struct tilemap_tile *tilemap_lookup(struct tilemap_grid *grid,
+                                           int64_t col, int64_t row) {
+  if (g_once_init_enter(&grid->index_ready)) {
+    tilemap_build_index(grid);
+    g_once_init_leave(&grid->index_ready, 1);
+  }
+  if (!grid->index ||
+      col < grid->min_col || col > grid->max_col ||
+      row < grid->min_row || row > grid->max_row) {
+    return NULL;
+  }
+  struct tilemap_tile *tiles = (struct tilemap_tile *) grid->tiles->data;
+
+  if (grid->index_dense) {
+    uint64_t cols = grid->max_col - grid->min_col + 1;
+    uint32_t i = grid->index[(row - grid->min_row) * cols +
+                             (col - grid->min_col)];
+    return i ? &tiles[i - 1] : NULL;
+  }
+
+  uint32_t lo = 0;
+  uint32_t hi = grid->index_len;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    struct tilemap_tile *tile = &tiles[grid->index[mid]];
+    int ret = compare_positions(tile->col, tile->row, col, row);
+    if (ret == 0) {
+      return tile;
+    } else if (ret < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
-  g_free(tile);
+  return NULL;
 }
 
 static void tilemap_get_bounds(struct _openslide_grid *_grid,
@@ -439,11 +655,7 @@ static bool tilemap_read_tile(struct _openslide_grid *_grid,
                               GError **err) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
 
-  struct tilemap_tile coords = {
-    .col = tile_col,
-    .row = tile_row,
-  };
-  struct tilemap_tile *tile = g_hash_table_lookup(grid->tiles, &coords);
+  struct tilemap_tile *tile = tilemap_lookup(grid, tile_col, tile_row);
   if (tile == NULL) {
     //g_debug("no tile at %"PRId64", %"PRId64, tile_col, tile_row);
     return true;
@@ -466,9 +678,13 @@ static bool tilemap_read_tile(struct _openslide_grid *_grid,
 
   g_auto(cairo_matrix) matrix G_GNUC_UNUSED = matrix_save(cr);
   cairo_translate(cr, tile->offset_x, tile->offset_y);
-  if (!grid->read_tile(grid->base.osr, cr, level,
-                       tile->col, tile->row, tile->data,
-                       arg, err)) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_COMPOSITE);
+  uint64_t mark = _openslide_phase_mark();
+  bool ok = grid->read_tile(grid->base.osr, cr, level,
+                            tile->col, tile->row, tile->data,
+                            arg, err);
+  _openslide_phase_end_exclusive(_OPENSLIDE_PHASE_COMPOSITE, phase, mark);
+  if (!ok) {
     return false;
   }
   if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
@@ -514,7 +730,15 @@ static bool tilemap_paint_region(struct _openslide_grid *_grid,
 static void tilemap_destroy(struct _openslide_grid *_grid) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
 
-  g_hash_table_destroy(grid->tiles);
+  for (uint32_t i = 0; i < grid->tiles->len; i++) {
+    struct tilemap_tile *tile =
+      &g_array_index(grid->tiles, struct tilemap_tile, i);
+    if (grid->destroy_tile && tile->data) {
+      grid->destroy_tile(tile->data);
+    }
+  }
+  g_array_free(grid->tiles, true);
+  g_free(grid->index);
   g_free(grid);
 }
 
@@ -531,18 +755,29 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
                                       void *data) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
   g_assert(grid->base.ops == &tilemap_grid_ops);
+  g_assert(!grid->index_ready);
+  g_assert(grid->tiles->len < G_MAXUINT32);
+
+  struct tilemap_tile tile = {
+    .data = data,
+    .col = col,
+    .row = row,
+    .w = w,
+    .h = h,
+    .offset_x = offset_x,
+    .offset_y = offset_y,
+  };
+  g_array_append_val(grid->tiles, tile);
 
-  struct tilemap_tile *tile = g_new0(struct tilemap_tile, 1);
-  tile->grid = grid;
-  tile->col = col;
-  tile->row = row;
-  tile->offset_x = offset_x;
-  tile->offset_y = offset_y;
-  tile->w = w;
-  tile->h = h;
-  tile->data = data;
-
-  g_hash_table_replace(grid->tiles, tile, tile);
+  if (grid->tiles->len == 1) {
+    grid->min_col = grid->max_col = col;
+    grid->min_row = grid->max_row = row;
+  } else {
+    grid->min_col = MIN(col, grid->min_col);
+    grid->min_row = MIN(row, grid->min_row);
+    grid->max_col = MAX(col, grid->max_col);
+    grid->max_row = MAX(row, grid->max_row);
+  }
 
   grid->left = MIN(col * grid->base.tile_advance_x + offset_x,
                    grid->left);
@@ -558,7 +793,7 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
     int32_t extra_right = ceil(-offset_x / grid->base.tile_advance_x);
     grid->extra_tiles_right = MAX(grid->extra_tiles_right, extra_right);
   }
-  double offset_xr = offset_x + (tile->w - grid->base.tile_advance_x);
+  double offset_xr = offset_x + (w - grid->base.tile_advance_x);
   if (offset_xr > 0) {
     // extra on left
     int32_t extra_left = ceil(offset_xr / grid->base.tile_advance_x);
@@ -570,7 +805,7 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
     int32_t extra_bottom = ceil(-offset_y / grid->base.tile_advance_y);
     grid->extra_tiles_bottom = MAX(grid->extra_tiles_bottom, extra_bottom);
   }
-  double offset_yr = offset_y + (tile->h - grid->base.tile_advance_y);
+  double offset_yr = offset_y + (h - grid->base.tile_advance_y);
   if (offset_yr > 0) {
     // extra on top
     int32_t extra_top = ceil(offset_yr / grid->base.tile_advance_y);
@@ -597,37 +832,22 @@ struct _openslide_grid *_openslide_grid_create_tilemap(openslide_t *osr,
   grid->left = INFINITY;
   grid->right = -INFINITY;
 
-  grid->tiles = g_hash_table_new_full(tilemap_tile_hash_func,
-                                      tilemap_tile_hash_key_equal,
-                                      NULL,
-                                      tilemap_tile_hash_destroy_value);
+  grid->tiles = g_array_new(false, false, sizeof(struct tilemap_tile));
 
   return (struct _openslide_grid *) grid;
 }
 
 
 
-static guint range_bin_address_hash_func(gconstpointer key) {
-  const struct range_bin_address *addr = key;
+static int range_compare_bin_entries(gconstpointer a, gconstpointer b) {
+  const struct range_bin_entry *c_a = a;
+  const struct range_bin_entry *c_b = b;
 
-  // assume 32-bit hash
-  return (guint) ((34369 * (uint64_t) addr->row) + ((uint64_t) addr->col));
-}
-
-static gboolean range_bin_address_hash_key_equal(gconstpointer a,
-                                                 gconstpointer b) {
-  const struct range_bin_address *c_a = a;
-  const struct range_bin_address *c_b = b;
-
-  return (c_a->col == c_b->col) && (c_a->row == c_b->row);
-}
-
-static void range_bin_address_free(void *data) {
-  g_free(data);
-}
-
-static void range_ptr_array_free(void *data) {
-  g_ptr_array_free(data, true);
+  int ret = compare_positions(c_a->col, c_a->row, c_b->col, c_b->row);
+  if (ret) {
+    return ret;
+  }
+  return c_a->tile < c_b->tile ? -1 : c_a->tile > c_b->tile ? 1 : 0;
 }
 
 static int range_compare_tiles(gconstpointer a, gconstpointer b) {
@@ -646,11 +866,37 @@ static int range_compare_tiles(gconstpointer a, gconstpointer b) {
     return 1;
   } else if (c_a->x > c_b->x) {
     return -1;
+  } else if (c_a->id < c_b->id) {
+    return 1;
+  } else if (c_a->id > c_b->id) {
+    return -1;
   } else {
     return 0;
   }
 }
 
+static int range_compare_tile_ptrs(gconstpointer a, gconstpointer b) {
+  return range_compare_tiles(*(struct range_tile * const *) a,
+                             *(struct range_tile * const *) b);
+}
+
+// returns the first bin at or after the position
+static uint32_t range_find_bin(struct range_grid *grid,
+                               int64_t col, int64_t row) {
+  uint32_t lo = 0;
+  uint32_t hi = grid->bin_count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    struct range_bin *bin = &grid->bins[mid];
+    if (compare_positions(bin->col, bin->row, col, row) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
 static void range_get_bounds(struct _openslide_grid *_grid,
                              struct bounds *bounds) {
   struct range_grid *grid = (struct range_grid *) _grid;
@@ -673,42 +919,46 @@ static bool range_paint_region(struct _openslide_grid *_grid,
   struct range_grid *grid = (struct range_grid *) _grid;
 
   // ensure _openslide_grid_range_finish_adding_tiles() was called
-  g_assert(grid->bins_runtime);
+  g_assert(!grid->bin_entries);
 
   // save
   g_auto(cairo_matrix) matrix = matrix_save(cr);
 
   // accumulate relevant tiles
-  struct range_bin_address addr;
-  g_autoptr(GList) tiles = NULL;
-  for (addr.row = y / grid->bin_height;
-       addr.row < (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
-       addr.row++) {
-    for (addr.col = x / grid->bin_width;
-         addr.col < (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
-         addr.col++) {
-      struct range_tile **cur = g_hash_table_lookup(grid->bins_runtime,
-                                                    &addr);
-      if (cur) {
-        for (; *cur; cur++) {
-          struct range_tile *tile = *cur;
-          // skip tile if it's outside the requested region
-          if (tile->x + tile->w <= x ||
-              tile->y + tile->h <= y ||
-              tile->x >= x + w ||
-              tile->y >= y + h) {
-            //g_debug("skip x %g w %g y %g h %g, region x %g w %d y %g h %d", tile->x, tile->w, tile->y, tile->h, x, w, y, h);
-            continue;
-          }
-          tiles = g_list_prepend(tiles, tile);
+  int64_t start_col = x / grid->bin_width;
+  int64_t end_col = (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
+  int64_t start_row = y / grid->bin_height;
+  int64_t end_row = (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
+  g_autoptr(GPtrArray) tiles = g_ptr_array_new();
+  for (int64_t row = start_row; row < end_row; row++) {
+    for (uint32_t i = range_find_bin(grid, start_col, row);
+         i < grid->bin_count &&
+         grid->bins[i].row == row && grid->bins[i].col < end_col;
+         i++) {
+      struct range_bin *bin = &grid->bins[i];
+      for (uint32_t j = bin->start; j < bin->start + bin->count; j++) {
+        struct range_tile *tile =
+          &g_array_index(grid->tiles, struct range_tile, grid->bin_tiles[j]);
+        // skip tile if it's outside the requested region
+        if (tile->x + tile->w <= x ||
+            tile->y + tile->h <= y ||
+            tile->x >= x + w ||
+            tile->y >= y + h) {
+          //g_debug("skip x %g w %g y %g h %g, region x %g w %d y %g h %d", tile->x, tile->w, tile->y, tile->h, x, w, y, h);
+          continue;
         }
+        g_ptr_array_add(tiles, tile);
       }
-      if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    }
+  }
+  if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    for (int64_t row = start_row; row < end_row; row++) {
+      for (int64_t col = start_col; col < end_col; col++) {
         g_autofree char *coordinates =
-          g_strdup_printf("%"PRId64", %"PRId64, addr.col, addr.row);
+          g_strdup_printf("%"PRId64", %"PRId64, col, row);
         cairo_translate(cr,
-                        addr.col * grid->bin_width - x,
-                        addr.row * grid->bin_height - y);
+                        col * grid->bin_width - x,
+                        row * grid->bin_height - y);
         label_tile(cr, COLOR_BIN,
                    grid->bin_width, grid->bin_height,
                    coordinates);
@@ -716,25 +966,33 @@ static bool range_paint_region(struct _openslide_grid *_grid,
       }
     }
   }
-  tiles = g_list_sort(tiles, range_compare_tiles);
+  g_ptr_array_sort(tiles, range_compare_tile_ptrs);
 
   // draw tiles
   struct range_tile *prev_tile = NULL;
-  for (GList *cur = tiles; cur; cur = cur->next) {
+  for (guint i = 0; i < tiles->len; i++) {
     // get tile struct
-    struct range_tile *tile = cur->data;
+    struct range_tile *tile = tiles->pdata[i];
     if (tile == prev_tile) {
       //g_debug("skipping repeated tile");
       continue;
     }
     prev_tile = tile;
 
+    if (!_openslide_worker_check_cancelled(err)) {
+      return false;
+    }
+
     // draw
     //g_debug("tile x %g y %g z %g", tile->x, tile->y, tile->z);
     cairo_translate(cr, tile->x - x, tile->y - y);
-    if (!grid->read_tile(grid->base.osr, cr, level,
-                         tile->id, tile->data,
-                         arg, err)) {
+    int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_COMPOSITE);
+    uint64_t mark = _openslide_phase_mark();
+    bool ok = grid->read_tile(grid->base.osr, cr, level,
+                              tile->id, tile->data,
+                              arg, err);
+    _openslide_phase_end_exclusive(_OPENSLIDE_PHASE_COMPOSITE, phase, mark);
+    if (!ok) {
       return false;
     }
     if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
@@ -751,20 +1009,18 @@ static bool range_paint_region(struct _openslide_grid *_grid,
 static void range_destroy(struct _openslide_grid *_grid) {
   struct range_grid *grid = (struct range_grid *) _grid;
 
-  if (grid->bins_init) {
-    g_hash_table_destroy(grid->bins_init);
-  }
-  if (grid->bins_runtime) {
-    g_hash_table_destroy(grid->bins_runtime);
+  if (grid->bin_entries) {
+    g_array_free(grid->bin_entries, true);
   }
-  for (uint64_t cur = 0; cur < grid->tiles->len; cur++) {
-    struct range_tile *tile = grid->tiles->pdata[cur];
+  g_free(grid->bins);
+  g_free(grid->bin_tiles);
+  for (uint32_t i = 0; i < grid->tiles->len; i++) {
+    struct range_tile *tile = &g_array_index(grid->tiles, struct range_tile, i);
     if (grid->destroy_tile && tile->data) {
       grid->destroy_tile(tile->data);
     }
-    g_free(tile);
   }
-  g_ptr_array_free(grid->tiles, true);
+  g_array_free(grid->tiles, true);
   g_free(grid);
 }
 
@@ -780,34 +1036,30 @@ void _openslide_grid_range_add_tile(struct _openslide_grid *_grid,
                                     void *data) {
   struct range_grid *grid = (struct range_grid *) _grid;
   g_assert(grid->base.ops == &range_grid_ops);
-  g_assert(grid->bins_init);
-
-  struct range_tile *tile = g_new0(struct range_tile, 1);
-  tile->id = grid->tiles->len;
-  tile->data = data;
-  tile->x = x;
-  tile->y = y;
-  tile->z = z;
-  tile->w = w;
-  tile->h = h;
-  g_ptr_array_add(grid->tiles, tile);
-
-  struct range_bin_address addr;
-  for (addr.row = y / grid->bin_height;
-       addr.row < (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
-       addr.row++) {
-    for (addr.col = x / grid->bin_width;
-         addr.col < (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
-         addr.col++) {
-      GPtrArray *bin = g_hash_table_lookup(grid->bins_init, &addr);
-      if (!bin) {
-        bin = g_ptr_array_new();
-        struct range_bin_address *addr2 = g_new(struct range_bin_address, 1);
-        addr2->col = addr.col;
-        addr2->row = addr.row;
-        g_hash_table_insert(grid->bins_init, addr2, bin);
-      }
-      g_ptr_array_add(bin, tile);
+  g_assert(grid->bin_entries);
+  g_assert(grid->tiles->len < G_MAXUINT32);
+
+  struct range_tile tile = {
+    .id = grid->tiles->len,
+    .data = data,
+    .x = x,
+    .y = y,
+    .z = z,
+    .w = w,
+    .h = h,
+  };
+  g_array_append_val(grid->tiles, tile);
+
+  struct range_bin_entry entry = {
+    .tile = tile.id,
+  };
+  for (entry.row = y / grid->bin_height;
+       entry.row < (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
+       entry.row++) {
+    for (entry.col = x / grid->bin_width;
+         entry.col < (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
+         entry.col++) {
+      g_array_append_val(grid->bin_entries, entry);
     }
   }
 
@@ -817,31 +1069,35 @@ void _openslide_grid_range_add_tile(struct _openslide_grid *_grid,
   grid->bottom = MAX(y + h, grid->bottom);
 }
 
-static void range_postprocess_bin(void *key, void *value, void *data) {
-  struct range_grid *grid = data;
-  GPtrArray *tiles = value;
-
-  struct range_tile **tile_array = g_new(struct range_tile *, tiles->len + 1);
-  memcpy(tile_array, tiles->pdata, tiles->len * sizeof(struct range_tile *));
-  tile_array[tiles->len] = NULL;
-  g_ptr_array_free(tiles, true);
-
-  g_hash_table_replace(grid->bins_runtime, key, tile_array);
-}
-
 void _openslide_grid_range_finish_adding_tiles(struct _openslide_grid *_grid) {
   struct range_grid *grid = (struct range_grid *) _grid;
   g_assert(grid->base.ops == &range_grid_ops);
-  g_assert(grid->bins_init);
-
-  grid->bins_runtime = g_hash_table_new_full(range_bin_address_hash_func,
-                                             range_bin_address_hash_key_equal,
-                                             range_bin_address_free,
-                                             g_free);
-  g_hash_table_foreach(grid->bins_init, range_postprocess_bin, grid);
-  g_hash_table_steal_all(grid->bins_init);
-  g_hash_table_destroy(grid->bins_init);
-  grid->bins_init = NULL;
+  g_assert(grid->bin_entries);
+
+  // sort memberships into bins
+  GArray *entries = g_steal_pointer(&grid->bin_entries);
+  g_array_sort(entries, range_compare_bin_entries);
+  g_assert(entries->len < G_MAXUINT32);
+
+  grid->bin_tiles = g_new(uint32_t, entries->len);
+  grid->bins = g_new(struct range_bin, entries->len);
+  for (uint32_t i = 0; i < entries->len; i++) {
+    struct range_bin_entry *entry =
+      &g_array_index(entries, struct range_bin_entry, i);
+    grid->bin_tiles[i] = entry->tile;
+    struct range_bin *bin = grid->bin_count ?
+      &grid->bins[grid->bin_count - 1] : NULL;
+    if (!bin || bin->col != entry->col || bin->row != entry->row) {
+      bin = &grid->bins[grid->bin_count++];
+      bin->col = entry->col;
+      bin->row = entry->row;
+      bin->start = i;
+      bin->count = 0;
+    }
+    bin->count++;
+  }
+  grid->bins = g_renew(struct range_bin, grid->bins, MAX(grid->bin_count, 1));
+  g_array_free(entries, true);
 }
 
 struct _openslide_grid *_openslide_grid_create_range(openslide_t *osr,
@@ -856,11 +1112,9 @@ struct _openslide_grid *_openslide_grid_create_range(openslide_t *osr,
   grid->base.tile_advance_y = NAN;  // unused
   grid->bin_width = typical_tile_width * RANGE_BIN_SIZE_MULTIPLIER;
   grid->bin_height = typical_tile_height * RANGE_BIN_SIZE_MULTIPLIER;
-  grid->tiles = g_ptr_array_new();
-  grid->bins_init = g_hash_table_new_full(range_bin_address_hash_func,
-                                          range_bin_address_hash_key_equal,
-                                          range_bin_address_free,
-                                          range_ptr_array_free);
+  grid->tiles = g_array_new(false, false, sizeof(struct range_tile));
+  grid->bin_entries = g_array_new(false, false,
+                                  sizeof(struct range_bin_entry));
   grid->read_tile = read_tile;
   grid->destroy_tile = destroy_tile;
 
@@ -24,6 +24,7 @@
 #include "openslide-hash.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 
@@ -57,47 +58,131 @@ bool _openslide_hash_file(struct _openslide_hash *hash, const char *filename,
   return _openslide_hash_file_part(hash, filename, 0, -1, err);
 }
 
-bool _openslide_hash_file_part(struct _openslide_hash *hash,
-			       const char *filename,
-			       int64_t offset, int64_t size,
-			       GError **err) {
+// Hashed data is read in chunks of up to HASH_CHUNK_SIZE, a window at a
+// time.  The chunks of a window are read concurrently, then hashed in order.
+#define HASH_CHUNK_SIZE (1 << 20)
+#define HASH_WINDOW_SIZE (8 << 20)
+#define HASH_WINDOW_CHUNKS 256
+
+struct hash_chunk {
+  uint64_t offset;
+  uint32_t size;
+  uint8_t *buf;
+};
+
+struct hash_window {
+  struct _openslide_file *f;
+  struct hash_chunk chunks[HASH_WINDOW_CHUNKS];
+  int32_t count;
+  uint32_t fill;
+  uint8_t *buf;
+};
+
+static bool read_hash_chunk(int64_t i, void *arg, GError **err) {
+  struct hash_window *w = arg;
+  struct hash_chunk *c = &w->chunks[i];
+  return _openslide_fpread_exact(w->f, c->buf, c->size, c->offset, err);
+}
+
+static bool flush_hash_window(struct _openslide_hash *hash,
+                              struct hash_window *w,
+                              GError **err) {
+  if (!_openslide_worker_run_batch(w->count, read_hash_chunk, w, err)) {
+    return false;
+  }
+  for (int32_t i = 0; i < w->count; i++) {
+    _openslide_hash_data(hash, w->chunks[i].buf, w->chunks[i].size);
+  }
+  w->count = 0;
+  w->fill = 0;
+  return true;
+}
+
+static int compare_range_offset(const void *a, const void *b) {
+  const struct _openslide_file_range *ra = a;
+  const struct _openslide_file_range *rb = b;
+  return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+bool _openslide_hash_file_parts(struct _openslide_hash *hash,
+                                const char *filename,
+                                const struct _openslide_file_range *ranges,
+                                int64_t count,
+                                GError **err) {
   g_autoptr(_openslide_file) f = _openslide_fopen(filename, err);
   if (f == NULL) {
     return false;
   }
+  // prefetch in offset order, as the hint requires, but hash in the
+  // caller's order
+  g_autofree struct _openslide_file_range *sorted =
+    g_memdup(ranges, count * sizeof(*ranges));
+  qsort(sorted, count, sizeof(*sorted), compare_range_offset);
+  _openslide_fprefetch(f, sorted, count);
+
+  uint64_t total = 0;
+  for (int64_t i = 0; i < count; i++) {
+    total += ranges[i].size;
+  }
+  g_autofree uint8_t *buf = g_malloc(MIN(total, HASH_WINDOW_SIZE));
+  struct hash_window w = {
+    .f = f,
+    .buf = buf,
+  };
+
+  for (int64_t i = 0; i < count; i++) {
+    uint64_t offset = ranges[i].offset;
+    uint64_t bytes_left = ranges[i].size;
+    while (bytes_left > 0) {
+      if (w.count == HASH_WINDOW_CHUNKS || w.fill == HASH_WINDOW_SIZE) {
+        if (!flush_hash_window(hash, &w, err)) {
+          return false;
+        }
+      }
+      uint32_t size = MIN(MIN(bytes_left, HASH_CHUNK_SIZE),
+                          HASH_WINDOW_SIZE - w.fill);
+      w.chunks[w.count++] = (struct hash_chunk) {
+        .offset = offset,
+        .size = size,
+        .buf = buf + w.fill,
+      };
+      //g_debug("hash '%s' %"PRIu64" %u", filename, offset, size);
+      w.fill += size;
+      offset += size;
+      bytes_left -= size;
+    }
+  }
+
+  return flush_hash_window(hash, &w, err);
+}
 
+bool _openslide_hash_file_part(struct _openslide_hash *hash,
+			       const char *filename,
+			       int64_t offset, int64_t size,
+			       GError **err) {
   if (size == -1) {
     // hash to end of file
+    g_autoptr(_openslide_file) f = _openslide_fopen(filename, err);
+    if (f == NULL) {
+      return false;
+    }
     int64_t len = _openslide_fsize(f, err);
     if (len == -1) {
       return false;
     }
     size = len - offset;
   }
-
-  uint8_t buf[4096];
-
-  if (offset != 0) {
-    if (!_openslide_fseek(f, offset, SEEK_SET, err)) {
-      return false;
-    }
-  }
-
-  int64_t bytes_left = size;
-  while (bytes_left > 0) {
-    int64_t bytes_to_read = MIN((int64_t) sizeof buf, bytes_left);
-    if (!_openslide_fread_exact(f, buf, bytes_to_read, err)) {
-      return false;
-    }
-
-    //    g_debug("hash '%s' %"PRId64" %d", filename, offset + (size - bytes_left), bytes_to_read);
-
-    bytes_left -= bytes_to_read;
-
-    _openslide_hash_data(hash, buf, bytes_to_read);
+  if (offset < 0 || size < 0) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Invalid range to hash in %s", filename);
+    return false;
   }
 
-  return true;
+  struct _openslide_file_range range = {
+    .offset = offset,
+    .size = size,
+  };
+  return _openslide_hash_file_parts(hash, filename, &range, 1, err);
 }
 
 // Invalidate this hash.  Use if this slide is unhashable for some reason.
@@ -115,6 +200,16 @@ const char *_openslide_hash_get_string(struct _openslide_hash *hash) {
   }
 }
 
+char *_openslide_hash_peek_string(struct _openslide_hash *hash) {
+  if (!hash || !hash->enabled) {
+    return NULL;
+  }
+  GChecksum *copy = g_checksum_copy(hash->checksum);
+  char *str = g_strdup(g_checksum_get_string(copy));
+  g_checksum_free(copy);
+  return str;
+}
+
 void _openslide_hash_destroy(struct _openslide_hash *hash) {
   g_checksum_free(hash->checksum);
   g_free(hash);
@@ -30,6 +30,7 @@
 #include <glib.h>
 
 struct _openslide_hash;
+struct _openslide_file_range;
 
 // constructor
 struct _openslide_hash *_openslide_hash_quickhash1_create(void);
@@ -44,12 +45,20 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
 			       const char *filename,
 			       int64_t offset, int64_t size,
 			       GError **err);
+// hash several ranges of a file, in order
+bool _openslide_hash_file_parts(struct _openslide_hash *hash,
+                                const char *filename,
+                                const struct _openslide_file_range *ranges,
+                                int64_t count,
+                                GError **err);
 
 // lockout
 void _openslide_hash_disable(struct _openslide_hash *hash);
 
 // accessor
 const char *_openslide_hash_get_string(struct _openslide_hash *hash);
+// the hash of the data so far, without finishing the hash; NULL if disabled
+char *_openslide_hash_peek_string(struct _openslide_hash *hash);
 
 // destructor
 void _openslide_hash_destroy(struct _openslide_hash *hash);
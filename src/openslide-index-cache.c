@@ -0,0 +1,157 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide-private.h"
+
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+
+// Indexes that are expensive to rebuild at open, such as the offsets of
+// JPEG restart markers found by scanning, can be saved in a directory and
+// reloaded when the same slide is opened again.  Files are named by index
+// kind and slide quickhash, so a stale index can only be found if the
+// slide's hashed data is unchanged.  Backends must still treat loaded
+// data as untrusted.  Files are replaced atomically and never pruned.
+
+#define INDEX_MAGIC "OSINDEX1"
+
+struct index_header {
+  char magic[8];
+  uint64_t size;  // little-endian
+};
+
+static struct _openslide_persistent_dir index_dir;
+
+// serializes setters of every persistent directory
+static GMutex dir_mutex;
+
+void _openslide_persistent_dir_set(struct _openslide_persistent_dir *pd,
+                                   const char *path) {
+  // readers don't lock, so the old value is kept until the setting is
+  // cleared
+  g_mutex_lock(&dir_mutex);
+  char *old = g_atomic_pointer_get(&pd->path);
+  if (old) {
+    pd->old = g_slist_prepend(pd->old, old);
+  }
+  g_atomic_pointer_set(&pd->path, g_strdup(path));
+  g_mutex_unlock(&dir_mutex);
+}
+
+const char *_openslide_persistent_dir_get(struct _openslide_persistent_dir *pd) {
+  return g_atomic_pointer_get(&pd->path);
+}
+
+void _openslide_persistent_dir_clear(struct _openslide_persistent_dir *pd) {
+  g_free(pd->path);
+  g_slist_free_full(pd->old, g_free);
+  pd->path = NULL;
+  pd->old = NULL;
+}
+
+char *_openslide_persistent_read(const char *path, const char *magic,
+                                 size_t header_size, size_t *len_OUT) {
+  g_autofree char *buf = NULL;
+  gsize len;
+  if (!g_file_get_contents(path, &buf, &len, NULL)) {
+    return NULL;
+  }
+  g_assert(header_size >= 8);
+  if (len < header_size || memcmp(buf, magic, 8)) {
+    return NULL;
+  }
+  *len_OUT = len;
+  return g_steal_pointer(&buf);
+}
+
+bool _openslide_persistent_write(const char *path,
+                                 const void *header, size_t header_size,
+                                 const void *data, size_t size,
+                                 GError **err) {
+  g_autofree char *buf = g_malloc(header_size + size);
+  memcpy(buf, header, header_size);
+  memcpy(buf + header_size, data, size);
+
+  // g_file_set_contents() writes a temporary file and renames it into place
+  g_autofree char *dir = g_path_get_dirname(path);
+  if (g_mkdir_with_parents(dir, 0777)) {
+    int errsv = errno;
+    g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                "Couldn't create directory %s: %s", dir, g_strerror(errsv));
+    return false;
+  }
+  return g_file_set_contents(path, buf, header_size + size, err);
+}
+
+void _openslide_index_cache_set_dir(const char *dir) {
+  _openslide_persistent_dir_set(&index_dir, dir);
+}
+
+static char *get_path(const char *key, const char *kind) {
+  if (!key) {
+    return NULL;
+  }
+  const char *dir = _openslide_persistent_dir_get(&index_dir);
+  if (!dir) {
+    return NULL;
+  }
+  return g_build_filename(dir, kind, key, NULL);
+}
+
+void *_openslide_index_cache_load(const char *key, const char *kind,
+                                  size_t *size_OUT) {
+  g_autofree char *path = get_path(key, kind);
+  if (!path) {
+    return NULL;
+  }
+  struct index_header hdr;
+  size_t len;
+  g_autofree char *buf = _openslide_persistent_read(path, INDEX_MAGIC,
+                                                    sizeof(hdr), &len);
+  if (!buf) {
+    return NULL;
+  }
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (GUINT64_FROM_LE(hdr.size) != len - sizeof(hdr)) {
+    return NULL;
+  }
+  *size_OUT = len - sizeof(hdr);
+  return g_memdup(buf + sizeof(hdr), len - sizeof(hdr));
+}
+
+void _openslide_index_cache_store(const char *key, const char *kind,
+                                  const void *data, size_t size) {
+  g_autofree char *path = get_path(key, kind);
+  if (!path) {
+    return;
+  }
+  struct index_header hdr = {
+    .size = GUINT64_TO_LE(size),
+  };
+  memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+  g_autoptr(GError) tmp_err = NULL;
+  if (!_openslide_persistent_write(path, &hdr, sizeof(hdr), data, size,
+                                   &tmp_err)) {
+    _openslide_performance_warn("Couldn't write index cache: %s",
+                                tmp_err->message);
+  }
+}
@@ -40,8 +40,9 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(openslide_t, openslide_close)
 struct _openslide_associated_image {
   const struct _openslide_associated_image_ops *ops;
 
-  int64_t w;
+  int64_t w;  // -1 until read_dimensions() succeeds, if the op is set
   int64_t h;
+  gsize dimensions_ready;  // filled in automatically
 
   // the size in bytes of the ICC profile, or 0 for no profile available
   int64_t icc_profile_size;
@@ -49,6 +50,10 @@ struct _openslide_associated_image {
 
 /* associated image operations */
 struct _openslide_associated_image_ops {
+  // optional.  set w and h of an image added without them.  called at
+  // most once, before the dimensions are first needed.
+  bool (*read_dimensions)(struct _openslide_associated_image *img,
+                          GError **err);
   // must fail if stored width or height doesn't match the image
   bool (*get_argb_data)(struct _openslide_associated_image *img,
                         uint32_t *dest,
@@ -69,19 +74,70 @@ struct _openslide {
   // associated images
   GHashTable *associated_images;  // created automatically
   const char **associated_image_names; // filled in automatically from hashtable
+  // images whose deferred dimensions couldn't be read are removed, but
+  // other threads may still hold them or an older name list, so they're
+  // kept until close.  protected by associated_lock, as are the above
+  // after open.
+  GMutex associated_lock;
+  GPtrArray *dropped_associated_images;
+  GPtrArray *dropped_associated_names;  // names and superseded name lists
 
   // metadata
   GHashTable *properties; // created automatically
   const char **property_names; // filled in automatically from hashtable
+  bool properties_deferred;  // properties will be added on first access
+  gsize properties_loaded;   // property_names is valid
 
   // the size in bytes of the ICC profile, or 0 for no profile available
   int64_t icc_profile_size;
 
+  // virtual levels wrapping the backend, or NULL
+  struct _openslide_virtual_levels *virtual_levels;
+
+  // focal planes, or NULL if the slide has only one.  owned by the backend.
+  struct _openslide_focal_planes *focal_planes;
+
   // cache
   struct _openslide_cache_binding *cache;
 
   // error handling, NULL if no error
   gpointer error; // must use g_atomic_pointer!
+
+  // outstanding asynchronous reads and prefetches
+  GMutex async_lock;
+  GCond async_cond;
+  int64_t async_pending;
+  gint prefetch_cancelled;  // atomic
+
+  // automatic read-ahead, protected by read_ahead_lock
+  GMutex read_ahead_lock;
+  int32_t read_ahead_tiles;  // 0 if disabled
+  int32_t read_ahead_level;
+  int64_t read_ahead_row_start;
+  int64_t read_ahead_row_end;
+  int64_t read_ahead_col_end;     // end of the tile columns read
+  int64_t read_ahead_prefetched;  // end of the tile columns prefetched
+
+  // low-resolution tissue mask, computed on first use
+  GMutex tissue_lock;
+  struct _openslide_tissue_mask *tissue_mask;
+
+  // conversion to sRGB, built when first enabled and then kept until
+  // close, so reads don't need the lock
+  GMutex color_lock;
+  struct _openslide_color_transform *color_transform;
+  uint8_t *color_planes;  // cache plane cookies for converted tiles, by level
+  gint color_managed;  // atomic
+};
+
+// A Z-stack.  Each focal plane has its own levels, with the same
+// geometry as the backend levels in osr->levels and their own cache
+// planes.  The default plane's levels are the ones in osr->levels.
+struct _openslide_focal_planes {
+  int32_t count;
+  int32_t default_plane;
+  int32_t level_count;
+  struct _openslide_level ***levels;  // [plane][level]
 };
 
 struct _openslide_level {
@@ -94,6 +150,19 @@ struct _openslide_level {
   // all levels must set these, or none
   int64_t tile_w;
   int64_t tile_h;
+
+  // set if the level's tiles can be decoded at 1/2, 1/4, and 1/8 scale
+  // through ops->get_tile_scaled.  tile_w and tile_h must be multiples
+  // of 8.
+  bool scaled_tiles;
+  // cache planes for scaled tiles; see _openslide_level_get_scaled_plane()
+  char scaled_plane[3];
+};
+
+// a tile of a level's tile geometry
+struct _openslide_tile_position {
+  int64_t col;
+  int64_t row;
 };
 
 /* the function pointer structure for backends */
@@ -103,12 +172,55 @@ struct _openslide_ops {
                        struct _openslide_level *level,
                        int32_t w, int32_t h,
                        GError **err);
+  // optional.  get the premultiplied ARGB pixels of one tile of the
+  // level's tile geometry (tile_w x tile_h), or NULL with no error if the
+  // tile is absent.  only for levels which paint_region renders by
+  // copying unscaled, non-overlapping tiles.  the data belongs to *entry.
+  uint32_t *(*get_tile)(openslide_t *osr,
+                        struct _openslide_level *level,
+                        int64_t tile_col, int64_t tile_row,
+                        struct _openslide_cache_entry **entry,
+                        GError **err);
+  // optional.  like get_tile, but decoded at 1/scale size, for scale 2,
+  // 4, or 8.  only called for levels with scaled_tiles set.  the tile is
+  // tile_w / scale x tile_h / scale pixels, and pixels beyond the scaled
+  // level dimensions are transparent.
+  uint32_t *(*get_tile_scaled)(openslide_t *osr,
+                               struct _openslide_level *level,
+                               int64_t tile_col, int64_t tile_row,
+                               int32_t scale,
+                               struct _openslide_cache_entry **entry,
+                               GError **err);
+  // optional.  get the compressed data of one tile of the level's tile
+  // geometry as a standalone image that decodes to the tile's pixels,
+  // including any beyond the level's edges.  NULL with no error if the
+  // tile is absent or not stored in a format that can be passed through.
+  // the data belongs to *entry.
+  void *(*get_raw_tile)(openslide_t *osr,
+                        struct _openslide_level *level,
+                        int64_t tile_col, int64_t tile_row,
+                        openslide_tile_format_t *format, int64_t *size,
+                        struct _openslide_cache_entry **entry,
+                        GError **err);
+  // optional.  a hint that these tiles of the level's tile geometry are
+  // about to be decoded, so the backend can fetch their compressed data
+  // with a few large reads.  tiles are unique and sorted by row, then
+  // column.
+  void (*prefetch_tile_data)(openslide_t *osr,
+                             struct _openslide_level *level,
+                             const struct _openslide_tile_position *tiles,
+                             int64_t count);
+  // optional.  add the vendor properties that open() skipped because
+  // _openslide_lazy_properties() was true and set osr->properties_deferred.
+  // called at most once, before properties are first returned.
+  bool (*load_properties)(openslide_t *osr, GError **err);
   // must fail if osr->icc_profile_size doesn't match the profile
   bool (*read_icc_profile)(openslide_t *osr, void *dest, GError **err);
   void (*destroy)(openslide_t *osr);
 };
 
 struct _openslide_tifflike;
+struct _openslide_probe;
 
 /* vendor detection and parsing */
 
@@ -130,12 +242,44 @@ struct _openslide_format {
   const char *name;
   const char *vendor;
   bool (*detect)(const char *filename, struct _openslide_tifflike *tl,
-                 GError **err);
+                 struct _openslide_probe *probe, GError **err);
   bool (*open)(openslide_t *osr, const char *filename,
                struct _openslide_tifflike *tl,
+               struct _openslide_probe *probe,
                struct _openslide_hash *quickhash1, GError **err);
 };
 
+/*
+ * State shared by format detection and open.  header holds the first
+ * bytes of the file, so formats with a fixed signature can reject other
+ * files without opening them.  A successful detect() can hand what it
+ * parsed to open() with _openslide_probe_set_data(); open() must cope
+ * with finding nothing, since detect() isn't obliged to leave anything.
+ */
+#define _OPENSLIDE_PROBE_HEADER_SIZE 512
+
+struct _openslide_probe {
+  uint8_t header[_OPENSLIDE_PROBE_HEADER_SIZE];
+  size_t header_len;  // 0 if the file couldn't be read
+  void *data;
+  GDestroyNotify destroy_data;
+};
+
+bool _openslide_probe_check_magic(struct _openslide_probe *probe,
+                                  size_t offset,
+                                  const void *magic, size_t len,
+                                  GError **err);
+void _openslide_probe_set_data(struct _openslide_probe *probe,
+                               void *data, GDestroyNotify destroy);
+void *_openslide_probe_steal_data(struct _openslide_probe *probe);
+void _openslide_probe_clear(struct _openslide_probe *probe);
+
+typedef struct _openslide_probe _openslide_probe;
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(_openslide_probe, _openslide_probe_clear)
+
+// whether open() may defer vendor properties to load_properties()
+bool _openslide_lazy_properties(void);
+
 extern const struct _openslide_format _openslide_format_aperio;
 extern const struct _openslide_format _openslide_format_dicom;
 extern const struct _openslide_format _openslide_format_generic_tiff;
@@ -162,6 +306,14 @@ void *_openslide_inflate_buffer(const void *src, int64_t src_len,
 void *_openslide_zstd_decompress_buffer(const void *src, int64_t src_len,
                                         int64_t dst_len, GError **err);
 
+// TIFF-style LZW
+void *_openslide_lzw_decompress_buffer(const void *src, int64_t src_len,
+                                       int64_t dst_len, GError **err);
+
+// fast zstd compression; returns NULL if the data doesn't shrink
+void *_openslide_zstd_compress_buffer(const void *src, int64_t src_len,
+                                      int64_t *dst_len);
+
 /* Compute the new offset after seeking a file with the specified initial
    offset and length. */
 int64_t _openslide_compute_seek(int64_t initial, int64_t length,
@@ -197,6 +349,26 @@ bool _openslide_clip_tile(uint32_t *tiledata,
                           int64_t clip_w, int64_t clip_h,
                           GError **err);
 
+// Decide whether to decode only the visible part of a large tile, rather
+// than decoding and caching all of it.  cr is the tile's context as
+// passed to its read callback.  If so, sets the visible rectangle in tile
+// coordinates.
+bool _openslide_get_partial_tile_region(cairo_t *cr,
+                                        int64_t tile_w, int64_t tile_h,
+                                        int32_t *x, int32_t *y,
+                                        int32_t *w, int32_t *h);
+
+// cache plane for tiles of a level decoded at 1/scale size
+void *_openslide_level_get_scaled_plane(struct _openslide_level *l,
+                                        int32_t scale);
+
+// bytes per pixel, or 0 for an invalid format
+int32_t _openslide_pixel_format_bytes(openslide_pixel_format_t format);
+
+// convert premultiplied ARGB pixels to another format
+void _openslide_convert_pixels(const uint32_t *src, void *dest,
+                               int64_t count,
+                               openslide_pixel_format_t format);
 
 // File handling
 struct _openslide_file;
@@ -206,6 +378,27 @@ size_t _openslide_fread(struct _openslide_file *file, void *buf, size_t size,
                         GError **err);
 bool _openslide_fread_exact(struct _openslide_file *file,
                             void *buf, size_t size, GError **err);
+size_t _openslide_fpread(struct _openslide_file *file, void *buf, size_t size,
+                         off_t offset, GError **err);
+bool _openslide_fpread_exact(struct _openslide_file *file,
+                             void *buf, size_t size, off_t offset,
+                             GError **err);
+struct _openslide_file *_openslide_fopen_mapped(const char *path,
+                                                GError **err);
+const void *_openslide_fmap_range(struct _openslide_file *file,
+                                  off_t offset, size_t size);
+
+// a byte range of a file
+struct _openslide_file_range {
+  uint64_t offset;
+  uint64_t size;
+};
+
+// hint that the ranges, sorted by offset, are about to be read
+void _openslide_fprefetch(struct _openslide_file *file,
+                          const struct _openslide_file_range *ranges,
+                          int64_t count);
+void _openslide_set_file_mapping(bool enabled);
 bool _openslide_fseek(struct _openslide_file *file, off_t offset, int whence,
                       GError **err);
 off_t _openslide_ftell(struct _openslide_file *file, GError **err);
@@ -213,6 +406,27 @@ off_t _openslide_fsize(struct _openslide_file *file, GError **err);
 void _openslide_fclose(struct _openslide_file *file);
 bool _openslide_fexists(const char *path, GError **err);
 
+/* Backend for files that aren't on the local filesystem.  read_at must be
+   thread-safe; it returns 0/NULL on EOF and 0/non-NULL on I/O error. */
+struct _openslide_file_ops {
+  size_t (*read_at)(void *handle, void *buf, size_t size, int64_t offset,
+                    GError **err);
+  int64_t (*size)(void *handle);
+  void (*close)(void *handle);
+  // optional; see _openslide_fprefetch()
+  void (*prefetch)(void *handle,
+                   const struct _openslide_file_range *ranges,
+                   int64_t count);
+};
+
+struct _openslide_file *_openslide_fopen_ops(const char *path,
+                                            const struct _openslide_file_ops *ops,
+                                            void *handle);
+
+/* HTTP(S) range requests; _openslide_fopen() dispatches URLs here */
+bool _openslide_http_is_url(const char *path);
+struct _openslide_file *_openslide_http_fopen(const char *url, GError **err);
+
 typedef struct _openslide_file _openslide_file;
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(_openslide_file, _openslide_fclose)
 
@@ -305,6 +519,46 @@ void _openslide_set_bounds_props_from_grid(openslide_t *osr,
                                            struct _openslide_grid *grid);
 
 
+/* Virtual levels */
+void _openslide_virtual_levels_set_enabled(bool enable);
+// add levels to fill gaps in the pyramid, if enabled
+void _openslide_virtual_levels_add(openslide_t *osr);
+// levels in an order that doesn't depend on whether virtual levels are
+// enabled, for the persistent cache
+struct _openslide_level **_openslide_virtual_levels_get_stable(openslide_t *osr,
+                                                               int32_t *count);
+
+/* Persistent files */
+// a directory setting that can be read without locking.  zero-initialize.
+struct _openslide_persistent_dir {
+  char *path;  // atomic ops only; or NULL.  immutable string
+  GSList *old;  // replaced values of path
+};
+void _openslide_persistent_dir_set(struct _openslide_persistent_dir *pd,
+                                   const char *path);
+// NULL if unset; valid until the setting is cleared
+const char *_openslide_persistent_dir_get(struct _openslide_persistent_dir *pd);
+void _openslide_persistent_dir_clear(struct _openslide_persistent_dir *pd);
+// the contents of a file beginning with a header of at least header_size
+// bytes, whose first 8 are magic; NULL if it's missing or doesn't match
+char *_openslide_persistent_read(const char *path, const char *magic,
+                                 size_t header_size, size_t *len_OUT);
+// atomically replace a file with header followed by data, creating its
+// directory if needed
+bool _openslide_persistent_write(const char *path,
+                                 const void *header, size_t header_size,
+                                 const void *data, size_t size,
+                                 GError **err);
+
+/* Index cache */
+// key is normally the quickhash; NULL to skip the cache
+void _openslide_index_cache_set_dir(const char *dir);
+void *_openslide_index_cache_load(const char *key, const char *kind,
+                                  size_t *size_OUT);
+void _openslide_index_cache_store(const char *key, const char *kind,
+                                  const void *data, size_t size);
+
+
 /* Cache */
 struct _openslide_cache_binding;
 struct _openslide_cache_entry;
@@ -316,6 +570,15 @@ openslide_cache_t *_openslide_cache_create(uint64_t capacity_in_bytes);
 
 void _openslide_cache_release(openslide_cache_t *cache);
 
+void _openslide_cache_set_compressed_capacity(openslide_cache_t *cache,
+                                              uint64_t capacity_in_bytes);
+
+void _openslide_cache_set_persistent_dir(openslide_cache_t *cache,
+                                         const char *path);
+
+void _openslide_cache_get_stats(openslide_cache_t *cache,
+                                openslide_cache_stats_t *stats);
+
 // binding a cache to an openslide_t
 struct _openslide_cache_binding *_openslide_cache_binding_create(uint64_t capacity_in_bytes);
 
@@ -324,6 +587,24 @@ void _openslide_cache_binding_set(struct _openslide_cache_binding *cb,
 
 void _openslide_cache_binding_destroy(struct _openslide_cache_binding *cb);
 
+// identify the slide to the persistent tier; levels must outlive cb
+void _openslide_cache_binding_set_identity(struct _openslide_cache_binding *cb,
+                                           const char *quickhash,
+                                           struct _openslide_level **levels,
+                                           int32_t level_count);
+
+void _openslide_cache_binding_set_quota(struct _openslide_cache_binding *cb,
+                                        uint64_t quota_in_bytes);
+
+void _openslide_cache_binding_set_priority(struct _openslide_cache_binding *cb,
+                                           openslide_cache_priority_t priority);
+
+uint64_t _openslide_cache_binding_get_capacity(struct _openslide_cache_binding *cb);
+
+// event counts are for this binding, sizes for the whole cache
+void _openslide_cache_binding_get_stats(struct _openslide_cache_binding *cb,
+                                        openslide_cache_stats_t *stats);
+
 // put and get
 void _openslide_cache_put(struct _openslide_cache_binding *cb,
                           void *plane,  // coordinate plane (level or grid)
@@ -339,14 +620,80 @@ void *_openslide_cache_get(struct _openslide_cache_binding *cb,
                            int64_t y,
                            struct _openslide_cache_entry **entry);
 
+// whether a tile is in memory, in either tier.  doesn't count towards the
+// stats, refresh the tile, or consult the persistent tier.
+bool _openslide_cache_contains(struct _openslide_cache_binding *cb,
+                               void *plane,
+                               int64_t x,
+                               int64_t y);
+
+// create an entry that isn't in any cache, taking ownership of data.
+// the caller holds the only reference.
+struct _openslide_cache_entry *_openslide_cache_entry_new(void *data,
+                                                          uint64_t size_in_bytes);
+
+// allocate a tile buffer, recycling memory from freed cache entries
+void *_openslide_cache_alloc(struct _openslide_cache_binding *cb,
+                             uint64_t size_in_bytes);
+
 // value unref
 void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry);
 
+// the last tile this thread put into or got from the cache while the
+// report was pushed.  reports nest.
+struct _openslide_cache_report {
+  struct _openslide_cache_report *prev;
+  int32_t tiles;     // tiles put or got
+  bool uniform;      // every pixel of the last tile is color
+  uint32_t color;    // premultiplied ARGB
+  uint64_t size;     // of the last tile, in bytes
+};
+
+void _openslide_cache_report_push(struct _openslide_cache_report *report);
+void _openslide_cache_report_pop(struct _openslide_cache_report *report);
+
 typedef struct _openslide_cache_entry _openslide_cache_entry;
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(_openslide_cache_entry,
                               _openslide_cache_entry_unref)
 
 
+/* Worker pool */
+typedef void (*_openslide_worker_fn)(void *data);
+
+// item callback for a batch; called concurrently from multiple threads
+typedef bool (*_openslide_worker_batch_fn)(int64_t item, void *arg,
+                                           GError **err);
+
+// number of threads in the shared worker pool, or 0 if work runs inline
+int32_t _openslide_worker_get_thread_count(void);
+
+// configuration behind the public API.  threads is -1 for one per
+// processor, or 0 to run everything inline.  set_cpus() and
+// set_numa_node() fail if the platform can't set thread affinity.
+void _openslide_worker_set_max_threads(int32_t threads);
+bool _openslide_worker_set_cpus(const int32_t *cpus, int32_t count);
+bool _openslide_worker_set_numa_node(int32_t node);
+void _openslide_worker_set_priority(openslide_worker_priority_t priority);
+
+// run fn(data) asynchronously on the shared worker pool
+void _openslide_worker_submit(_openslide_worker_fn fn, void *data);
+
+// call fn for each item in [0, count) using the shared worker pool and the
+// calling thread, and wait for completion.  after the first failure, no
+// further items are started and that error is returned.
+bool _openslide_worker_run_batch(int64_t count,
+                                 _openslide_worker_batch_fn fn,
+                                 void *arg,
+                                 GError **err);
+
+// set the atomic flag that cancels reads on the current thread, or NULL
+void _openslide_worker_set_cancel_flag(gint *flag);
+
+// fail with OPENSLIDE_ERROR_CANCELLED if the current thread's read has been
+// cancelled.  call before starting work on each tile.
+bool _openslide_worker_check_cancelled(GError **err);
+
+
 /* Internal error propagation */
 enum OpenSlideError {
   // generic failure
@@ -355,6 +702,8 @@ enum OpenSlideError {
   OPENSLIDE_ERROR_CAIRO_ERROR,
   // no such value (e.g. for tifflike accessors)
   OPENSLIDE_ERROR_NO_VALUE,
+  // read cancelled by the caller; not propagated to the openslide_t
+  OPENSLIDE_ERROR_CANCELLED,
 };
 #define OPENSLIDE_ERROR _openslide_error_quark()
 GQuark _openslide_error_quark(void);
@@ -367,6 +716,7 @@ enum _openslide_debug_flag {
   OPENSLIDE_DEBUG_DETECTION,
   OPENSLIDE_DEBUG_JPEG_MARKERS,
   OPENSLIDE_DEBUG_PERFORMANCE,
+  OPENSLIDE_DEBUG_SCALAR,
   OPENSLIDE_DEBUG_SEARCH,
   OPENSLIDE_DEBUG_SQL,
   OPENSLIDE_DEBUG_SYNTHETIC,
@@ -399,6 +749,118 @@ void _openslide_performance_warn_once(gint *warned_flag,
 #define _OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_HEIGHT "openslide.associated.%s.height"
 #define _OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_ICC_SIZE "openslide.associated.%s.icc-size"
 
+/* Pixel conversion to ARGB32, vectorized where the CPU allows */
+void _openslide_simd_rgb24_to_argb32(const uint8_t *src, uint32_t *dst,
+                                     int64_t n);
+void _openslide_simd_bgr24_to_argb32(const uint8_t *src, uint32_t *dst,
+                                     int64_t n);
+// little-endian 16-bit samples, truncated to 8 bits
+void _openslide_simd_bgr48_to_argb32(const uint8_t *src, uint32_t *dst,
+                                     int64_t n);
+void _openslide_simd_planar8_to_argb32(const uint8_t *r, const uint8_t *g,
+                                       const uint8_t *b, uint32_t *dst,
+                                       int64_t n);
+// samples truncated to 8 bits
+void _openslide_simd_planar32_to_argb32(const int32_t *r, const int32_t *g,
+                                        const int32_t *b, uint32_t *dst,
+                                        int64_t n);
+// one row; chroma subsampled 2x horizontally
+void _openslide_simd_ycbcr422_32_to_argb32(const int32_t *y,
+                                           const int32_t *cb,
+                                           const int32_t *cr,
+                                           uint32_t *dst, int64_t w);
+// add each byte of n pixels to the corresponding one of 4n sums
+void _openslide_simd_accumulate_argb32(const uint32_t *src, uint32_t *acc,
+                                       int64_t n);
+
+/* Instrumentation */
+enum _openslide_phase {
+  _OPENSLIDE_PHASE_IO,
+  _OPENSLIDE_PHASE_DECODE,
+  _OPENSLIDE_PHASE_CACHE_WAIT,
+  _OPENSLIDE_PHASE_COMPOSITE,
+  _OPENSLIDE_PHASE_COUNT,
+};
+
+void _openslide_trace_init(void);
+void _openslide_trace_set_enabled(bool enabled);
+void _openslide_trace_get_stats(openslide_instrumentation_stats_t *stats);
+void _openslide_trace_reset_stats(void);
+
+// Start timing a phase.  Returns a token for _openslide_phase_end(): 0 if
+// instrumentation is off, negative if this thread is already in the phase.
+int64_t _openslide_phase_begin(enum _openslide_phase phase);
+void _openslide_phase_end(enum _openslide_phase phase, int64_t token,
+                          uint64_t bytes);
+// End a phase, excluding time this thread spent in other phases since
+// _openslide_phase_mark() returned mark.
+uint64_t _openslide_phase_mark(void);
+void _openslide_phase_end_exclusive(enum _openslide_phase phase,
+                                    int64_t token, uint64_t mark);
+
+// Totals for one public read call.  Begin returns NULL if instrumentation
+// is off or the thread is already inside a read.
+struct _openslide_read_record *_openslide_read_stats_begin(void);
+void _openslide_read_stats_end(struct _openslide_read_record *rs);
+typedef struct _openslide_read_record _openslide_read_record;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(_openslide_read_record,
+                              _openslide_read_stats_end)
+// carry the current read over to a worker thread
+struct _openslide_read_record *_openslide_read_stats_get_current(void);
+void _openslide_read_stats_set_current(struct _openslide_read_record *rs);
+// add this thread's share of the current read to it.  other threads
+// working on a read must do this before the read can end.
+void _openslide_read_stats_merge(void);
+// bracket a pass that decodes the read's tiles into the cache
+void _openslide_read_stats_set_prefetching(bool prefetching);
+void _openslide_read_stats_add_cache_hit(void);
+void _openslide_read_stats_add_cache_miss(void);
+void _openslide_read_stats_get_last(openslide_read_stats_t *stats);
+
+/* Resampling */
+// the integer box reduction applied before filtering for a scale factor
+int32_t _openslide_resample_box_factor(double scale);
+// source pixels a filter reads beyond a region
+int64_t _openslide_resample_margin(openslide_scale_filter_t filter,
+                                   double scale);
+// Box sums of a bw x bh plane of kx x ky boxes, built up from blocks of
+// source pixels so the source never has to be held at once
+struct _openslide_resample_box;
+struct _openslide_resample_box *
+_openslide_resample_box_new(int64_t bw, int64_t bh, int32_t kx, int32_t ky,
+                            GError **err);
+// add a w x h block of premultiplied ARGB at x, y in source pixels from the
+// plane's origin; the block must lie within bw * kx x bh * ky
+void _openslide_resample_box_add(struct _openslide_resample_box *box,
+                                 const uint32_t *src,
+                                 int64_t x, int64_t y,
+                                 int64_t w, int64_t h);
+// Scale the averaged boxes into dest.  x and y locate the top left of dest
+// within the plane, and scale_x and scale_y are the size of a dest pixel,
+// all in source pixels.  For consistent results across calls, the plane's
+// origin must be a multiple of the box factor in its source.
+void _openslide_resample_box_finish(const struct _openslide_resample_box *box,
+                                    double x, double y,
+                                    double scale_x, double scale_y,
+                                    openslide_scale_filter_t filter,
+                                    uint32_t *dest, int64_t stride,
+                                    int64_t dw, int64_t dh);
+void _openslide_resample_box_free(struct _openslide_resample_box *box);
+typedef struct _openslide_resample_box _openslide_resample_box;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(_openslide_resample_box,
+                              _openslide_resample_box_free)
+
+/* Color management */
+// a conversion from an ICC profile to sRGB; fails if OpenSlide was built
+// without lcms2
+struct _openslide_color_transform *
+_openslide_color_transform_new(const void *profile, int64_t profile_size,
+                               GError **err);
+// convert premultiplied ARGB in place
+void _openslide_color_transform_apply(const struct _openslide_color_transform *ct,
+                                      uint32_t *pixels, int64_t count);
+void _openslide_color_transform_free(struct _openslide_color_transform *ct);
+
 /* Tables */
 // YCbCr -> RGB chroma contributions
 extern const int16_t _openslide_R_Cr[256];
@@ -0,0 +1,233 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide-private.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+// Each open slide has an entry, found by path while it can be shared and
+// by handle until it is closed.  Entries that are still acquired but can
+// no longer be shared, because the file changed or the handle is in
+// error, are detached from the path table and closed on their last
+// release.  Unreferenced entries wait in an LRU queue for reuse or
+// eviction.  Slides are opened and closed without holding the lock.
+
+struct entry {
+  char *path;
+  openslide_t *osr;  // NULL while opening
+  int64_t mtime;
+  int64_t size;
+  int32_t refcount;
+  bool detached;
+  GList *idle_link;  // in registry->idle, while unreferenced
+};
+
+struct _openslide_registry {
+  GMutex lock;
+  GCond open_cond;       // an open finished
+  GHashTable *by_path;   // path -> struct entry, for shareable entries
+  GHashTable *by_osr;    // openslide_t -> struct entry, for open entries
+  GQueue idle;           // struct entry, most recently released first
+  int32_t max_slides;
+  openslide_cache_t *cache;  // or NULL
+};
+
+static void entry_free(struct entry *e) {
+  g_free(e->path);
+  g_free(e);
+}
+
+static void get_file_stamp(const char *path, int64_t *mtime, int64_t *size) {
+  // non-local paths can't be checked; assume they don't change
+  GStatBuf st;
+  if (g_stat(path, &st)) {
+    *mtime = -1;
+    *size = -1;
+    return;
+  }
+  *mtime = st.st_mtime;
+  *size = st.st_size;
+}
+
+static void detach(openslide_registry_t *reg, struct entry *e) {
+  if (!e->detached) {
+    g_hash_table_remove(reg->by_path, e->path);
+    e->detached = true;
+  }
+}
+
+// forget an unreferenced entry; the caller closes its handle
+static openslide_t *remove_entry(openslide_registry_t *reg, struct entry *e) {
+  g_assert(e->refcount == 0);
+  detach(reg, e);
+  if (e->idle_link) {
+    g_queue_delete_link(&reg->idle, e->idle_link);
+  }
+  g_hash_table_remove(reg->by_osr, e->osr);
+  openslide_t *osr = e->osr;
+  entry_free(e);
+  return osr;
+}
+
+// evict idle entries beyond the limit; returns handles to close
+static GSList *evict(openslide_registry_t *reg, int32_t max_slides) {
+  GSList *closing = NULL;
+  while (g_hash_table_size(reg->by_osr) > (guint) max_slides &&
+         reg->idle.length) {
+    struct entry *e = g_queue_peek_tail(&reg->idle);
+    closing = g_slist_prepend(closing, remove_entry(reg, e));
+  }
+  return closing;
+}
+
+static void close_all(GSList *closing) {
+  g_slist_free_full(closing, (GDestroyNotify) openslide_close);
+}
+
+openslide_registry_t *openslide_registry_create(int32_t max_slides,
+                                                size_t cache_capacity) {
+  openslide_registry_t *reg = g_new0(openslide_registry_t, 1);
+  g_mutex_init(&reg->lock);
+  g_cond_init(&reg->open_cond);
+  reg->by_path = g_hash_table_new(g_str_hash, g_str_equal);
+  reg->by_osr = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&reg->idle);
+  reg->max_slides = MAX(max_slides, 0);
+  if (cache_capacity) {
+    reg->cache = openslide_cache_create(cache_capacity);
+  }
+  return reg;
+}
+
+openslide_t *openslide_registry_acquire(openslide_registry_t *reg,
+                                        const char *filename) {
+  int64_t mtime, size;
+  get_file_stamp(filename, &mtime, &size);
+
+  g_mutex_lock(&reg->lock);
+  GSList *closing = NULL;
+  struct entry *e;
+  while ((e = g_hash_table_lookup(reg->by_path, filename))) {
+    if (!e->osr) {
+      // another thread is opening it
+      g_cond_wait(&reg->open_cond, &reg->lock);
+      continue;
+    }
+    if (e->mtime == mtime && e->size == size) {
+      if (e->idle_link) {
+        g_queue_delete_link(&reg->idle, e->idle_link);
+        e->idle_link = NULL;
+      }
+      e->refcount++;
+      g_mutex_unlock(&reg->lock);
+      return e->osr;
+    }
+    // file changed
+    if (e->refcount) {
+      detach(reg, e);
+    } else {
+      closing = g_slist_prepend(closing, remove_entry(reg, e));
+    }
+  }
+
+  // add a placeholder so concurrent callers wait for us
+  e = g_new0(struct entry, 1);
+  e->path = g_strdup(filename);
+  e->mtime = mtime;
+  e->size = size;
+  g_hash_table_insert(reg->by_path, e->path, e);
+  g_mutex_unlock(&reg->lock);
+
+  close_all(closing);
+  openslide_t *osr = openslide_open(filename);
+  if (osr && reg->cache) {
+    openslide_set_cache(osr, reg->cache);
+  }
+
+  g_mutex_lock(&reg->lock);
+  if (!osr) {
+    g_hash_table_remove(reg->by_path, e->path);
+    entry_free(e);
+  } else {
+    e->osr = osr;
+    e->refcount = 1;
+    g_hash_table_insert(reg->by_osr, osr, e);
+    if (openslide_get_error(osr)) {
+      // let the next caller retry
+      detach(reg, e);
+    }
+    closing = evict(reg, reg->max_slides);
+  }
+  g_cond_broadcast(&reg->open_cond);
+  g_mutex_unlock(&reg->lock);
+
+  close_all(closing);
+  return osr;
+}
+
+void openslide_registry_release(openslide_registry_t *reg,
+                                openslide_t *osr) {
+  g_mutex_lock(&reg->lock);
+  struct entry *e = g_hash_table_lookup(reg->by_osr, osr);
+  if (!e || e->refcount <= 0) {
+    g_mutex_unlock(&reg->lock);
+    g_warning("Releasing OpenSlide object not acquired from registry");
+    return;
+  }
+  GSList *closing = NULL;
+  if (--e->refcount == 0) {
+    if (e->detached) {
+      closing = g_slist_prepend(closing, remove_entry(reg, e));
+    } else {
+      g_queue_push_head(&reg->idle, e);
+      e->idle_link = reg->idle.head;
+      closing = evict(reg, reg->max_slides);
+    }
+  }
+  g_mutex_unlock(&reg->lock);
+
+  close_all(closing);
+}
+
+void openslide_registry_close_idle(openslide_registry_t *reg) {
+  g_mutex_lock(&reg->lock);
+  GSList *closing = evict(reg, 0);
+  g_mutex_unlock(&reg->lock);
+
+  close_all(closing);
+}
+
+void openslide_registry_destroy(openslide_registry_t *reg) {
+  openslide_registry_close_idle(reg);
+  if (g_hash_table_size(reg->by_osr)) {
+    g_warning("Destroying slide registry with acquired slides");
+  }
+
+  g_hash_table_unref(reg->by_osr);
+  g_hash_table_unref(reg->by_path);
+  if (reg->cache) {
+    openslide_cache_release(reg->cache);
+  }
+  g_cond_clear(&reg->open_cond);
+  g_mutex_clear(&reg->lock);
+  g_free(reg);
+}
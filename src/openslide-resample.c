@@ -0,0 +1,247 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide-private.h"
+
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+
+// Scaling happens in two steps.  Whole factors of two or more are removed
+// by averaging boxes of source pixels, which is exact and cheap.  The
+// remaining factor, below 2, is applied by a separable filter: a tent for
+// the fast filter, Lanczos-3 for the best one.  Filtering is done on
+// premultiplied samples, in float.
+
+// byte of a pixel holding alpha
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define ALPHA 3
+#else
+#define ALPHA 0
+#endif
+
+// contributions of a span of source samples to one dest sample
+struct contrib {
+  int64_t start;
+  int32_t count;
+  float *weights;
+};
+
+static double filter_radius(openslide_scale_filter_t filter) {
+  return filter == OPENSLIDE_SCALE_FILTER_BEST ? 3 : 1;
+}
+
+static double filter_kernel(openslide_scale_filter_t filter, double x) {
+  x = fabs(x);
+  if (filter != OPENSLIDE_SCALE_FILTER_BEST) {
+    return MAX(1 - x, 0);
+  }
+  if (x < 1e-8) {
+    return 1;
+  }
+  if (x >= 3) {
+    return 0;
+  }
+  return 3 * sin(G_PI * x) * sin(G_PI * x / 3) / (G_PI * G_PI * x * x);
+}
+
+int32_t _openslide_resample_box_factor(double scale) {
+  return scale >= 2 ? (int32_t) MIN(floor(scale), G_MAXINT32) : 1;
+}
+
+int64_t _openslide_resample_margin(openslide_scale_filter_t filter,
+                                   double scale) {
+  int32_t k = _openslide_resample_box_factor(scale);
+  double support = filter_radius(filter) * MAX(scale / k, 1);
+  return ceil((support + 1) * k);
+}
+
+// weights for count dest samples starting at pos in a source of len
+// samples, each dest sample scale source samples wide
+static struct contrib *compute_contribs(openslide_scale_filter_t filter,
+                                        double pos, double scale,
+                                        int64_t len, int64_t count,
+                                        float **weights) {
+  double width = MAX(scale, 1);
+  double support = filter_radius(filter) * width;
+  int32_t max_count = ceil(2 * support) + 3;
+  struct contrib *contribs = g_new(struct contrib, count);
+  *weights = g_new0(float, count * max_count);
+
+  for (int64_t i = 0; i < count; i++) {
+    struct contrib *c = &contribs[i];
+    double center = pos + (i + 0.5) * scale;
+    int64_t lo = MAX((int64_t) floor(center - support - 0.5), 0);
+    int64_t hi = MIN((int64_t) ceil(center + support - 0.5), len - 1);
+    c->start = lo;
+    c->count = CLAMP(hi - lo + 1, 0, max_count);
+    c->weights = *weights + i * max_count;
+
+    double total = 0;
+    for (int32_t k = 0; k < c->count; k++) {
+      double w = filter_kernel(filter, (lo + k + 0.5 - center) / width);
+      c->weights[k] = w;
+      total += w;
+    }
+    if (total != 0) {
+      for (int32_t k = 0; k < c->count; k++) {
+        c->weights[k] /= total;
+      }
+    }
+  }
+  return contribs;
+}
+
+struct _openslide_resample_box {
+  int64_t bw;
+  int64_t bh;
+  int32_t kx;
+  int32_t ky;
+  uint64_t *sums;  // per channel, of the source pixels in each box
+};
+
+struct _openslide_resample_box *
+_openslide_resample_box_new(int64_t bw, int64_t bh, int32_t kx, int32_t ky,
+                            GError **err) {
+  uint64_t *sums = g_try_malloc0(bw * bh * 4 * sizeof(*sums));
+  if (bw && bh && !sums) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't allocate %"PRId64"x%"PRId64" box plane", bw, bh);
+    return NULL;
+  }
+  struct _openslide_resample_box *box =
+    g_new(struct _openslide_resample_box, 1);
+  box->bw = bw;
+  box->bh = bh;
+  box->kx = kx;
+  box->ky = ky;
+  box->sums = sums;
+  return box;
+}
+
+void _openslide_resample_box_add(struct _openslide_resample_box *box,
+                                 const uint32_t *src,
+                                 int64_t x, int64_t y,
+                                 int64_t w, int64_t h) {
+  g_autofree uint32_t *acc = g_new(uint32_t, w * 4);
+  int64_t row = 0;
+  while (row < h) {
+    // sum the rows falling in one row of boxes
+    int64_t brow = (y + row) / box->ky;
+    int64_t end = MIN(h, (brow + 1) * box->ky - y);
+    memset(acc, 0, w * 4 * sizeof(*acc));
+    for (; row < end; row++) {
+      _openslide_simd_accumulate_argb32(src + row * w, acc, w);
+    }
+
+    // then the columns falling in each box
+    uint64_t *out = box->sums + brow * box->bw * 4;
+    int64_t col = 0;
+    while (col < w) {
+      int64_t bcol = (x + col) / box->kx;
+      int64_t col_end = MIN(w, (bcol + 1) * box->kx - x);
+      uint64_t sum[4] = {0};
+      for (; col < col_end; col++) {
+        for (int c = 0; c < 4; c++) {
+          sum[c] += acc[col * 4 + c];
+        }
+      }
+      for (int c = 0; c < 4; c++) {
+        out[bcol * 4 + c] += sum[c];
+      }
+    }
+  }
+}
+
+void _openslide_resample_box_free(struct _openslide_resample_box *box) {
+  g_free(box->sums);
+  g_free(box);
+}
+
+void _openslide_resample_box_finish(const struct _openslide_resample_box *b,
+                                    double x, double y,
+                                    double scale_x, double scale_y,
+                                    openslide_scale_filter_t filter,
+                                    uint32_t *dest, int64_t stride,
+                                    int64_t dw, int64_t dh) {
+  int32_t kx = b->kx;
+  int32_t ky = b->ky;
+  int64_t bw = b->bw;
+  int64_t bh = b->bh;
+  g_autofree float *box = g_new(float, bw * bh * 4);
+  float inv = 1.0 / ((double) kx * ky);
+  for (int64_t i = 0; i < bw * bh * 4; i++) {
+    box[i] = b->sums[i] * inv;
+  }
+
+  g_autofree float *xweights = NULL;
+  g_autofree float *yweights = NULL;
+  g_autofree struct contrib *xc =
+    compute_contribs(filter, x / kx, scale_x / kx, bw, dw, &xweights);
+  g_autofree struct contrib *yc =
+    compute_contribs(filter, y / ky, scale_y / ky, bh, dh, &yweights);
+
+  // horizontal pass, over the box rows used by the vertical one
+  int64_t row0 = bh;
+  int64_t row1 = 0;
+  for (int64_t j = 0; j < dh; j++) {
+    if (yc[j].count) {
+      row0 = MIN(row0, yc[j].start);
+      row1 = MAX(row1, yc[j].start + yc[j].count);
+    }
+  }
+  g_autofree float *tmp = g_new0(float, MAX(row1 - row0, 0) * dw * 4);
+  for (int64_t row = row0; row < row1; row++) {
+    const float *in = box + row * bw * 4;
+    float *out = tmp + (row - row0) * dw * 4;
+    for (int64_t i = 0; i < dw; i++) {
+      const struct contrib *c = &xc[i];
+      float sum[4] = {0};
+      for (int32_t k = 0; k < c->count; k++) {
+        const float *p = in + (c->start + k) * 4;
+        for (int ch = 0; ch < 4; ch++) {
+          sum[ch] += c->weights[k] * p[ch];
+        }
+      }
+      memcpy(out + i * 4, sum, sizeof(sum));
+    }
+  }
+
+  // vertical pass, clamping to valid premultiplied values
+  for (int64_t j = 0; j < dh; j++) {
+    const struct contrib *c = &yc[j];
+    uint8_t *out = (uint8_t *) (dest + j * stride);
+    for (int64_t i = 0; i < dw; i++) {
+      float sum[4] = {0};
+      for (int32_t k = 0; k < c->count; k++) {
+        const float *p = tmp + ((c->start + k - row0) * dw + i) * 4;
+        for (int ch = 0; ch < 4; ch++) {
+          sum[ch] += c->weights[k] * p[ch];
+        }
+      }
+      int alpha = CLAMP(lrintf(sum[ALPHA]), 0, 255);
+      for (int ch = 0; ch < 4; ch++) {
+        out[i * 4 + ch] = ch == ALPHA ? alpha :
+                          CLAMP(lrintf(sum[ch]), 0, alpha);
+      }
+    }
+  }
+}
@@ -0,0 +1,477 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide-private.h"
+
+#include <string.h>
+#include <glib.h>
+
+// Pixel conversion kernels producing premultiplied-opaque ARGB32.
+// Each has a scalar implementation and, where it pays, vector ones
+// chosen at runtime: SSSE3 and AVX2 on x86, NEON on little-endian ARM.
+// All implementations produce bit-identical output; the YCbCr kernel
+// gathers from the same chroma tables as the scalar code.  The
+// accumulation kernel sums pixel bytes for box filtering.
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+struct kernels {
+  void (*rgb24)(const uint8_t *src, uint32_t *dst, int64_t n);
+  void (*bgr24)(const uint8_t *src, uint32_t *dst, int64_t n);
+  void (*bgr48)(const uint8_t *src, uint32_t *dst, int64_t n);
+  void (*planar8)(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                  uint32_t *dst, int64_t n);
+  void (*planar32)(const int32_t *r, const int32_t *g, const int32_t *b,
+                   uint32_t *dst, int64_t n);
+  void (*ycbcr422_32)(const int32_t *y, const int32_t *cb, const int32_t *cr,
+                      uint32_t *dst, int64_t w);
+  void (*accumulate)(const uint32_t *src, uint32_t *acc, int64_t n);
+};
+
+/* scalar */
+
+static void rgb24_scalar(const uint8_t *src, uint32_t *dst, int64_t n) {
+  for (int64_t i = 0; i < n; i++, src += 3) {
+    dst[i] = 0xff000000 | src[0] << 16 | src[1] << 8 | src[2];
+  }
+}
+
+static void bgr24_scalar(const uint8_t *src, uint32_t *dst, int64_t n) {
+  for (int64_t i = 0; i < n; i++, src += 3) {
+    dst[i] = 0xff000000 | src[2] << 16 | src[1] << 8 | src[0];
+  }
+}
+
+// little-endian 16-bit samples; keep the high bytes
+static void bgr48_scalar(const uint8_t *src, uint32_t *dst, int64_t n) {
+  for (int64_t i = 0; i < n; i++, src += 6) {
+    dst[i] = 0xff000000 | src[5] << 16 | src[3] << 8 | src[1];
+  }
+}
+
+static void planar8_scalar(const uint8_t *r, const uint8_t *g,
+                           const uint8_t *b, uint32_t *dst, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    dst[i] = 0xff000000 | r[i] << 16 | g[i] << 8 | b[i];
+  }
+}
+
+// samples are truncated to 8 bits
+static void planar32_scalar(const int32_t *r, const int32_t *g,
+                            const int32_t *b, uint32_t *dst, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    dst[i] = 0xff000000 | (uint8_t) r[i] << 16 | (uint8_t) g[i] << 8 |
+             (uint8_t) b[i];
+  }
+}
+
+static inline uint32_t ycbcr_pixel(uint8_t Y, int16_t R_chroma,
+                                   int16_t G_chroma, int16_t B_chroma) {
+  int16_t R = Y + R_chroma;
+  int16_t G = Y + G_chroma;
+  int16_t B = Y + B_chroma;
+
+  R = CLAMP(R, 0, 255);
+  G = CLAMP(G, 0, 255);
+  B = CLAMP(B, 0, 255);
+
+  return 0xff000000 | ((uint8_t) R << 16) | ((uint8_t) G << 8) | ((uint8_t) B);
+}
+
+// convert pixels [start, w) of a row with horizontally-subsampled chroma
+static void ycbcr422_32_tail(const int32_t *y, const int32_t *cb,
+                             const int32_t *cr, uint32_t *dst,
+                             int64_t start, int64_t w) {
+  for (int64_t x = start; x < w; x++) {
+    uint8_t c0 = y[x];
+    uint8_t c1 = cb[x / 2];
+    uint8_t c2 = cr[x / 2];
+    int16_t R_chroma = _openslide_R_Cr[c2];
+    int16_t G_chroma = (_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16;
+    int16_t B_chroma = _openslide_B_Cb[c1];
+    dst[x] = ycbcr_pixel(c0, R_chroma, G_chroma, B_chroma);
+  }
+}
+
+static void ycbcr422_32_scalar(const int32_t *y, const int32_t *cb,
+                               const int32_t *cr, uint32_t *dst, int64_t w) {
+  ycbcr422_32_tail(y, cb, cr, dst, 0, w);
+}
+
+static void accumulate_scalar(const uint32_t *src, uint32_t *acc,
+                              int64_t n) {
+  const uint8_t *p = (const uint8_t *) src;
+  for (int64_t i = 0; i < 4 * n; i++) {
+    acc[i] += p[i];
+  }
+}
+
+static const struct kernels scalar_kernels = {
+  .rgb24 = rgb24_scalar,
+  .bgr24 = bgr24_scalar,
+  .bgr48 = bgr48_scalar,
+  .planar8 = planar8_scalar,
+  .planar32 = planar32_scalar,
+  .ycbcr422_32 = ycbcr422_32_scalar,
+  .accumulate = accumulate_scalar,
+};
+
+#ifdef HAVE_X86_SIMD
+
+/* SSE2 (always available on x86_64) and SSSE3 */
+
+#define SSE_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// 4 packed 24-bit pixels per 16-byte load; the load reads 4 bytes past
+// the pixels, so stop while 16 bytes remain
+SSE_TARGET
+static void rgb24_ssse3(const uint8_t *src, uint32_t *dst, int64_t n) {
+  const __m128i shuf = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+                                     8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  int64_t i = 0;
+  for (; i + 6 <= n; i += 4, src += 12) {
+    __m128i v = _mm_loadu_si128((const __m128i *) src);
+    v = _mm_or_si128(_mm_shuffle_epi8(v, shuf), alpha);
+    _mm_storeu_si128((__m128i *) (dst + i), v);
+  }
+  rgb24_scalar(src, dst + i, n - i);
+}
+
+SSE_TARGET
+static void bgr24_ssse3(const uint8_t *src, uint32_t *dst, int64_t n) {
+  const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                     6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  int64_t i = 0;
+  for (; i + 6 <= n; i += 4, src += 12) {
+    __m128i v = _mm_loadu_si128((const __m128i *) src);
+    v = _mm_or_si128(_mm_shuffle_epi8(v, shuf), alpha);
+    _mm_storeu_si128((__m128i *) (dst + i), v);
+  }
+  bgr24_scalar(src, dst + i, n - i);
+}
+
+// 2 packed 48-bit pixels per 16-byte load
+SSE_TARGET
+static void bgr48_ssse3(const uint8_t *src, uint32_t *dst, int64_t n) {
+  const __m128i shuf = _mm_setr_epi8(1, 3, 5, -1, 7, 9, 11, -1,
+                                     -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  int64_t i = 0;
+  for (; i + 5 <= n; i += 4, src += 24) {
+    __m128i lo = _mm_loadu_si128((const __m128i *) src);
+    __m128i hi = _mm_loadu_si128((const __m128i *) (src + 12));
+    __m128i v = _mm_unpacklo_epi64(_mm_shuffle_epi8(lo, shuf),
+                                   _mm_shuffle_epi8(hi, shuf));
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(v, alpha));
+  }
+  bgr48_scalar(src, dst + i, n - i);
+}
+
+SSE_TARGET
+static void planar8_ssse3(const uint8_t *r, const uint8_t *g,
+                          const uint8_t *b, uint32_t *dst, int64_t n) {
+  const __m128i ff = _mm_set1_epi8(-1);
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i rv = _mm_loadu_si128((const __m128i *) (r + i));
+    __m128i gv = _mm_loadu_si128((const __m128i *) (g + i));
+    __m128i bv = _mm_loadu_si128((const __m128i *) (b + i));
+    __m128i bg_lo = _mm_unpacklo_epi8(bv, gv);
+    __m128i bg_hi = _mm_unpackhi_epi8(bv, gv);
+    __m128i ra_lo = _mm_unpacklo_epi8(rv, ff);
+    __m128i ra_hi = _mm_unpackhi_epi8(rv, ff);
+    __m128i *out = (__m128i *) (dst + i);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bg_hi, ra_hi));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bg_hi, ra_hi));
+  }
+  planar8_scalar(r + i, g + i, b + i, dst + i, n - i);
+}
+
+SSE_TARGET
+static void accumulate_ssse3(const uint32_t *src, uint32_t *acc, int64_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128i *out = (__m128i *) (acc + 4 * i);
+#define ADD(k, v) _mm_storeu_si128(out + (k), \
+    _mm_add_epi32(_mm_loadu_si128(out + (k)), (v)))
+    ADD(0, _mm_unpacklo_epi16(lo, zero));
+    ADD(1, _mm_unpackhi_epi16(lo, zero));
+    ADD(2, _mm_unpacklo_epi16(hi, zero));
+    ADD(3, _mm_unpackhi_epi16(hi, zero));
+#undef ADD
+  }
+  accumulate_scalar(src + i, acc + 4 * i, n - i);
+}
+
+/* AVX2 */
+
+AVX2_TARGET
+static void planar32_avx2(const int32_t *r, const int32_t *g,
+                          const int32_t *b, uint32_t *dst, int64_t n) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i rv = _mm256_loadu_si256((const __m256i *) (r + i));
+    __m256i gv = _mm256_loadu_si256((const __m256i *) (g + i));
+    __m256i bv = _mm256_loadu_si256((const __m256i *) (b + i));
+    __m256i v = _mm256_or_si256(
+      _mm256_or_si256(alpha, _mm256_slli_epi32(_mm256_and_si256(rv, mask), 16)),
+      _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(gv, mask), 8),
+                      _mm256_and_si256(bv, mask)));
+    _mm256_storeu_si256((__m256i *) (dst + i), v);
+  }
+  planar32_scalar(r + i, g + i, b + i, dst + i, n - i);
+}
+
+// the 16-bit tables widened, so they can be gathered
+static int32_t R_Cr32[256];
+static int32_t B_Cb32[256];
+
+// 8 pixels at a time, sharing 4 chroma samples
+AVX2_TARGET
+static void ycbcr422_32_avx2(const int32_t *y, const int32_t *cb,
+                             const int32_t *cr, uint32_t *dst, int64_t w) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);
+  int64_t x = 0;
+  for (; x + 8 <= w; x += 8) {
+    __m256i yv = _mm256_and_si256(
+      _mm256_loadu_si256((const __m256i *) (y + x)), mask);
+    __m256i cbv = _mm256_and_si256(_mm256_permutevar8x32_epi32(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (cb + x / 2))),
+      dup), mask);
+    __m256i crv = _mm256_and_si256(_mm256_permutevar8x32_epi32(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (cr + x / 2))),
+      dup), mask);
+
+    __m256i r_chroma = _mm256_i32gather_epi32(R_Cr32, crv, 4);
+    __m256i b_chroma = _mm256_i32gather_epi32(B_Cb32, cbv, 4);
+    __m256i g_chroma = _mm256_srai_epi32(
+      _mm256_add_epi32(_mm256_i32gather_epi32(_openslide_G_Cb, cbv, 4),
+                       _mm256_i32gather_epi32(_openslide_G_Cr, crv, 4)),
+      16);
+
+    __m256i rv = _mm256_min_epi32(_mm256_max_epi32(
+      _mm256_add_epi32(yv, r_chroma), zero), mask);
+    __m256i gv = _mm256_min_epi32(_mm256_max_epi32(
+      _mm256_add_epi32(yv, g_chroma), zero), mask);
+    __m256i bv = _mm256_min_epi32(_mm256_max_epi32(
+      _mm256_add_epi32(yv, b_chroma), zero), mask);
+    __m256i v = _mm256_or_si256(
+      _mm256_or_si256(alpha, _mm256_slli_epi32(rv, 16)),
+      _mm256_or_si256(_mm256_slli_epi32(gv, 8), bv));
+    _mm256_storeu_si256((__m256i *) (dst + x), v);
+  }
+  ycbcr422_32_tail(y, cb, cr, dst, x, w);
+}
+
+AVX2_TARGET
+static void accumulate_avx2(const uint32_t *src, uint32_t *acc, int64_t n) {
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const uint8_t *p = (const uint8_t *) (src + i);
+    __m256i *out = (__m256i *) (acc + 4 * i);
+    for (int k = 0; k < 4; k++) {
+      __m256i v = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i *) (p + 8 * k)));
+      _mm256_storeu_si256(out + k,
+                          _mm256_add_epi32(_mm256_loadu_si256(out + k), v));
+    }
+  }
+  accumulate_scalar(src + i, acc + 4 * i, n - i);
+}
+
+#endif
+
+#ifdef HAVE_NEON
+
+static void rgb24_neon(const uint8_t *src, uint32_t *dst, int64_t n) {
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16, src += 48) {
+    uint8x16x3_t in = vld3q_u8(src);
+    uint8x16x4_t out = {{in.val[2], in.val[1], in.val[0], vdupq_n_u8(0xff)}};
+    vst4q_u8((uint8_t *) (dst + i), out);
+  }
+  rgb24_scalar(src, dst + i, n - i);
+}
+
+static void bgr24_neon(const uint8_t *src, uint32_t *dst, int64_t n) {
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16, src += 48) {
+    uint8x16x3_t in = vld3q_u8(src);
+    uint8x16x4_t out = {{in.val[0], in.val[1], in.val[2], vdupq_n_u8(0xff)}};
+    vst4q_u8((uint8_t *) (dst + i), out);
+  }
+  bgr24_scalar(src, dst + i, n - i);
+}
+
+static void bgr48_neon(const uint8_t *src, uint32_t *dst, int64_t n) {
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8, src += 48) {
+    uint16x8x3_t in = vld3q_u16((const uint16_t *) src);
+    uint8x8x4_t out = {{vshrn_n_u16(in.val[0], 8), vshrn_n_u16(in.val[1], 8),
+                        vshrn_n_u16(in.val[2], 8), vdup_n_u8(0xff)}};
+    vst4_u8((uint8_t *) (dst + i), out);
+  }
+  bgr48_scalar(src, dst + i, n - i);
+}
+
+static void planar8_neon(const uint8_t *r, const uint8_t *g,
+                         const uint8_t *b, uint32_t *dst, int64_t n) {
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16x4_t out = {{vld1q_u8(b + i), vld1q_u8(g + i), vld1q_u8(r + i),
+                         vdupq_n_u8(0xff)}};
+    vst4q_u8((uint8_t *) (dst + i), out);
+  }
+  planar8_scalar(r + i, g + i, b + i, dst + i, n - i);
+}
+
+static void planar32_neon(const int32_t *r, const int32_t *g,
+                          const int32_t *b, uint32_t *dst, int64_t n) {
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    // narrowing moves truncate
+#define NARROW(p) vmovn_u16(vcombine_u16( \
+    vmovn_u32(vreinterpretq_u32_s32(vld1q_s32((p) + i))), \
+    vmovn_u32(vreinterpretq_u32_s32(vld1q_s32((p) + i + 4)))))
+    uint8x8x4_t out = {{NARROW(b), NARROW(g), NARROW(r), vdup_n_u8(0xff)}};
+#undef NARROW
+    vst4_u8((uint8_t *) (dst + i), out);
+  }
+  planar32_scalar(r + i, g + i, b + i, dst + i, n - i);
+}
+
+static void accumulate_neon(const uint32_t *src, uint32_t *acc, int64_t n) {
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint8x16_t v = vld1q_u8((const uint8_t *) (src + i));
+    uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+    uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+    uint32_t *out = acc + 4 * i;
+    vst1q_u32(out, vaddw_u16(vld1q_u32(out), vget_low_u16(lo)));
+    vst1q_u32(out + 4, vaddw_u16(vld1q_u32(out + 4), vget_high_u16(lo)));
+    vst1q_u32(out + 8, vaddw_u16(vld1q_u32(out + 8), vget_low_u16(hi)));
+    vst1q_u32(out + 12, vaddw_u16(vld1q_u32(out + 12), vget_high_u16(hi)));
+  }
+  accumulate_scalar(src + i, acc + 4 * i, n - i);
+}
+
+#endif
+
+static void *select_kernels(void *arg G_GNUC_UNUSED) {
+  static struct kernels k;
+  k = scalar_kernels;
+  if (_openslide_debug(OPENSLIDE_DEBUG_SCALAR)) {
+    return &k;
+  }
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    k.rgb24 = rgb24_ssse3;
+    k.bgr24 = bgr24_ssse3;
+    k.bgr48 = bgr48_ssse3;
+    k.planar8 = planar8_ssse3;
+    k.accumulate = accumulate_ssse3;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    for (int i = 0; i < 256; i++) {
+      R_Cr32[i] = _openslide_R_Cr[i];
+      B_Cb32[i] = _openslide_B_Cb[i];
+    }
+    k.planar32 = planar32_avx2;
+    k.ycbcr422_32 = ycbcr422_32_avx2;
+    k.accumulate = accumulate_avx2;
+  }
+#endif
+#ifdef HAVE_NEON
+  k.rgb24 = rgb24_neon;
+  k.bgr24 = bgr24_neon;
+  k.bgr48 = bgr48_neon;
+  k.planar8 = planar8_neon;
+  k.planar32 = planar32_neon;
+  k.accumulate = accumulate_neon;
+#endif
+  return &k;
+}
+
+static const struct kernels *get_kernels(void) {
+  static GOnce once = G_ONCE_INIT;
+  return g_once(&once, select_kernels, NULL);
+}
+
+void _openslide_simd_rgb24_to_argb32(const uint8_t *src, uint32_t *dst,
+                                     int64_t n) {
+  get_kernels()->rgb24(src, dst, n);
+}
+
+void _openslide_simd_bgr24_to_argb32(const uint8_t *src, uint32_t *dst,
+                                     int64_t n) {
+  get_kernels()->bgr24(src, dst, n);
+}
+
+void _openslide_simd_bgr48_to_argb32(const uint8_t *src, uint32_t *dst,
+                                     int64_t n) {
+  get_kernels()->bgr48(src, dst, n);
+}
+
+void _openslide_simd_planar8_to_argb32(const uint8_t *r, const uint8_t *g,
+                                       const uint8_t *b, uint32_t *dst,
+                                       int64_t n) {
+  get_kernels()->planar8(r, g, b, dst, n);
+}
+
+void _openslide_simd_planar32_to_argb32(const int32_t *r, const int32_t *g,
+                                        const int32_t *b, uint32_t *dst,
+                                        int64_t n) {
+  get_kernels()->planar32(r, g, b, dst, n);
+}
+
+void _openslide_simd_ycbcr422_32_to_argb32(const int32_t *y,
+                                           const int32_t *cb,
+                                           const int32_t *cr,
+                                           uint32_t *dst, int64_t w) {
+  get_kernels()->ycbcr422_32(y, cb, cr, dst, w);
+}
+
+void _openslide_simd_accumulate_argb32(const uint32_t *src, uint32_t *acc,
+                                       int64_t n) {
+  get_kernels()->accumulate(src, acc, n);
+}
@@ -0,0 +1,453 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+// Phase timing.  When instrumentation is off, a phase costs one atomic
+// load.  When it's on, each outermost phase on a thread is timed and
+// added to the thread's totals, and optionally written to the thread's
+// trace buffer.  Totals are merged when they're read, and trace buffers
+// are written out when they fill, when the thread leaves a read, and when
+// the thread exits.
+
+static const char TRACE_ENV_VAR[] = "OPENSLIDE_TRACE";
+
+static const char *const phase_names[] = {
+  [_OPENSLIDE_PHASE_IO] = "io",
+  [_OPENSLIDE_PHASE_DECODE] = "decode",
+  [_OPENSLIDE_PHASE_CACHE_WAIT] = "cache-wait",
+  [_OPENSLIDE_PHASE_COMPOSITE] = "composite",
+};
+
+struct totals {
+  uint64_t count;
+  uint64_t ns;
+  uint64_t bytes;
+};
+
+// totals for one public read call, shared by the threads working on it.
+// each thread keeps its own share and adds it in when it leaves the read.
+struct _openslide_read_record {
+  GMutex lock;
+  openslide_read_stats_t stats;
+  // Tiles are first decoded into the cache by a prefetch pass, and then
+  // composited from the cache.  Count cache lookups in the first pass and
+  // tiles in the second.
+  gint prefetching;  // atomic
+  gint prefetched;   // atomic
+};
+
+struct thread_state {
+  int32_t depth[_OPENSLIDE_PHASE_COUNT];
+  // time in outermost non-composite phases, for exclusive timing
+  uint64_t ns;
+  // trace thread ID
+  int32_t id;
+  // read in progress on this thread, if any
+  struct _openslide_read_record *read;
+  // this thread's share of that read, not yet added to it
+  openslide_read_stats_t read_stats;
+  // totals from the last read started on this thread
+  openslide_read_stats_t last_read;
+  // phase totals; only contended while they're being merged or reset
+  GMutex lock;
+  struct totals totals[_OPENSLIDE_PHASE_COUNT];
+  // trace events not yet written
+  GString *trace;
+  uint64_t trace_events;
+};
+
+static gint enabled;
+
+static void thread_state_free(gpointer data);
+
+// every thread's state, and the totals of threads that have exited
+static GMutex threads_lock;
+static GSList *threads;
+static struct totals retired[_OPENSLIDE_PHASE_COUNT];
+
+static GPrivate thread_state_key = G_PRIVATE_INIT(thread_state_free);
+static gint next_thread_id;
+
+// Chrome trace output, if requested at startup
+#define TRACE_BUFFER_SIZE (64 << 10)
+static GMutex trace_lock;
+static FILE *trace_file;
+static int64_t trace_epoch;
+static uint64_t trace_events;
+
+static int64_t now_ns(void) {
+#ifdef _WIN32
+  return g_get_monotonic_time() * 1000;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void add_totals(struct totals *dest, const struct totals *src) {
+  for (int i = 0; i < _OPENSLIDE_PHASE_COUNT; i++) {
+    dest[i].count += src[i].count;
+    dest[i].ns += src[i].ns;
+    dest[i].bytes += src[i].bytes;
+  }
+}
+
+static void flush_trace(struct thread_state *ts) {
+  if (!ts->trace_events) {
+    return;
+  }
+  // events are buffered with a leading separator, which the first event
+  // in the file mustn't have
+  g_mutex_lock(&trace_lock);
+  fputs(ts->trace->str + (trace_events ? 0 : 1), trace_file);
+  trace_events += ts->trace_events;
+  g_mutex_unlock(&trace_lock);
+  g_string_truncate(ts->trace, 0);
+  ts->trace_events = 0;
+}
+
+static struct thread_state *get_thread_state(void) {
+  struct thread_state *ts = g_private_get(&thread_state_key);
+  if (!ts) {
+    ts = g_new0(struct thread_state, 1);
+    ts->id = g_atomic_int_add(&next_thread_id, 1) + 1;
+    g_mutex_init(&ts->lock);
+    if (trace_file) {
+      ts->trace = g_string_sized_new(TRACE_BUFFER_SIZE);
+    }
+    g_private_set(&thread_state_key, ts);
+    g_mutex_lock(&threads_lock);
+    threads = g_slist_prepend(threads, ts);
+    g_mutex_unlock(&threads_lock);
+  }
+  return ts;
+}
+
+static void thread_state_free(gpointer data) {
+  struct thread_state *ts = data;
+  g_mutex_lock(&threads_lock);
+  threads = g_slist_remove(threads, ts);
+  add_totals(retired, ts->totals);
+  g_mutex_unlock(&threads_lock);
+  if (ts->trace) {
+    flush_trace(ts);
+    g_string_free(ts->trace, true);
+  }
+  g_mutex_clear(&ts->lock);
+  g_free(ts);
+}
+
+// called from shared-library constructor!
+void _openslide_trace_init(void) {
+  // note: g_getenv() is not reentrant
+  const char *path = g_getenv(TRACE_ENV_VAR);
+  if (!path || !*path) {
+    return;
+  }
+  trace_file = g_fopen(path, "w");
+  if (!trace_file) {
+    g_warning("Couldn't open trace file %s", path);
+    return;
+  }
+  // the closing bracket is optional in the JSON Array Format, so a
+  // process that exits without closing the trace still leaves it valid
+  fputs("[\n", trace_file);
+  trace_epoch = now_ns();
+  g_atomic_int_set(&enabled, true);
+}
+
+void _openslide_trace_set_enabled(bool enable) {
+  g_atomic_int_set(&enabled, enable);
+}
+
+void _openslide_trace_get_stats(openslide_instrumentation_stats_t *out) {
+  openslide_phase_stats_t *phases[] = {
+    [_OPENSLIDE_PHASE_IO] = &out->io,
+    [_OPENSLIDE_PHASE_DECODE] = &out->decode,
+    [_OPENSLIDE_PHASE_CACHE_WAIT] = &out->cache_wait,
+    [_OPENSLIDE_PHASE_COMPOSITE] = &out->composite,
+  };
+  struct totals stats[_OPENSLIDE_PHASE_COUNT];
+  g_mutex_lock(&threads_lock);
+  memcpy(stats, retired, sizeof(stats));
+  for (GSList *l = threads; l; l = l->next) {
+    struct thread_state *ts = l->data;
+    g_mutex_lock(&ts->lock);
+    add_totals(stats, ts->totals);
+    g_mutex_unlock(&ts->lock);
+  }
+  g_mutex_unlock(&threads_lock);
+  memset(out, 0, sizeof(*out));
+  for (int i = 0; i < _OPENSLIDE_PHASE_COUNT; i++) {
+    phases[i]->count = stats[i].count;
+    phases[i]->nanoseconds = stats[i].ns;
+    phases[i]->bytes = stats[i].bytes;
+  }
+}
+
+void _openslide_trace_reset_stats(void) {
+  g_mutex_lock(&threads_lock);
+  memset(retired, 0, sizeof(retired));
+  for (GSList *l = threads; l; l = l->next) {
+    struct thread_state *ts = l->data;
+    g_mutex_lock(&ts->lock);
+    memset(ts->totals, 0, sizeof(ts->totals));
+    g_mutex_unlock(&ts->lock);
+  }
+  g_mutex_unlock(&threads_lock);
+}
+
+int64_t _openslide_phase_begin(enum _openslide_phase phase) {
+  if (!g_atomic_int_get(&enabled)) {
+    return 0;
+  }
+  struct thread_state *ts = get_thread_state();
+  if (ts->depth[phase]++) {
+    return -1;
+  }
+  return MAX(now_ns(), 1);
+}
+
+static void emit(struct thread_state *ts, const char *name,
+                 int64_t start, uint64_t duration, uint64_t bytes) {
+#ifdef HAVE_SYS_SDT_H
+  DTRACE_PROBE3(openslide, phase, name, duration, bytes);
+#endif
+  if (!ts->trace) {
+    return;
+  }
+  g_string_append_printf(ts->trace,
+                         ",{\"name\":\"%s\",\"cat\":\"openslide\","
+                         "\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"pid\":1,\"tid\":%d,"
+                         "\"args\":{\"bytes\":%"PRIu64"}}\n",
+                         name, (start - trace_epoch) / 1000.0,
+                         duration / 1000.0, ts->id, bytes);
+  ts->trace_events++;
+  if (ts->trace->len >= TRACE_BUFFER_SIZE) {
+    flush_trace(ts);
+  }
+}
+
+static void add_read_stats(struct thread_state *ts,
+                           enum _openslide_phase phase,
+                           uint64_t ns, uint64_t bytes) {
+  struct _openslide_read_record *rs = ts->read;
+  if (!rs) {
+    return;
+  }
+  switch (phase) {
+  case _OPENSLIDE_PHASE_IO:
+    ts->read_stats.bytes_read += bytes;
+    break;
+  case _OPENSLIDE_PHASE_DECODE:
+    ts->read_stats.decode_nanoseconds += ns;
+    break;
+  case _OPENSLIDE_PHASE_COMPOSITE:
+    if (!g_atomic_int_get(&rs->prefetching)) {
+      ts->read_stats.tiles++;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// add this thread's share to its read
+static void merge_read_stats(struct thread_state *ts) {
+  struct _openslide_read_record *rs = ts->read;
+  if (!rs) {
+    return;
+  }
+  g_mutex_lock(&rs->lock);
+  rs->stats.tiles += ts->read_stats.tiles;
+  rs->stats.cache_hits += ts->read_stats.cache_hits;
+  rs->stats.cache_misses += ts->read_stats.cache_misses;
+  rs->stats.bytes_read += ts->read_stats.bytes_read;
+  rs->stats.decode_nanoseconds += ts->read_stats.decode_nanoseconds;
+  g_mutex_unlock(&rs->lock);
+  memset(&ts->read_stats, 0, sizeof(ts->read_stats));
+}
+
+static void finish(struct thread_state *ts, enum _openslide_phase phase,
+                   int64_t start, uint64_t duration, uint64_t counted,
+                   uint64_t bytes) {
+  g_mutex_lock(&ts->lock);
+  ts->totals[phase].count++;
+  ts->totals[phase].ns += counted;
+  ts->totals[phase].bytes += bytes;
+  g_mutex_unlock(&ts->lock);
+  add_read_stats(ts, phase, counted, bytes);
+  emit(ts, phase_names[phase], start, duration, bytes);
+}
+
+void _openslide_phase_end(enum _openslide_phase phase, int64_t token,
+                          uint64_t bytes) {
+  if (!token) {
+    return;
+  }
+  struct thread_state *ts = get_thread_state();
+  ts->depth[phase]--;
+  if (token < 0) {
+    return;
+  }
+  uint64_t duration = MAX(now_ns() - token, 0);
+
+  // only the outermost phase counts toward exclusive timing
+  bool outermost = true;
+  for (int i = 0; i < _OPENSLIDE_PHASE_COUNT; i++) {
+    if (i != _OPENSLIDE_PHASE_COMPOSITE && ts->depth[i]) {
+      outermost = false;
+    }
+  }
+  if (outermost) {
+    ts->ns += duration;
+  }
+  finish(ts, phase, token, duration, duration, bytes);
+}
+
+uint64_t _openslide_phase_mark(void) {
+  if (!g_atomic_int_get(&enabled)) {
+    return 0;
+  }
+  return get_thread_state()->ns;
+}
+
+void _openslide_phase_end_exclusive(enum _openslide_phase phase,
+                                    int64_t token, uint64_t mark) {
+  if (!token) {
+    return;
+  }
+  struct thread_state *ts = get_thread_state();
+  ts->depth[phase]--;
+  if (token < 0) {
+    return;
+  }
+  uint64_t duration = MAX(now_ns() - token, 0);
+  uint64_t inner = ts->ns - mark;
+  finish(ts, phase, token, duration,
+         duration > inner ? duration - inner : 0, 0);
+}
+
+struct _openslide_read_record *_openslide_read_stats_begin(void) {
+  if (!g_atomic_int_get(&enabled)) {
+    return NULL;
+  }
+  struct thread_state *ts = get_thread_state();
+  if (ts->read) {
+    // nested inside another read, which gets the totals
+    return NULL;
+  }
+  struct _openslide_read_record *rs = g_new0(struct _openslide_read_record, 1);
+  g_mutex_init(&rs->lock);
+  ts->read = rs;
+  return rs;
+}
+
+void _openslide_read_stats_end(struct _openslide_read_record *rs) {
+  struct thread_state *ts = get_thread_state();
+  g_assert(ts->read == rs);
+  merge_read_stats(ts);
+  ts->read = NULL;
+  if (ts->trace) {
+    flush_trace(ts);
+  }
+  // no other thread can still be recording into rs
+  ts->last_read = rs->stats;
+  g_mutex_clear(&rs->lock);
+  g_free(rs);
+}
+
+struct _openslide_read_record *_openslide_read_stats_get_current(void) {
+  if (!g_atomic_int_get(&enabled)) {
+    return NULL;
+  }
+  return get_thread_state()->read;
+}
+
+void _openslide_read_stats_set_current(struct _openslide_read_record *rs) {
+  struct thread_state *ts = get_thread_state();
+  // the previous read may already have ended; its share was merged by
+  // _openslide_read_stats_merge()
+  memset(&ts->read_stats, 0, sizeof(ts->read_stats));
+  ts->read = rs;
+  if (!rs && ts->trace) {
+    flush_trace(ts);
+  }
+}
+
+void _openslide_read_stats_merge(void) {
+  merge_read_stats(get_thread_state());
+}
+
+void _openslide_read_stats_set_prefetching(bool prefetching) {
+  struct _openslide_read_record *rs = _openslide_read_stats_get_current();
+  if (!rs) {
+    return;
+  }
+  g_atomic_int_set(&rs->prefetching, prefetching);
+  g_atomic_int_set(&rs->prefetched, true);
+}
+
+static void add_cache_lookup(bool hit) {
+  if (!g_atomic_int_get(&enabled)) {
+    return;
+  }
+  struct thread_state *ts = get_thread_state();
+  struct _openslide_read_record *rs = ts->read;
+  if (!rs) {
+    return;
+  }
+  if (g_atomic_int_get(&rs->prefetching) ||
+      !g_atomic_int_get(&rs->prefetched)) {
+    if (hit) {
+      ts->read_stats.cache_hits++;
+    } else {
+      ts->read_stats.cache_misses++;
+    }
+  }
+}
+
+void _openslide_read_stats_add_cache_hit(void) {
+  add_cache_lookup(true);
+}
+
+void _openslide_read_stats_add_cache_miss(void) {
+  add_cache_lookup(false);
+}
+
+void _openslide_read_stats_get_last(openslide_read_stats_t *out) {
+  *out = get_thread_state()->last_read;
+}
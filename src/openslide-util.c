@@ -33,6 +33,10 @@
 #include <zstd.h>
 
 #define KEY_FILE_HARD_MAX_SIZE (100 << 20)
+// tiles are decoded partially if they have at least this many pixels, and
+// no more than 1/PARTIAL_TILE_MAX_FRACTION of them are visible
+#define PARTIAL_TILE_MIN_PIXELS (1024 * 1024)
+#define PARTIAL_TILE_MAX_FRACTION 16
 
 static const char DEBUG_ENV_VAR[] = "OPENSLIDE_DEBUG";
 
@@ -48,12 +52,15 @@ static const struct debug_option {
    "verify Hamamatsu restart markers"},
   {"performance", OPENSLIDE_DEBUG_PERFORMANCE,
    "log conditions causing poor performance"},
+  {"scalar", OPENSLIDE_DEBUG_SCALAR,
+   "use scalar code instead of SIMD kernels"},
   {"search", OPENSLIDE_DEBUG_SEARCH,
    "log skipped files when searching directory"},
   {"sql", OPENSLIDE_DEBUG_SQL,
    "log SQL queries"},
   {"synthetic", OPENSLIDE_DEBUG_SYNTHETIC,
-   "openslide_open(\"\") opens a synthetic test slide"},
+   "openslide_open(\"\") opens a synthetic test slide, "
+   "openslide_open(\"synthetic:PARAMS\") a generated pyramid"},
   {"tiles", OPENSLIDE_DEBUG_TILES, "render tile outlines"},
   {NULL, 0, NULL}
 };
@@ -135,9 +142,9 @@ static void zlib_error(z_stream *strm, int64_t dst_len, int error_code,
   }
 }
 
-void *_openslide_inflate_buffer(const void *src, int64_t src_len,
-                                int64_t dst_len,
-                                GError **err) {
+static void *inflate_buffer(const void *src, int64_t src_len,
+                            int64_t dst_len,
+                            GError **err) {
   g_autofree void *dst = g_malloc(dst_len);
   z_stream strm = {
     .avail_in = src_len,
@@ -165,8 +172,35 @@ void *_openslide_inflate_buffer(const void *src, int64_t src_len,
   return g_steal_pointer(&dst);
 }
 
-void *_openslide_zstd_decompress_buffer(const void *src, int64_t src_len,
-                                        int64_t dst_len, GError **err) {
+void *_openslide_inflate_buffer(const void *src, int64_t src_len,
+                                int64_t dst_len,
+                                GError **err) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+  void *dst = inflate_buffer(src, src_len, dst_len, err);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase, dst ? dst_len : 0);
+  return dst;
+}
+
+static void zstd_dctx_free(void *dctx) {
+  ZSTD_freeDCtx(dctx);
+}
+
+// each thread keeps a decompression context rather than having zstd
+// allocate one per call
+static GPrivate zstd_dctx_key = G_PRIVATE_INIT(zstd_dctx_free);
+
+static void *zstd_decompress_buffer(const void *src, int64_t src_len,
+                                    int64_t dst_len, GError **err) {
+  ZSTD_DCtx *dctx = g_private_get(&zstd_dctx_key);
+  if (!dctx) {
+    dctx = ZSTD_createDCtx();
+    if (!dctx) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't create zstd decompression context");
+      return NULL;
+    }
+    g_private_set(&zstd_dctx_key, dctx);
+  }
   g_autofree void *dst = g_try_malloc(dst_len);
   if (!dst) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -174,7 +208,7 @@ void *_openslide_zstd_decompress_buffer(const void *src, int64_t src_len,
                 dst_len);
     return NULL;
   }
-  size_t rc = ZSTD_decompress(dst, dst_len, src, src_len);
+  size_t rc = ZSTD_decompressDCtx(dctx, dst, dst_len, src, src_len);
   if (ZSTD_isError(rc)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "zstd decompression error: %s", ZSTD_getErrorName(rc));
@@ -189,6 +223,162 @@ void *_openslide_zstd_decompress_buffer(const void *src, int64_t src_len,
   return g_steal_pointer(&dst);
 }
 
+void *_openslide_zstd_decompress_buffer(const void *src, int64_t src_len,
+                                        int64_t dst_len, GError **err) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+  void *dst = zstd_decompress_buffer(src, src_len, dst_len, err);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase, dst ? dst_len : 0);
+  return dst;
+}
+
+void *_openslide_zstd_compress_buffer(const void *src, int64_t src_len,
+                                      int64_t *dst_len) {
+  size_t bound = ZSTD_compressBound(src_len);
+  g_autofree void *dst = g_try_malloc(bound);
+  if (!dst) {
+    return NULL;
+  }
+  size_t rc = ZSTD_compress(dst, bound, src, src_len, 1);
+  if (ZSTD_isError(rc) || (int64_t) rc >= src_len) {
+    return NULL;
+  }
+  *dst_len = rc;
+  return g_realloc(g_steal_pointer(&dst), rc);
+}
+
+#define LZW_CLEAR 256
+#define LZW_EOI 257
+#define LZW_FIRST_CODE 258
+#define LZW_MAX_BITS 12
+
+struct lzw_table {
+  uint16_t prefix[1 << LZW_MAX_BITS];
+  uint16_t length[1 << LZW_MAX_BITS];
+  uint8_t suffix[1 << LZW_MAX_BITS];
+  uint8_t first[1 << LZW_MAX_BITS];
+};
+
+// write the string for code, dropping any part past avail
+static void lzw_write(const struct lzw_table *t, uint16_t code,
+                      uint8_t *dst, int64_t avail) {
+  for (int32_t i = t->length[code] - 1; i >= 0; i--) {
+    if (i < avail) {
+      dst[i] = t->suffix[code];
+    }
+    code = t->prefix[code];
+  }
+}
+
+// TIFF flavor of LZW: MSB-first codes, widened one code early
+static void *lzw_decompress_buffer(const void *src, int64_t src_len,
+                                   int64_t dst_len, GError **err) {
+  const uint8_t *in = src;
+  if (src_len >= 2 && in[0] == 0 && (in[1] & 1)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Old-style LZW compression is not supported");
+    return NULL;
+  }
+  g_autofree uint8_t *dst = g_try_malloc(dst_len);
+  g_autofree struct lzw_table *t = g_try_new(struct lzw_table, 1);
+  if (!dst || !t) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't allocate %"PRId64" bytes for LZW decompression",
+                dst_len);
+    return NULL;
+  }
+  for (int i = 0; i < 256; i++) {
+    t->prefix[i] = 0;
+    t->length[i] = 1;
+    t->suffix[i] = i;
+    t->first[i] = i;
+  }
+
+  int64_t pos = 0;
+  int64_t out = 0;
+  uint32_t bitbuf = 0;
+  int bits = 0;
+  int width = 9;
+  int next = LZW_FIRST_CODE;
+  int prev = -1;
+  while (out < dst_len) {
+    while (bits < width && pos < src_len) {
+      bitbuf = (bitbuf << 8) | in[pos++];
+      bits += 8;
+    }
+    if (bits < width) {
+      break;
+    }
+    int code = (bitbuf >> (bits - width)) & ((1 << width) - 1);
+    bits -= width;
+
+    if (code == LZW_EOI) {
+      break;
+    } else if (code == LZW_CLEAR) {
+      width = 9;
+      next = LZW_FIRST_CODE;
+      prev = -1;
+      continue;
+    } else if (prev == -1) {
+      if (code > 255) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Corrupt LZW data: code %d after clear", code);
+        return NULL;
+      }
+      dst[out++] = code;
+      prev = code;
+      continue;
+    }
+
+    uint8_t first;
+    if (code < next) {
+      first = t->first[code];
+      lzw_write(t, code, dst + out, dst_len - out);
+      out += t->length[code];
+    } else if (code == next) {
+      // the string for prev, followed by its own first byte
+      first = t->first[prev];
+      lzw_write(t, prev, dst + out, dst_len - out);
+      out += t->length[prev];
+      if (out < dst_len) {
+        dst[out] = first;
+      }
+      out++;
+    } else {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Corrupt LZW data: code %d is undefined", code);
+      return NULL;
+    }
+
+    if (next < (1 << LZW_MAX_BITS)) {
+      t->prefix[next] = prev;
+      t->length[next] = t->length[prev] + 1;
+      t->suffix[next] = first;
+      t->first[next] = t->first[prev];
+      next++;
+      if (next + 1 >= (1 << width) && width < LZW_MAX_BITS) {
+        width++;
+      }
+    }
+    prev = code;
+  }
+
+  if (out < dst_len) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Short read while decompressing: %"PRId64"/%"PRId64,
+                out, dst_len);
+    return NULL;
+  }
+  return g_steal_pointer(&dst);
+}
+
+void *_openslide_lzw_decompress_buffer(const void *src, int64_t src_len,
+                                       int64_t dst_len, GError **err) {
+  int64_t phase = _openslide_phase_begin(_OPENSLIDE_PHASE_DECODE);
+  void *dst = lzw_decompress_buffer(src, src_len, dst_len, err);
+  _openslide_phase_end(_OPENSLIDE_PHASE_DECODE, phase, dst ? dst_len : 0);
+  return dst;
+}
+
 int64_t _openslide_compute_seek(int64_t initial, int64_t length,
                                 int64_t offset, int whence) {
   int64_t result = initial;
@@ -208,6 +398,45 @@ int64_t _openslide_compute_seek(int64_t initial, int64_t length,
   return result;
 }
 
+// succeeds if the header couldn't be read, so callers fall back to
+// checking the file themselves
+bool _openslide_probe_check_magic(struct _openslide_probe *probe,
+                                  size_t offset,
+                                  const void *magic, size_t len,
+                                  GError **err) {
+  g_assert(offset + len <= sizeof(probe->header));
+  if (!probe->header_len) {
+    return true;
+  }
+  if (probe->header_len < offset + len ||
+      memcmp(probe->header + offset, magic, len)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "File signature doesn't match");
+    return false;
+  }
+  return true;
+}
+
+void _openslide_probe_set_data(struct _openslide_probe *probe,
+                               void *data, GDestroyNotify destroy) {
+  _openslide_probe_clear(probe);
+  probe->data = data;
+  probe->destroy_data = destroy;
+}
+
+void *_openslide_probe_steal_data(struct _openslide_probe *probe) {
+  probe->destroy_data = NULL;
+  return g_steal_pointer(&probe->data);
+}
+
+void _openslide_probe_clear(struct _openslide_probe *probe) {
+  if (probe->data && probe->destroy_data) {
+    probe->destroy_data(probe->data);
+  }
+  probe->data = NULL;
+  probe->destroy_data = NULL;
+}
+
 bool _openslide_parse_int64(const char *value, int64_t *result) {
   char *endptr;
   errno = 0;
@@ -348,6 +577,119 @@ bool _openslide_clip_tile(uint32_t *tiledata,
   return _openslide_check_cairo_status(cr, err);
 }
 
+bool _openslide_get_partial_tile_region(cairo_t *cr,
+                                        int64_t tile_w, int64_t tile_h,
+                                        int32_t *x, int32_t *y,
+                                        int32_t *w, int32_t *h) {
+  if (tile_w * tile_h < PARTIAL_TILE_MIN_PIXELS) {
+    return false;
+  }
+
+  double x1, y1, x2, y2;
+  cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+  int64_t left = MAX((int64_t) floor(x1), 0);
+  int64_t top = MAX((int64_t) floor(y1), 0);
+  int64_t right = MIN((int64_t) ceil(x2), tile_w);
+  int64_t bottom = MIN((int64_t) ceil(y2), tile_h);
+  if (right <= left || bottom <= top ||
+      (right - left) * (bottom - top) * PARTIAL_TILE_MAX_FRACTION >
+      tile_w * tile_h) {
+    return false;
+  }
+
+  *x = left;
+  *y = top;
+  *w = right - left;
+  *h = bottom - top;
+  return true;
+}
+
+void *_openslide_level_get_scaled_plane(struct _openslide_level *l,
+                                        int32_t scale) {
+  switch (scale) {
+  case 2:
+    return &l->scaled_plane[0];
+  case 4:
+    return &l->scaled_plane[1];
+  case 8:
+    return &l->scaled_plane[2];
+  default:
+    g_assert_not_reached();
+  }
+}
+
+int32_t _openslide_pixel_format_bytes(openslide_pixel_format_t format) {
+  switch (format) {
+  case OPENSLIDE_PIXEL_FORMAT_ARGB:
+  case OPENSLIDE_PIXEL_FORMAT_RGBA:
+    return 4;
+  case OPENSLIDE_PIXEL_FORMAT_RGB:
+    return 3;
+  case OPENSLIDE_PIXEL_FORMAT_GRAY:
+    return 1;
+  }
+  return 0;
+}
+
+static inline uint8_t unpremultiply(uint32_t c, uint32_t a) {
+  return MIN((c * 255 + a / 2) / a, 255);
+}
+
+void _openslide_convert_pixels(const uint32_t *src, void *dest,
+                               int64_t count,
+                               openslide_pixel_format_t format) {
+  uint8_t *d = dest;
+  switch (format) {
+  case OPENSLIDE_PIXEL_FORMAT_ARGB:
+    memcpy(dest, src, count * 4);
+    break;
+  case OPENSLIDE_PIXEL_FORMAT_RGBA:
+    for (int64_t i = 0; i < count; i++) {
+      uint32_t p = src[i];
+      uint32_t a = p >> 24;
+      if (a == 255 || a == 0) {
+        d[0] = (p >> 16) & 0xff;
+        d[1] = (p >> 8) & 0xff;
+        d[2] = p & 0xff;
+      } else {
+        d[0] = unpremultiply((p >> 16) & 0xff, a);
+        d[1] = unpremultiply((p >> 8) & 0xff, a);
+        d[2] = unpremultiply(p & 0xff, a);
+      }
+      d[3] = a;
+      d += 4;
+    }
+    break;
+  case OPENSLIDE_PIXEL_FORMAT_RGB:
+    for (int64_t i = 0; i < count; i++) {
+      uint32_t p = src[i];
+      uint32_t a = p >> 24;
+      if (a == 255 || a == 0) {
+        d[0] = (p >> 16) & 0xff;
+        d[1] = (p >> 8) & 0xff;
+        d[2] = p & 0xff;
+      } else {
+        d[0] = unpremultiply((p >> 16) & 0xff, a);
+        d[1] = unpremultiply((p >> 8) & 0xff, a);
+        d[2] = unpremultiply(p & 0xff, a);
+      }
+      d += 3;
+    }
+    break;
+  case OPENSLIDE_PIXEL_FORMAT_GRAY:
+    for (int64_t i = 0; i < count; i++) {
+      uint32_t p = src[i];
+      uint32_t a = p >> 24;
+      // ITU-R BT.601 luma
+      uint32_t y = (77 * ((p >> 16) & 0xff) +
+                    150 * ((p >> 8) & 0xff) +
+                    29 * (p & 0xff) + 128) >> 8;
+      d[i] = (a == 255 || a == 0) ? y : unpremultiply(y, a);
+    }
+    break;
+  }
+}
+
 // note: g_getenv() is not reentrant
 void _openslide_debug_init(void) {
   const char *debug_str = g_getenv(DEBUG_ENV_VAR);
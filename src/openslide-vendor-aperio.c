@@ -168,6 +168,46 @@ static bool decode_tile(struct level *l,
                                        err);
 }
 
+static uint32_t *load_tile(openslide_t *osr,
+                           struct level *l,
+                           TIFF *tiff,
+                           int64_t tile_col, int64_t tile_row,
+                           struct _openslide_cache_entry **cache_entry,
+                           GError **err) {
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+
+  // tile size
+  int64_t tw = tiffl->tile_w;
+  int64_t th = tiffl->tile_h;
+
+  // cache
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            l, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
+  if (!decode_tile(l, tiff, buf, tile_col, tile_row, err)) {
+    return NULL;
+  }
+
+  // clip, if necessary
+  if (!_openslide_tiff_clip_tile(tiffl, buf,
+                                 tile_col, tile_row,
+                                 err)) {
+    return NULL;
+  }
+
+  // put it in the cache
+  tiledata = g_steal_pointer(&buf);
+  _openslide_cache_put(osr->cache, l, tile_col, tile_row,
+                       tiledata, tw * th * 4,
+                       cache_entry);
+  return tiledata;
+}
+
 static bool read_tile(openslide_t *osr,
 		      cairo_t *cr,
 		      struct _openslide_level *level,
@@ -175,43 +215,21 @@ static bool read_tile(openslide_t *osr,
 		      void *arg,
 		      GError **err) {
   struct level *l = (struct level *) level;
-  struct _openslide_tiff_level *tiffl = &l->tiffl;
   TIFF *tiff = arg;
 
-  // tile size
-  int64_t tw = tiffl->tile_w;
-  int64_t th = tiffl->tile_h;
-
-  // cache
   g_autoptr(_openslide_cache_entry) cache_entry = NULL;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = load_tile(osr, l, tiff, tile_col, tile_row,
+                                 &cache_entry, err);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(tw * th * 4);
-    if (!decode_tile(l, tiff, buf, tile_col, tile_row, err)) {
-      return false;
-    }
-
-    // clip, if necessary
-    if (!_openslide_tiff_clip_tile(tiffl, buf,
-                                   tile_col, tile_row,
-                                   err)) {
-      return false;
-    }
-
-    // put it in the cache
-    tiledata = g_steal_pointer(&buf);
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-			 tiledata, tw * th * 4,
-			 &cache_entry);
+    return false;
   }
 
   // draw it
   g_autoptr(cairo_surface_t) surface =
     cairo_image_surface_create_for_data((unsigned char *) tiledata,
                                         CAIRO_FORMAT_ARGB32,
-                                        tw, th, tw * 4);
+                                        l->tiffl.tile_w, l->tiffl.tile_h,
+                                        l->tiffl.tile_w * 4);
   cairo_set_source_surface(cr, surface, 0, 0);
   cairo_paint(cr);
 
@@ -238,6 +256,147 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
                                       err);
 }
 
+static uint32_t *get_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          struct _openslide_cache_entry **cache_entry,
+                          GError **err) {
+  struct aperio_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  // skip the TIFF handle if the tile is cached
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            level, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return NULL;
+  }
+  return load_tile(osr, l, ct.tiff, tile_col, tile_row, cache_entry, err);
+}
+
+static uint32_t *get_tile_scaled(openslide_t *osr,
+                                 struct _openslide_level *level,
+                                 int64_t tile_col, int64_t tile_row,
+                                 int32_t scale,
+                                 struct _openslide_cache_entry **cache_entry,
+                                 GError **err) {
+  struct aperio_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+  void *plane = _openslide_level_get_scaled_plane(level, scale);
+
+  // tile size
+  int64_t tw = tiffl->tile_w / scale;
+  int64_t th = tiffl->tile_h / scale;
+
+  // cache
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            plane, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return NULL;
+  }
+
+  g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
+  if (l->compression == APERIO_COMPRESSION_JP2K_YCBCR ||
+      l->compression == APERIO_COMPRESSION_JP2K_RGB) {
+    g_autofree void *data = NULL;
+    int32_t datalen;
+    if (!_openslide_tiff_read_tile_data(tiffl, ct.tiff,
+                                        &data, &datalen,
+                                        tile_col, tile_row,
+                                        err)) {
+      return NULL;
+    }
+    enum _openslide_jp2k_colorspace space =
+      l->compression == APERIO_COMPRESSION_JP2K_YCBCR ?
+      OPENSLIDE_JP2K_YCBCR : OPENSLIDE_JP2K_RGB;
+    if (!_openslide_jp2k_decode_buffer_scaled(buf,
+                                              tiffl->tile_w, tiffl->tile_h,
+                                              data, datalen,
+                                              space, scale,
+                                              err)) {
+      return NULL;
+    }
+    // clip to the scaled image dimensions
+    int64_t sw = (tiffl->image_w + scale - 1) / scale;
+    int64_t sh = (tiffl->image_h + scale - 1) / scale;
+    if (!_openslide_clip_tile(buf, tw, th,
+                              sw - tile_col * tw, sh - tile_row * th,
+                              err)) {
+      return NULL;
+    }
+  } else if (!_openslide_tiff_read_tile_scaled(tiffl, ct.tiff, buf,
+                                               tile_col, tile_row, scale,
+                                               err)) {
+    return NULL;
+  }
+
+  // put it in the cache
+  tiledata = g_steal_pointer(&buf);
+  _openslide_cache_put(osr->cache, plane, tile_col, tile_row,
+                       tiledata, tw * th * 4,
+                       cache_entry);
+  return tiledata;
+}
+
+static void *get_raw_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          openslide_tile_format_t *format, int64_t *size,
+                          struct _openslide_cache_entry **cache_entry,
+                          GError **err) {
+  struct aperio_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+
+  // missing tiles are synthesized
+  int64_t tile_no = tile_row * tiffl->tiles_across + tile_col;
+  if (g_hash_table_lookup_extended(l->missing_tiles, &tile_no, NULL, NULL)) {
+    return NULL;
+  }
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return NULL;
+  }
+
+  void *buf;
+  int32_t len;
+  if (!_openslide_tiff_read_jpeg_stream(tiffl, ct.tiff, &buf, &len,
+                                        tile_col, tile_row, err) || !buf) {
+    return NULL;
+  }
+  *format = OPENSLIDE_TILE_FORMAT_JPEG;
+  *size = len;
+  *cache_entry = _openslide_cache_entry_new(buf, len);
+  return buf;
+}
+
+static void prefetch_tile_data(openslide_t *osr,
+                               struct _openslide_level *level,
+                               const struct _openslide_tile_position *tiles,
+                               int64_t count) {
+  struct aperio_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, NULL);
+  if (ct.tiff == NULL) {
+    return;
+  }
+  _openslide_tiff_prefetch_tile_data(&l->tiffl, ct.tiff, tiles, count);
+}
+
 static bool read_icc_profile(openslide_t *osr, void *dest, GError **err) {
   struct level *l = (struct level *) osr->levels[0];
   struct aperio_ops_data *data = osr->data;
@@ -253,12 +412,18 @@ static bool read_icc_profile(openslide_t *osr, void *dest, GError **err) {
 
 static const struct _openslide_ops aperio_ops = {
   .paint_region = paint_region,
+  .get_tile = get_tile,
+  .get_tile_scaled = get_tile_scaled,
+  .get_raw_tile = get_raw_tile,
+  .prefetch_tile_data = prefetch_tile_data,
   .read_icc_profile = read_icc_profile,
   .destroy = destroy,
 };
 
 static bool aperio_detect(const char *filename G_GNUC_UNUSED,
-                          struct _openslide_tifflike *tl, GError **err) {
+                          struct _openslide_tifflike *tl,
+                          struct _openslide_probe *probe G_GNUC_UNUSED,
+                          GError **err) {
   // ensure we have a TIFF
   if (!tl) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -417,6 +582,7 @@ static void propagate_missing_tile(void *key, void *value G_GNUC_UNUSED,
 static bool aperio_open(openslide_t *osr,
                         const char *filename,
                         struct _openslide_tifflike *tl,
+                        struct _openslide_probe *probe G_GNUC_UNUSED,
                         struct _openslide_hash *quickhash1, GError **err) {
   // open TIFF
   g_autoptr(_openslide_tiffcache) tc = _openslide_tiffcache_create(filename);
@@ -510,6 +676,12 @@ static bool aperio_open(openslide_t *osr,
         _openslide_tiff_error(err, ct.tiff, "Can't read compression scheme");
         return false;
       }
+      // OpenJPEG can skip resolution levels to decode at reduced size
+      if (l->compression == APERIO_COMPRESSION_JP2K_YCBCR ||
+          l->compression == APERIO_COMPRESSION_JP2K_RGB) {
+        l->base.scaled_tiles = tiffl->tile_w % 8 == 0 &&
+                               tiffl->tile_h % 8 == 0;
+      }
 
       // some Aperio slides have some zero-length tiles, apparently due to
       // an encoder bug
@@ -565,6 +737,13 @@ static bool aperio_open(openslide_t *osr,
     g_hash_table_foreach(l->missing_tiles, propagate_missing_tile,
                          level_array->pdata[i + 1]);
   }
+  // missing tiles are rendered from the previous level at full size
+  for (guint i = 0; i < level_array->len; i++) {
+    struct level *l = level_array->pdata[i];
+    if (g_hash_table_size(l->missing_tiles)) {
+      l->base.scaled_tiles = false;
+    }
+  }
 
   // get icc profile size, if present
   struct level *base_level = level_array->pdata[0];
@@ -52,6 +52,12 @@ enum image_format {
   FORMAT_RGB,
 };
 
+// a filehandle for reading frames
+struct dicom_reader {
+  DcmFilehandle *filehandle;
+  struct _openslide_dicom_io *dio;
+};
+
 struct dicom_file {
   char *filename;
 
@@ -59,6 +65,13 @@ struct dicom_file {
   DcmFilehandle *filehandle;
   struct _openslide_dicom_io *dio;
   uint64_t dio_users;
+
+  // libdicom filehandles aren't thread-safe, so concurrent frame reads
+  // use a pool of filehandles that grows on demand.  the first reader
+  // borrows the main filehandle.
+  GQueue idle_readers;
+  int32_t reader_count;
+  GCond reader_cond;
   const DcmDataSet *file_meta;
   const DcmDataSet *metadata;
   const char *slide_id;
@@ -122,6 +135,10 @@ static const struct allowed_types LEVEL_TYPES = {
   G_N_ELEMENTS(LEVEL_TYPE_STRINGS)
 };
 
+// Part 10 files normally have a 128-byte preamble followed by this prefix
+static const char DICOM_PREFIX[] = "DICM";
+#define DICOM_PREFIX_OFFSET 128
+
 // the ImageTypes we allow for associated images
 static const char LABEL_TYPE[] = "LABEL";
 static const char OVERVIEW_TYPE[] = "OVERVIEW";
@@ -200,7 +217,17 @@ static struct syntax_format supported_syntax_formats[] = {
 };
 
 static void dicom_file_destroy(struct dicom_file *f) {
+  g_warn_if_fail(g_queue_get_length(&f->idle_readers) ==
+                 (guint) f->reader_count);
+  struct dicom_reader *r;
+  while ((r = g_queue_pop_head(&f->idle_readers)) != NULL) {
+    if (r->filehandle != f->filehandle) {
+      dcm_filehandle_destroy(r->filehandle);
+    }
+    g_free(r);
+  }
   dcm_filehandle_destroy(f->filehandle);
+  g_cond_clear(&f->reader_cond);
   g_mutex_clear(&f->lock);
   g_free(f->filename);
   g_free(f);
@@ -223,16 +250,62 @@ static struct dicom_file_io dicom_file_io_get(struct dicom_file *f) {
 
 // put a dicom_file reference, and close the underlying _openslide_file if idle
 static void dicom_file_io_put(struct dicom_file_io *fio) {
-  g_mutex_lock(&fio->file->lock);
-  if (!--fio->file->dio_users) {
-    _openslide_dicom_io_suspend(fio->file->dio);
+  struct dicom_file *f = fio->file;
+  g_mutex_lock(&f->lock);
+  if (!--f->dio_users) {
+    _openslide_dicom_io_suspend(f->dio);
+    for (GList *l = f->idle_readers.head; l; l = l->next) {
+      struct dicom_reader *r = l->data;
+      _openslide_dicom_io_suspend(r->dio);
+    }
   }
-  g_mutex_unlock(&fio->file->lock);
+  g_mutex_unlock(&f->lock);
 }
 
 typedef struct dicom_file_io dicom_file_io;
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(dicom_file_io, dicom_file_io_put)
 
+// get an idle reader, opening another filehandle if all are busy
+static struct dicom_reader *dicom_reader_get(struct dicom_file *f,
+                                             GError **err) {
+  int32_t max_readers = _openslide_worker_get_thread_count() + 1;
+  g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
+    g_mutex_locker_new(&f->lock);
+  while (true) {
+    struct dicom_reader *r = g_queue_pop_head(&f->idle_readers);
+    if (r) {
+      return r;
+    }
+    if (f->reader_count < max_readers) {
+      break;
+    }
+    g_cond_wait(&f->reader_cond, &f->lock);
+  }
+
+  // open a new filehandle without holding the lock.  it will read the
+  // metadata and offset table on first use.
+  f->reader_count++;
+  g_mutex_unlock(&f->lock);
+  struct dicom_reader *r = g_new0(struct dicom_reader, 1);
+  r->filehandle = _openslide_dicom_open(f->filename, &r->dio, err);
+  g_mutex_lock(&f->lock);
+  if (!r->filehandle) {
+    g_free(r);
+    f->reader_count--;
+    g_cond_signal(&f->reader_cond);
+    return NULL;
+  }
+  return r;
+}
+
+static void dicom_reader_put(struct dicom_file *f, struct dicom_reader *r) {
+  g_mutex_lock(&f->lock);
+  // reuse the most recently used reader first
+  g_queue_push_head(&f->idle_readers, r);
+  g_cond_signal(&f->reader_cond);
+  g_mutex_unlock(&f->lock);
+}
+
 static bool get_tag_int(const DcmDataSet *dataset,
                         const char *keyword,
                         int64_t *result) {
@@ -357,12 +430,18 @@ static struct dicom_file *dicom_file_new(const char *filename,
                                          bool load_metadata, GError **err) {
   g_autoptr(dicom_file) f = g_new0(struct dicom_file, 1);
   g_mutex_init(&f->lock);
+  g_cond_init(&f->reader_cond);
 
   f->filehandle = _openslide_dicom_open(filename, &f->dio, err);
   if (!f->filehandle) {
     return NULL;
   }
   f->filename = g_strdup(filename);
+  struct dicom_reader *r = g_new0(struct dicom_reader, 1);
+  r->filehandle = f->filehandle;
+  r->dio = f->dio;
+  g_queue_push_head(&f->idle_readers, r);
+  f->reader_count = 1;
 
   DcmError *dcm_error = NULL;
   f->file_meta = dcm_filehandle_get_file_meta(&dcm_error, f->filehandle);
@@ -417,26 +496,20 @@ static void destroy(openslide_t *osr) {
   g_free(osr->levels);
 }
 
-static void rgb_to_cairo(const uint8_t *rgb, uint32_t *dest,
-                         int64_t width, int64_t height) {
-  int64_t n_pixels = width * height;
-  for (int64_t i = 0; i < n_pixels; i++) {
-    dest[i] = 0xff000000 | rgb[0] << 16 | rgb[1] << 8 | rgb[2];
-    rgb += 3;
-  }
-}
-
 static bool decode_frame(struct dicom_file *file,
                          int64_t tile_col, int64_t tile_row,
                          uint32_t *dest, int64_t w, int64_t h,
                          GError **err) {
-  g_mutex_lock(&file->lock);
+  struct dicom_reader *reader = dicom_reader_get(file, err);
+  if (!reader) {
+    return false;
+  }
   DcmError *dcm_error = NULL;
   g_autoptr(DcmFrame) frame =
       dcm_filehandle_read_frame_position(&dcm_error,
-                                         file->filehandle,
+                                         reader->filehandle,
                                          tile_col, tile_row);
-  g_mutex_unlock(&file->lock);
+  dicom_reader_put(file, reader);
 
   if (!frame) {
     if (dcm_error_get_code(dcm_error) == DCM_ERROR_CODE_MISSING_FRAME) {
@@ -476,11 +549,59 @@ static bool decode_frame(struct dicom_file *file,
                   "RGB frame length %u != %"PRIu64, frame_length, w * h * 3);
       return false;
     }
-    rgb_to_cairo(frame_value, dest, w, h);
+    _openslide_simd_rgb24_to_argb32(frame_value, dest, w * h);
   }
   return true;
 }
 
+// caller must hold a dicom_file_io.  returns NULL without an error for a
+// missing tile.
+static uint32_t *load_tile(openslide_t *osr,
+                           struct dicom_level *l,
+                           int64_t tile_col, int64_t tile_row,
+                           struct _openslide_cache_entry **cache_entry,
+                           GError **err) {
+  // cache
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            l, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_autofree uint32_t *buf =
+    _openslide_cache_alloc(osr->cache, l->base.tile_w * l->base.tile_h * 4);
+  GError *tmp_err = NULL;
+  if (!decode_frame(l->file, tile_col, tile_row,
+                    buf, l->base.tile_w, l->base.tile_h,
+                    &tmp_err)) {
+    if (g_error_matches(tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_NO_VALUE)) {
+      // missing tile
+      g_clear_error(&tmp_err);
+    } else {
+      g_propagate_error(err, tmp_err);
+    }
+    return NULL;
+  }
+
+  // clip, if necessary
+  if (!_openslide_clip_tile(buf,
+                            l->base.tile_w, l->base.tile_h,
+                            l->base.w - tile_col * l->base.tile_w,
+                            l->base.h - tile_row * l->base.tile_h,
+                            err)) {
+    return NULL;
+  }
+
+  // put it in the cache
+  tiledata = g_steal_pointer(&buf);
+  _openslide_cache_put(osr->cache,
+                       l, tile_col, tile_row,
+                       tiledata, l->base.tile_w * l->base.tile_h * 4,
+                       cache_entry);
+  return tiledata;
+}
+
 static bool read_tile(openslide_t *osr,
                       cairo_t *cr,
                       struct _openslide_level *level,
@@ -489,42 +610,17 @@ static bool read_tile(openslide_t *osr,
                       GError **err) {
   struct dicom_level *l = (struct dicom_level *) level;
 
-  // cache
+  GError *tmp_err = NULL;
   g_autoptr(_openslide_cache_entry) cache_entry = NULL;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = load_tile(osr, l, tile_col, tile_row,
+                                 &cache_entry, &tmp_err);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(l->base.tile_w * l->base.tile_h * 4);
-    GError *tmp_err = NULL;
-    if (!decode_frame(l->file, tile_col, tile_row,
-                      buf, l->base.tile_w, l->base.tile_h,
-                      &tmp_err)) {
-      if (g_error_matches(tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_NO_VALUE)) {
-        // missing tile
-        g_clear_error(&tmp_err);
-        return true;
-      } else {
-        g_propagate_error(err, tmp_err);
-        return false;
-      }
-    }
-
-    // clip, if necessary
-    if (!_openslide_clip_tile(buf,
-                              l->base.tile_w, l->base.tile_h,
-                              l->base.w - tile_col * l->base.tile_w,
-                              l->base.h - tile_row * l->base.tile_h,
-                              err)) {
+    if (tmp_err) {
+      g_propagate_error(err, tmp_err);
       return false;
     }
-
-    // put it in the cache
-    tiledata = g_steal_pointer(&buf);
-    _openslide_cache_put(osr->cache,
-                         level, tile_col, tile_row,
-                         tiledata, l->base.tile_w * l->base.tile_h * 4,
-                         &cache_entry);
+    // missing tile
+    return true;
   }
 
   // draw it
@@ -555,6 +651,78 @@ static bool paint_region(openslide_t *osr G_GNUC_UNUSED,
                                       err);
 }
 
+static uint32_t *get_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          struct _openslide_cache_entry **cache_entry,
+                          GError **err) {
+  struct dicom_level *l = (struct dicom_level *) level;
+
+  // skip the file lock if the tile is cached
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            level, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_auto(dicom_file_io) fio G_GNUC_UNUSED = dicom_file_io_get(l->file);
+  return load_tile(osr, l, tile_col, tile_row, cache_entry, err);
+}
+
+static void *get_raw_tile(openslide_t *osr G_GNUC_UNUSED,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          openslide_tile_format_t *format, int64_t *size,
+                          struct _openslide_cache_entry **cache_entry,
+                          GError **err) {
+  struct dicom_level *l = (struct dicom_level *) level;
+  struct dicom_file *file = l->file;
+  if (file->format != FORMAT_JPEG) {
+    return NULL;
+  }
+
+  g_auto(dicom_file_io) fio G_GNUC_UNUSED = dicom_file_io_get(file);
+  struct dicom_reader *reader = dicom_reader_get(file, err);
+  if (!reader) {
+    return NULL;
+  }
+  DcmError *dcm_error = NULL;
+  g_autoptr(DcmFrame) frame =
+      dcm_filehandle_read_frame_position(&dcm_error,
+                                         reader->filehandle,
+                                         tile_col, tile_row);
+  dicom_reader_put(file, reader);
+  if (!frame) {
+    if (dcm_error_get_code(dcm_error) == DCM_ERROR_CODE_MISSING_FRAME) {
+      // missing tile
+      dcm_error_clear(&dcm_error);
+    } else {
+      _openslide_dicom_propagate_error(err, dcm_error);
+    }
+    return NULL;
+  }
+  if (dcm_frame_get_columns(frame) != l->base.tile_w ||
+      dcm_frame_get_rows(frame) != l->base.tile_h) {
+    return NULL;
+  }
+
+  uint32_t len;
+  uint8_t *buf =
+    _openslide_jpeg_make_interchange(dcm_frame_get_value(frame),
+                                     dcm_frame_get_length(frame),
+                                     NULL, 0,
+                                     file->jpeg_colorspace == JCS_RGB,
+                                     &len);
+  if (!buf) {
+    return NULL;
+  }
+  *format = OPENSLIDE_TILE_FORMAT_JPEG;
+  *size = len;
+  *cache_entry = _openslide_cache_entry_new(buf, len);
+  return buf;
+}
+
 static const void *get_icc_profile(struct dicom_file *file, int64_t *len) {
   const DcmDataSet *metadata = file->metadata;
 
@@ -589,13 +757,19 @@ static bool read_icc_profile(openslide_t *osr, void *dest,
   return true;
 }
 
+static bool load_properties(openslide_t *osr, GError **err);
+
 static const struct _openslide_ops dicom_ops = {
   .paint_region = paint_region,
+  .get_tile = get_tile,
+  .get_raw_tile = get_raw_tile,
+  .load_properties = load_properties,
   .read_icc_profile = read_icc_profile,
   .destroy = destroy,
 };
 
 static bool dicom_detect(const char *filename, struct _openslide_tifflike *tl,
+                         struct _openslide_probe *probe,
                          GError **err) {
   if (tl && (g_str_has_suffix(filename, ".tif") ||
              g_str_has_suffix(filename, ".tiff"))) {
@@ -606,7 +780,15 @@ static bool dicom_detect(const char *filename, struct _openslide_tifflike *tl,
   }
   // otherwise, ignore any TIFF metadata
 
+  // the prefix is only a hint, since libdicom also reads files that lack
+  // the preamble; without it, let libdicom decide
+  bool have_prefix =
+    _openslide_probe_check_magic(probe, DICOM_PREFIX_OFFSET,
+                                 DICOM_PREFIX, strlen(DICOM_PREFIX), NULL);
   g_autoptr(dicom_file) f = dicom_file_new(filename, false, err);
+  if (!f && !have_prefix) {
+    g_prefix_error(err, "Not a DICOM file: ");
+  }
   return f != NULL;
 }
 
@@ -1041,6 +1223,18 @@ static bool add_properties_element(const DcmElement *element,
   return true;
 }
 
+static void add_dicom_properties(openslide_t *osr, struct dicom_file *file) {
+  struct property_iterate iter = { osr, "dicom", true };
+  add_properties_dataset(file->file_meta, 0, &iter);
+  add_properties_dataset(file->metadata, 0, &iter);
+}
+
+static bool load_properties(openslide_t *osr, GError **err G_GNUC_UNUSED) {
+  struct dicom_level *level0 = (struct dicom_level *) osr->levels[0];
+  add_dicom_properties(osr, level0->file);
+  return true;
+}
+
 static void add_properties(openslide_t *osr, struct dicom_level *level0) {
   // pixel spacing is in mm, so convert to microns
   if (level0->pixel_spacing_x && level0->pixel_spacing_y) {
@@ -1057,10 +1251,45 @@ static void add_properties(openslide_t *osr, struct dicom_level *level0) {
                         _openslide_format_double(level0->objective_lens_power));
   }
 
-  // add all dicom elements
-  struct property_iterate iter = { osr, "dicom", true };
-  add_properties_dataset(level0->file->file_meta, 0, &iter);
-  add_properties_dataset(level0->file->metadata, 0, &iter);
+  // add all dicom elements, or leave them for load_properties()
+  if (_openslide_lazy_properties()) {
+    osr->properties_deferred = true;
+  } else {
+    add_dicom_properties(osr, level0->file);
+  }
+}
+
+// candidate files in the slide directory, probed in parallel
+struct probe {
+  const char *slide_id;
+  char **paths;
+  struct dicom_file **files;  // NULL if unusable
+};
+
+static bool probe_file(int64_t i, void *arg, GError **err G_GNUC_UNUSED) {
+  struct probe *probe = arg;
+  const char *path = probe->paths[i];
+
+  GError *tmp_err = NULL;
+  g_autoptr(dicom_file) f = dicom_file_new(path, true, &tmp_err);
+  if (!f) {
+    if (_openslide_debug(OPENSLIDE_DEBUG_SEARCH)) {
+      g_message("opening %s: %s", path, tmp_err->message);
+    }
+    g_error_free(tmp_err);
+    return true;
+  }
+
+  if (!g_str_equal(f->slide_id, probe->slide_id)) {
+    if (_openslide_debug(OPENSLIDE_DEBUG_SEARCH)) {
+      g_message("opening %s: Series Instance UID %s != %s",
+                path, f->slide_id, probe->slide_id);
+    }
+    return true;
+  }
+
+  probe->files[i] = g_steal_pointer(&f);
+  return true;
 }
 
 static gint compare_level_width(const void *a, const void *b) {
@@ -1073,6 +1302,7 @@ static gint compare_level_width(const void *a, const void *b) {
 static bool dicom_open(openslide_t *osr,
                        const char *filename,
                        struct _openslide_tifflike *tl G_GNUC_UNUSED,
+                       struct _openslide_probe *probe G_GNUC_UNUSED,
                        struct _openslide_hash *quickhash1,
                        GError **err) {
   g_autofree char *dirname = g_path_get_dirname(filename);
@@ -1098,42 +1328,45 @@ static bool dicom_open(openslide_t *osr,
     return false;
   }
 
-  // scan for other DICOMs with this slide id
+  // list other files in the directory
+  g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func(g_free);
   const char *name;
   GError *dir_err = NULL;
   while ((name = _openslide_dir_next(dir, &dir_err))) {
     // no need to add the start file again
-    if (g_str_equal(name, basename)) {
-      continue;
-    }
-
-    g_autofree char *path = g_build_filename(dirname, name, NULL);
-
-    GError *tmp_err = NULL;
-    g_autoptr(dicom_file) f = dicom_file_new(path, true, &tmp_err);
-    if (!f) {
-      if (_openslide_debug(OPENSLIDE_DEBUG_SEARCH)) {
-        g_message("opening %s: %s", path, tmp_err->message);
-      }
-      g_error_free(tmp_err);
-      continue;
+    if (!g_str_equal(name, basename)) {
+      g_ptr_array_add(paths, g_build_filename(dirname, name, NULL));
     }
+  }
+  if (dir_err) {
+    g_propagate_error(err, dir_err);
+    return false;
+  }
 
-    if (!g_str_equal(f->slide_id, slide_id)) {
-      if (_openslide_debug(OPENSLIDE_DEBUG_SEARCH)) {
-        g_message("opening %s: Series Instance UID %s != %s",
-                  path, f->slide_id, slide_id);
-      }
-      continue;
+  // each file needs several reads to check the series, which add up on
+  // high-latency storage, so probe them in parallel
+  g_autofree struct dicom_file **files = g_new0(struct dicom_file *,
+                                                paths->len);
+  struct probe series = {
+    .slide_id = slide_id,
+    .paths = (char **) paths->pdata,
+    .files = files,
+  };
+  _openslide_worker_run_batch(paths->len, probe_file, &series, NULL);
+
+  // add matching files in directory order
+  bool ok = true;
+  for (guint i = 0; i < paths->len; i++) {
+    if (files[i] && ok &&
+        !maybe_add_file(osr, level_array, g_steal_pointer(&files[i]), err)) {
+      g_prefix_error(err, "Reading %s: ", (char *) paths->pdata[i]);
+      ok = false;
     }
-
-    if (!maybe_add_file(osr, level_array, g_steal_pointer(&f), err)) {
-      g_prefix_error(err, "Reading %s: ", path);
-      return false;
+    if (files[i]) {
+      dicom_file_destroy(files[i]);
     }
   }
-  if (dir_err) {
-    g_propagate_error(err, dir_err);
+  if (!ok) {
     return false;
   }
 
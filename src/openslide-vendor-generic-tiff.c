@@ -65,6 +65,113 @@ static void destroy(openslide_t *osr) {
   g_free(osr->levels);
 }
 
+// returns NULL without an error for a missing tile
+static uint32_t *decode_tile(openslide_t *osr,
+                             struct level *l,
+                             TIFF *tiff,
+                             int64_t tile_col, int64_t tile_row,
+                             struct _openslide_cache_entry **cache_entry,
+                             GError **err) {
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+
+  // tile size
+  int64_t tw = tiffl->tile_w;
+  int64_t th = tiffl->tile_h;
+
+  // TIFF doesn't allow missing tiles, but WSI-derived TIFFs might have them
+  bool is_missing;
+  if (!_openslide_tiff_check_missing_tile(tiffl, tiff,
+                                          tile_col, tile_row,
+                                          &is_missing, err)) {
+    return NULL;
+  }
+  if (is_missing) {
+    return NULL;
+  }
+
+  g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
+  if (!_openslide_tiff_read_tile(tiffl, tiff,
+                                 buf, tile_col, tile_row,
+                                 err)) {
+    return NULL;
+  }
+
+  // clip, if necessary
+  if (!_openslide_tiff_clip_tile(tiffl, buf,
+                                 tile_col, tile_row,
+                                 err)) {
+    return NULL;
+  }
+
+  // put it in the cache
+  uint32_t *tiledata = g_steal_pointer(&buf);
+  _openslide_cache_put(osr->cache, l, tile_col, tile_row,
+                       tiledata, tw * th * 4,
+                       cache_entry);
+  return tiledata;
+}
+
+// returns NULL without an error for a missing tile
+static uint32_t *load_tile(openslide_t *osr,
+                           struct level *l,
+                           TIFF *tiff,
+                           int64_t tile_col, int64_t tile_row,
+                           struct _openslide_cache_entry **cache_entry,
+                           GError **err) {
+  // cache
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            l, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+  return decode_tile(osr, l, tiff, tile_col, tile_row, cache_entry, err);
+}
+
+// decode and draw part of a tile, bypassing the cache
+static bool read_partial_tile(cairo_t *cr,
+                              struct level *l,
+                              TIFF *tiff,
+                              int64_t tile_col, int64_t tile_row,
+                              int32_t x, int32_t y,
+                              int32_t w, int32_t h,
+                              GError **err) {
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+
+  bool is_missing;
+  if (!_openslide_tiff_check_missing_tile(tiffl, tiff,
+                                          tile_col, tile_row,
+                                          &is_missing, err)) {
+    return false;
+  }
+
+  // clip to the image
+  w = MIN(w, tiffl->image_w - tile_col * tiffl->tile_w - x);
+  h = MIN(h, tiffl->image_h - tile_row * tiffl->tile_h - y);
+  if (is_missing || w <= 0 || h <= 0) {
+    // nothing to draw
+    return true;
+  }
+
+  g_autofree uint32_t *buf = g_malloc((int64_t) w * h * 4);
+  if (!_openslide_tiff_read_tile_region(tiffl, tiff, buf,
+                                        tile_col, tile_row,
+                                        x, y, w, h,
+                                        err)) {
+    return false;
+  }
+
+  // draw it
+  g_autoptr(cairo_surface_t) surface =
+    cairo_image_surface_create_for_data((unsigned char *) buf,
+                                        CAIRO_FORMAT_ARGB32,
+                                        w, h, w * 4);
+  cairo_set_source_surface(cr, surface, x, y);
+  cairo_paint(cr);
+
+  return true;
+}
+
 static bool read_tile(openslide_t *osr,
                       cairo_t *cr,
                       struct _openslide_level *level,
@@ -72,57 +179,41 @@ static bool read_tile(openslide_t *osr,
                       void *arg,
                       GError **err) {
   struct level *l = (struct level *) level;
-  struct _openslide_tiff_level *tiffl = &l->tiffl;
   TIFF *tiff = arg;
 
-  // tile size
-  int64_t tw = tiffl->tile_w;
-  int64_t th = tiffl->tile_h;
-
-  // cache
+  GError *tmp_err = NULL;
   g_autoptr(_openslide_cache_entry) cache_entry = NULL;
   uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
+                                            l, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    // TIFF doesn't allow missing tiles, but WSI-derived TIFFs might have them
-    bool is_missing;
-    if (!_openslide_tiff_check_missing_tile(tiffl, tiff,
-                                            tile_col, tile_row,
-                                            &is_missing, err)) {
-      return false;
-    }
-    if (is_missing) {
-      // nothing to draw
-      return true;
+    // small reads of large JPEG tiles decode only the part they draw
+    int32_t x, y, w, h;
+    if (l->tiffl.tile_read_direct &&
+        _openslide_get_partial_tile_region(cr,
+                                           l->tiffl.tile_w, l->tiffl.tile_h,
+                                           &x, &y, &w, &h)) {
+      return read_partial_tile(cr, l, tiff, tile_col, tile_row,
+                               x, y, w, h, err);
     }
-
-    g_autofree uint32_t *buf = g_malloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
-                                   buf, tile_col, tile_row,
-                                   err)) {
-      return false;
-    }
-
-    // clip, if necessary
-    if (!_openslide_tiff_clip_tile(tiffl, buf,
-                                   tile_col, tile_row,
-                                   err)) {
+    tiledata = decode_tile(osr, l, tiff, tile_col, tile_row,
+                           &cache_entry, &tmp_err);
+  }
+  if (!tiledata) {
+    if (tmp_err) {
+      g_propagate_error(err, tmp_err);
       return false;
     }
-
-    // put it in the cache
-    tiledata = g_steal_pointer(&buf);
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-                         tiledata, tw * th * 4,
-                         &cache_entry);
+    // nothing to draw
+    return true;
   }
 
   // draw it
   g_autoptr(cairo_surface_t) surface =
     cairo_image_surface_create_for_data((unsigned char *) tiledata,
                                         CAIRO_FORMAT_ARGB32,
-                                        tw, th, tw * 4);
+                                        l->tiffl.tile_w, l->tiffl.tile_h,
+                                        l->tiffl.tile_w * 4);
   cairo_set_source_surface(cr, surface, 0, 0);
   cairo_paint(cr);
 
@@ -149,6 +240,133 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
                                       err);
 }
 
+static uint32_t *get_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          struct _openslide_cache_entry **cache_entry,
+                          GError **err) {
+  struct generic_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  // skip the TIFF handle if the tile is cached
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            level, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return NULL;
+  }
+  return load_tile(osr, l, ct.tiff, tile_col, tile_row, cache_entry, err);
+}
+
+static uint32_t *get_tile_scaled(openslide_t *osr,
+                                 struct _openslide_level *level,
+                                 int64_t tile_col, int64_t tile_row,
+                                 int32_t scale,
+                                 struct _openslide_cache_entry **cache_entry,
+                                 GError **err) {
+  struct generic_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+  void *plane = _openslide_level_get_scaled_plane(level, scale);
+
+  // tile size
+  int64_t tw = tiffl->tile_w / scale;
+  int64_t th = tiffl->tile_h / scale;
+
+  // cache
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            plane, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return NULL;
+  }
+
+  bool is_missing;
+  if (!_openslide_tiff_check_missing_tile(tiffl, ct.tiff,
+                                          tile_col, tile_row,
+                                          &is_missing, err)) {
+    return NULL;
+  }
+  if (is_missing) {
+    return NULL;
+  }
+
+  g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
+  if (!_openslide_tiff_read_tile_scaled(tiffl, ct.tiff, buf,
+                                        tile_col, tile_row, scale,
+                                        err)) {
+    return NULL;
+  }
+
+  // put it in the cache
+  tiledata = g_steal_pointer(&buf);
+  _openslide_cache_put(osr->cache, plane, tile_col, tile_row,
+                       tiledata, tw * th * 4,
+                       cache_entry);
+  return tiledata;
+}
+
+static void *get_raw_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          openslide_tile_format_t *format, int64_t *size,
+                          struct _openslide_cache_entry **cache_entry,
+                          GError **err) {
+  struct generic_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return NULL;
+  }
+
+  bool is_missing;
+  if (!_openslide_tiff_check_missing_tile(tiffl, ct.tiff,
+                                          tile_col, tile_row,
+                                          &is_missing, err)) {
+    return NULL;
+  }
+  if (is_missing) {
+    return NULL;
+  }
+
+  void *buf;
+  int32_t len;
+  if (!_openslide_tiff_read_jpeg_stream(tiffl, ct.tiff, &buf, &len,
+                                        tile_col, tile_row, err) || !buf) {
+    return NULL;
+  }
+  *format = OPENSLIDE_TILE_FORMAT_JPEG;
+  *size = len;
+  *cache_entry = _openslide_cache_entry_new(buf, len);
+  return buf;
+}
+
+static void prefetch_tile_data(openslide_t *osr,
+                               struct _openslide_level *level,
+                               const struct _openslide_tile_position *tiles,
+                               int64_t count) {
+  struct generic_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, NULL);
+  if (ct.tiff == NULL) {
+    return;
+  }
+  _openslide_tiff_prefetch_tile_data(&l->tiffl, ct.tiff, tiles, count);
+}
+
 static bool read_icc_profile(openslide_t *osr, void *dest, GError **err) {
   struct level *l = (struct level *) osr->levels[0];
   struct generic_tiff_ops_data *data = osr->data;
@@ -164,12 +382,17 @@ static bool read_icc_profile(openslide_t *osr, void *dest, GError **err) {
 
 static const struct _openslide_ops generic_tiff_ops = {
   .paint_region = paint_region,
+  .get_tile = get_tile,
+  .get_tile_scaled = get_tile_scaled,
+  .get_raw_tile = get_raw_tile,
+  .prefetch_tile_data = prefetch_tile_data,
   .read_icc_profile = read_icc_profile,
   .destroy = destroy,
 };
 
 static bool generic_tiff_detect(const char *filename G_GNUC_UNUSED,
                                 struct _openslide_tifflike *tl,
+                                struct _openslide_probe *probe G_GNUC_UNUSED,
                                 GError **err) {
   // ensure we have a TIFF
   if (!tl) {
@@ -204,6 +427,7 @@ static int width_compare(gconstpointer a, gconstpointer b) {
 static bool generic_tiff_open(openslide_t *osr,
                               const char *filename,
                               struct _openslide_tifflike *tl,
+                              struct _openslide_probe *probe G_GNUC_UNUSED,
                               struct _openslide_hash *quickhash1,
                               GError **err) {
   // open TIFF
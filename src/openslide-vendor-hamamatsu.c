@@ -56,6 +56,12 @@
 
 #define NGR_TILE_HEIGHT 64
 
+// read size when searching for a restart marker before reading a tile
+#define MARKER_SEARCH_BUF_SIZE (64 * 1024)
+
+// bytes of JPEG data per restart marker scan task
+#define MARKER_SCAN_CHUNK_SIZE (4 * 1024 * 1024)
+
 // VMS/VMU
 static const char GROUP_VMS[] = "Virtual Microscope Specimen";
 static const char GROUP_VMU[] = "Uncompressed Virtual Microscope Specimen";
@@ -152,6 +158,9 @@ struct hamamatsu_jpeg_ops_data {
   bool restart_marker_thread_throttle;
   bool restart_marker_thread_stop;
   GError *restart_marker_thread_error;
+
+  // for saving the scan results to the index cache; or NULL
+  char *index_key;
 };
 
 struct ngr_level {
@@ -462,6 +471,17 @@ static bool find_next_ff_marker(struct _openslide_file *f,
   }
 }
 
+// whether a recorded MCU start follows a restart marker
+static bool verify_restart_marker(struct _openslide_file *f, int64_t offset) {
+  uint8_t buf[2];
+  if (offset < 2 ||
+      !_openslide_fseek(f, offset - 2, SEEK_SET, NULL) ||
+      !_openslide_fread_exact(f, buf, 2, NULL)) {
+    return false;
+  }
+  return buf[0] == 0xFF && buf[1] >= 0xD0 && buf[1] <= 0xD7;
+}
+
 static bool _compute_mcu_start(struct jpeg *jpeg,
 			       struct _openslide_file *f,
 			       int64_t target,
@@ -480,24 +500,11 @@ static bool _compute_mcu_start(struct jpeg *jpeg,
       offset = jpeg->unreliable_mcu_starts[first_good];
     }
     if (offset != -1) {
-      uint8_t buf[2];
-      if (!_openslide_fseek(f, offset - 2, SEEK_SET, err)) {
-        g_prefix_error(err, "Couldn't seek to recorded restart marker at "
-                       "%"PRId64": ", offset - 2);
-        return false;
-      }
-
-      if (!_openslide_fread_exact(f, buf, 2, err)) {
-        g_prefix_error(err,
-                       "Reading restart marker at recorded position %"PRId64": ",
-                       offset - 2);
-        return false;
-      }
-      if (buf[0] != 0xFF || buf[1] < 0xD0 || buf[1] > 0xD7) {
-        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                    "Restart marker not found at recorded position %"PRId64,
-                    offset - 2);
-        return false;
+      if (!verify_restart_marker(f, offset)) {
+        // stale or corrupt; drop it and keep walking, so we end up
+        // scanning from an earlier known marker instead
+        jpeg->unreliable_mcu_starts[first_good] = -1;
+        continue;
       }
 
       //  g_debug("accepted unreliable marker %"PRId64, first_good);
@@ -518,13 +525,13 @@ static bool _compute_mcu_start(struct jpeg *jpeg,
     return false;
   }
 
-  uint8_t buf_start[4096];
+  g_autofree uint8_t *buf_start = g_malloc(MARKER_SEARCH_BUF_SIZE);
   uint8_t *buf = buf_start;
   int bytes_in_buf = 0;
   while (first_good < target) {
     uint8_t marker_byte;
     int64_t after_marker_pos;
-    if (!find_next_ff_marker(f, buf_start, &buf, sizeof(buf_start),
+    if (!find_next_ff_marker(f, buf_start, &buf, MARKER_SEARCH_BUF_SIZE,
                              jpeg->end_in_file,
                              &marker_byte,
                              &after_marker_pos,
@@ -588,12 +595,15 @@ static bool compute_mcu_start(openslide_t *osr,
   return true;
 }
 
+// region_w == 0 to decode the whole tile, else dest is region_w x region_h
 static bool read_from_jpeg(openslide_t *osr,
                            struct jpeg *jpeg,
                            int32_t tileno,
                            int32_t scale_denom,
                            uint32_t *dest,
                            int32_t w, int32_t h,
+                           int32_t region_x, int32_t region_y,
+                           int32_t region_w, int32_t region_h,
                            GError **err) {
   // open file
   g_autoptr(_openslide_file) f = _openslide_fopen(jpeg->filename, err);
@@ -643,6 +653,12 @@ static bool read_from_jpeg(openslide_t *osr,
     //    g_debug("output_width: %d", cinfo->output_width);
     //    g_debug("output_height: %d", cinfo->output_height);
 
+    if (region_w) {
+      return _openslide_jpeg_decompress_run_region(dc, dest, w, h,
+                                                   region_x, region_y,
+                                                   region_w, region_h,
+                                                   err);
+    }
     return _openslide_jpeg_decompress_run(dc, dest, false, w, h, err);
   } else {
     // setjmp returns again
@@ -683,11 +699,33 @@ static bool read_jpeg_tile(openslide_t *osr,
                                             &cache_entry);
 
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(tw * th * 4);
+    // small reads of large tiles decode only the part they draw
+    int32_t x, y, w, h;
+    if (_openslide_get_partial_tile_region(cr, tw, th, &x, &y, &w, &h)) {
+      g_autofree uint32_t *buf = g_malloc((int64_t) w * h * 4);
+      if (!read_from_jpeg(osr,
+                          jp, tileno,
+                          l->scale_denom,
+                          buf, tw, th,
+                          x, y, w, h,
+                          err)) {
+        return false;
+      }
+      g_autoptr(cairo_surface_t) surface =
+        cairo_image_surface_create_for_data((unsigned char *) buf,
+                                            CAIRO_FORMAT_RGB24,
+                                            w, h, w * 4);
+      cairo_set_source_surface(cr, surface, x, y);
+      cairo_paint(cr);
+      return true;
+    }
+
+    g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
     if (!read_from_jpeg(osr,
                         jp, tileno,
                         l->scale_denom,
                         buf, tw, th,
+                        0, 0, 0, 0,
                         err)) {
       return false;
     }
@@ -796,6 +834,7 @@ static void jpeg_do_destroy(openslide_t *osr) {
   g_mutex_clear(&data->restart_marker_cond_mutex);
 
   // the structure
+  g_free(data->index_key);
   g_free(data);
 }
 
@@ -806,6 +845,7 @@ static const struct _openslide_ops hamamatsu_jpeg_ops = {
 
 static bool hamamatsu_vms_vmu_detect(const char *filename,
                                      struct _openslide_tifflike *tl,
+                                     struct _openslide_probe *probe G_GNUC_UNUSED,
                                      GError **err) {
   // reject TIFFs
   if (tl) {
@@ -892,78 +932,256 @@ static bool verify_mcu_starts(int32_t num_jpegs, struct jpeg **jpegs,
   return true;
 }
 
-static gpointer restart_marker_thread_func(gpointer d) {
-  openslide_t *osr = d;
+// Index cache payload: little-endian jpeg count, then for each JPEG its
+// tile count and the offset of each tile (-1 if unknown).
+static void store_mcu_starts(openslide_t *osr) {
   struct hamamatsu_jpeg_ops_data *data = osr->data;
+  g_autoptr(GByteArray) buf = g_byte_array_new();
+  uint32_t count = GUINT32_TO_LE(data->jpeg_count);
+  g_byte_array_append(buf, (const uint8_t *) &count, sizeof(count));
+  {
+    g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
+      g_mutex_locker_new(&data->restart_marker_mutex);
+    for (int32_t i = 0; i < data->jpeg_count; i++) {
+      struct jpeg *jp = data->all_jpegs[i];
+      uint32_t tiles = GUINT32_TO_LE(jp->tile_count);
+      g_byte_array_append(buf, (const uint8_t *) &tiles, sizeof(tiles));
+      for (int32_t tile = 0; tile < jp->tile_count; tile++) {
+        int64_t offset = GINT64_TO_LE(jp->mcu_starts[tile]);
+        g_byte_array_append(buf, (const uint8_t *) &offset, sizeof(offset));
+      }
+    }
+  }
+  _openslide_index_cache_store(data->index_key, "hamamatsu-mcu-starts",
+                               buf->data, buf->len);
+}
 
-  int32_t current_jpeg = 0;
-  int32_t current_mcu_start = 0;
+// Replace the unreliable MCU starts with those from the index cache.  They
+// are still validated before use, since the cache could be corrupt.
+static bool load_mcu_starts(struct hamamatsu_jpeg_ops_data *data) {
+  size_t len;
+  g_autofree uint8_t *buf =
+    _openslide_index_cache_load(data->index_key, "hamamatsu-mcu-starts",
+                                &len);
+  if (!buf) {
+    return false;
+  }
 
-  g_autoptr(_openslide_file) current_file = NULL;
+  // validate
+  size_t pos = 0;
+  uint32_t value;
+  if (len < sizeof(value)) {
+    return false;
+  }
+  memcpy(&value, buf, sizeof(value));
+  pos += sizeof(value);
+  if ((int64_t) GUINT32_FROM_LE(value) != data->jpeg_count) {
+    return false;
+  }
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    struct jpeg *jp = data->all_jpegs[i];
+    if (len - pos < sizeof(value)) {
+      return false;
+    }
+    memcpy(&value, buf + pos, sizeof(value));
+    pos += sizeof(value);
+    if ((int64_t) GUINT32_FROM_LE(value) != jp->tile_count ||
+        (len - pos) / sizeof(int64_t) < (uint64_t) jp->tile_count) {
+      return false;
+    }
+    pos += jp->tile_count * sizeof(int64_t);
+  }
+  if (pos != len) {
+    return false;
+  }
 
-  GError *tmp_err = NULL;
+  // use
+  pos = sizeof(value);
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    struct jpeg *jp = data->all_jpegs[i];
+    pos += sizeof(value);
+    int64_t *starts = g_new(int64_t, jp->tile_count);
+    for (int32_t tile = 0; tile < jp->tile_count; tile++) {
+      int64_t offset;
+      memcpy(&offset, buf + pos, sizeof(offset));
+      pos += sizeof(offset);
+      offset = GINT64_FROM_LE(offset);
+      if (offset < 2 || offset > jp->end_in_file) {
+        offset = -1;
+      }
+      starts[tile] = offset;
+    }
+    g_free(jp->unreliable_mcu_starts);
+    jp->unreliable_mcu_starts = starts;
+  }
+  return true;
+}
 
-  while(current_jpeg < data->jpeg_count) {
-    {
-      g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
-        g_mutex_locker_new(&data->restart_marker_cond_mutex);
+// wait until reads have been idle for a while, unless throttling is
+// disabled; false if the thread should stop
+static bool wait_for_restart_marker_idle(struct hamamatsu_jpeg_ops_data *data) {
+  g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
+    g_mutex_locker_new(&data->restart_marker_cond_mutex);
+  while (true) {
+    // should we pause?
+    while (data->restart_marker_users && !data->restart_marker_thread_stop) {
+      //      g_debug("thread paused");
+      g_cond_wait(&data->restart_marker_cond,
+                  &data->restart_marker_cond_mutex); // zzz
+      //      g_debug("thread awoken");
+    }
 
-      // should we pause?
-      while (data->restart_marker_users && !data->restart_marker_thread_stop) {
-        //      g_debug("thread paused");
-        g_cond_wait(&data->restart_marker_cond,
-                    &data->restart_marker_cond_mutex); // zzz
-        //      g_debug("thread awoken");
-      }
+    // should we stop?
+    if (data->restart_marker_thread_stop) {
+      //      g_debug("thread stopping");
+      return false;
+    }
 
-      // should we stop?
-      if (data->restart_marker_thread_stop) {
-        //      g_debug("thread stopping");
-        break;
-      }
+    // should we sleep?
+    int64_t end_time = data->restart_marker_last_used_time + G_TIME_SPAN_SECOND;
+    if (data->restart_marker_thread_throttle &&
+        end_time > g_get_monotonic_time()) {
+      //g_debug("zz: %lu", end_time - g_get_monotonic_time());
+      g_cond_wait_until(&data->restart_marker_cond,
+                        &data->restart_marker_cond_mutex,
+                        end_time);
+      //      g_debug("running again");
+      continue;
+    }
+    return true;
+  }
+}
 
-      // should we sleep?
-      int64_t end_time = data->restart_marker_last_used_time + G_TIME_SPAN_SECOND;
-      if (data->restart_marker_thread_throttle &&
-          end_time > g_get_monotonic_time()) {
-        //g_debug("zz: %lu", end_time - g_get_monotonic_time());
-        g_cond_wait_until(&data->restart_marker_cond,
-                          &data->restart_marker_cond_mutex,
-                          end_time);
-        //      g_debug("running again");
-        continue;
-      }
+// a range of a JPEG's entropy-coded data to scan for restart markers
+struct marker_scan_chunk {
+  struct jpeg *jpeg;
+  int64_t start;
+  int64_t end;
+  GArray *positions;  // offsets just after each marker in the range
+};
+
+static void marker_scan_chunk_free(struct marker_scan_chunk *chunk) {
+  if (chunk->positions) {
+    g_array_free(chunk->positions, true);
+  }
+  g_free(chunk);
+}
+
+// Restart markers can be found without decoding, since 0xFF is always
+// followed by a stuffed zero in entropy-coded data.  So a chunk can be
+// scanned without knowing where the preceding chunk ended, as long as a
+// marker straddling the end of the chunk is counted.
+static bool scan_marker_chunk(int64_t item, void *arg, GError **err) {
+  struct marker_scan_chunk *chunk = ((struct marker_scan_chunk **) arg)[item];
+  struct jpeg *jp = chunk->jpeg;
+  // include the byte after the chunk, in case the chunk ends with 0xFF
+  size_t len = MIN(chunk->end + 1, jp->end_in_file) - chunk->start;
+  g_autoptr(_openslide_file) f = _openslide_fopen(jp->filename, err);
+  if (!f) {
+    return false;
+  }
+  g_autofree uint8_t *buf = g_malloc(len);
+  if (!_openslide_fpread_exact(f, buf, len, chunk->start, err)) {
+    g_prefix_error(err, "Reading JPEG data for restart marker scan: ");
+    return false;
+  }
+
+  chunk->positions = g_array_new(false, false, sizeof(int64_t));
+  size_t chunk_len = chunk->end - chunk->start;
+  const uint8_t *p = buf;
+  while ((p = memchr(p, 0xFF, chunk_len - (p - buf))) != NULL) {
+    size_t off = p - buf;
+    if (off + 1 < len && p[1] >= 0xD0 && p[1] <= 0xD7) {
+      int64_t after_marker_pos = chunk->start + off + 2;
+      g_array_append_val(chunk->positions, after_marker_pos);
     }
+    p++;
+  }
+  return true;
+}
 
-    // we are finally able to run
+// install the markers found in chunks [first, last] of one JPEG
+static bool merge_marker_chunks(struct hamamatsu_jpeg_ops_data *data,
+                                struct marker_scan_chunk **chunks,
+                                uint32_t first, uint32_t last,
+                                GError **err) {
+  struct jpeg *jp = chunks[first]->jpeg;
+  int64_t found = 0;
+  for (uint32_t i = first; i <= last; i++) {
+    found += chunks[i]->positions->len;
+  }
+  if (found < jp->tile_count - 1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Expected %d restart markers in %s, found %"PRId64,
+                jp->tile_count - 1, jp->filename, found);
+    return false;
+  }
 
-    //g_debug("current_jpeg: %d, current_mcu_start: %d",
-    //        current_jpeg, current_mcu_start);
+  g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
+    g_mutex_locker_new(&data->restart_marker_mutex);
+  jp->mcu_starts[0] = jp->header_stop_position;
+  int32_t tile = 1;
+  for (uint32_t i = first; i <= last && tile < jp->tile_count; i++) {
+    GArray *positions = chunks[i]->positions;
+    for (guint j = 0; j < positions->len && tile < jp->tile_count; j++) {
+      jp->mcu_starts[tile++] = g_array_index(positions, int64_t, j);
+    }
+  }
+  return true;
+}
 
-    struct jpeg *jp = data->all_jpegs[current_jpeg];
-    if (jp->tile_count > 1) {
-      if (current_file == NULL) {
-	current_file = _openslide_fopen(jp->filename, &tmp_err);
-	if (current_file == NULL) {
-	  //g_debug("restart_marker_thread_func fopen failed");
-	  break;
-	}
-      }
+static gpointer restart_marker_thread_func(gpointer d) {
+  openslide_t *osr = d;
+  struct hamamatsu_jpeg_ops_data *data = osr->data;
 
-      if (!compute_mcu_start(osr, jp, current_file, current_mcu_start,
-                             NULL, NULL, &tmp_err)) {
-        //g_debug("restart_marker_thread_func compute_mcu_start failed");
-        break;
-      }
+  // split the JPEGs into chunks
+  g_autoptr(GPtrArray) chunks =
+    g_ptr_array_new_with_free_func((GDestroyNotify) marker_scan_chunk_free);
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    struct jpeg *jp = data->all_jpegs[i];
+    if (jp->tile_count <= 1) {
+      continue;
+    }
+    for (int64_t start = jp->header_stop_position; start < jp->end_in_file;
+         start += MARKER_SCAN_CHUNK_SIZE) {
+      struct marker_scan_chunk *chunk = g_new0(struct marker_scan_chunk, 1);
+      chunk->jpeg = jp;
+      chunk->start = start;
+      chunk->end = MIN(start + MARKER_SCAN_CHUNK_SIZE, jp->end_in_file);
+      g_ptr_array_add(chunks, chunk);
+    }
+  }
+
+  // scan a round of chunks at a time, so reads can pause the scan
+  uint32_t round_size = MAX(_openslide_worker_get_thread_count(), 1);
+  uint32_t next = 0;
+  uint32_t jpeg_first = 0;
+  GError *tmp_err = NULL;
+  while (next < chunks->len) {
+    if (!wait_for_restart_marker_idle(data)) {
+      break;
+    }
+
+    uint32_t count = MIN(chunks->len - next, round_size);
+    if (!_openslide_worker_run_batch(count, scan_marker_chunk,
+                                     chunks->pdata + next, &tmp_err)) {
+      break;
+    }
+    next += count;
 
-      current_mcu_start++;
-      if (current_mcu_start >= jp->tile_count) {
-	current_mcu_start = 0;
-	current_jpeg++;
-	_openslide_fclose(g_steal_pointer(&current_file));
+    // install the markers of each JPEG that has been fully scanned
+    struct marker_scan_chunk **c =
+      (struct marker_scan_chunk **) chunks->pdata;
+    for (uint32_t i = jpeg_first; i < next; i++) {
+      if (i + 1 == chunks->len || c[i + 1]->jpeg != c[i]->jpeg) {
+        if (!merge_marker_chunks(data, c, jpeg_first, i, &tmp_err)) {
+          break;
+        }
+        jpeg_first = i + 1;
       }
-    } else {
-      current_jpeg++;
+    }
+    if (tmp_err) {
+      break;
     }
   }
 
@@ -973,6 +1191,8 @@ static gpointer restart_marker_thread_func(gpointer d) {
     g_autoptr(GMutexLocker) locker G_GNUC_UNUSED =
       g_mutex_locker_new(&data->restart_marker_cond_mutex);
     data->restart_marker_thread_error = tmp_err;
+  } else if (next == chunks->len) {
+    store_mcu_starts(osr);
   }
 
   //  g_debug("restart_marker_thread_func done!");
@@ -1265,6 +1485,7 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(jpeg_osr, jpeg_do_destroy)
 // consumes setup, even on failure
 static bool init_jpeg_ops(openslide_t *_osr,
                           struct jpeg_setup *_setup,
+                          struct _openslide_hash *quickhash1,
                           bool background_thread,
                           GError **err) {
   g_autoptr(jpeg_setup) setup = _setup;
@@ -1295,6 +1516,17 @@ static bool init_jpeg_ops(openslide_t *_osr,
   g_mutex_init(&data->restart_marker_cond_mutex);
   data->restart_marker_thread_throttle =
     !_openslide_debug(OPENSLIDE_DEBUG_JPEG_MARKERS);
+  if (!_openslide_worker_get_thread_count()) {
+    // the caller wants everything inline; find markers on demand
+    background_thread = false;
+  }
+  if (background_thread) {
+    // skip the scan if an earlier one was saved
+    data->index_key = _openslide_hash_peek_string(quickhash1);
+    if (load_mcu_starts(data)) {
+      background_thread = false;
+    }
+  }
   if (background_thread) {
     data->restart_marker_thread = g_thread_new("hamamatsu-marker",
                                                restart_marker_thread_func,
@@ -1383,6 +1615,7 @@ static bool hamamatsu_vms_part2(openslide_t *osr,
 				int num_jpegs, char **image_filenames,
 				int num_jpeg_cols, int num_jpeg_rows,
 				struct _openslide_file *optimisation_file,
+				struct _openslide_hash *quickhash1,
 				GError **err) {
   g_autoptr(jpeg_setup) setup = jpeg_setup_new();
 
@@ -1515,7 +1748,7 @@ static bool hamamatsu_vms_part2(openslide_t *osr,
   */
 
   // init ops
-  return init_jpeg_ops(osr, g_steal_pointer(&setup), true, err);
+  return init_jpeg_ops(osr, g_steal_pointer(&setup), quickhash1, true, err);
 }
 
 static void ngr_level_free(struct ngr_level *l) {
@@ -1720,6 +1953,7 @@ static bool hamamatsu_vmu_part2(openslide_t *osr,
 
 static bool hamamatsu_vms_vmu_open(openslide_t *osr, const char *filename,
                                    struct _openslide_tifflike *tl G_GNUC_UNUSED,
+                                   struct _openslide_probe *probe G_GNUC_UNUSED,
                                    struct _openslide_hash *quickhash1,
                                    GError **err) {
   // first, see if it's a VMS/VMU file
@@ -1955,6 +2189,7 @@ static bool hamamatsu_vms_vmu_open(openslide_t *osr, const char *filename,
                              (char **) image_filenames->pdata,
                              num_cols, num_rows,
                              optimisation_file,
+                             quickhash1,
                              err)) {
       return false;
     }
@@ -2001,6 +2236,7 @@ const struct _openslide_format _openslide_format_hamamatsu_vms_vmu = {
 
 static bool hamamatsu_ndpi_detect(const char *filename G_GNUC_UNUSED,
                                   struct _openslide_tifflike *tl,
+                                  struct _openslide_probe *probe G_GNUC_UNUSED,
                                   GError **err) {
   // ensure we have a tifflike
   if (!tl) {
@@ -2096,6 +2332,7 @@ static void ndpi_set_props(openslide_t *osr,
 
 static bool hamamatsu_ndpi_open(openslide_t *osr, const char *filename,
                                 struct _openslide_tifflike *tl,
+                                struct _openslide_probe *probe G_GNUC_UNUSED,
                                 struct _openslide_hash *quickhash1,
                                 GError **err) {
   g_autoptr(jpeg_setup) setup = jpeg_setup_new();
@@ -2296,7 +2533,7 @@ static bool hamamatsu_ndpi_open(openslide_t *osr, const char *filename,
   ndpi_set_props(osr, tl, 0);
 
   // init ops
-  return init_jpeg_ops(osr, g_steal_pointer(&setup),
+  return init_jpeg_ops(osr, g_steal_pointer(&setup), quickhash1,
                        restart_marker_scan, err);
 }
 
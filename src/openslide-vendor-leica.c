@@ -50,6 +50,9 @@ static const char LEICA_ATTR_IFD[] = "ifd";
 static const char LEICA_ATTR_Z_PLANE[] = "z";
 static const char LEICA_VALUE_BRIGHTFIELD[] = "brightfield";
 
+// the most bands of rows used to index a level's areas
+#define LEVEL_BANDS_MAX 256
+
 #define PARSE_INT_ATTRIBUTE_OR_RETURN(NODE, NAME, OUT, RET)	\
   do {								\
     GError *tmp_err = NULL;					\
@@ -68,6 +71,13 @@ struct level {
   struct _openslide_level base;
   double nm_per_pixel;
   GPtrArray *areas;
+
+  // the level divided into bands of rows, each listing the areas that
+  // overlap it in painting order, for finding the ones a region touches
+  int64_t band_h;
+  uint32_t band_count;
+  uint32_t *band_start;       // band_count + 1 offsets into band_areas
+  struct area **band_areas;
 };
 
 // a TIFF directory within a level
@@ -77,6 +87,8 @@ struct area {
 
   int64_t offset_x;
   int64_t offset_y;
+
+  uint32_t index;  // painting order
 };
 
 struct read_tile_args {
@@ -127,6 +139,8 @@ static void destroy_area(struct area *area) {
 
 static void destroy_level(struct level *l) {
   g_ptr_array_free(l->areas, true);
+  g_free(l->band_start);
+  g_free(l->band_areas);
   g_free(l);
 }
 
@@ -160,7 +174,7 @@ static bool read_tile(openslide_t *osr,
                                             args->area, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(tw * th * 4);
+    g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
     if (!_openslide_tiff_read_tile(tiffl, args->tiff,
                                    buf, tile_col, tile_row,
                                    err)) {
@@ -193,6 +207,138 @@ static bool read_tile(openslide_t *osr,
   return true;
 }
 
+static bool paint_area(struct level *l, struct area *area, TIFF *tiff,
+                       cairo_t *cr,
+                       int64_t x, int64_t y,
+                       int32_t w, int32_t h,
+                       GError **err) {
+  struct read_tile_args args = {
+    .tiff = tiff,
+    .area = area,
+  };
+  int64_t ax = x / l->base.downsample - area->offset_x;
+  int64_t ay = y / l->base.downsample - area->offset_y;
+  return _openslide_grid_paint_region(area->grid, cr, &args,
+                                      ax, ay, &l->base, w, h,
+                                      err);
+}
+
+static int cmp_area_index(const void *a, const void *b) {
+  const struct area *aa = *(const struct area **) a;
+  const struct area *ab = *(const struct area **) b;
+  return aa->index < ab->index ? -1 : aa->index > ab->index;
+}
+
+static uint32_t get_band(struct level *l, int64_t y) {
+  return CLAMP(y / l->band_h, 0, (int64_t) l->band_count - 1);
+}
+
+// the first and last bands an area overlaps
+static void get_area_bands(struct level *l, struct area *area,
+                           uint32_t *first, uint32_t *last) {
+  *first = get_band(l, area->offset_y);
+  *last = get_band(l, area->offset_y + MAX(area->tiffl.image_h, 1) - 1);
+}
+
+static void index_areas(struct level *l) {
+  // about one band per area, so an area usually spans a few bands
+  l->band_count = CLAMP(l->areas->len, 1, LEVEL_BANDS_MAX);
+  l->band_h = MAX((l->base.h + l->band_count - 1) / l->band_count, 1);
+  l->band_start = g_new0(uint32_t, l->band_count + 1);
+
+  // count the areas in each band, then fill the bands in painting order
+  for (uint32_t n = 0; n < l->areas->len; n++) {
+    struct area *area = l->areas->pdata[n];
+    area->index = n;
+    uint32_t first, last;
+    get_area_bands(l, area, &first, &last);
+    for (uint32_t band = first; band <= last; band++) {
+      l->band_start[band + 1]++;
+    }
+  }
+  for (uint32_t band = 0; band < l->band_count; band++) {
+    l->band_start[band + 1] += l->band_start[band];
+  }
+  l->band_areas = g_new(struct area *, l->band_start[l->band_count]);
+  g_autofree uint32_t *fill = g_memdup(l->band_start,
+                                       l->band_count * sizeof(*fill));
+  for (uint32_t n = 0; n < l->areas->len; n++) {
+    struct area *area = l->areas->pdata[n];
+    uint32_t first, last;
+    get_area_bands(l, area, &first, &last);
+    for (uint32_t band = first; band <= last; band++) {
+      l->band_areas[fill[band]++] = area;
+    }
+  }
+}
+
+// Add the areas touched by a region of the level, in level pixels, to
+// out in painting order.  Returns the number of pixels of the region they
+// cover, counting overlaps twice.
+static int64_t find_areas(struct level *l,
+                          int64_t x, int64_t y, int64_t w, int64_t h,
+                          GPtrArray *out) {
+  // allow for rounding in the grid
+  x--;
+  y--;
+  w += 2;
+  h += 2;
+
+  uint32_t first_band = get_band(l, y);
+  uint32_t last_band = get_band(l, y + h - 1);
+  int64_t pixels = 0;
+  for (uint32_t band = first_band; band <= last_band; band++) {
+    for (uint32_t n = l->band_start[band]; n < l->band_start[band + 1];
+         n++) {
+      struct area *area = l->band_areas[n];
+      // visit each area once, in the first band shared with the region
+      uint32_t area_first, area_last;
+      get_area_bands(l, area, &area_first, &area_last);
+      if (band != MAX(area_first, first_band)) {
+        continue;
+      }
+      int64_t x0 = MAX(x, area->offset_x);
+      int64_t y0 = MAX(y, area->offset_y);
+      int64_t x1 = MIN(x + w, area->offset_x + area->tiffl.image_w);
+      int64_t y1 = MIN(y + h, area->offset_y + area->tiffl.image_h);
+      if (x0 < x1 && y0 < y1) {
+        g_ptr_array_add(out, area);
+        pixels += (x1 - x0) * (y1 - y0);
+      }
+    }
+  }
+  if (first_band != last_band) {
+    g_ptr_array_sort(out, cmp_area_index);
+  }
+  return pixels;
+}
+
+struct area_prefetch {
+  openslide_t *osr;
+  struct level *l;
+  GPtrArray *areas;
+  int64_t x;
+  int64_t y;
+  int32_t w;
+  int32_t h;
+};
+
+// decode one area's tiles into the cache, painting to a nil surface
+static bool prefetch_area(int64_t item, void *arg, GError **err) {
+  struct area_prefetch *p = arg;
+  struct leica_ops_data *data = p->osr->data;
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return false;
+  }
+  g_autoptr(cairo_surface_t) surface =
+    cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 0, 0);
+  g_autoptr(cairo_t) cr = cairo_create(surface);
+  return paint_area(p->l, p->areas->pdata[item], ct.tiff, cr,
+                    p->x, p->y, p->w, p->h, err);
+}
+
 static bool paint_region(openslide_t *osr, cairo_t *cr,
 			 int64_t x, int64_t y,
 			 struct _openslide_level *level,
@@ -201,23 +347,45 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
   struct leica_ops_data *data = osr->data;
   struct level *l = (struct level *) level;
 
+  g_autoptr(GPtrArray) areas = g_ptr_array_new();
+  int64_t pixels = find_areas(l, x / level->downsample, y / level->downsample,
+                              w, h, areas);
+  if (!areas->len) {
+    return true;
+  }
+
+  // Decode the areas' tiles in parallel, then composite them in order.
+  // Skip this if we're already painting to a nil surface as part of a
+  // prefetch, or if the tiles might evict each other before they're
+  // composited.
+  cairo_surface_t *target = cairo_get_target(cr);
+  if (areas->len > 1 && _openslide_worker_get_thread_count() &&
+      cairo_image_surface_get_width(target) > 0 &&
+      (uint64_t) pixels * 4 <
+      _openslide_cache_binding_get_capacity(osr->cache) / 2) {
+    struct area_prefetch p = {
+      .osr = osr,
+      .l = l,
+      .areas = areas,
+      .x = x,
+      .y = y,
+      .w = w,
+      .h = h,
+    };
+    // only a hint; the paint below will report any errors
+    g_autoptr(GError) tmp_err = NULL;
+    _openslide_read_stats_set_prefetching(true);
+    _openslide_worker_run_batch(areas->len, prefetch_area, &p, &tmp_err);
+    _openslide_read_stats_set_prefetching(false);
+  }
+
   g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
   if (ct.tiff == NULL) {
     return false;
   }
 
-  for (uint32_t n = 0; n < l->areas->len; n++) {
-    struct area *area = l->areas->pdata[n];
-
-    struct read_tile_args args = {
-      .tiff = ct.tiff,
-      .area = area,
-    };
-    int64_t ax = x / l->base.downsample - area->offset_x;
-    int64_t ay = y / l->base.downsample - area->offset_y;
-    if (!_openslide_grid_paint_region(area->grid, cr, &args,
-                                      ax, ay, level, w, h,
-                                      err)) {
+  for (uint32_t n = 0; n < areas->len; n++) {
+    if (!paint_area(l, areas->pdata[n], ct.tiff, cr, x, y, w, h, err)) {
       return false;
     }
   }
@@ -231,7 +399,9 @@ static const struct _openslide_ops leica_ops = {
 };
 
 static bool leica_detect(const char *filename G_GNUC_UNUSED,
-                         struct _openslide_tifflike *tl, GError **err) {
+                         struct _openslide_tifflike *tl,
+                         struct _openslide_probe *probe,
+                         GError **err) {
   // ensure we have a TIFF
   if (!tl) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -275,6 +445,9 @@ static bool leica_detect(const char *filename G_GNUC_UNUSED,
     return false;
   }
 
+  // open() can reuse the document
+  _openslide_probe_set_data(probe, g_steal_pointer(&doc),
+                            (GDestroyNotify) xmlFreeDoc);
   return true;
 }
 
@@ -357,14 +530,8 @@ static void set_region_bounds_props(openslide_t *osr,
                       g_strdup_printf("%"PRId64, y1 - y0));
 }
 
-static struct collection *parse_xml_description(const char *xml,
+static struct collection *parse_xml_description(xmlDoc *doc,
                                                 GError **err) {
-  // parse the xml
-  g_autoptr(xmlDoc) doc = _openslide_xml_parse(xml, err);
-  if (doc == NULL) {
-    return NULL;
-  }
-
   // create XPATH context to query the document
   g_autoptr(xmlXPathContext) ctx = _openslide_xml_xpath_create(doc);
 
@@ -702,6 +869,7 @@ static bool create_levels_from_collection(openslide_t *osr,
       area->offset_x = area->offset_x / l->nm_per_pixel;
       area->offset_y = area->offset_y / l->nm_per_pixel;
     }
+    index_areas(l);
   }
 
   // process macro image
@@ -755,6 +923,7 @@ static bool create_levels_from_collection(openslide_t *osr,
 
 static bool leica_open(openslide_t *osr, const char *filename,
                        struct _openslide_tifflike *tl,
+                       struct _openslide_probe *probe,
                        struct _openslide_hash *quickhash1, GError **err) {
   // open TIFF
   g_autoptr(_openslide_tiffcache) tc = _openslide_tiffcache_create(filename);
@@ -770,11 +939,19 @@ static bool leica_open(openslide_t *osr, const char *filename,
     return false;
   }
 
-  // read XML
-  g_autoptr(collection) collection = parse_xml_description(image_desc, err);
+  // read XML, unless detect() already parsed it
+  g_autoptr(xmlDoc) doc = _openslide_probe_steal_data(probe);
+  if (!doc) {
+    doc = _openslide_xml_parse(image_desc, err);
+  }
+  if (!doc) {
+    return false;
+  }
+  g_autoptr(collection) collection = parse_xml_description(doc, err);
   if (!collection) {
     return false;
   }
+  g_clear_pointer(&doc, xmlFreeDoc);
 
   // initialize and verify levels
   g_autoptr(GPtrArray) level_array =
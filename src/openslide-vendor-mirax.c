@@ -76,6 +76,7 @@ static const char VALUE_SCAN_DATA_LAYER_THUMBNAIL[] = "ScanDataLayer_SlidePrevie
 static const char VALUE_SLIDE_ZOOM_LEVEL[] = "Slide zoom level";
 
 static const int SLIDE_POSITION_RECORD_SIZE = 9;
+static const int HIER_RECORD_SIZE = 16;
 
 static const char GROUP_DATAFILE[] = "DATAFILE";
 static const char KEY_FILE_COUNT[] = "FILE_COUNT";
@@ -168,20 +169,22 @@ struct slide_zoom_level_params {
   double tile_advance_y;
 };
 
+// Slides can have millions of images, so images and tiles are kept in
+// flat arrays rather than as individual allocations.  An image's index in
+// the slide's image array is its cache key.
 struct image {
   int32_t fileno;
   int32_t start_in_file;
   int32_t length;
-  int32_t imageno;   // used only for cache lookup
-  int refcount;
 };
 
+// the grid's tile data is the index into the level's tile array, plus one
 struct tile {
-  struct image *image;
+  uint32_t imageno;
 
-  // location in the image
-  double src_x;
-  double src_y;
+  // location in the image, in tiles
+  uint16_t src_col;
+  uint16_t src_row;
 };
 
 struct level {
@@ -194,25 +197,60 @@ struct level {
 
   double tile_w;
   double tile_h;
+
+  GArray *tiles;
 };
 
 struct mirax_ops_data {
   gchar **datafile_paths;
+  GArray *images;
+
+  // opened on demand and shared between threads with positional reads
+  GMutex datafiles_lock;
+  struct _openslide_file **datafiles;
 };
 
-static void image_unref(struct image *image) {
-  if (!--image->refcount) {
-    g_free(image);
+// returns the compressed image, either in the file mapping or in *buf_OUT,
+// which must be freed
+static const void *read_image_data(openslide_t *osr,
+                                   struct image *image,
+                                   void **buf_OUT,
+                                   GError **err) {
+  struct mirax_ops_data *data = osr->data;
+  *buf_OUT = NULL;
+
+  g_mutex_lock(&data->datafiles_lock);
+  struct _openslide_file *f = data->datafiles[image->fileno];
+  g_mutex_unlock(&data->datafiles_lock);
+  if (!f) {
+    // open without the lock, so a slow open doesn't stall reads from
+    // other data files.  if another thread wins the race, use its handle.
+    g_autoptr(_openslide_file) new_f =
+      _openslide_fopen_mapped(data->datafile_paths[image->fileno], err);
+    if (!new_f) {
+      return NULL;
+    }
+    g_mutex_lock(&data->datafiles_lock);
+    if (!data->datafiles[image->fileno]) {
+      data->datafiles[image->fileno] = g_steal_pointer(&new_f);
+    }
+    f = data->datafiles[image->fileno];
+    g_mutex_unlock(&data->datafiles_lock);
   }
-}
 
-typedef struct image image;
-G_DEFINE_AUTOPTR_CLEANUP_FUNC(image, image_unref)
+  const void *mapped = _openslide_fmap_range(f, image->start_in_file,
+                                             image->length);
+  if (mapped) {
+    return mapped;
+  }
 
-static void tile_free(gpointer data) {
-  struct tile *tile = data;
-  image_unref(tile->image);
-  g_free(tile);
+  g_autofree void *buf = g_malloc(image->length);
+  if (!_openslide_fpread_exact(f, buf, image->length, image->start_in_file,
+                               err)) {
+    return NULL;
+  }
+  *buf_OUT = g_steal_pointer(&buf);
+  return *buf_OUT;
 }
 
 static uint32_t *read_image(openslide_t *osr,
@@ -220,30 +258,32 @@ static uint32_t *read_image(openslide_t *osr,
                             enum image_format format,
                             int w, int h,
                             GError **err) {
-  struct mirax_ops_data *data = osr->data;
   bool result = false;
 
-  g_autofree uint32_t *dest = g_malloc(w * h * 4);
+  g_autofree void *allocated = NULL;
+  const void *buf = read_image_data(osr, image, &allocated, err);
+  if (!buf) {
+    return NULL;
+  }
+
+  g_autofree uint32_t *dest = _openslide_cache_alloc(osr->cache, w * h * 4);
 
   switch (format) {
   case FORMAT_JPEG:
-    result = _openslide_jpeg_read(data->datafile_paths[image->fileno],
-                                  image->start_in_file,
-                                  dest, w, h,
-                                  err);
+    result = _openslide_jpeg_decode_buffer(buf, image->length,
+                                           dest, w, h,
+                                           err);
     break;
   case FORMAT_PNG:
-    result = _openslide_png_read(data->datafile_paths[image->fileno],
-                                 image->start_in_file,
-                                 dest, w, h,
-                                 err);
+    result = _openslide_png_decode_buffer(buf, image->length,
+                                          dest, w, h,
+                                          err);
     break;
   case FORMAT_BMP:
-    result = _openslide_gdkpixbuf_read("bmp",
-                                       data->datafile_paths[image->fileno],
-                                       image->start_in_file, image->length,
-                                       dest, w, h,
-                                       err);
+    result = _openslide_gdkpixbuf_decode_buffer("bmp",
+                                                buf, image->length,
+                                                dest, w, h,
+                                                err);
     break;
   default:
     g_assert_not_reached();
@@ -263,31 +303,37 @@ static bool read_tile(openslide_t *osr,
                       void *data,
                       void *arg G_GNUC_UNUSED,
                       GError **err) {
+  struct mirax_ops_data *mdata = osr->data;
   struct level *l = (struct level *) level;
-  struct tile *tile = data;
+  const struct tile *tile =
+    &g_array_index(l->tiles, struct tile, GPOINTER_TO_SIZE(data) - 1);
+  struct image *image =
+    &g_array_index(mdata->images, struct image, tile->imageno);
+  const double src_x = l->tile_w * tile->src_col;
+  const double src_y = l->tile_h * tile->src_row;
   bool success = true;
 
   int iw = l->image_width;
   int ih = l->image_height;
 
-  //g_debug("mirax read_tile: src: %g %g, dim: %d %d, tile dim: %g %g, region %g %g %g %g", tile->src_x, tile->src_y, l->image_width, l->image_height, l->tile_w, l->tile_h, x, y, w, h);
+  //g_debug("mirax read_tile: src: %g %g, dim: %d %d, tile dim: %g %g, region %g %g %g %g", src_x, src_y, l->image_width, l->image_height, l->tile_w, l->tile_h, x, y, w, h);
 
   // get the image data, possibly from cache
   g_autoptr(_openslide_cache_entry) cache_entry = NULL;
   uint32_t *tiledata = _openslide_cache_get(osr->cache,
                                             level,
-                                            tile->image->imageno,
+                                            tile->imageno,
                                             0,
                                             &cache_entry);
 
   if (!tiledata) {
-    tiledata = read_image(osr, tile->image, l->image_format, iw, ih, err);
+    tiledata = read_image(osr, image, l->image_format, iw, ih, err);
     if (tiledata == NULL) {
       return false;
     }
 
     _openslide_cache_put(osr->cache,
-                         level, tile->image->imageno, 0,
+                         level, tile->imageno, 0,
                          tiledata,
                          iw * ih * 4,
                          &cache_entry);
@@ -307,7 +353,7 @@ static bool read_tile(openslide_t *osr,
                                                            ceil(l->tile_w),
                                                            ceil(l->tile_h));
     g_autoptr(cairo_t) cr2 = cairo_create(surface2);
-    cairo_set_source_surface(cr2, surface, -tile->src_x, -tile->src_y);
+    cairo_set_source_surface(cr2, surface, -src_x, -src_y);
 
     // replace original image surface
     cairo_surface_destroy(surface);
@@ -342,6 +388,9 @@ static bool paint_region(openslide_t *osr G_GNUC_UNUSED, cairo_t *cr,
 
 static void destroy_level(struct level *l) {
   _openslide_grid_destroy(l->grid);
+  if (l->tiles) {
+    g_array_free(l->tiles, true);
+  }
   g_free(l);
 }
 
@@ -355,7 +404,15 @@ static void destroy(openslide_t *osr) {
   g_free(osr->levels);
 
   // the ops data
+  for (int i = 0; data->datafile_paths[i]; i++) {
+    if (data->datafiles[i]) {
+      _openslide_fclose(data->datafiles[i]);
+    }
+  }
+  g_free(data->datafiles);
+  g_mutex_clear(&data->datafiles_lock);
   g_strfreev(data->datafile_paths);
+  g_array_free(data->images, true);
   g_free(data);
 }
 
@@ -365,6 +422,7 @@ static const struct _openslide_ops mirax_ops = {
 };
 
 static bool mirax_detect(const char *filename, struct _openslide_tifflike *tl,
+                         struct _openslide_probe *probe G_GNUC_UNUSED,
                          GError **err) {
   // reject TIFFs
   if (tl) {
@@ -559,19 +617,18 @@ static bool read_nonhier_record(struct _openslide_file *f,
 
 static void insert_tile(struct level *l,
                         const struct slide_zoom_level_params *lp,
-                        struct image *image,
+                        uint32_t imageno,
                         double pos_x, double pos_y,
-                        double src_x, double src_y,
+                        int src_col, int src_row,
                         int tile_x, int tile_y,
                         int zoom_level) {
-  // increment image refcount
-  image->refcount++;
-
   // generate tile
-  struct tile *tile = g_new0(struct tile, 1);
-  tile->image = image;
-  tile->src_x = src_x;
-  tile->src_y = src_y;
+  struct tile tile = {
+    .imageno = imageno,
+    .src_col = src_col,
+    .src_row = src_row,
+  };
+  g_array_append_val(l->tiles, tile);
 
   // compute offset
   double offset_x = pos_x - (tile_x * lp->tile_advance_x);
@@ -592,14 +649,14 @@ static void insert_tile(struct level *l,
                                    tile_x, tile_y,
                                    offset_x, offset_y,
                                    l->tile_w, l->tile_h,
-                                   tile);
+                                   GSIZE_TO_POINTER(l->tiles->len));
 
   if (!true) {
     g_debug("zoom %d, tile %d %d, pos %.10g %.10g, offset %.10g %.10g",
 	    zoom_level, tile_x, tile_y, pos_x, pos_y, offset_x, offset_y);
 
     g_debug(" src %.10g %.10g dim %.10g %.10g",
-	    tile->src_x, tile->src_y, l->tile_w, l->tile_h);
+	    l->tile_w * src_col, l->tile_h * src_row, l->tile_w, l->tile_h);
   }
 }
 
@@ -682,9 +739,9 @@ static bool process_hier_data_pages_from_indexfile(struct _openslide_file *f,
 						   int image_divisions,
 						   const struct slide_zoom_level_params *slide_zoom_level_params,
 						   int32_t *slide_positions,
+						   GArray *images,
 						   struct _openslide_hash *quickhash1,
 						   GError **err) {
-  int32_t image_number = 0;
 
   // used for storing which positions actually have data
   g_autoptr(GHashTable) active_positions =
@@ -696,6 +753,12 @@ static bool process_hier_data_pages_from_indexfile(struct _openslide_file *f,
         zoom_level;
     int32_t ptr;
 
+    if (lp->tiles_per_image > G_MAXUINT16) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Too many tiles per image for zoom level %d", zoom_level);
+      return false;
+    }
+
     //    g_debug("reading zoom_level %d", zoom_level);
 
     if (!_openslide_fseek(f, seek_location, SEEK_SET, err)) {
@@ -755,12 +818,39 @@ static bool process_hier_data_pages_from_indexfile(struct _openslide_file *f,
         return false;
       }
 
+      // read the whole page at once, if the file can hold it
+      off_t pos = _openslide_ftell(f, err);
+      if (pos == -1) {
+        return false;
+      }
+      off_t size = _openslide_fsize(f, err);
+      if (size == -1) {
+        return false;
+      }
+      if (page_len < 0 ||
+          (uint64_t) page_len * HIER_RECORD_SIZE > (uint64_t) (size - pos)) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Invalid page length %d", page_len);
+        return false;
+      }
+      size_t page_size = (size_t) page_len * HIER_RECORD_SIZE;
+      g_autofree int32_t *page = g_try_malloc(page_size);
+      if (page_size && !page) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Couldn't allocate data page of %d records", page_len);
+        return false;
+      }
+      if (!_openslide_fread_exact(f, page, page_size, err)) {
+        g_prefix_error(err, "Can't read data page: ");
+        return false;
+      }
+
       // read all the data into the list
       for (int i = 0; i < page_len; i++) {
-	int32_t image_index = read_le_int32_from_file(f);
-	int32_t offset = read_le_int32_from_file(f);
-	int32_t length = read_le_int32_from_file(f);
-	int32_t fileno = read_le_int32_from_file(f);
+	int32_t image_index = GINT32_FROM_LE(page[i * 4]);
+	int32_t offset = GINT32_FROM_LE(page[i * 4 + 1]);
+	int32_t length = GINT32_FROM_LE(page[i * 4 + 2]);
+	int32_t fileno = GINT32_FROM_LE(page[i * 4 + 3]);
 
 	if (image_index < 0) {
           g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -826,12 +916,13 @@ static bool process_hier_data_pages_from_indexfile(struct _openslide_file *f,
 	}
 
 	// populate the image structure
-	g_autoptr(image) image = g_new0(struct image, 1);
-	image->fileno = fileno;
-	image->start_in_file = offset;
-	image->length = length;
-	image->imageno = image_number++;
-	image->refcount = 1;
+	struct image image = {
+	  .fileno = fileno,
+	  .start_in_file = offset,
+	  .length = length,
+	};
+	uint32_t imageno = images->len;
+	g_array_append_val(images, image);
 
 	/*
 	g_debug("image_concat: %d, tiles_per_image: %d",
@@ -877,11 +968,10 @@ static bool process_hier_data_pages_from_indexfile(struct _openslide_file *f,
 
 	    //g_debug("pos0: %d %d, pos: %g %g", pos0_x, pos0_y, pos_x, pos_y);
 
-            // increments image refcount
 	    insert_tile(l, lp,
-                        image,
+                        imageno,
                         pos_x, pos_y,
-                        l->tile_w * xi, l->tile_h * yi,
+                        xi, yi,
                         x / lp->tile_count_divisor + xi,
                         y / lp->tile_count_divisor + yi,
                         zoom_level);
@@ -1026,6 +1116,7 @@ static bool process_indexfile(openslide_t *osr,
 			      const struct slide_zoom_level_params *slide_zoom_level_params,
 			      struct _openslide_file *indexfile,
 			      struct level **levels,
+			      GArray *images,
 			      struct _openslide_hash *quickhash1,
 			      GError **err) {
   const int npositions = (images_x / image_divisions) * (images_y / image_divisions);
@@ -1192,6 +1283,7 @@ static bool process_indexfile(openslide_t *osr,
 					      image_divisions,
 					      slide_zoom_level_params,
 					      slide_positions,
+					      images,
 					      quickhash1,
 					      err)) {
     return false;
@@ -1369,6 +1461,7 @@ static int get_associated_image_nonhier_offset(GKeyFile *keyfile,
 
 static bool mirax_open(openslide_t *osr, const char *filename,
                        struct _openslide_tifflike *tl G_GNUC_UNUSED,
+                       struct _openslide_probe *probe G_GNUC_UNUSED,
                        struct _openslide_hash *quickhash1, GError **err) {
   // get directory from filename
   g_autofree char *dirname =
@@ -1677,6 +1770,7 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   // set up level dimensions and such
   g_autoptr(GPtrArray) level_array =
     g_ptr_array_new_with_free_func((GDestroyNotify) destroy_level);
+  g_autoptr(GArray) images = g_array_new(false, false, sizeof(struct image));
   g_autofree struct slide_zoom_level_params *slide_zoom_level_params =
     g_new(struct slide_zoom_level_params, zoom_levels);
   int total_concat_exponent = 0;
@@ -1775,7 +1869,8 @@ static bool mirax_open(openslide_t *osr, const char *filename,
     l->grid = _openslide_grid_create_tilemap(osr,
                                              lp->tile_advance_x,
                                              lp->tile_advance_y,
-                                             read_tile, tile_free);
+                                             read_tile, NULL);
+    l->tiles = g_array_new(false, false, sizeof(struct tile));
 
     //g_debug("level %d tile advance %.10g %.10g, dim %"PRId64" %"PRId64", image size %d %d, tile %g %g, image_concat %d, tile_count_divisor %d, positions_per_tile %d", i, lp->tile_advance_x, lp->tile_advance_y, l->base.w, l->base.h, l->image_width, l->image_height, l->tile_w, l->tile_h, lp->image_concat, lp->tile_count_divisor, lp->positions_per_tile);
   }
@@ -1797,6 +1892,7 @@ static bool mirax_open(openslide_t *osr, const char *filename,
 			 slide_zoom_level_params,
 			 indexfile,
 			 (struct level **) level_array->pdata,
+			 images,
 			 quickhash1,
 			 err)) {
     return false;
@@ -1854,6 +1950,9 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   g_assert(osr->data == NULL);
   struct mirax_ops_data *data = g_new0(struct mirax_ops_data, 1);
   data->datafile_paths = g_steal_pointer(&datafile_paths);
+  data->images = g_steal_pointer(&images);
+  g_mutex_init(&data->datafiles_lock);
+  data->datafiles = g_new0(struct _openslide_file *, datafile_count);
   osr->data = data;
 
   // set ops
@@ -88,11 +88,11 @@ static bool read_tile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
+    tiledata = _openslide_cache_alloc(osr->cache, tw * th * 4);
     if (!_openslide_tiff_read_tile(tiffl, tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      g_free(tiledata);
       return false;
     }
 
@@ -100,7 +100,7 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      g_free(tiledata);
       return false;
     }
 
@@ -211,7 +211,8 @@ FAIL:
 
 static bool optra_detect(const char *filename G_GNUC_UNUSED,
                                 struct _openslide_tifflike *tl,
-                                GError **err) {
+                         struct _openslide_probe *probe G_GNUC_UNUSED,
+                         GError **err) {
   // ensure we have a TIFF
   if (!tl) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -271,7 +272,8 @@ static int width_compare(gconstpointer a, gconstpointer b) {
 static bool optra_open(openslide_t *osr,
                               const char *filename,
                               struct _openslide_tifflike *tl,
-                              struct _openslide_hash *quickhash1,
+                       struct _openslide_probe *probe G_GNUC_UNUSED,
+                       struct _openslide_hash *quickhash1,
                               GError **err) {
   GPtrArray *level_array = g_ptr_array_new();
 
@@ -61,6 +61,18 @@ static const char MAIN_IMAGE_XPATH[] = SCANNED_IMAGE_XPATH("WSI");
 static const char LABEL_DATA_XPATH[] = ASSOCIATED_IMAGE_DATA_XPATH("LABELIMAGE");
 static const char MACRO_DATA_XPATH[] = ASSOCIATED_IMAGE_DATA_XPATH("MACROIMAGE");
 
+// the value add_properties() would give the "philips.<name>" property
+#define PROPERTY_XPATH(name) \
+  "(/DataObject/Attribute[@Name='" name "'] | " \
+  SCANNED_IMAGE_XPATH("WSI") "[1]/Attribute[@Name='" name "'])" \
+  "[not(*)][last()]"
+static const char PIXEL_SPACING_XPATH[] = PROPERTY_XPATH("DICOM_PIXEL_SPACING");
+static const char DERIVATION_XPATH[] =
+  PROPERTY_XPATH("DICOM_DERIVATION_DESCRIPTION");
+
+// base64 characters to decode when reading associated image dimensions
+#define DIMENSIONS_B64_PREFIX (64 << 10)
+
 struct philips_tiff_ops_data {
   struct _openslide_tiffcache *tc;
 };
@@ -75,6 +87,11 @@ struct xml_associated_image {
   struct _openslide_associated_image base;
   struct _openslide_tiffcache *tc;
   const char *xpath;  // static string; do not free
+  // location of the base64 data in the ImageDescription, if it appears
+  // there verbatim; otherwise the XML is reparsed on every read
+  bool have_range;
+  size_t b64_offset;
+  size_t b64_len;
 };
 
 static void destroy_level(struct level *l) {
@@ -93,6 +110,62 @@ static void destroy(openslide_t *osr) {
   g_free(osr->levels);
 }
 
+// returns NULL without an error for a missing tile
+static uint32_t *load_tile(openslide_t *osr,
+                           struct level *l,
+                           TIFF *tiff,
+                           int64_t tile_col, int64_t tile_row,
+                           struct _openslide_cache_entry **cache_entry,
+                           GError **err) {
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+
+  // tile size
+  int64_t tw = tiffl->tile_w;
+  int64_t th = tiffl->tile_h;
+
+  // cache
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            l, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  // slides with multiple ROIs are sparse
+  bool is_missing;
+  if (!_openslide_tiff_check_missing_tile(tiffl, tiff,
+                                          tile_col, tile_row,
+                                          &is_missing, err)) {
+    return NULL;
+  }
+  if (is_missing) {
+    return NULL;
+  }
+
+  g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
+  if (!_openslide_tiff_read_tile(tiffl, tiff,
+                                 buf, tile_col, tile_row,
+                                 err)) {
+    return NULL;
+  }
+
+  // clip, if necessary
+  if (!_openslide_clip_tile(buf,
+                            tw, th,
+                            l->base.w - tile_col * tw,
+                            l->base.h - tile_row * th,
+                            err)) {
+    return NULL;
+  }
+
+  // put it in the cache
+  tiledata = g_steal_pointer(&buf);
+  _openslide_cache_put(osr->cache, l, tile_col, tile_row,
+                       tiledata, tw * th * 4,
+                       cache_entry);
+  return tiledata;
+}
+
 static bool read_tile(openslide_t *osr,
                       cairo_t *cr,
                       struct _openslide_level *level,
@@ -100,59 +173,27 @@ static bool read_tile(openslide_t *osr,
                       void *arg,
                       GError **err) {
   struct level *l = (struct level *) level;
-  struct _openslide_tiff_level *tiffl = &l->tiffl;
   TIFF *tiff = arg;
 
-  // tile size
-  int64_t tw = tiffl->tile_w;
-  int64_t th = tiffl->tile_h;
-
-  // cache
+  GError *tmp_err = NULL;
   g_autoptr(_openslide_cache_entry) cache_entry = NULL;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = load_tile(osr, l, tiff, tile_col, tile_row,
+                                 &cache_entry, &tmp_err);
   if (!tiledata) {
-    // slides with multiple ROIs are sparse
-    bool is_missing;
-    if (!_openslide_tiff_check_missing_tile(tiffl, tiff,
-                                            tile_col, tile_row,
-                                            &is_missing, err)) {
-      return false;
-    }
-    if (is_missing) {
-      // nothing to draw
-      return true;
-    }
-
-    g_autofree uint32_t *buf = g_malloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
-                                   buf, tile_col, tile_row,
-                                   err)) {
-      return false;
-    }
-
-    // clip, if necessary
-    if (!_openslide_clip_tile(buf,
-                              tw, th,
-                              l->base.w - tile_col * tw,
-                              l->base.h - tile_row * th,
-                              err)) {
+    if (tmp_err) {
+      g_propagate_error(err, tmp_err);
       return false;
     }
-
-    // put it in the cache
-    tiledata = g_steal_pointer(&buf);
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-                         tiledata, tw * th * 4,
-                         &cache_entry);
+    // nothing to draw
+    return true;
   }
 
   // draw it
   g_autoptr(cairo_surface_t) surface =
     cairo_image_surface_create_for_data((unsigned char *) tiledata,
                                         CAIRO_FORMAT_ARGB32,
-                                        tw, th, tw * 4);
+                                        l->tiffl.tile_w, l->tiffl.tile_h,
+                                        l->tiffl.tile_w * 4);
   cairo_set_source_surface(cr, surface, 0, 0);
   cairo_paint(cr);
 
@@ -179,13 +220,56 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
                                       err);
 }
 
+static uint32_t *get_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          struct _openslide_cache_entry **cache_entry,
+                          GError **err) {
+  struct philips_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  // skip the TIFF handle if the tile is cached
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            level, tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (ct.tiff == NULL) {
+    return NULL;
+  }
+  return load_tile(osr, l, ct.tiff, tile_col, tile_row, cache_entry, err);
+}
+
+static void prefetch_tile_data(openslide_t *osr,
+                               struct _openslide_level *level,
+                               const struct _openslide_tile_position *tiles,
+                               int64_t count) {
+  struct philips_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, NULL);
+  if (ct.tiff == NULL) {
+    return;
+  }
+  _openslide_tiff_prefetch_tile_data(&l->tiffl, ct.tiff, tiles, count);
+}
+
+static bool load_properties(openslide_t *osr, GError **err);
+
 static const struct _openslide_ops philips_tiff_ops = {
   .paint_region = paint_region,
+  .get_tile = get_tile,
+  .prefetch_tile_data = prefetch_tile_data,
+  .load_properties = load_properties,
   .destroy = destroy,
 };
 
 static bool philips_tiff_detect(const char *filename G_GNUC_UNUSED,
                                 struct _openslide_tifflike *tl,
+                                struct _openslide_probe *probe,
                                 GError **err) {
   // ensure we have a TIFF
   if (!tl) {
@@ -236,6 +320,9 @@ static bool philips_tiff_detect(const char *filename G_GNUC_UNUSED,
     return false;
   }
 
+  // open() can reuse the document
+  _openslide_probe_set_data(probe, g_steal_pointer(&doc),
+                            (GDestroyNotify) xmlFreeDoc);
   return true;
 }
 
@@ -252,20 +339,45 @@ static xmlDoc *parse_xml(TIFF *tiff, GError **err) {
   return _openslide_xml_parse(image_desc, err);
 }
 
-static bool get_compressed_xml_associated_image_data(xmlDoc *doc,
-                                                     const char *xpath,
-                                                     void **out_data,
-                                                     gsize *out_len,
-                                                     GError **err) {
+static char *get_xml_associated_image_b64(xmlDoc *doc,
+                                          const char *xpath,
+                                          GError **err) {
   g_autoptr(xmlXPathContext) ctx = _openslide_xml_xpath_create(doc);
-  g_autofree char *b64_data = _openslide_xml_xpath_get_string(ctx, xpath);
+  char *b64_data = _openslide_xml_xpath_get_string(ctx, xpath);
   if (!b64_data) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Couldn't read associated image data");
-    return false;
+    return NULL;
   }
-  *out_data = g_base64_decode(b64_data, out_len);
-  return true;
+  return b64_data;
+}
+
+static void *decode_b64(const char *b64, size_t len, gsize *out_len) {
+  uint8_t *data = g_malloc(len / 4 * 3 + 3);
+  gint state = 0;
+  guint save = 0;
+  *out_len = g_base64_decode_step(b64, len, data, &state, &save);
+  return data;
+}
+
+static void *read_xml_associated_image_range(struct xml_associated_image *img,
+                                             TIFF *tiff,
+                                             gsize *out_len,
+                                             GError **err) {
+  if (!_openslide_tiff_set_dir(tiff, 0, err)) {
+    return NULL;
+  }
+  const char *image_desc;
+  if (!TIFFGetField(tiff, TIFFTAG_IMAGEDESCRIPTION, &image_desc)) {
+    _openslide_tiff_error(err, tiff, "Couldn't read ImageDescription");
+    return NULL;
+  }
+  if (strlen(image_desc) < img->b64_offset + img->b64_len) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "ImageDescription changed after open");
+    return NULL;
+  }
+  return decode_b64(image_desc + img->b64_offset, img->b64_len, out_len);
 }
 
 static bool get_xml_associated_image_data(struct _openslide_associated_image *_img,
@@ -278,16 +390,24 @@ static bool get_xml_associated_image_data(struct _openslide_associated_image *_i
     return false;
   }
 
-  g_autoptr(xmlDoc) doc = parse_xml(ct.tiff, err);
-  if (!doc) {
-    return false;
-  }
-
   g_autofree void *data = NULL;
   gsize len;
-  if (!get_compressed_xml_associated_image_data(doc, img->xpath,
-                                                &data, &len, err)) {
-    return false;
+  if (img->have_range) {
+    data = read_xml_associated_image_range(img, ct.tiff, &len, err);
+    if (!data) {
+      return false;
+    }
+  } else {
+    g_autoptr(xmlDoc) doc = parse_xml(ct.tiff, err);
+    if (!doc) {
+      return false;
+    }
+    g_autofree char *b64_data =
+      get_xml_associated_image_b64(doc, img->xpath, err);
+    if (!b64_data) {
+      return false;
+    }
+    data = g_base64_decode(b64_data, &len);
   }
 
   return _openslide_jpeg_decode_buffer(data, len, dest,
@@ -309,6 +429,7 @@ static const struct _openslide_associated_image_ops philips_tiff_xml_associated_
 static bool maybe_add_xml_associated_image(openslide_t *osr,
                                            struct _openslide_tiffcache *tc,
                                            xmlDoc *doc,
+                                           const char *image_desc,
                                            const char *name,
                                            const char *xpath,
                                            GError **err) {
@@ -317,18 +438,25 @@ static bool maybe_add_xml_associated_image(openslide_t *osr,
     return true;
   }
 
-  g_autofree void *data = NULL;
-  gsize len;
-  if (!get_compressed_xml_associated_image_data(doc, xpath,
-                                                &data, &len, err)) {
+  g_autofree char *b64_data = get_xml_associated_image_b64(doc, xpath, err);
+  if (!b64_data) {
     g_prefix_error(err, "Can't locate %s associated image: ", name);
     return false;
   }
+  size_t b64_len = strlen(b64_data);
 
+  // the JPEG header is at the start, so try to read the dimensions
+  // without decoding the whole image
   int32_t w, h;
-  if (!_openslide_jpeg_decode_buffer_dimensions(data, len, &w, &h, err)) {
-    g_prefix_error(err, "Can't decode %s associated image: ", name);
-    return false;
+  gsize len;
+  g_autofree void *prefix =
+    decode_b64(b64_data, MIN(b64_len, DIMENSIONS_B64_PREFIX), &len);
+  if (!_openslide_jpeg_decode_buffer_dimensions(prefix, len, &w, &h, NULL)) {
+    g_autofree void *data = decode_b64(b64_data, b64_len, &len);
+    if (!_openslide_jpeg_decode_buffer_dimensions(data, len, &w, &h, err)) {
+      g_prefix_error(err, "Can't decode %s associated image: ", name);
+      return false;
+    }
   }
 
   //g_debug("Adding %s image from XML", name);
@@ -339,6 +467,14 @@ static bool maybe_add_xml_associated_image(openslide_t *osr,
   img->tc = tc;
   img->xpath = xpath;
 
+  // remember where the data is, so reads needn't reparse the XML
+  const char *b64_start = strstr(image_desc, b64_data);
+  if (b64_start) {
+    img->have_range = true;
+    img->b64_offset = b64_start - image_desc;
+    img->b64_len = b64_len;
+  }
+
   g_hash_table_insert(osr->associated_images, g_strdup(name), img);
 
   return true;
@@ -446,9 +582,9 @@ static uint32_t parse_objective_power(const char *derivation, GError **err) {
   return 0;
 }
 
-static void add_openslide_properties(openslide_t *osr) {
-  const char *spacing = g_hash_table_lookup(osr->properties,
-                                            "philips.DICOM_PIXEL_SPACING");
+static void add_openslide_properties(openslide_t *osr,
+                                     const char *spacing,
+                                     const char *derivation) {
   if (spacing) {
     double w, h;
     if (parse_pixel_spacing(spacing, &w, &h, NULL)) {
@@ -461,9 +597,6 @@ static void add_openslide_properties(openslide_t *osr) {
     }
   }
 
-  const char *derivation =
-    g_hash_table_lookup(osr->properties,
-                        "philips.DICOM_DERIVATION_DESCRIPTION");
   if (derivation) {
     uint32_t objective_power = parse_objective_power(derivation, NULL);
     if (objective_power) {
@@ -474,6 +607,21 @@ static void add_openslide_properties(openslide_t *osr) {
   }
 }
 
+static bool load_properties(openslide_t *osr, GError **err) {
+  struct philips_tiff_ops_data *data = osr->data;
+  g_auto(_openslide_cached_tiff) ct = _openslide_tiffcache_get(data->tc, err);
+  if (!ct.tiff) {
+    return false;
+  }
+  g_autoptr(xmlDoc) doc = parse_xml(ct.tiff, err);
+  if (doc == NULL) {
+    return false;
+  }
+  g_autoptr(xmlXPathContext) ctx = _openslide_xml_xpath_create(doc);
+  add_properties(osr, ctx, "philips", "/DataObject/Attribute");
+  return true;
+}
+
 static bool fix_level_dimensions(struct level **levels,
                                  int32_t level_count,
                                  xmlDoc *doc,
@@ -544,6 +692,7 @@ static bool verify_main_image_count(xmlDoc *doc, GError **err) {
 static bool philips_tiff_open(openslide_t *osr,
                               const char *filename,
                               struct _openslide_tifflike *tl,
+                              struct _openslide_probe *probe,
                               struct _openslide_hash *quickhash1,
                               GError **err) {
   // open TIFF
@@ -553,8 +702,12 @@ static bool philips_tiff_open(openslide_t *osr,
     return false;
   }
 
-  // parse XML document
-  g_autoptr(xmlDoc) doc = parse_xml(ct.tiff, err);
+  // parse XML document, unless detect() already did
+  // the DOM is only needed during open
+  g_autoptr(xmlDoc) doc = _openslide_probe_steal_data(probe);
+  if (!doc) {
+    doc = parse_xml(ct.tiff, err);
+  }
   if (doc == NULL) {
     return false;
   }
@@ -673,17 +826,35 @@ static bool philips_tiff_open(openslide_t *osr,
   g_hash_table_remove(osr->properties, OPENSLIDE_PROPERTY_NAME_COMMENT);
   g_hash_table_remove(osr->properties, "tiff.ImageDescription");
 
-  // add properties from XML
+  // add properties from XML, or leave them for load_properties()
   g_autoptr(xmlXPathContext) ctx = _openslide_xml_xpath_create(doc);
-  add_properties(osr, ctx, "philips", "/DataObject/Attribute");
-  add_openslide_properties(osr);
+  if (_openslide_lazy_properties()) {
+    osr->properties_deferred = true;
+    g_autofree char *spacing =
+      _openslide_xml_xpath_get_string(ctx, PIXEL_SPACING_XPATH);
+    g_autofree char *derivation =
+      _openslide_xml_xpath_get_string(ctx, DERIVATION_XPATH);
+    add_openslide_properties(osr, spacing, derivation);
+  } else {
+    add_properties(osr, ctx, "philips", "/DataObject/Attribute");
+    add_openslide_properties(osr,
+                             g_hash_table_lookup(osr->properties,
+                                                 "philips.DICOM_PIXEL_SPACING"),
+                             g_hash_table_lookup(osr->properties,
+                                                 "philips.DICOM_DERIVATION_DESCRIPTION"));
+  }
 
   // add associated images from XML
   // errors are non-fatal
-  maybe_add_xml_associated_image(osr, tc, doc,
-                                 "label", LABEL_DATA_XPATH, NULL);
-  maybe_add_xml_associated_image(osr, tc, doc,
-                                 "macro", MACRO_DATA_XPATH, NULL);
+  const char *image_desc;
+  if (_openslide_tiff_set_dir(ct.tiff, 0, NULL) &&
+      TIFFGetField(ct.tiff, TIFFTAG_IMAGEDESCRIPTION, &image_desc)) {
+    maybe_add_xml_associated_image(osr, tc, doc, image_desc,
+                                   "label", LABEL_DATA_XPATH, NULL);
+    maybe_add_xml_associated_image(osr, tc, doc, image_desc,
+                                   "macro", MACRO_DATA_XPATH, NULL);
+  }
+  g_clear_pointer(&doc, xmlFreeDoc);
 
   // allocate private data
   struct philips_tiff_ops_data *data = g_new0(struct philips_tiff_ops_data, 1);
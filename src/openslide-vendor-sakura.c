@@ -40,6 +40,7 @@
 #include <string.h>
 
 static const char MAGIC_BYTES[] = "SVGigaPixelImage";
+static const char SQLITE_MAGIC[] = "SQLite format 3";  // plus trailing NUL
 
 static const struct property {
   const char *table;
@@ -87,14 +88,26 @@ enum color_index {
 
 struct sakura_ops_data {
   char *filename;
-  char *data_sql;
+  char *tile_sql;
   int32_t tile_size;
-  int32_t focal_plane;
+  struct _openslide_focal_planes focal_planes;
+
+  // idle connections; opening a database and preparing its statement
+  // cost more than reading a tile
+  GMutex conns_lock;
+  GQueue idle_conns;
+};
+
+// a database connection and its prepared tile query
+struct conn {
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
 };
 
 struct level {
   struct _openslide_level base;
   struct _openslide_grid *grid;
+  int32_t focal_plane;
 };
 
 struct associated_image {
@@ -122,7 +135,9 @@ static char *get_quoted_unique_table_name(sqlite3 *db, GError **err) {
 }
 
 static bool sakura_detect(const char *filename,
-                          struct _openslide_tifflike *tl, GError **err) {
+                          struct _openslide_tifflike *tl,
+                          struct _openslide_probe *probe,
+                          GError **err) {
   // reject TIFFs
   if (tl) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -130,6 +145,13 @@ static bool sakura_detect(const char *filename,
     return false;
   }
 
+  // check SQLite header before starting SQLite
+  if (!_openslide_probe_check_magic(probe, 0, SQLITE_MAGIC,
+                                    sizeof(SQLITE_MAGIC), err)) {
+    g_prefix_error(err, "Not an SQLite database: ");
+    return false;
+  }
+
   // open database
   g_autoptr(sqlite3) db = _openslide_sqlite_open(filename, err);
   if (!db) {
@@ -156,6 +178,9 @@ static bool sakura_detect(const char *filename,
     return false;
   }
 
+  // open() can reuse the connection
+  _openslide_probe_set_data(probe, g_steal_pointer(&db),
+                            (GDestroyNotify) _openslide_sqlite_close);
   return true;
 }
 
@@ -164,10 +189,58 @@ static void destroy_level(struct level *l) {
   g_free(l);
 }
 
+static void conn_free(struct conn *c) {
+  _openslide_sqlite_finalize(c->stmt);
+  _openslide_sqlite_close(c->db);
+  g_free(c);
+}
+
+static struct conn *conn_get(struct sakura_ops_data *data, GError **err) {
+  g_mutex_lock(&data->conns_lock);
+  struct conn *c = g_queue_pop_head(&data->idle_conns);
+  g_mutex_unlock(&data->conns_lock);
+  if (c) {
+    return c;
+  }
+
+  g_autoptr(sqlite3) db = _openslide_sqlite_open(data->filename, err);
+  if (!db) {
+    return NULL;
+  }
+  sqlite3_stmt *stmt;
+  PREPARE_OR_RETURN(stmt, db, data->tile_sql, NULL);
+  c = g_new0(struct conn, 1);
+  c->db = g_steal_pointer(&db);
+  c->stmt = stmt;
+  return c;
+}
+
+static void conn_put(struct sakura_ops_data *data, struct conn *c) {
+  g_mutex_lock(&data->conns_lock);
+  g_queue_push_head(&data->idle_conns, c);
+  g_mutex_unlock(&data->conns_lock);
+}
+
 static void destroy(openslide_t *osr) {
   struct sakura_ops_data *data = osr->data;
+  struct conn *c;
+  while ((c = g_queue_pop_head(&data->idle_conns)) != NULL) {
+    conn_free(c);
+  }
+  g_mutex_clear(&data->conns_lock);
   g_free(data->filename);
-  g_free(data->data_sql);
+  g_free(data->tile_sql);
+
+  // the default plane's levels are freed below
+  struct _openslide_focal_planes *fp = &data->focal_planes;
+  for (int32_t plane = 0; plane < fp->count; plane++) {
+    for (int32_t i = 0; plane != fp->default_plane && i < fp->level_count;
+         i++) {
+      destroy_level((struct level *) fp->levels[plane][i]);
+    }
+    g_free(fp->levels[plane]);
+  }
+  g_free(fp->levels);
   g_free(data);
 
   for (int32_t i = 0; i < osr->level_count; i++) {
@@ -262,31 +335,7 @@ static bool parse_tileid(const char *tileid,
   return true;
 }
 
-static bool read_channel(uint8_t *channeldata,
-                         int64_t tile_col, int64_t tile_row,
-                         int64_t downsample,
-                         enum color_index color,
-                         int32_t focal_plane,
-                         int32_t tile_size,
-                         sqlite3_stmt *stmt,
-                         GError **err) {
-  // compute tile id
-  g_autofree char *tileid = make_tileid(tile_col * tile_size * downsample,
-                                        tile_row * tile_size * downsample,
-                                        downsample, color, focal_plane);
-
-  // retrieve compressed tile
-  sqlite3_reset(stmt);
-  BIND_TEXT_OR_RETURN(stmt, 1, tileid, false);
-  STEP_OR_RETURN(stmt, false);
-  const void *buf = sqlite3_column_blob(stmt, 0);
-  int buflen = sqlite3_column_bytes(stmt, 0);
-
-  // decompress
-  return _openslide_jpeg_decode_buffer_gray(buf, buflen, channeldata,
-                                            tile_size, tile_size, err);
-}
-
+// fetch and decode the three channels of a tile with one query
 static bool read_image(uint32_t *tiledata,
                        int64_t tile_col, int64_t tile_row,
                        int64_t downsample,
@@ -294,30 +343,60 @@ static bool read_image(uint32_t *tiledata,
                        int32_t tile_size,
                        sqlite3_stmt *stmt,
                        GError **err) {
-  g_autofree uint8_t *red_channel = g_malloc(tile_size * tile_size);
-  g_autofree uint8_t *green_channel = g_malloc(tile_size * tile_size);
-  g_autofree uint8_t *blue_channel = g_malloc(tile_size * tile_size);
+  // compute tile ids
+  g_auto(GStrv) tileids = g_new0(char *, NUM_INDEXES + 1);
+  for (int i = 0; i < NUM_INDEXES; i++) {
+    tileids[i] = make_tileid(tile_col * tile_size * downsample,
+                             tile_row * tile_size * downsample,
+                             downsample, i, focal_plane);
+  }
 
-  if (!read_channel(red_channel, tile_col, tile_row, downsample,
-                    INDEX_RED, focal_plane, tile_size, stmt, err)) {
-    return false;
+  // retrieve and decompress channels
+  g_autofree uint8_t *channels = g_malloc(NUM_INDEXES * tile_size * tile_size);
+  bool found[NUM_INDEXES] = {0};
+  sqlite3_reset(stmt);
+  for (int i = 0; i < NUM_INDEXES; i++) {
+    BIND_TEXT_OR_RETURN(stmt, i + 1, tileids[i], false);
   }
-  if (!read_channel(green_channel, tile_col, tile_row, downsample,
-                    INDEX_GREEN, focal_plane, tile_size, stmt, err)) {
-    return false;
+  int ret;
+  while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *tileid = (const char *) sqlite3_column_text(stmt, 0);
+    for (int i = 0; i < NUM_INDEXES; i++) {
+      if (!found[i] && tileid && !strcmp(tileid, tileids[i])) {
+        const void *buf = sqlite3_column_blob(stmt, 1);
+        int buflen = sqlite3_column_bytes(stmt, 1);
+        if (!_openslide_jpeg_decode_buffer_gray(buf, buflen,
+                                                channels +
+                                                i * tile_size * tile_size,
+                                                tile_size, tile_size, err)) {
+          sqlite3_reset(stmt);
+          return false;
+        }
+        found[i] = true;
+        break;
+      }
+    }
   }
-  if (!read_channel(blue_channel, tile_col, tile_row, downsample,
-                    INDEX_BLUE, focal_plane, tile_size, stmt, err)) {
+  if (ret != SQLITE_DONE) {
+    _openslide_sqlite_propagate_stmt_error(stmt, err);
+    sqlite3_reset(stmt);
     return false;
   }
-
-  for (int32_t i = 0; i < tile_size * tile_size; i++) {
-    tiledata[i] = 0xff000000 |
-                  (red_channel[i] << 16) |
-                  (green_channel[i] << 8) |
-                  blue_channel[i];
+  // end the read transaction
+  sqlite3_reset(stmt);
+  for (int i = 0; i < NUM_INDEXES; i++) {
+    if (!found[i]) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_NO_VALUE,
+                  "Couldn't find tile %s", tileids[i]);
+      return false;
+    }
   }
 
+  int64_t pixels = tile_size * tile_size;
+  _openslide_simd_planar8_to_argb32(channels + INDEX_RED * pixels,
+                                    channels + INDEX_GREEN * pixels,
+                                    channels + INDEX_BLUE * pixels,
+                                    tiledata, pixels);
   return true;
 }
 
@@ -339,11 +418,12 @@ static bool read_tile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(tile_size * tile_size * 4);
+    g_autofree uint32_t *buf =
+      _openslide_cache_alloc(osr->cache, tile_size * tile_size * 4);
 
     // read tile
     if (!read_image(buf, tile_col, tile_row, l->base.downsample,
-                    data->focal_plane, tile_size, stmt, &tmp_err)) {
+                    l->focal_plane, tile_size, stmt, &tmp_err)) {
       if (g_error_matches(tmp_err, OPENSLIDE_ERROR,
                           OPENSLIDE_ERROR_NO_VALUE)) {
         // no such tile
@@ -383,6 +463,29 @@ static bool read_tile(openslide_t *osr,
   return true;
 }
 
+static struct level *create_level(openslide_t *osr,
+                                  int64_t downsample,
+                                  int64_t image_width, int64_t image_height,
+                                  int32_t tile_size,
+                                  int32_t focal_plane) {
+  struct level *l = g_new0(struct level, 1);
+  l->base.downsample = downsample;
+  l->base.w = image_width / downsample;
+  l->base.h = image_height / downsample;
+  l->base.tile_w = tile_size;
+  l->base.tile_h = tile_size;
+  int64_t tiles_across =
+    (l->base.w / tile_size) + !!(l->base.w % tile_size);
+  int64_t tiles_down =
+    (l->base.h / tile_size) + !!(l->base.h % tile_size);
+  l->grid = _openslide_grid_create_simple(osr,
+                                          tiles_across, tiles_down,
+                                          tile_size, tile_size,
+                                          read_tile);
+  l->focal_plane = focal_plane;
+  return l;
+}
+
 static bool paint_region(openslide_t *osr, cairo_t *cr,
                          int64_t x, int64_t y,
                          struct _openslide_level *level,
@@ -391,18 +494,17 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
   struct sakura_ops_data *data = osr->data;
   struct level *l = (struct level *) level;
 
-  g_autoptr(sqlite3) db = _openslide_sqlite_open(data->filename, err);
-  if (!db) {
+  struct conn *c = conn_get(data, err);
+  if (!c) {
     return false;
   }
-  g_autoptr(sqlite3_stmt) stmt = NULL;
-  PREPARE_OR_RETURN(stmt, db, data->data_sql, false);
-
-  return _openslide_grid_paint_region(l->grid, cr, stmt,
-                                      x / l->base.downsample,
-                                      y / l->base.downsample,
-                                      level, w, h,
-                                      err);
+  bool success = _openslide_grid_paint_region(l->grid, cr, c->stmt,
+                                              x / l->base.downsample,
+                                              y / l->base.downsample,
+                                              level, w, h,
+                                              err);
+  conn_put(data, c);
+  return success;
 }
 
 static const struct _openslide_ops sakura_ops = {
@@ -758,9 +860,13 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(tileid_queue, free_tileid_queue)
 
 static bool sakura_open(openslide_t *osr, const char *filename,
                         struct _openslide_tifflike *tl G_GNUC_UNUSED,
+                        struct _openslide_probe *probe,
                         struct _openslide_hash *quickhash1, GError **err) {
-  // open database
-  g_autoptr(sqlite3) db = _openslide_sqlite_open(filename, err);
+  // open database, unless detect() left it open
+  g_autoptr(sqlite3) db = _openslide_probe_steal_data(probe);
+  if (!db) {
+    db = _openslide_sqlite_open(filename, err);
+  }
   if (!db) {
     return false;
   }
@@ -826,20 +932,8 @@ static bool sakura_open(openslide_t *osr, const char *filename,
         return false;
       }
 
-      l = g_new0(struct level, 1);
-      l->base.downsample = downsample;
-      l->base.w = image_width / downsample;
-      l->base.h = image_height / downsample;
-      l->base.tile_w = tile_size;
-      l->base.tile_h = tile_size;
-      int64_t tiles_across =
-        (l->base.w / tile_size) + !!(l->base.w % tile_size);
-      int64_t tiles_down =
-        (l->base.h / tile_size) + !!(l->base.h % tile_size);
-      l->grid = _openslide_grid_create_simple(osr,
-                                              tiles_across, tiles_down,
-                                              tile_size, tile_size,
-                                              read_tile);
+      l = create_level(osr, downsample, image_width, image_height,
+                       tile_size, chosen_focal_plane);
       int64_t *downsample_val = g_new(int64_t, 1);
       *downsample_val = downsample;
       g_hash_table_insert(level_hash, downsample_val, l);
@@ -903,10 +997,34 @@ static bool sakura_open(openslide_t *osr, const char *filename,
   // build ops data
   struct sakura_ops_data *data = g_new0(struct sakura_ops_data, 1);
   data->filename = g_strdup(filename);
-  data->data_sql =
-    g_strdup_printf("SELECT data FROM %s WHERE id=?", unique_table_name);
+  data->tile_sql =
+    g_strdup_printf("SELECT id, data FROM %s WHERE id IN (?, ?, ?)",
+                    unique_table_name);
+  g_mutex_init(&data->conns_lock);
+  g_queue_init(&data->idle_conns);
   data->tile_size = tile_size;
-  data->focal_plane = chosen_focal_plane;
+
+  // the other focal planes get copies of the levels
+  if (focal_planes > 1) {
+    struct _openslide_focal_planes *fp = &data->focal_planes;
+    fp->count = focal_planes;
+    fp->default_plane = chosen_focal_plane;
+    fp->level_count = level_count;
+    fp->levels = g_new(struct _openslide_level **, focal_planes);
+    for (int32_t plane = 0; plane < focal_planes; plane++) {
+      fp->levels[plane] = g_new(struct _openslide_level *, level_count);
+      for (i = 0; i < level_count; i++) {
+        struct level *l = levels[i];
+        if (plane != chosen_focal_plane) {
+          l = create_level(osr, l->base.downsample,
+                           image_width, image_height,
+                           tile_size, plane);
+        }
+        fp->levels[plane][i] = (struct _openslide_level *) l;
+      }
+    }
+    osr->focal_planes = fp;
+  }
 
   // commit
   g_assert(osr->data == NULL);
@@ -22,7 +22,8 @@
  */
 
 /*
- * Synthetic vendor driver to test library dependencies.
+ * Synthetic vendor driver to test library dependencies, and to generate
+ * large slides for benchmarking.
  *
  * quickhash is the hash of the names and compressed contents of all test
  * items.
@@ -42,9 +43,12 @@
 #include "openslide-decode-xml.h"
 
 #include <glib.h>
+#include <inttypes.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <zlib.h>
 
 #define IMAGE_PIXELS 16
 #define IMAGE_BUFSIZE (4 * IMAGE_PIXELS * IMAGE_PIXELS)
@@ -311,7 +315,7 @@ static bool decode_item(const struct synthetic_item *item,
   return true;
 }
 
-static bool read_tile(openslide_t *osr G_GNUC_UNUSED,
+static bool read_tile(openslide_t *osr,
                       cairo_t *cr,
                       struct _openslide_level *level,
                       int64_t tile_col, int64_t tile_row,
@@ -326,7 +330,8 @@ static bool read_tile(openslide_t *osr G_GNUC_UNUSED,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(IMAGE_BUFSIZE);
+    g_autofree uint32_t *buf =
+      _openslide_cache_alloc(osr->cache, IMAGE_BUFSIZE);
     if (!decode_item(item, buf, err)) {
       return false;
     }
@@ -367,11 +372,383 @@ static const struct _openslide_ops synthetic_ops = {
   .destroy = destroy,
 };
 
+/*
+ * Scalable slides, for benchmarking.  openslide_open("synthetic:PARAMS")
+ * opens a pyramid generated in memory, where PARAMS is a comma-separated
+ * list of KEY=VALUE:
+ *
+ *   width, height  level 0 dimensions (default 100000 x 80000)
+ *   tile-size      tile edge length (default 256)
+ *   levels         level count (default: until a level fits in one tile)
+ *   compression    none, deflate, zstd, or jpeg (default jpeg)
+ *   sparsity       fraction of tiles left empty (default 0)
+ *   seed           pixel generator seed (default 1)
+ *
+ * A few distinct tiles are generated and compressed at open; each grid
+ * position selects one by hash, and every read decodes it again through
+ * the real decoder and the tile cache.
+ */
+
+#define SCALABLE_PREFIX "synthetic:"
+#define SCALABLE_VARIANTS 16
+#define SCALABLE_JPEG_QUALITY 80
+
+enum scalable_compression {
+  SCALABLE_NONE,
+  SCALABLE_DEFLATE,
+  SCALABLE_ZSTD,
+  SCALABLE_JPEG,
+};
+
+static const char *const scalable_compression_names[] = {
+  [SCALABLE_NONE] = "none",
+  [SCALABLE_DEFLATE] = "deflate",
+  [SCALABLE_ZSTD] = "zstd",
+  [SCALABLE_JPEG] = "jpeg",
+  NULL
+};
+
+struct scalable_variant {
+  void *data;
+  int64_t len;
+};
+
+struct scalable_slide {
+  int32_t tile_size;
+  enum scalable_compression compression;
+  double sparsity;
+  uint64_t seed;
+  struct scalable_variant variants[SCALABLE_VARIANTS];
+};
+
+static void scalable_slide_free(struct scalable_slide *slide) {
+  for (int i = 0; i < SCALABLE_VARIANTS; i++) {
+    g_free(slide->variants[i].data);
+  }
+  g_free(slide);
+}
+typedef struct scalable_slide scalable_slide;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(scalable_slide, scalable_slide_free)
+
+// splitmix64 finalizer
+static uint64_t mix(uint64_t x) {
+  x += UINT64_C(0x9e3779b97f4a7c15);
+  x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return x ^ (x >> 31);
+}
+
+static uint64_t tile_hash(const struct scalable_slide *slide, int32_t level,
+                          int64_t col, int64_t row) {
+  return mix(slide->seed ^ mix(level ^ mix(col ^ mix(row))));
+}
+
+// deterministic stain-like texture: pink and purple bands plus noise
+static void generate_variant(const struct scalable_slide *slide, int idx,
+                             uint32_t *dest) {
+  int32_t size = slide->tile_size;
+  uint64_t state = mix(slide->seed + idx);
+  double fx = 2 * G_PI * (1 + state % 5) / size;
+  double fy = 2 * G_PI * (1 + (state >> 8) % 5) / size;
+  double phase = (state >> 16) % 360 * G_PI / 180;
+  for (int32_t y = 0; y < size; y++) {
+    for (int32_t x = 0; x < size; x++) {
+      double t = (sin(x * fx + phase) * cos(y * fy) + 1) / 2;
+      state = mix(state);
+      int noise = (int) (state % 17) - 8;
+      int r = CLAMP(230 - 110 * t + noise, 0, 255);
+      int g = CLAMP(200 - 140 * t + noise, 0, 255);
+      int b = CLAMP(225 - 75 * t + noise, 0, 255);
+      dest[y * size + x] = 0xff000000 | r << 16 | g << 8 | b;
+    }
+  }
+}
+
+static bool encode_variant(struct scalable_slide *slide, int idx,
+                           GError **err) {
+  int64_t size = (int64_t) slide->tile_size * slide->tile_size * 4;
+  struct scalable_variant *variant = &slide->variants[idx];
+  g_autofree uint32_t *pixels = g_malloc(size);
+  generate_variant(slide, idx, pixels);
+
+  switch (slide->compression) {
+  case SCALABLE_NONE:
+    variant->data = g_steal_pointer(&pixels);
+    variant->len = size;
+    return true;
+  case SCALABLE_DEFLATE: {
+    uLongf len = compressBound(size);
+    g_autofree void *data = g_malloc(len);
+    if (compress2(data, &len, (const Bytef *) pixels, size,
+                  Z_DEFAULT_COMPRESSION) != Z_OK) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't deflate synthetic tile");
+      return false;
+    }
+    variant->data = g_steal_pointer(&data);
+    variant->len = len;
+    return true;
+  }
+  case SCALABLE_ZSTD:
+    variant->data =
+      _openslide_zstd_compress_buffer(pixels, size, &variant->len);
+    if (!variant->data) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't zstd-compress synthetic tile");
+      return false;
+    }
+    return true;
+  case SCALABLE_JPEG: {
+    uint32_t len;
+    variant->data =
+      _openslide_jpeg_encode_buffer(pixels,
+                                    slide->tile_size, slide->tile_size,
+                                    SCALABLE_JPEG_QUALITY, &len, err);
+    variant->len = len;
+    return variant->data != NULL;
+  }
+  }
+  g_assert_not_reached();
+}
+
+static bool decode_variant(const struct scalable_slide *slide,
+                           const struct scalable_variant *variant,
+                           uint32_t *dest, GError **err) {
+  int32_t size = slide->tile_size;
+  int64_t bufsize = (int64_t) size * size * 4;
+  g_autofree void *buf = NULL;
+
+  switch (slide->compression) {
+  case SCALABLE_NONE:
+    memcpy(dest, variant->data, bufsize);
+    return true;
+  case SCALABLE_DEFLATE:
+    buf = _openslide_inflate_buffer(variant->data, variant->len, bufsize,
+                                    err);
+    break;
+  case SCALABLE_ZSTD:
+    buf = _openslide_zstd_decompress_buffer(variant->data, variant->len,
+                                            bufsize, err);
+    break;
+  case SCALABLE_JPEG:
+    return _openslide_jpeg_decode_buffer(variant->data, variant->len,
+                                         dest, size, size, err);
+  }
+  if (!buf) {
+    return false;
+  }
+  memcpy(dest, buf, bufsize);
+  return true;
+}
+
+static bool scalable_read_tile(openslide_t *osr,
+                               cairo_t *cr,
+                               struct _openslide_level *level,
+                               int64_t tile_col, int64_t tile_row,
+                               void *arg G_GNUC_UNUSED,
+                               GError **err) {
+  const struct scalable_slide *slide = osr->data;
+  int32_t size = slide->tile_size;
+  int32_t level_idx = 0;
+  while (osr->levels[level_idx] != level) {
+    level_idx++;
+  }
+
+  // sparse tiles are missing, as empty regions of a scan would be
+  uint64_t hash = tile_hash(slide, level_idx, tile_col, tile_row);
+  if ((hash >> 11) * 0x1p-53 < slide->sparsity) {
+    return true;
+  }
+
+  // cache
+  g_autoptr(_openslide_cache_entry) cache_entry = NULL;
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            level, tile_col, tile_row,
+                                            &cache_entry);
+  if (!tiledata) {
+    g_autofree uint32_t *buf =
+      _openslide_cache_alloc(osr->cache, (int64_t) size * size * 4);
+    const struct scalable_variant *variant =
+      &slide->variants[hash % SCALABLE_VARIANTS];
+    if (!decode_variant(slide, variant, buf, err)) {
+      return false;
+    }
+
+    // put it in the cache
+    tiledata = g_steal_pointer(&buf);
+    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
+                         tiledata, (int64_t) size * size * 4,
+                         &cache_entry);
+  }
+
+  // draw it, clipped to the level
+  g_autoptr(cairo_surface_t) surface =
+    cairo_image_surface_create_for_data((unsigned char *) tiledata,
+                                        CAIRO_FORMAT_ARGB32,
+                                        size, size, size * 4);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_rectangle(cr, 0, 0,
+                  MIN(size, level->w - tile_col * size),
+                  MIN(size, level->h - tile_row * size));
+  cairo_fill(cr);
+
+  return true;
+}
+
+static void scalable_destroy(openslide_t *osr) {
+  for (int32_t i = 0; i < osr->level_count; i++) {
+    level_free((struct level *) osr->levels[i]);
+  }
+  g_free(osr->levels);
+  scalable_slide_free(osr->data);
+}
+
+static const struct _openslide_ops scalable_ops = {
+  .paint_region = paint_region,
+  .destroy = scalable_destroy,
+};
+
+static bool parse_scalable_int(const char *key, const char *value,
+                               int64_t min, int64_t max, int64_t *result,
+                               GError **err) {
+  if (!_openslide_parse_int64(value, result) ||
+      *result < min || *result > max) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Invalid synthetic %s: %s", key, value);
+    return false;
+  }
+  return true;
+}
+
+static bool scalable_open(openslide_t *osr, const char *params,
+                          struct _openslide_hash *quickhash1,
+                          GError **err) {
+  g_autoptr(scalable_slide) slide = g_new0(struct scalable_slide, 1);
+  int64_t w = 100000;
+  int64_t h = 80000;
+  int64_t tile_size = 256;
+  int64_t levels = 0;
+  int64_t seed = 1;
+  slide->compression = SCALABLE_JPEG;
+
+  // parse parameters
+  g_auto(GStrv) pairs = g_strsplit(params, ",", 0);
+  for (char **pair = pairs; *pair; pair++) {
+    if (!**pair) {
+      continue;
+    }
+    g_auto(GStrv) kv = g_strsplit(*pair, "=", 2);
+    if (!kv[1]) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Synthetic parameter without value: %s", *pair);
+      return false;
+    }
+    const char *key = kv[0];
+    const char *value = kv[1];
+    bool ok = true;
+    if (g_str_equal(key, "width")) {
+      ok = parse_scalable_int(key, value, 1, INT64_C(1) << 40, &w, err);
+    } else if (g_str_equal(key, "height")) {
+      ok = parse_scalable_int(key, value, 1, INT64_C(1) << 40, &h, err);
+    } else if (g_str_equal(key, "tile-size")) {
+      ok = parse_scalable_int(key, value, 16, 8192, &tile_size, err);
+    } else if (g_str_equal(key, "levels")) {
+      ok = parse_scalable_int(key, value, 1, 40, &levels, err);
+    } else if (g_str_equal(key, "seed")) {
+      ok = parse_scalable_int(key, value, 0, G_MAXINT64, &seed, err);
+    } else if (g_str_equal(key, "sparsity")) {
+      slide->sparsity = _openslide_parse_double(value);
+      if (!(slide->sparsity >= 0 && slide->sparsity < 1)) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Invalid synthetic sparsity: %s", value);
+        return false;
+      }
+    } else if (g_str_equal(key, "compression")) {
+      int i = 0;
+      while (scalable_compression_names[i] &&
+             !g_str_equal(scalable_compression_names[i], value)) {
+        i++;
+      }
+      if (!scalable_compression_names[i]) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Unknown synthetic compression: %s", value);
+        return false;
+      }
+      slide->compression = i;
+    } else {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Unknown synthetic parameter: %s", key);
+      return false;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  slide->tile_size = tile_size;
+  slide->seed = seed;
+
+  // default to a full pyramid
+  if (!levels) {
+    levels = 1;
+    while (((w - 1) >> (levels - 1)) >= tile_size ||
+           ((h - 1) >> (levels - 1)) >= tile_size) {
+      levels++;
+    }
+  }
+
+  // generate tiles
+  for (int i = 0; i < SCALABLE_VARIANTS; i++) {
+    if (!encode_variant(slide, i, err)) {
+      return false;
+    }
+  }
+
+  // create levels
+  g_assert(osr->data == NULL);
+  g_assert(osr->levels == NULL);
+  osr->levels = g_new0(struct _openslide_level *, levels);
+  for (int32_t i = 0; i < levels; i++) {
+    struct level *l = g_new0(struct level, 1);
+    l->base.w = MAX(((w - 1) >> i) + 1, 1);
+    l->base.h = MAX(((h - 1) >> i) + 1, 1);
+    l->base.downsample = (double) (INT64_C(1) << i);
+    l->base.tile_w = tile_size;
+    l->base.tile_h = tile_size;
+    l->grid = _openslide_grid_create_simple(osr,
+                                            (l->base.w + tile_size - 1) / tile_size,
+                                            (l->base.h + tile_size - 1) / tile_size,
+                                            tile_size, tile_size,
+                                            scalable_read_tile);
+    osr->levels[i] = (struct _openslide_level *) l;
+  }
+  osr->level_count = levels;
+
+  // properties
+  g_hash_table_insert(osr->properties,
+                      g_strdup("synthetic.compression"),
+                      g_strdup(scalable_compression_names[slide->compression]));
+  g_hash_table_insert(osr->properties,
+                      g_strdup("synthetic.sparsity"),
+                      _openslide_format_double(slide->sparsity));
+  g_hash_table_insert(osr->properties,
+                      g_strdup("synthetic.seed"),
+                      g_strdup_printf("%"PRIu64, slide->seed));
+
+  // the parameters determine the pixels
+  _openslide_hash_string(quickhash1, params);
+
+  osr->data = g_steal_pointer(&slide);
+  osr->ops = &scalable_ops;
+  return true;
+}
+
 static bool synthetic_detect(const char *filename,
                              struct _openslide_tifflike *tl G_GNUC_UNUSED,
+                             struct _openslide_probe *probe G_GNUC_UNUSED,
                              GError **err) {
-  // only accept hardcoded filename
-  if (!g_str_equal(filename, "")) {
+  // only accept hardcoded filename or scalable parameters
+  if (!g_str_equal(filename, "") &&
+      !g_str_has_prefix(filename, SCALABLE_PREFIX)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Unrecognized filename");
     return false;
@@ -388,10 +765,16 @@ static bool synthetic_detect(const char *filename,
 }
 
 static bool synthetic_open(openslide_t *osr,
-                           const char *filename G_GNUC_UNUSED,
+                           const char *filename,
                            struct _openslide_tifflike *tl G_GNUC_UNUSED,
+                           struct _openslide_probe *probe G_GNUC_UNUSED,
                            struct _openslide_hash *quickhash1,
                            GError **err) {
+  if (g_str_has_prefix(filename, SCALABLE_PREFIX)) {
+    return scalable_open(osr, filename + strlen(SCALABLE_PREFIX),
+                         quickhash1, err);
+  }
+
   g_autoptr(level) level = g_new0(struct level, 1);
   level->grid =
     _openslide_grid_create_tilemap(osr, IMAGE_PIXELS, IMAGE_PIXELS,
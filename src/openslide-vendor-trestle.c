@@ -89,7 +89,7 @@ static bool read_tile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(tw * th * 4);
+    g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
     if (!_openslide_tiff_read_tile(tiffl, tiff,
                                    buf, tile_col, tile_row,
                                    err)) {
@@ -148,6 +148,7 @@ static const struct _openslide_ops trestle_ops = {
 
 static bool trestle_detect(const char *filename G_GNUC_UNUSED,
                            struct _openslide_tifflike *tl,
+                           struct _openslide_probe *probe G_GNUC_UNUSED,
                            GError **err) {
   // ensure we have a TIFF
   if (!tl) {
@@ -275,6 +276,7 @@ static void add_associated_jpeg(openslide_t *osr, TIFF *tiff,
 
 static bool trestle_open(openslide_t *osr, const char *filename,
                          struct _openslide_tifflike *tl,
+                         struct _openslide_probe *probe G_GNUC_UNUSED,
                          struct _openslide_hash *quickhash1, GError **err) {
   // open TIFF
   g_autoptr(_openslide_tiffcache) tc = _openslide_tiffcache_create(filename);
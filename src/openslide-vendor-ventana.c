@@ -51,6 +51,8 @@ static const char MAGNIFICATION_KEY[] = "mag";
 static const char INITIAL_XML_ISCAN[] = "iScan";
 static const char INITIAL_XML_ALT_ROOT[] = "Metadata";
 
+static const char ELEMENT_TILE_JOINT_INFO[] = "TileJointInfo";
+
 static const char ATTR_AOI_SCANNED[] = "AOIScanned";
 static const char ATTR_WIDTH[] = "Width";
 static const char ATTR_HEIGHT[] = "Height";
@@ -91,18 +93,23 @@ static const char DIRECTION_UP[] = "UP";
 
 struct ventana_ops_data {
   struct _openslide_tiffcache *tc;
+  struct bif *bif;  // or NULL
 };
 
 struct level {
   struct _openslide_level base;
   struct _openslide_tiff_level tiffl;
+  // BIF grids are built from the shared area table on first use
   struct _openslide_grid *grid;
+  gsize grid_ready;
   int64_t subtiles_per_tile;
 };
 
-// structs used during BIF open
+// BIF stitching geometry, parsed once and shared by all levels.  The
+// per-joint overlaps only contribute to the average tile advance, so
+// they aren't kept.
 struct bif {
-  struct area **areas;
+  struct area *areas;
   int32_t num_areas;
 
   double tile_advance_x;
@@ -117,18 +124,6 @@ struct area {
   int64_t tiles_across;
   int64_t tiles_down;
   int64_t tile_count;
-  struct tile *tiles;
-};
-
-struct joint {
-  double offset_x;
-  double offset_y;
-  int64_t confidence;
-};
-
-struct tile {
-  struct joint left;
-  struct joint top;
 };
 
 static void destroy_level(struct level *l) {
@@ -136,9 +131,21 @@ static void destroy_level(struct level *l) {
   g_free(l);
 }
 
+static void bif_free(struct bif *bif) {
+  if (bif == NULL) {
+    return;
+  }
+  g_free(bif->areas);
+  g_free(bif);
+}
+
+typedef struct bif bif;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(bif, bif_free)
+
 static void destroy(openslide_t *osr) {
   struct ventana_ops_data *data = osr->data;
   _openslide_tiffcache_destroy(data->tc);
+  bif_free(data->bif);
   g_free(data);
 
   for (int32_t i = 0; i < osr->level_count; i++) {
@@ -176,7 +183,7 @@ static bool read_subtile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(tw * th * 4);
+    g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
     if (!_openslide_tiff_read_tile(tiffl, tiff,
                                    buf, tile_col, tile_row,
                                    err)) {
@@ -243,6 +250,97 @@ static bool read_subtile_tilemap(openslide_t *osr,
                       arg, err);
 }
 
+static struct _openslide_grid *create_bif_grid(openslide_t *osr,
+                                               struct bif *bif,
+                                               double downsample,
+                                               int64_t tile_w, int64_t tile_h) {
+  double subtile_w = tile_w / downsample;
+  double subtile_h = tile_h / downsample;
+
+  struct _openslide_grid *grid =
+    _openslide_grid_create_tilemap(osr,
+                                   bif->tile_advance_x / downsample,
+                                   bif->tile_advance_y / downsample,
+                                   read_subtile_tilemap, NULL);
+
+  for (int32_t i = 0; i < bif->num_areas; i++) {
+    struct area *area = &bif->areas[i];
+    double offset_x =
+      (area->x - area->start_col * bif->tile_advance_x) / downsample;
+    double offset_y =
+      (area->y - area->start_row * bif->tile_advance_y) / downsample;
+    //g_debug("ds %g area %d pos %"PRId64" %"PRId64" offset %g %g", downsample, i, area->x, area->y, offset_x, offset_y);
+    for (int64_t row = area->start_row;
+         row < area->start_row + area->tiles_down; row++) {
+      for (int64_t col = area->start_col;
+           col < area->start_col + area->tiles_across; col++) {
+        _openslide_grid_tilemap_add_tile(grid,
+                                         col, row,
+                                         offset_x, offset_y,
+                                         subtile_w, subtile_h,
+                                         NULL);
+      }
+    }
+  }
+
+  return grid;
+}
+
+// compute the bounds create_bif_grid() would produce, without building it
+static void get_bif_grid_bounds(struct bif *bif,
+                                double downsample,
+                                int64_t tile_w, int64_t tile_h,
+                                double *x, double *y,
+                                double *w, double *h) {
+  double subtile_w = tile_w / downsample;
+  double subtile_h = tile_h / downsample;
+  double advance_x = bif->tile_advance_x / downsample;
+  double advance_y = bif->tile_advance_y / downsample;
+
+  double left = INFINITY;
+  double top = INFINITY;
+  double right = -INFINITY;
+  double bottom = -INFINITY;
+  for (int32_t i = 0; i < bif->num_areas; i++) {
+    struct area *area = &bif->areas[i];
+    if (area->tiles_across <= 0 || area->tiles_down <= 0) {
+      continue;
+    }
+    double offset_x =
+      (area->x - area->start_col * bif->tile_advance_x) / downsample;
+    double offset_y =
+      (area->y - area->start_row * bif->tile_advance_y) / downsample;
+    int64_t end_col = area->start_col + area->tiles_across - 1;
+    int64_t end_row = area->start_row + area->tiles_down - 1;
+    left = MIN(area->start_col * advance_x + offset_x, left);
+    top = MIN(area->start_row * advance_y + offset_y, top);
+    right = MAX(end_col * advance_x + offset_x + subtile_w, right);
+    bottom = MAX(end_row * advance_y + offset_y + subtile_h, bottom);
+  }
+
+  *x = *y = *w = *h = 0;
+  if (!isinf(left)) {
+    *x = left;
+    *y = top;
+    *w = right - left;
+    *h = bottom - top;
+  }
+}
+
+static struct _openslide_grid *get_grid(openslide_t *osr,
+                                        struct level *l) {
+  if (g_once_init_enter(&l->grid_ready)) {
+    struct ventana_ops_data *data = osr->data;
+    if (!l->grid) {
+      l->grid = create_bif_grid(osr, data->bif,
+                                l->base.downsample,
+                                l->tiffl.tile_w, l->tiffl.tile_h);
+    }
+    g_once_init_leave(&l->grid_ready, 1);
+  }
+  return l->grid;
+}
+
 static bool paint_region(openslide_t *osr, cairo_t *cr,
                          int64_t x, int64_t y,
                          struct _openslide_level *level,
@@ -256,7 +354,7 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
     return false;
   }
 
-  return _openslide_grid_paint_region(l->grid, cr, ct.tiff,
+  return _openslide_grid_paint_region(get_grid(osr, l), cr, ct.tiff,
                                       x / l->base.downsample,
                                       y / l->base.downsample,
                                       level, w, h,
@@ -308,6 +406,7 @@ static xmlNode *get_initial_xml_iscan(xmlDoc *doc, GError **err) {
 
 static bool ventana_detect(const char *filename G_GNUC_UNUSED,
                            struct _openslide_tifflike *tl,
+                           struct _openslide_probe *probe G_GNUC_UNUSED,
                            GError **err) {
   // ensure we have a TIFF
   if (!tl) {
@@ -344,21 +443,6 @@ static bool ventana_detect(const char *filename G_GNUC_UNUSED,
   return true;
 }
 
-static void area_free(struct area *area) {
-  g_free(area->tiles);
-  g_free(area);
-}
-
-static void bif_free(struct bif *bif) {
-  for (int32_t i = 0; i < bif->num_areas; i++) {
-    area_free(bif->areas[i]);
-  }
-  g_free(bif->areas);
-  g_free(bif);
-}
-
-typedef struct bif bif;
-G_DEFINE_AUTOPTR_CLEANUP_FUNC(bif, bif_free)
 
 static int width_compare(gconstpointer a, gconstpointer b) {
   const struct level *la = *(const struct level **) a;
@@ -466,8 +550,7 @@ static struct bif *parse_level0_xml(const char *xml,
   }
 
   // walk AOIs
-  g_autoptr(GPtrArray) area_array =
-    g_ptr_array_new_with_free_func((GDestroyNotify) area_free);
+  g_autoptr(GArray) area_array = g_array_new(false, true, sizeof(struct area));
   double total_offset_x = 0;
   double total_offset_y = 0;
   int64_t total_x_weight = 0;
@@ -484,8 +567,9 @@ static struct bif *parse_level0_xml(const char *xml,
     }
 
     // create area
-    struct area *area = g_new0(struct area, 1);
-    g_ptr_array_add(area_array, area);
+    g_array_set_size(area_array, area_array->len + 1);
+    struct area *area =
+      &g_array_index(area_array, struct area, area_array->len - 1);
 
     // get start tiles
     int64_t start_col_x, start_row_y;
@@ -526,21 +610,19 @@ static struct bif *parse_level0_xml(const char *xml,
 
     //g_debug("area %d: start %"PRId64" %"PRId64", count %"PRId64" %"PRId64", pos %"PRId64" %"PRId64, i, area->start_col, area->start_row, area->tiles_across, area->tiles_down, area->x, area->y);
 
-    // create tile structs
     area->tile_count = area->tiles_across * area->tiles_down;
-    area->tiles = g_new0(struct tile, area->tile_count);
 
-    // walk tiles
-    ctx->node = info;
-    g_autoptr(xmlXPathObject) result =
-      _openslide_xml_xpath_eval(ctx, "TileJointInfo");
-    if (!result) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Couldn't find tile joint info");
-      return NULL;
-    }
-    for (int j = 0; j < result->nodesetval->nodeNr; j++) {
-      xmlNode *joint_info = result->nodesetval->nodeTab[j];
+    // walk tile joints
+    // large slides have hundreds of thousands, so iterate the children
+    // directly rather than building an XPath node set
+    int64_t joint_count = 0;
+    for (xmlNode *joint_info = info->children; joint_info;
+         joint_info = joint_info->next) {
+      if (joint_info->type != XML_ELEMENT_NODE ||
+          xmlStrcmp(joint_info->name, BAD_CAST ELEMENT_TILE_JOINT_INFO)) {
+        continue;
+      }
+      joint_count++;
 
       // get tile coordinates
       int64_t tile1_col, tile1_row;
@@ -554,24 +636,17 @@ static struct bif *parse_level0_xml(const char *xml,
         return NULL;
       }
 
-      // check coordinates against direction, and get joint
+      // check coordinates against direction
       g_autoptr(xmlChar) direction =
         xmlGetProp(joint_info, BAD_CAST ATTR_DIRECTION);
-      struct joint *joint;
       bool ok;
       bool direction_y = false;
       //g_debug("%s, tile1 %"PRId64" %"PRId64", tile2 %"PRId64" %"PRId64, (char *) direction, tile1_col, tile1_row, tile2_col, tile2_row);
       if (!xmlStrcmp(direction, BAD_CAST DIRECTION_RIGHT)) {
-        // get left joint of right tile
-        struct tile *tile =
-          &area->tiles[tile2_row * area->tiles_across + tile2_col];
-        joint = &tile->left;
+        // left joint of right tile
         ok = (tile2_col == tile1_col + 1 && tile2_row == tile1_row);
       } else if (!xmlStrcmp(direction, BAD_CAST DIRECTION_UP)) {
-        // get top joint of bottom tile
-        struct tile *tile =
-          &area->tiles[tile1_row * area->tiles_across + tile1_col];
-        joint = &tile->top;
+        // top joint of bottom tile
         ok = (tile2_col == tile1_col && tile2_row == tile1_row - 1);
         direction_y = true;
       } else {
@@ -589,31 +664,36 @@ static struct bif *parse_level0_xml(const char *xml,
       }
 
       // read values
+      double offset_x, offset_y;
+      int64_t confidence;
       PARSE_DOUBLE_ATTRIBUTE_OR_RETURN(joint_info, ATTR_OVERLAP_X,
-                                       joint->offset_x, NULL);
-      joint->offset_x *= -1;
+                                       offset_x, NULL);
       PARSE_DOUBLE_ATTRIBUTE_OR_RETURN(joint_info, ATTR_OVERLAP_Y,
-                                       joint->offset_y, NULL);
-      joint->offset_y *= -1;
+                                       offset_y, NULL);
       PARSE_INT_ATTRIBUTE_OR_RETURN(joint_info, ATTR_CONFIDENCE,
-                                    joint->confidence, NULL);
+                                    confidence, NULL);
 
       // add to totals
       if (direction_y) {
-        total_offset_y += joint->confidence * joint->offset_y;
-        total_y_weight += joint->confidence;
+        total_offset_y += confidence * -offset_y;
+        total_y_weight += confidence;
       } else {
-        total_offset_x += joint->confidence * joint->offset_x;
-        total_x_weight += joint->confidence;
+        total_offset_x += confidence * -offset_x;
+        total_x_weight += confidence;
       }
     }
+    if (!joint_count) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't find tile joint info");
+      return NULL;
+    }
   }
 
   // create wrapper struct
   g_autoptr(bif) bif = g_new0(struct bif, 1);
   bif->num_areas = area_array->len;
   bif->areas =
-    (struct area **) g_ptr_array_free(g_steal_pointer(&area_array), false);
+    (struct area *) g_array_free(g_steal_pointer(&area_array), false);
   bif->tile_advance_x = tiff_tile_width + total_offset_x / total_x_weight;
   bif->tile_advance_y = tiff_tile_height + total_offset_y / total_y_weight;
   //g_debug("advances: %g %g", bif->tile_advance_x, bif->tile_advance_y);
@@ -624,7 +704,7 @@ static struct bif *parse_level0_xml(const char *xml,
   // find position of top of slide in coordinate plane of file
   int64_t top = 0;
   for (int32_t i = 0; i < bif->num_areas; i++) {
-    struct area *area = bif->areas[i];
+    struct area *area = &bif->areas[i];
     heights[i] =
       (area->tiles_down - 1) * bif->tile_advance_y + tiff_tile_height;
     top = MAX(top, area->y + heights[i]);
@@ -633,7 +713,7 @@ static struct bif *parse_level0_xml(const char *xml,
   //g_debug("top %"PRId64, top);
   // convert Y coordinate of each area
   for (int32_t i = 0; i < bif->num_areas; i++) {
-    struct area *area = bif->areas[i];
+    struct area *area = &bif->areas[i];
     area->y = top - area->y - heights[i];
   }
 
@@ -682,46 +762,10 @@ static bool parse_level_info(const char *desc,
   return true;
 }
 
-static struct _openslide_grid *create_bif_grid(openslide_t *osr,
-                                               struct bif *bif,
-                                               double downsample,
-                                               int64_t tile_w, int64_t tile_h) {
-  double subtile_w = tile_w / downsample;
-  double subtile_h = tile_h / downsample;
-
-  struct _openslide_grid *grid =
-    _openslide_grid_create_tilemap(osr,
-                                   bif->tile_advance_x / downsample,
-                                   bif->tile_advance_y / downsample,
-                                   read_subtile_tilemap, NULL);
-
-  for (int32_t i = 0; i < bif->num_areas; i++) {
-    struct area *area = bif->areas[i];
-    double offset_x =
-      (area->x - area->start_col * bif->tile_advance_x) / downsample;
-    double offset_y =
-      (area->y - area->start_row * bif->tile_advance_y) / downsample;
-    //g_debug("ds %g area %d pos %"PRId64" %"PRId64" offset %g %g", downsample, i, area->x, area->y, offset_x, offset_y);
-    for (int64_t row = area->start_row;
-         row < area->start_row + area->tiles_down; row++) {
-      for (int64_t col = area->start_col;
-           col < area->start_col + area->tiles_across; col++) {
-        _openslide_grid_tilemap_add_tile(grid,
-                                         col, row,
-                                         offset_x, offset_y,
-                                         subtile_w, subtile_h,
-                                         NULL);
-      }
-    }
-  }
-
-  return grid;
-}
-
 static void set_region_props(openslide_t *osr, struct bif *bif,
                              struct level *level0) {
   for (int32_t i = 0; i < bif->num_areas; i++) {
-    struct area *area = bif->areas[i];
+    struct area *area = &bif->areas[i];
     g_hash_table_insert(osr->properties,
                         g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_REGION_X, i),
                         g_strdup_printf("%"PRId64, (int64_t) (bif->tile_advance_x * area->start_col)));
@@ -739,6 +783,7 @@ static void set_region_props(openslide_t *osr, struct bif *bif,
 
 static bool ventana_open(openslide_t *osr, const char *filename,
                          struct _openslide_tifflike *tl,
+                         struct _openslide_probe *probe G_GNUC_UNUSED,
                          struct _openslide_hash *quickhash1, GError **err) {
   // open TIFF
   g_autoptr(_openslide_tiffcache) tc = _openslide_tiffcache_create(filename);
@@ -864,14 +909,13 @@ static bool ventana_open(openslide_t *osr, const char *filename,
       }
       l->base.downsample = downsample;
       if (bif) {
-        l->grid = create_bif_grid(osr, bif,
-                                  downsample,
-                                  tiffl->tile_w, tiffl->tile_h);
+        // the grid is built by get_grid() when the level is first read
         l->subtiles_per_tile = downsample;
         // the format doesn't seem to record the level size, so make it
         // large enough for all the pixels
         double x, y, w, h;
-        _openslide_grid_get_bounds(l->grid, &x, &y, &w, &h);
+        get_bif_grid_bounds(bif, downsample, tiffl->tile_w, tiffl->tile_h,
+                            &x, &y, &w, &h);
         l->base.w = ceil(x + w);
         l->base.h = ceil(y + h);
         // clear tile size hints set by _openslide_tiff_level_init()
@@ -950,6 +994,7 @@ static bool ventana_open(openslide_t *osr, const char *filename,
   // allocate private data
   struct ventana_ops_data *data = g_new0(struct ventana_ops_data, 1);
   data->tc = g_steal_pointer(&tc);
+  data->bif = g_steal_pointer(&bif);
 
   // store osr data
   g_assert(osr->data == NULL);
@@ -28,8 +28,13 @@
  *
  */
 
+#include <config.h>
+
 #include "openslide-private.h"
 #include "openslide-decode-jpeg.h"
+#ifdef HAVE_JXR
+#include "openslide-decode-jxr.h"
+#endif
 #include "openslide-decode-xml.h"
 
 #include <glib.h>
@@ -286,6 +291,7 @@ struct level {
 struct zeiss_ops_data {
   struct czi *czi;
   char *filename;
+  struct _openslide_file *file;  // shared; tile reads are positional
 };
 
 static void destroy_level(struct level *l) {
@@ -309,18 +315,18 @@ static void destroy(openslide_t *osr) {
   if (osr->data) {
     struct zeiss_ops_data *data = osr->data;
     destroy_czi(data->czi);
+    if (data->file) {
+      _openslide_fclose(data->file);
+    }
     g_free(data->filename);
     g_free(data);
   }
 }
 
+// positional, so a file can be shared between threads
 static bool freadn_to_buf(struct _openslide_file *f, off_t offset,
                           void *buf, size_t len, GError **err) {
-  if (!_openslide_fseek(f, offset, SEEK_SET, err)) {
-    g_prefix_error(err, "Couldn't seek to offset %"PRId64": ", offset);
-    return false;
-  }
-  if (!_openslide_fread_exact(f, buf, len, err)) {
+  if (!_openslide_fpread_exact(f, buf, len, offset, err)) {
     g_prefix_error(err, "At offset %"PRId64": ", (int64_t) offset);
     return false;
   }
@@ -338,24 +344,13 @@ static bool check_magic(const void *found, const char *expected,
   return true;
 }
 
-static void bgr24_to_argb32(uint8_t *src, size_t src_len, uint32_t *dst) {
-  // one 24-bit pixel at a time
-  for (size_t i = 0; i < src_len; i += 3, src += 3) {
-    *dst++ = (0xFF000000 |
-              (uint32_t)(src[0]) |
-              ((uint32_t)(src[1]) << 8) |
-              ((uint32_t)(src[2]) << 16));
-  }
+static void bgr24_to_argb32(const uint8_t *src, size_t src_len, uint32_t *dst) {
+  _openslide_simd_bgr24_to_argb32(src, dst, src_len / 3);
 }
 
-static void bgr48_to_argb32(uint8_t *src, size_t src_len, uint32_t *dst) {
-  // one 48-bit pixel at a time
-  for (size_t i = 0; i < src_len; i += 6, src += 6) {
-    *dst++ = (0xFF000000 |
-              (uint32_t)(src[1]) |
-              ((uint32_t)(src[3]) << 8) |
-              ((uint32_t)(src[5]) << 16));
-  }
+static void bgr48_to_argb32(const uint8_t *src, size_t src_len, uint32_t *dst) {
+  // keep the high byte of each 16-bit sample
+  _openslide_simd_bgr48_to_argb32(src, dst, src_len / 6);
 }
 
 static bool czi_read_raw(struct _openslide_file *f, int64_t pos, int64_t len,
@@ -363,7 +358,7 @@ static bool czi_read_raw(struct _openslide_file *f, int64_t pos, int64_t len,
                          uint32_t *dst, int32_t w, int32_t h,
                          GError **err) {
   // figure out what to do with pixel type
-  void (*convert)(uint8_t *, size_t, uint32_t *);
+  void (*convert)(const uint8_t *, size_t, uint32_t *);
   int bytes_per_pixel;
   switch (pixel_type) {
   case PT_BGR24:
@@ -379,20 +374,24 @@ static bool czi_read_raw(struct _openslide_file *f, int64_t pos, int64_t len,
   }
   const int64_t pixel_bytes = w * h * bytes_per_pixel;
 
-  // read from file
-  g_autofree uint8_t *file_data = g_try_malloc(len);
-  if (!file_data) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Couldn't allocate %"PRId64" bytes for image data", len);
-    return false;
-  }
-  if (!freadn_to_buf(f, pos, file_data, len, err)) {
-    g_prefix_error(err, "Couldn't read image data: ");
-    return false;
+  // read from file, unless it's mapped
+  const uint8_t *src = _openslide_fmap_range(f, pos, len);
+  g_autofree uint8_t *file_data = NULL;
+  if (!src) {
+    file_data = g_try_malloc(len);
+    if (!file_data) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't allocate %"PRId64" bytes for image data", len);
+      return false;
+    }
+    if (!freadn_to_buf(f, pos, file_data, len, err)) {
+      g_prefix_error(err, "Couldn't read image data: ");
+      return false;
+    }
+    src = file_data;
   }
 
   // process compression
-  uint8_t *src = file_data;
   g_autofree uint8_t *decompressed_data = NULL;
   bool do_hilo = false;
   switch (compression) {
@@ -447,6 +446,11 @@ static bool czi_read_raw(struct _openslide_file *f, int64_t pos, int64_t len,
     }
     src = decompressed_data;
     break;
+#ifdef HAVE_JXR
+  case COMP_JXR:
+    // decodes straight to ARGB
+    return _openslide_jxr_decode_buffer(dst, w, h, src, len, err);
+#endif
   default:
     g_assert_not_reached();
   }
@@ -463,6 +467,11 @@ static bool czi_read_raw(struct _openslide_file *f, int64_t pos, int64_t len,
       return false;
     }
     int64_t half_bytes = pixel_bytes / 2;
+    if (pixel_type == PT_BGR48) {
+      // we only keep the high bytes, which are already packed as BGR24
+      bgr24_to_argb32(src + half_bytes, half_bytes, dst);
+      return true;
+    }
     unhilo_data = g_try_malloc(pixel_bytes);
     if (!unhilo_data) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -471,8 +480,8 @@ static bool czi_read_raw(struct _openslide_file *f, int64_t pos, int64_t len,
       return false;
     }
     uint8_t *p = unhilo_data;
-    uint8_t *slo = src;
-    uint8_t *shi = src + half_bytes;
+    const uint8_t *slo = src;
+    const uint8_t *shi = src + half_bytes;
     for (int64_t i = 0; i < half_bytes; i++) {
       *p++ = *slo++;
       *p++ = *shi++;
@@ -505,6 +514,9 @@ static bool read_subblk(struct _openslide_file *f, int64_t zisraw_offset,
   case COMP_NONE:
   case COMP_ZSTD0:
   case COMP_ZSTD1:
+#ifdef HAVE_JXR
+  case COMP_JXR:
+#endif
     return czi_read_raw(f, data_pos, data_size, sb->compression, sb->pixel_type,
                         dst, sb->w, sb->h, err);
   default:
@@ -526,7 +538,8 @@ static bool read_tile(openslide_t *osr, cairo_t *cr,
   uint32_t *tiledata = _openslide_cache_get(osr->cache, level, tid, 0,
                                             &cache_entry);
   if (!tiledata) {
-    g_autofree uint32_t *buf = g_malloc(sb->w * sb->h * 4);
+    g_autofree uint32_t *buf =
+      _openslide_cache_alloc(osr->cache, sb->w * sb->h * 4);
     if (!read_subblk(f, czi->zisraw_offset, sb, buf, err)) {
       return false;
     }
@@ -552,18 +565,17 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
   struct zeiss_ops_data *data = osr->data;
   struct level *l = (struct level *) level;
 
-  g_autoptr(_openslide_file) f = _openslide_fopen(data->filename, err);
-  if (!f) {
-    return false;
-  }
-  return _openslide_grid_paint_region(l->grid, cr, f,
+  return _openslide_grid_paint_region(l->grid, cr, data->file,
                                       x / l->base.downsample,
                                       y / l->base.downsample,
                                       level, w, h, err);
 }
 
+static bool load_properties(openslide_t *osr, GError **err);
+
 static const struct _openslide_ops zeiss_ops = {
   .paint_region = paint_region,
+  .load_properties = load_properties,
   .destroy = destroy,
 };
 
@@ -602,12 +614,19 @@ static const struct _openslide_associated_image_ops zeiss_associated_ops = {
 };
 
 static bool zeiss_detect(const char *filename,
-                         struct _openslide_tifflike *tl, GError **err) {
+                         struct _openslide_tifflike *tl,
+                         struct _openslide_probe *probe,
+                         GError **err) {
   // reject TIFFs
   if (tl) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED, "Is a TIFF file");
     return false;
   }
+  if (!_openslide_probe_check_magic(probe, 0, SID_ZISRAWFILE,
+                                    strlen(SID_ZISRAWFILE), err)) {
+    g_prefix_error(err, "Not a Zeiss CZI file: ");
+    return false;
+  }
 
   g_autoptr(_openslide_file) f = _openslide_fopen(filename, err);
   if (!f) {
@@ -625,6 +644,16 @@ static bool zeiss_detect(const char *filename,
   return true;
 }
 
+// dimension names are one character, NUL-padded
+static char dim_name(const struct zisraw_dim_entry_dv *dim) {
+  for (size_t i = 1; i < sizeof(dim->dimension); i++) {
+    if (dim->dimension[i]) {
+      return 0;
+    }
+  }
+  return dim->dimension[0];
+}
+
 static bool read_dim_entry(struct czi_subblk *sb, char **p, size_t *avail,
                            GError **err) {
   const size_t len = sizeof(struct zisraw_dim_entry_dv);
@@ -637,35 +666,43 @@ static bool read_dim_entry(struct czi_subblk *sb, char **p, size_t *avail,
   *p += len;
   *avail -= len;
 
-  g_autofree char *name = g_strndup(dim->dimension, sizeof(dim->dimension));
   int start = GINT32_FROM_LE(dim->start);
   int size = GINT32_FROM_LE(dim->size);
   int stored_size = GINT32_FROM_LE(dim->stored_size);
 
-  if (g_str_equal(name, "X")) {
+  // called for every dimension of every subblock, so avoid allocating
+  switch (dim_name(dim)) {
+  case 'X':
     sb->x = start;
     sb->w = stored_size;
     sb->downsample_i = DIV_ROUND_CLOSEST(size, stored_size);
-  } else if (g_str_equal(name, "Y")) {
+    break;
+  case 'Y':
     sb->y = start;
     sb->h = stored_size;
-  } else if (g_str_equal(name, "S")) {
+    break;
+  case 'S':
     sb->scene = start;
-  } else if (g_str_equal(name, "C")) {
+    break;
+  case 'C':
     // channel
     if (start) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Nonzero subblock channel %d", start);
       return false;
     }
-  } else if (g_str_equal(name, "M")) {
+    break;
+  case 'M':
     // mosaic tile index in drawing stack; highest number is frontmost
     sb->z = start;
-  } else {
+    break;
+  default: {
+    g_autofree char *name = g_strndup(dim->dimension, sizeof(dim->dimension));
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Unrecognized subblock dimension \"%s\"", name);
     return false;
   }
+  }
   return true;
 }
 
@@ -703,9 +740,10 @@ static bool read_dir_entry(struct czi_subblk *sb, char **p, size_t *avail,
   return true;
 }
 
-/* read all data subblocks info (x, y, w, h etc.) from subblock directory */
+/* read all data subblocks info (x, y, w, h etc.) from subblock directory.
+   if there are more than max_entries (if nonzero), only set the count. */
 static bool read_subblk_dir(struct czi *czi, struct _openslide_file *f,
-                            GError **err) {
+                            int32_t max_entries, GError **err) {
   int64_t offset = czi->zisraw_offset + czi->subblk_dir_pos;
   struct zisraw_subblk_dir_hdr hdr;
   if (!freadn_to_buf(f, offset, &hdr, sizeof(hdr), err)) {
@@ -719,6 +757,9 @@ static bool read_subblk_dir(struct czi *czi, struct _openslide_file *f,
   }
 
   czi->nsubblk = GINT32_FROM_LE(hdr.entry_count);
+  if (max_entries && czi->nsubblk > max_entries) {
+    return true;
+  }
   int64_t seg_size =
     GINT64_FROM_LE(hdr.seg_hdr.used_size) - sizeof(hdr) + sizeof(hdr.seg_hdr);
   g_autofree char *buf_dir = g_try_malloc(seg_size);
@@ -775,7 +816,7 @@ static void adjust_coordinate_origin(struct czi *czi) {
 }
 
 static struct czi *create_czi(struct _openslide_file *f, int64_t offset,
-                              GError **err) {
+                              int32_t max_subblks, GError **err) {
   struct zisraw_data_file_hdr hdr;
   if (!freadn_to_buf(f, offset, &hdr, sizeof(hdr), err)) {
     g_prefix_error(err, "Couldn't read file header: ");
@@ -793,10 +834,12 @@ static struct czi *create_czi(struct _openslide_file *f, int64_t offset,
   czi->meta_pos = GINT64_FROM_LE(hdr.meta_pos);
   czi->att_dir_pos = GINT64_FROM_LE(hdr.att_dir_pos);
 
-  if (!read_subblk_dir(czi, f, err)) {
+  if (!read_subblk_dir(czi, f, max_subblks, err)) {
     return NULL;
   }
-  adjust_coordinate_origin(czi);
+  if (czi->subblks) {
+    adjust_coordinate_origin(czi);
+  }
   return g_steal_pointer(&czi);
 }
 
@@ -926,6 +969,44 @@ static void add_xml_props(openslide_t *osr, xmlDoc *doc, GPtrArray *path,
   g_ptr_array_remove_index(path, path->len - 1);
 }
 
+static void add_metadata_props(openslide_t *osr, xmlXPathContext *ctx) {
+  g_autoptr(GPtrArray) path = g_ptr_array_new_full(16, g_free);
+  g_ptr_array_add(path, g_strdup("zeiss"));
+  for (unsigned i = 0; i < G_N_ELEMENTS(metadata_property_xpaths); i++) {
+    xmlNode *node =
+      _openslide_xml_xpath_get_node(ctx, metadata_property_xpaths[i]);
+    if (node) {
+      add_xml_props(osr, ctx->doc, path, node);
+    }
+  }
+}
+
+// get a metadata value from its zeiss property, or from the XML if the
+// properties were deferred
+static char *get_metadata_value(openslide_t *osr, xmlXPathContext *ctx,
+                                const char *name, const char *xpath) {
+  if (osr->properties_deferred) {
+    return _openslide_xml_xpath_get_string(ctx, xpath);
+  }
+  return g_strdup(g_hash_table_lookup(osr->properties, name));
+}
+
+static bool load_properties(openslide_t *osr, GError **err) {
+  struct zeiss_ops_data *data = osr->data;
+  g_autofree char *xml = read_czi_meta_xml(data->czi, data->file, err);
+  if (!xml) {
+    return false;
+  }
+  g_autoptr(xmlDoc) doc = _openslide_xml_parse(xml, err);
+  if (doc == NULL) {
+    g_prefix_error(err, "Couldn't parse metadata XML: ");
+    return false;
+  }
+  g_autoptr(xmlXPathContext) ctx = _openslide_xml_xpath_create(doc);
+  add_metadata_props(osr, ctx);
+  return true;
+}
+
 // parse XML, set CZI parameters and OpenSlide properties
 static bool parse_xml_set_prop(openslide_t *osr, struct czi *czi,
                                const char *xml, GError **err) {
@@ -977,22 +1058,22 @@ static bool parse_xml_set_prop(openslide_t *osr, struct czi *czi,
   */
   g_autoptr(xmlXPathContext) ctx = _openslide_xml_xpath_create(doc);
 
-  g_autoptr(GPtrArray) path = g_ptr_array_new_full(16, g_free);
-  g_ptr_array_add(path, g_strdup("zeiss"));
-  for (unsigned i = 0; i < G_N_ELEMENTS(metadata_property_xpaths); i++) {
-    xmlNode *node =
-      _openslide_xml_xpath_get_node(ctx, metadata_property_xpaths[i]);
-    if (node) {
-      add_xml_props(osr, doc, path, node);
-    }
-  }
-
-  const char *size_x =
-    g_hash_table_lookup(osr->properties, "zeiss.Information.Image.SizeX");
-  const char *size_y =
-    g_hash_table_lookup(osr->properties, "zeiss.Information.Image.SizeY");
-  const char *size_s =
-    g_hash_table_lookup(osr->properties, "zeiss.Information.Image.SizeS");
+  // add zeiss properties, or leave them for load_properties()
+  if (_openslide_lazy_properties()) {
+    osr->properties_deferred = true;
+  } else {
+    add_metadata_props(osr, ctx);
+  }
+
+  g_autofree char *size_x =
+    get_metadata_value(osr, ctx, "zeiss.Information.Image.SizeX",
+                       "/ImageDocument/Metadata/Information/Image/SizeX");
+  g_autofree char *size_y =
+    get_metadata_value(osr, ctx, "zeiss.Information.Image.SizeY",
+                       "/ImageDocument/Metadata/Information/Image/SizeY");
+  g_autofree char *size_s =
+    get_metadata_value(osr, ctx, "zeiss.Information.Image.SizeS",
+                       "/ImageDocument/Metadata/Information/Image/SizeS");
   if (!size_x || !size_y) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Couldn't read image dimensions");
@@ -1018,8 +1099,10 @@ static bool parse_xml_set_prop(openslide_t *osr, struct czi *czi,
   czi->nscene = nscene;
 
   // in meter/pixel
-  const char *meters =
-    g_hash_table_lookup(osr->properties, "zeiss.Scaling.Items.X.Value");
+  g_autofree char *meters =
+    get_metadata_value(osr, ctx, "zeiss.Scaling.Items.X.Value",
+                       "/ImageDocument/Metadata/Scaling/Items"
+                       "/Distance[@Id='X']/Value");
   if (meters) {
     double d = _openslide_parse_double(meters);
     if (!isnan(d)) {
@@ -1030,7 +1113,10 @@ static bool parse_xml_set_prop(openslide_t *osr, struct czi *czi,
     }
   }
 
-  meters = g_hash_table_lookup(osr->properties, "zeiss.Scaling.Items.Y.Value");
+  g_free(meters);
+  meters = get_metadata_value(osr, ctx, "zeiss.Scaling.Items.Y.Value",
+                              "/ImageDocument/Metadata/Scaling/Items"
+                              "/Distance[@Id='Y']/Value");
   if (meters) {
     double d = _openslide_parse_double(meters);
     if (!isnan(d)) {
@@ -1040,14 +1126,29 @@ static bool parse_xml_set_prop(openslide_t *osr, struct czi *czi,
     }
   }
 
-  char *objective_id = g_hash_table_lookup(osr->properties,
-                                           "zeiss.Information.Image.ObjectiveSettings.ObjectiveRef.Id");
-  if (objective_id) {
+  g_autofree char *objective_id =
+    get_metadata_value(osr, ctx,
+                       "zeiss.Information.Image.ObjectiveSettings.ObjectiveRef.Id",
+                       "/ImageDocument/Metadata/Information/Image"
+                       "/ObjectiveSettings/ObjectiveRef/@Id");
+  if (objective_id && !strchr(objective_id, '\'')) {
     g_autofree char *objective_key =
       g_strdup_printf("zeiss.Information.Instrument.Objectives.%s.NominalMagnification",
                       objective_id);
-    _openslide_duplicate_double_prop(osr, objective_key,
-                                     OPENSLIDE_PROPERTY_NAME_OBJECTIVE_POWER);
+    g_autofree char *objective_xpath =
+      g_strdup_printf("/ImageDocument/Metadata/Information/Instrument"
+                      "/Objectives/Objective[@Id='%s']/NominalMagnification",
+                      objective_id);
+    g_autofree char *magnification =
+      get_metadata_value(osr, ctx, objective_key, objective_xpath);
+    if (magnification) {
+      double d = _openslide_parse_double(magnification);
+      if (!isnan(d)) {
+        g_hash_table_insert(osr->properties,
+                            g_strdup(OPENSLIDE_PROPERTY_NAME_OBJECTIVE_POWER),
+                            _openslide_format_double(d));
+      }
+    }
   }
 
   return true;
@@ -1156,6 +1257,16 @@ static bool validate_subblk(const struct czi_subblk *sb, GError **err) {
   case COMP_ZSTD0:
   case COMP_ZSTD1:
     break;
+#ifdef HAVE_JXR
+  case COMP_JXR:
+    if (sb->pixel_type != PT_BGR24) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "JPEG XR compression is only supported for %s pixels",
+                  czi_pixel_type_names[PT_BGR24].name);
+      return false;
+    }
+    break;
+#endif
   default:
     if (sb->compression >= 0 &&
         sb->compression < (int) G_N_ELEMENTS(czi_compression_names)) {
@@ -1286,7 +1397,8 @@ static bool add_one_associated_image(openslide_t *osr, const char *filename,
     img->base.w = w;
     img->base.h = h;
   } else if (g_str_equal(file_type, "CZI")) {
-    g_autoptr(czi) czi = create_czi(f, data_offset, err);
+    // don't read the directory of an unexpectedly large embedded CZI
+    g_autoptr(czi) czi = create_czi(f, data_offset, 1, err);
     if (!czi) {
       g_prefix_error(err, "Reading CZI for associated image \"%s\": ", name);
       return false;
@@ -1374,13 +1486,14 @@ static bool add_associated_images(openslide_t *osr, struct czi *czi,
 
 static bool zeiss_open(openslide_t *osr, const char *filename,
                        struct _openslide_tifflike *tl G_GNUC_UNUSED,
+                       struct _openslide_probe *probe G_GNUC_UNUSED,
                        struct _openslide_hash *quickhash1, GError **err) {
-  g_autoptr(_openslide_file) f = _openslide_fopen(filename, err);
+  g_autoptr(_openslide_file) f = _openslide_fopen_mapped(filename, err);
   if (!f) {
     return false;
   }
 
-  g_autoptr(czi) czi = create_czi(f, 0, err);
+  g_autoptr(czi) czi = create_czi(f, 0, 0, err);
   if (!czi) {
     return false;
   }
@@ -1424,6 +1537,7 @@ static bool zeiss_open(openslide_t *osr, const char *filename,
   struct zeiss_ops_data *data = g_new0(struct zeiss_ops_data, 1);
   data->czi = g_steal_pointer(&czi);
   data->filename = g_strdup(filename);
+  data->file = g_steal_pointer(&f);
   osr->data = data;
   osr->ops = &zeiss_ops;
   osr->cache = _openslide_cache_binding_create(default_cache_size);
@@ -0,0 +1,356 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide-private.h"
+
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+
+// Slides with large gaps in their pyramid, or no pyramid at all, can get
+// virtual levels at 2x steps.  A virtual level's tiles are made on demand
+// by box filtering the level with half its downsample, which may itself
+// be virtual, and are cached like backend tiles.  The backend's ops are
+// wrapped so the backend never sees a virtual level.
+
+// fill gaps between backend levels larger than this
+#define MAX_GAP 4.5
+// tile size for virtual levels, if the backend doesn't report one
+#define DEFAULT_TILE_SIZE 256
+
+struct virtual_level {
+  struct _openslide_level base;
+  struct _openslide_level *source;  // half the downsample
+  struct _openslide_grid *grid;
+  int64_t tile_w;
+  int64_t tile_h;
+};
+
+struct _openslide_virtual_levels {
+  struct _openslide_ops ops;
+  const struct _openslide_ops *backend_ops;
+  struct _openslide_level **backend_levels;
+  int32_t backend_level_count;
+  // backend levels, then virtual levels, for the persistent cache
+  struct _openslide_level **stable_levels;
+  int32_t level_count;
+};
+
+static gint enabled;
+
+void _openslide_virtual_levels_set_enabled(bool enable) {
+  g_atomic_int_set(&enabled, enable);
+}
+
+static struct virtual_level *get_virtual_level(openslide_t *osr,
+                                               struct _openslide_level *l) {
+  struct _openslide_virtual_levels *vl = osr->virtual_levels;
+  for (int32_t i = vl->backend_level_count; i < vl->level_count; i++) {
+    if (vl->stable_levels[i] == l) {
+      return (struct virtual_level *) l;
+    }
+  }
+  return NULL;
+}
+
+// average 2x2 blocks of premultiplied ARGB; src is 2w x 2h
+static void box_filter(const uint32_t *src, uint32_t *dest,
+                       int64_t w, int64_t h) {
+  for (int64_t y = 0; y < h; y++) {
+    const uint32_t *r0 = src + 2 * y * 2 * w;
+    const uint32_t *r1 = r0 + 2 * w;
+    for (int64_t x = 0; x < w; x++) {
+      uint32_t a = r0[2 * x];
+      uint32_t b = r0[2 * x + 1];
+      uint32_t c = r1[2 * x];
+      uint32_t d = r1[2 * x + 1];
+      uint32_t out = 0;
+      for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t sum = ((a >> shift) & 0xff) + ((b >> shift) & 0xff) +
+                       ((c >> shift) & 0xff) + ((d >> shift) & 0xff);
+        out |= ((sum + 2) >> 2) << shift;
+      }
+      dest[y * w + x] = out;
+    }
+  }
+}
+
+static bool paint_region(openslide_t *osr, cairo_t *cr,
+                         int64_t x, int64_t y,
+                         struct _openslide_level *level,
+                         int32_t w, int32_t h,
+                         GError **err);
+
+static uint32_t *get_virtual_tile(openslide_t *osr,
+                                  struct virtual_level *v,
+                                  int64_t tile_col, int64_t tile_row,
+                                  struct _openslide_cache_entry **cache_entry,
+                                  GError **err) {
+  uint32_t *tiledata = _openslide_cache_get(osr->cache, v,
+                                            tile_col, tile_row,
+                                            cache_entry);
+  if (tiledata) {
+    return tiledata;
+  }
+
+  // paint the source area, which is twice the size of the tile
+  int64_t tw = v->tile_w;
+  int64_t th = v->tile_h;
+  g_autofree uint32_t *src = g_try_malloc0(4 * tw * th * 4);
+  if (!src) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't allocate %"PRId64"x%"PRId64" source buffer",
+                2 * tw, 2 * th);
+    return NULL;
+  }
+  g_autoptr(cairo_surface_t) surface =
+    cairo_image_surface_create_for_data((unsigned char *) src,
+                                        CAIRO_FORMAT_ARGB32,
+                                        2 * tw, 2 * th, 2 * tw * 4);
+  g_autoptr(cairo_t) cr = cairo_create(surface);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SATURATE);
+  double ds = v->source->downsample;
+  if (!paint_region(osr, cr,
+                    2 * tile_col * tw * ds, 2 * tile_row * th * ds,
+                    v->source, 2 * tw, 2 * th, err)) {
+    return NULL;
+  }
+  if (!_openslide_check_cairo_status(cr, err)) {
+    return NULL;
+  }
+  cairo_surface_flush(surface);
+
+  g_autofree uint32_t *buf = _openslide_cache_alloc(osr->cache, tw * th * 4);
+  box_filter(src, buf, tw, th);
+  if (!_openslide_clip_tile(buf, tw, th,
+                            v->base.w - tile_col * tw,
+                            v->base.h - tile_row * th,
+                            err)) {
+    return NULL;
+  }
+
+  tiledata = g_steal_pointer(&buf);
+  _openslide_cache_put(osr->cache, v, tile_col, tile_row,
+                       tiledata, tw * th * 4,
+                       cache_entry);
+  return tiledata;
+}
+
+static bool read_tile(openslide_t *osr,
+                      cairo_t *cr,
+                      struct _openslide_level *level,
+                      int64_t tile_col, int64_t tile_row,
+                      void *arg G_GNUC_UNUSED,
+                      GError **err) {
+  struct virtual_level *v = (struct virtual_level *) level;
+
+  g_autoptr(_openslide_cache_entry) cache_entry = NULL;
+  uint32_t *tiledata = get_virtual_tile(osr, v, tile_col, tile_row,
+                                        &cache_entry, err);
+  if (!tiledata) {
+    return false;
+  }
+
+  g_autoptr(cairo_surface_t) surface =
+    cairo_image_surface_create_for_data((unsigned char *) tiledata,
+                                        CAIRO_FORMAT_ARGB32,
+                                        v->tile_w, v->tile_h,
+                                        v->tile_w * 4);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_paint(cr);
+  return true;
+}
+
+static bool paint_region(openslide_t *osr, cairo_t *cr,
+                         int64_t x, int64_t y,
+                         struct _openslide_level *level,
+                         int32_t w, int32_t h,
+                         GError **err) {
+  struct virtual_level *v = get_virtual_level(osr, level);
+  if (!v) {
+    return osr->virtual_levels->backend_ops->paint_region(osr, cr, x, y,
+                                                          level, w, h, err);
+  }
+  return _openslide_grid_paint_region(v->grid, cr, NULL,
+                                      x / v->base.downsample,
+                                      y / v->base.downsample,
+                                      level, w, h, err);
+}
+
+static uint32_t *get_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          struct _openslide_cache_entry **entry,
+                          GError **err) {
+  struct virtual_level *v = get_virtual_level(osr, level);
+  if (!v) {
+    return osr->virtual_levels->backend_ops->get_tile(osr, level,
+                                                      tile_col, tile_row,
+                                                      entry, err);
+  }
+  return get_virtual_tile(osr, v, tile_col, tile_row, entry, err);
+}
+
+static void *get_raw_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          openslide_tile_format_t *format, int64_t *size,
+                          struct _openslide_cache_entry **entry,
+                          GError **err) {
+  if (get_virtual_level(osr, level)) {
+    return NULL;
+  }
+  return osr->virtual_levels->backend_ops->get_raw_tile(osr, level,
+                                                        tile_col, tile_row,
+                                                        format, size,
+                                                        entry, err);
+}
+
+static void prefetch_tile_data(openslide_t *osr,
+                               struct _openslide_level *level,
+                               const struct _openslide_tile_position *tiles,
+                               int64_t count) {
+  if (!get_virtual_level(osr, level)) {
+    osr->virtual_levels->backend_ops->prefetch_tile_data(osr, level,
+                                                         tiles, count);
+  }
+}
+
+static void destroy(openslide_t *osr) {
+  struct _openslide_virtual_levels *vl = osr->virtual_levels;
+
+  // give the backend back its own levels
+  g_free(osr->levels);
+  osr->levels = vl->backend_levels;
+  osr->level_count = vl->backend_level_count;
+  osr->ops = vl->backend_ops;
+  osr->virtual_levels = NULL;
+  osr->ops->destroy(osr);
+
+  for (int32_t i = vl->backend_level_count; i < vl->level_count; i++) {
+    struct virtual_level *v = (struct virtual_level *) vl->stable_levels[i];
+    _openslide_grid_destroy(v->grid);
+    g_free(v);
+  }
+  g_free(vl->stable_levels);
+  g_free(vl);
+}
+
+void _openslide_virtual_levels_add(openslide_t *osr) {
+  if (!g_atomic_int_get(&enabled) || !osr->level_count) {
+    return;
+  }
+
+  // use the backend's tile size if it's reasonable
+  struct _openslide_level *l0 = osr->levels[0];
+  bool have_geometry = l0->tile_w > 0 && l0->tile_h > 0;
+  int64_t tw = DEFAULT_TILE_SIZE;
+  int64_t th = DEFAULT_TILE_SIZE;
+  if (have_geometry && l0->tile_w <= 1024 && l0->tile_h <= 1024) {
+    tw = l0->tile_w;
+    th = l0->tile_h;
+  }
+
+  g_autoptr(GPtrArray) levels = g_ptr_array_new();
+  g_autoptr(GPtrArray) virtual = g_ptr_array_new();
+  for (int32_t i = 0; i < osr->level_count; i++) {
+    struct _openslide_level *l = osr->levels[i];
+    struct _openslide_level *next =
+      i + 1 < osr->level_count ? osr->levels[i + 1] : NULL;
+    g_ptr_array_add(levels, l);
+
+    // fill a large gap, or continue below the last level until a level
+    // fits in one tile
+    if (next && next->downsample / l->downsample <= MAX_GAP) {
+      continue;
+    }
+    struct _openslide_level *prev = l;
+    while ((next ? next->downsample / prev->downsample > 2.5
+                 : prev->w > tw || prev->h > th) &&
+           prev->w >= 2 && prev->h >= 2) {
+      struct virtual_level *v = g_new0(struct virtual_level, 1);
+      v->base.downsample = prev->downsample * 2;
+      v->base.w = prev->w / 2;
+      v->base.h = prev->h / 2;
+      if (have_geometry) {
+        v->base.tile_w = tw;
+        v->base.tile_h = th;
+      }
+      v->source = prev;
+      v->tile_w = tw;
+      v->tile_h = th;
+      v->grid = _openslide_grid_create_simple(osr,
+                                              (v->base.w + tw - 1) / tw,
+                                              (v->base.h + th - 1) / th,
+                                              tw, th,
+                                              read_tile);
+      g_ptr_array_add(levels, v);
+      g_ptr_array_add(virtual, v);
+      prev = &v->base;
+    }
+  }
+  if (!virtual->len) {
+    return;
+  }
+
+  struct _openslide_virtual_levels *vl =
+    g_new0(struct _openslide_virtual_levels, 1);
+  vl->backend_ops = osr->ops;
+  vl->backend_levels = osr->levels;
+  vl->backend_level_count = osr->level_count;
+  vl->level_count = levels->len;
+  vl->stable_levels = g_new(struct _openslide_level *, levels->len);
+  memcpy(vl->stable_levels, osr->levels,
+         osr->level_count * sizeof(*osr->levels));
+  memcpy(vl->stable_levels + osr->level_count, virtual->pdata,
+         virtual->len * sizeof(*osr->levels));
+
+  // wrap the backend ops
+  vl->ops = *osr->ops;
+  vl->ops.paint_region = paint_region;
+  if (vl->ops.get_tile) {
+    vl->ops.get_tile = get_tile;
+  }
+  if (vl->ops.get_raw_tile) {
+    vl->ops.get_raw_tile = get_raw_tile;
+  }
+  if (vl->ops.prefetch_tile_data) {
+    vl->ops.prefetch_tile_data = prefetch_tile_data;
+  }
+  vl->ops.destroy = destroy;
+
+  osr->virtual_levels = vl;
+  osr->ops = &vl->ops;
+  osr->level_count = levels->len;
+  osr->levels = (struct _openslide_level **)
+    g_ptr_array_free(g_steal_pointer(&levels), false);
+}
+
+struct _openslide_level **_openslide_virtual_levels_get_stable(openslide_t *osr,
+                                                               int32_t *count) {
+  struct _openslide_virtual_levels *vl = osr->virtual_levels;
+  if (!vl) {
+    *count = osr->level_count;
+    return osr->levels;
+  }
+  *count = vl->level_count;
+  return vl->stable_levels;
+}
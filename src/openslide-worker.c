@@ -0,0 +1,445 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2026 Lumea Digital
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// for sched_setaffinity()
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <glib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined __linux__
+#include <sys/resource.h>
+#endif
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+// A process-wide pool of worker threads, shared by every openslide_t and
+// created on first use.  Work is submitted either as fire-and-forget tasks
+// or as batches.  The thread waiting on a batch also runs the batch's
+// items, so a batch submitted from a worker thread always makes progress
+// even if every other worker is busy.
+//
+// Workers pick up changes to their CPU affinity and priority before
+// starting their next task.
+
+struct task {
+  _openslide_worker_fn fn;
+  void *data;
+};
+
+struct batch {
+  GMutex lock;
+  GCond cond;
+
+  _openslide_worker_batch_fn fn;
+  void *arg;
+  int64_t count;
+
+  int64_t next;      // next item to start
+  int64_t running;   // items started but not finished
+  int refcount;      // waiting thread + queued helpers
+  GError *err;       // first error
+
+  struct _openslide_read_record *read;  // read the batch is part of
+  gint *cancel;                         // caller's cancel flag, or NULL
+};
+
+// per-worker state
+struct worker {
+  gint generation;  // of the configuration applied to this thread
+#ifdef HAVE_SCHED_SETAFFINITY
+  bool saved_affinity;
+  cpu_set_t affinity;  // before we changed it
+#endif
+};
+
+// protected by config_lock.  pool and pool_threads are also published
+// atomically, so get_pool() only locks until the pool is set up.
+static GMutex config_lock;
+static GThreadPool *pool;         // atomic reads
+static gint pool_failed;          // atomic reads
+static gint pool_threads = -1;    // atomic reads; -1 until configured
+static int32_t max_threads = -1;  // -1 for one per processor
+static int32_t *cpus;
+static int32_t cpu_count;         // 0 for no restriction
+static openslide_worker_priority_t priority;
+static gint generation;           // atomic; bumped by configuration changes
+
+static GPrivate worker_key = G_PRIVATE_INIT(g_free);
+static GPrivate cancel_flag;
+
+static int32_t thread_count_locked(void) {
+  return max_threads < 0 ? MAX(g_get_num_processors(), 1) : max_threads;
+}
+
+static void apply_affinity(struct worker *w G_GNUC_UNUSED,
+                           const int32_t *set G_GNUC_UNUSED,
+                           int32_t count G_GNUC_UNUSED) {
+#ifdef HAVE_SCHED_SETAFFINITY
+  if (!count) {
+    if (w->saved_affinity) {
+      sched_setaffinity(0, sizeof(w->affinity), &w->affinity);
+    }
+    return;
+  }
+  if (!w->saved_affinity &&
+      !sched_getaffinity(0, sizeof(w->affinity), &w->affinity)) {
+    w->saved_affinity = true;
+  }
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (int32_t i = 0; i < count; i++) {
+    if (set[i] >= 0 && set[i] < CPU_SETSIZE) {
+      CPU_SET(set[i], &mask);
+    }
+  }
+  sched_setaffinity(0, sizeof(mask), &mask);
+#elif defined _WIN32
+  DWORD_PTR mask = 0;
+  for (int32_t i = 0; i < count; i++) {
+    if (set[i] >= 0 && set[i] < (int32_t) (8 * sizeof(mask))) {
+      mask |= (DWORD_PTR) 1 << set[i];
+    }
+  }
+  if (!mask) {
+    DWORD_PTR system_mask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &mask, &system_mask)) {
+      return;
+    }
+  }
+  SetThreadAffinityMask(GetCurrentThread(), mask);
+#endif
+}
+
+static void apply_priority(openslide_worker_priority_t prio) {
+#ifdef _WIN32
+  SetThreadPriority(GetCurrentThread(),
+                    prio == OPENSLIDE_WORKER_PRIORITY_LOW ?
+                    THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_NORMAL);
+#elif defined __linux__
+  // sets the nice value of the calling thread, not the process.
+  // unprivileged processes can't lower it again, so returning to normal
+  // priority may fail.
+  setpriority(PRIO_PROCESS, 0,
+              prio == OPENSLIDE_WORKER_PRIORITY_LOW ? 10 : 0);
+#else
+  // elsewhere setpriority() affects the whole process
+  (void) prio;
+#endif
+}
+
+// bring this worker thread up to date with the configuration
+static void configure_worker(void) {
+  struct worker *w = g_private_get(&worker_key);
+  if (!w) {
+    w = g_new0(struct worker, 1);
+    g_private_set(&worker_key, w);
+  }
+  gint gen = g_atomic_int_get(&generation);
+  if (w->generation == gen) {
+    return;
+  }
+
+  g_mutex_lock(&config_lock);
+  w->generation = g_atomic_int_get(&generation);
+  g_autofree int32_t *set = g_memdup(cpus, cpu_count * sizeof(*cpus));
+  int32_t count = cpu_count;
+  openslide_worker_priority_t prio = priority;
+  g_mutex_unlock(&config_lock);
+
+  apply_affinity(w, set, count);
+  apply_priority(prio);
+}
+
+static void run_task(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct task *task = data;
+  configure_worker();
+  task->fn(task->data);
+  g_free(task);
+}
+
+// NULL if work runs inline.  *threads_OUT is the number of pool threads.
+static GThreadPool *get_pool(int32_t *threads_OUT) {
+  int32_t threads = g_atomic_int_get(&pool_threads);
+  GThreadPool *p = g_atomic_pointer_get(&pool);
+  if (threads < 0 || (threads && !p && !g_atomic_int_get(&pool_failed))) {
+    g_mutex_lock(&config_lock);
+    threads = thread_count_locked();
+    if (!pool && !pool_failed && threads) {
+      // exclusive, since non-exclusive pools return idle threads to GLib
+      // for use by the application, and we change their affinity and
+      // priority
+      GError *tmp_err = NULL;
+      GThreadPool *new_pool = g_thread_pool_new(run_task, NULL, threads,
+                                                true, &tmp_err);
+      if (new_pool) {
+        g_atomic_pointer_set(&pool, new_pool);
+      } else {
+        // we'll run everything inline
+        g_warning("Couldn't create worker pool: %s", tmp_err->message);
+        g_clear_error(&tmp_err);
+        g_atomic_int_set(&pool_failed, true);
+      }
+    }
+    g_atomic_int_set(&pool_threads, threads);
+    p = pool;
+    g_mutex_unlock(&config_lock);
+  }
+  // an existing pool is kept while running inline, so its queued tasks
+  // can finish
+  p = threads ? p : NULL;
+  if (threads_OUT) {
+    *threads_OUT = p ? threads : 0;
+  }
+  return p;
+}
+
+int32_t _openslide_worker_get_thread_count(void) {
+  int32_t threads;
+  get_pool(&threads);
+  return threads;
+}
+
+void _openslide_worker_set_max_threads(int32_t threads) {
+  g_mutex_lock(&config_lock);
+  max_threads = MAX(threads, -1);
+  int32_t count = thread_count_locked();
+  if (pool && count) {
+    g_thread_pool_set_max_threads(pool, count, NULL);
+  }
+  g_atomic_int_set(&pool_threads, count);
+  g_mutex_unlock(&config_lock);
+}
+
+bool _openslide_worker_set_cpus(const int32_t *set, int32_t count) {
+#if defined HAVE_SCHED_SETAFFINITY || defined _WIN32
+  g_mutex_lock(&config_lock);
+  g_free(cpus);
+  count = set ? MAX(count, 0) : 0;
+  cpus = g_memdup(set, count * sizeof(*set));
+  cpu_count = count;
+  g_atomic_int_inc(&generation);
+  g_mutex_unlock(&config_lock);
+  return true;
+#else
+  (void) set;
+  (void) count;
+  return false;
+#endif
+}
+
+bool _openslide_worker_set_numa_node(int32_t node) {
+  if (node < 0) {
+    return _openslide_worker_set_cpus(NULL, 0);
+  }
+#ifdef HAVE_SCHED_SETAFFINITY
+  // e.g. "0-7,16-23"
+  g_autofree char *path =
+    g_strdup_printf("/sys/devices/system/node/node%d/cpulist", node);
+  g_autofree char *list = NULL;
+  if (!g_file_get_contents(path, &list, NULL, NULL)) {
+    return false;
+  }
+  g_autoptr(GArray) set = g_array_new(false, false, sizeof(int32_t));
+  g_auto(GStrv) ranges = g_strsplit(g_strstrip(list), ",", 0);
+  for (char **range = ranges; *range; range++) {
+    char *end;
+    int64_t first = g_ascii_strtoll(*range, &end, 10);
+    int64_t last = *end == '-' ? g_ascii_strtoll(end + 1, NULL, 10) : first;
+    for (int64_t cpu = MAX(first, 0); cpu <= MIN(last, CPU_SETSIZE - 1);
+         cpu++) {
+      int32_t c = cpu;
+      g_array_append_val(set, c);
+    }
+  }
+  if (!set->len) {
+    return false;
+  }
+  return _openslide_worker_set_cpus((const int32_t *) set->data, set->len);
+#else
+  return false;
+#endif
+}
+
+void _openslide_worker_set_priority(openslide_worker_priority_t prio) {
+  g_mutex_lock(&config_lock);
+  priority = prio;
+  g_atomic_int_inc(&generation);
+  g_mutex_unlock(&config_lock);
+}
+
+void _openslide_worker_submit(_openslide_worker_fn fn, void *data) {
+  GThreadPool *p = get_pool(NULL);
+  if (!p) {
+    fn(data);
+    return;
+  }
+  struct task *task = g_new0(struct task, 1);
+  task->fn = fn;
+  task->data = data;
+  GError *tmp_err = NULL;
+  if (!g_thread_pool_push(p, task, &tmp_err)) {
+    g_warning("Couldn't submit task to worker pool: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+    g_free(task);
+    fn(data);
+  }
+}
+
+static void batch_unref(struct batch *b) {
+  g_mutex_lock(&b->lock);
+  bool last = --b->refcount == 0;
+  g_mutex_unlock(&b->lock);
+  if (last) {
+    g_mutex_clear(&b->lock);
+    g_cond_clear(&b->cond);
+    g_clear_error(&b->err);
+    g_free(b);
+  }
+}
+
+// run items until there are none left or an error has occurred
+static void batch_run_items(struct batch *b) {
+  g_mutex_lock(&b->lock);
+  while (b->next < b->count && !b->err) {
+    if (b->cancel && g_atomic_int_get(b->cancel)) {
+      g_set_error(&b->err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_CANCELLED,
+                  "Read cancelled");
+      break;
+    }
+    int64_t i = b->next++;
+    b->running++;
+    g_mutex_unlock(&b->lock);
+
+    GError *tmp_err = NULL;
+    bool ok = b->fn(i, b->arg, &tmp_err);
+    if (b->read) {
+      // the read may end once the item is done
+      _openslide_read_stats_merge();
+    }
+
+    g_mutex_lock(&b->lock);
+    if (!ok) {
+      if (!b->err) {
+        b->err = tmp_err;
+      } else {
+        g_clear_error(&tmp_err);
+      }
+    }
+    if (--b->running == 0) {
+      g_cond_broadcast(&b->cond);
+    }
+  }
+  g_mutex_unlock(&b->lock);
+}
+
+static void batch_helper(void *data) {
+  struct batch *b = data;
+  if (b->read) {
+    _openslide_read_stats_set_current(b->read);
+  }
+  gint *prev_cancel = g_private_get(&cancel_flag);
+  g_private_set(&cancel_flag, b->cancel);
+  batch_run_items(b);
+  g_private_set(&cancel_flag, prev_cancel);
+  if (b->read) {
+    _openslide_read_stats_set_current(NULL);
+  }
+  batch_unref(b);
+}
+
+bool _openslide_worker_run_batch(int64_t count,
+                                 _openslide_worker_batch_fn fn,
+                                 void *arg,
+                                 GError **err) {
+  if (count <= 0) {
+    return true;
+  }
+  int32_t threads;
+  if (count == 1 || !get_pool(&threads)) {
+    // no point in involving the pool
+    for (int64_t i = 0; i < count; i++) {
+      if (!fn(i, arg, err)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  struct batch *b = g_new0(struct batch, 1);
+  g_mutex_init(&b->lock);
+  g_cond_init(&b->cond);
+  b->fn = fn;
+  b->arg = arg;
+  b->count = count;
+  b->refcount = 1;
+  b->read = _openslide_read_stats_get_current();
+  b->cancel = g_private_get(&cancel_flag);
+
+  // the calling thread is one of the workers
+  int64_t helpers = MIN(count - 1, (int64_t) threads);
+  g_mutex_lock(&b->lock);
+  b->refcount += helpers;
+  g_mutex_unlock(&b->lock);
+  for (int64_t i = 0; i < helpers; i++) {
+    _openslide_worker_submit(batch_helper, b);
+  }
+
+  batch_run_items(b);
+
+  // wait for items still running in helpers
+  g_mutex_lock(&b->lock);
+  while (b->running) {
+    g_cond_wait(&b->cond, &b->lock);
+  }
+  GError *tmp_err = g_steal_pointer(&b->err);
+  // stop helpers that haven't started yet
+  b->next = b->count;
+  g_mutex_unlock(&b->lock);
+  batch_unref(b);
+
+  if (tmp_err) {
+    g_propagate_error(err, tmp_err);
+    return false;
+  }
+  return true;
+}
+
+void _openslide_worker_set_cancel_flag(gint *flag) {
+  g_private_set(&cancel_flag, flag);
+}
+
+bool _openslide_worker_check_cancelled(GError **err) {
+  gint *flag = g_private_get(&cancel_flag);
+  if (flag && g_atomic_int_get(flag)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_CANCELLED,
+                "Read cancelled");
+    return false;
+  }
+  return true;
+}
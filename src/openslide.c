@@ -23,10 +23,12 @@
 #include <config.h>
 
 #include "openslide-private.h"
+#include "openslide-decode-tiff.h"
 #include "openslide-decode-tifflike.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <glib.h>
 #include <glib-object.h>
@@ -39,6 +41,11 @@ const char _openslide_release_info[] = "OpenSlide " SUFFIXED_VERSION ", copyrigh
 
 static const char * const EMPTY_STRING_ARRAY[] = { NULL };
 
+// the tissue mask's longest side, in pixels
+static const int64_t TISSUE_MASK_MAX_SIZE = 2048;
+// how far a channel must differ from the background to be tissue
+static const int32_t TISSUE_THRESHOLD = 24;
+
 static const struct _openslide_format *formats[] = {
   &_openslide_format_synthetic,
   &_openslide_format_mirax,
@@ -59,12 +66,16 @@ static const struct _openslide_format *formats[] = {
 
 static bool openslide_was_dynamically_loaded;
 
+static gint lazy_properties;
+
 // called from shared-library constructor!
 static void __attribute__((constructor)) _openslide_init(void) {
   // init libxml2
   xmlInitParser();
   // parse debug options
   _openslide_debug_init();
+  // start tracing, if requested
+  _openslide_trace_init();
   openslide_was_dynamically_loaded = true;
 }
 
@@ -74,6 +85,21 @@ static void destroy_associated_image(gpointer data) {
   img->ops->destroy(img);
 }
 
+struct _openslide_tissue_mask {
+  int64_t w;
+  int64_t h;
+  double scale_x;  // level 0 pixels per mask pixel
+  double scale_y;
+  uint8_t *pixels;  // nonzero for tissue
+};
+
+static void tissue_mask_free(struct _openslide_tissue_mask *mask) {
+  if (mask) {
+    g_free(mask->pixels);
+    g_free(mask);
+  }
+}
+
 static bool level_in_range(openslide_t *osr, int32_t level) {
   if (level < 0) {
     return false;
@@ -119,17 +145,38 @@ static void *verify_pixman_works(void *arg G_GNUC_UNUSED) {
   return GINT_TO_POINTER(dest[8 * 16 + 8] != 0);
 }
 
+static void read_probe_header(const char *filename,
+                              struct _openslide_probe *probe) {
+  g_autoptr(_openslide_file) f = _openslide_fopen(filename, NULL);
+  if (f) {
+    probe->header_len = _openslide_fread(f, probe->header,
+                                         sizeof(probe->header), NULL);
+  }
+}
+
 static const struct _openslide_format *detect_format(const char *filename,
-                                                     struct _openslide_tifflike **tl_OUT) {
+                                                     struct _openslide_tifflike **tl_OUT,
+                                                     struct _openslide_probe *probe) {
   GError *tmp_err = NULL;
 
-  g_autoptr(_openslide_tifflike) tl =
-    _openslide_tifflike_create(filename, &tmp_err);
-  if (!tl) {
+  // read the start of the file once, for formats with a signature
+  read_probe_header(filename, probe);
+
+  g_autoptr(_openslide_tifflike) tl = NULL;
+  if (probe->header_len >= 2 &&
+      memcmp(probe->header, "II", 2) && memcmp(probe->header, "MM", 2)) {
+    // not a TIFF; don't bother opening it again
     if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
-      g_message("tifflike: %s", tmp_err->message);
+      g_message("tifflike: Unrecognized TIFF magic number");
+    }
+  } else {
+    tl = _openslide_tifflike_create(filename, &tmp_err);
+    if (!tl) {
+      if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
+        g_message("tifflike: %s", tmp_err->message);
+      }
+      g_clear_error(&tmp_err);
     }
-    g_clear_error(&tmp_err);
   }
 
   for (const struct _openslide_format **cur = formats; *cur; cur++) {
@@ -138,7 +185,7 @@ static const struct _openslide_format *detect_format(const char *filename,
     g_assert(format->name && format->vendor &&
              format->detect && format->open);
 
-    if (format->detect(filename, tl, &tmp_err)) {
+    if (format->detect(filename, tl, probe, &tmp_err)) {
       // success!
       if (tl_OUT) {
         *tl_OUT = g_steal_pointer(&tl);
@@ -151,6 +198,7 @@ static const struct _openslide_format *detect_format(const char *filename,
       g_message("%s: %s", format->name, tmp_err->message);
     }
     g_clear_error(&tmp_err);
+    _openslide_probe_clear(probe);
   }
 
   // no match
@@ -161,9 +209,10 @@ static bool open_backend(openslide_t *osr,
                          const struct _openslide_format *format,
                          const char *filename,
                          struct _openslide_tifflike *tl,
+                         struct _openslide_probe *probe,
                          struct _openslide_hash *quickhash1,
                          GError **err) {
-  if (!format->open(osr, filename, tl, quickhash1, err)) {
+  if (!format->open(osr, filename, tl, probe, quickhash1, err)) {
     if (err && !*err) {
       // error-handling bug in open function
       g_warning("%s opener failed without setting error", format->name);
@@ -184,7 +233,9 @@ static bool open_backend(openslide_t *osr,
 const char *openslide_detect_vendor(const char *filename) {
   g_assert(openslide_was_dynamically_loaded);
 
-  const struct _openslide_format *format = detect_format(filename, NULL);
+  g_auto(_openslide_probe) probe = {0};
+  const struct _openslide_format *format = detect_format(filename, NULL,
+                                                         &probe);
   if (!format) {
     return NULL;
   }
@@ -203,12 +254,118 @@ static const char **strv_from_hashtable_keys(GHashTable *h) {
   return result;
 }
 
+static struct _openslide_associated_image *
+lookup_associated_image(openslide_t *osr, const char *name) {
+  g_mutex_lock(&osr->associated_lock);
+  struct _openslide_associated_image *img =
+    lookup_associated_image(osr, name);
+  g_mutex_unlock(&osr->associated_lock);
+  return img;
+}
+
+// remove an image whose deferred dimensions couldn't be read, so it
+// doesn't put the whole handle in error
+static void drop_associated_image(openslide_t *osr,
+                                  struct _openslide_associated_image *img) {
+  g_mutex_lock(&osr->associated_lock);
+  GHashTableIter iter;
+  char *name;
+  void *value;
+  g_hash_table_iter_init(&iter, osr->associated_images);
+  while (g_hash_table_iter_next(&iter, (void *) &name, &value)) {
+    if (value == img) {
+      g_hash_table_iter_steal(&iter);
+      g_ptr_array_add(osr->dropped_associated_names, name);
+      g_ptr_array_add(osr->dropped_associated_images, img);
+      break;
+    }
+  }
+  g_ptr_array_add(osr->dropped_associated_names,
+                  osr->associated_image_names);
+  osr->associated_image_names =
+    strv_from_hashtable_keys(osr->associated_images);
+  g_mutex_unlock(&osr->associated_lock);
+}
+
+// read deferred associated image dimensions; false if they're unavailable
+static bool ensure_associated_image_dimensions(openslide_t *osr,
+                                               struct _openslide_associated_image *img) {
+  if (img->ops->read_dimensions &&
+      g_once_init_enter(&img->dimensions_ready)) {
+    g_autoptr(GError) tmp_err = NULL;
+    if (!img->ops->read_dimensions(img, &tmp_err)) {
+      g_warning("%s", tmp_err->message);
+      img->w = -1;
+      img->h = -1;
+      drop_associated_image(osr, img);
+    }
+    g_once_init_leave(&img->dimensions_ready, 1);
+  }
+  return img->w >= 0 && img->h >= 0;
+}
+
+static void finish_properties(openslide_t *osr) {
+  // set associated image properties
+  g_mutex_lock(&osr->associated_lock);
+  const char **names = osr->associated_image_names;
+  g_mutex_unlock(&osr->associated_lock);
+  for (const char **name = names; *name != NULL; name++) {
+    struct _openslide_associated_image *img =
+      lookup_associated_image(osr, *name);
+    if (!img || !ensure_associated_image_dimensions(osr, img)) {
+      continue;
+    }
+    g_hash_table_insert(osr->properties,
+			g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_WIDTH, *name),
+			g_strdup_printf("%"PRId64, img->w));
+    g_hash_table_insert(osr->properties,
+			g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_HEIGHT, *name),
+			g_strdup_printf("%"PRId64, img->h));
+    if (img->icc_profile_size) {
+      g_hash_table_insert(osr->properties,
+                          g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_ICC_SIZE, *name),
+                          g_strdup_printf("%"PRId64, img->icc_profile_size));
+    }
+  }
+
+  // ensure NULL values don't leak into properties
+  GHashTableIter iter;
+  char *name;
+  char *value;
+  g_hash_table_iter_init(&iter, osr->properties);
+  while (g_hash_table_iter_next(&iter, (void *) &name, (void *) &value)) {
+    if (!value) {
+      g_warning("Property \"%s\" has NULL value", name);
+      g_hash_table_iter_remove(&iter);
+    }
+  }
+
+  // fill in property names
+  osr->property_names = strv_from_hashtable_keys(osr->properties);
+}
+
+// add deferred vendor properties; returns false if the handle is in error
+static bool ensure_properties(openslide_t *osr) {
+  if (g_once_init_enter(&osr->properties_loaded)) {
+    GError *tmp_err = NULL;
+    if (osr->ops->load_properties &&
+        !osr->ops->load_properties(osr, &tmp_err)) {
+      _openslide_propagate_error(osr, tmp_err);
+    }
+    finish_properties(osr);
+    g_once_init_leave(&osr->properties_loaded, 1);
+  }
+  return !openslide_get_error(osr);
+}
+
 openslide_t *openslide_open(const char *filename) {
   g_assert(openslide_was_dynamically_loaded);
 
   // detect format
   g_autoptr(_openslide_tifflike) tl = NULL;
-  const struct _openslide_format *format = detect_format(filename, &tl);
+  g_auto(_openslide_probe) probe = {0};
+  const struct _openslide_format *format = detect_format(filename, &tl,
+                                                         &probe);
   if (!format) {
     // not a slide file
     return NULL;
@@ -216,6 +373,15 @@ openslide_t *openslide_open(const char *filename) {
 
   // alloc memory
   g_autoptr(openslide_t) osr = g_new0(openslide_t, 1);
+  g_mutex_init(&osr->async_lock);
+  g_cond_init(&osr->async_cond);
+  g_mutex_init(&osr->read_ahead_lock);
+  g_mutex_init(&osr->tissue_lock);
+  g_mutex_init(&osr->color_lock);
+  g_mutex_init(&osr->associated_lock);
+  osr->dropped_associated_images =
+    g_ptr_array_new_with_free_func(destroy_associated_image);
+  osr->dropped_associated_names = g_ptr_array_new_with_free_func(g_free);
   osr->properties = g_hash_table_new_full(g_str_hash, g_str_equal,
                                           g_free, g_free);
   osr->associated_images = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -236,7 +402,8 @@ openslide_t *openslide_open(const char *filename) {
   // open backend
   g_autoptr(_openslide_hash) quickhash1 = _openslide_hash_quickhash1_create();
   GError *tmp_err = NULL;
-  if (!open_backend(osr, format, filename, tl, quickhash1, &tmp_err)) {
+  if (!open_backend(osr, format, filename, tl, &probe, quickhash1,
+                    &tmp_err)) {
     // failed to read slide
     _openslide_propagate_error(osr, tmp_err);
     return g_steal_pointer(&osr);
@@ -270,6 +437,9 @@ openslide_t *openslide_open(const char *filename) {
     }
   }
 
+  // fill gaps in the pyramid, if requested
+  _openslide_virtual_levels_add(osr);
+
   // set hash property
   const char *hash_str = _openslide_hash_get_string(quickhash1);
   if (hash_str != NULL) {
@@ -322,49 +492,43 @@ openslide_t *openslide_open(const char *filename) {
     }
   }
 
-  // fill in associated image names and set properties
+  // fill in associated image names
   osr->associated_image_names = strv_from_hashtable_keys(osr->associated_images);
-  for (const char **name = osr->associated_image_names; *name != NULL; name++) {
-    struct _openslide_associated_image *img =
-      g_hash_table_lookup(osr->associated_images, *name);
-    g_hash_table_insert(osr->properties,
-			g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_WIDTH, *name),
-			g_strdup_printf("%"PRId64, img->w));
-    g_hash_table_insert(osr->properties,
-			g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_HEIGHT, *name),
-			g_strdup_printf("%"PRId64, img->h));
-    if (img->icc_profile_size) {
-      g_hash_table_insert(osr->properties,
-                          g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_ASSOCIATED_ICC_SIZE, *name),
-                          g_strdup_printf("%"PRId64, img->icc_profile_size));
-    }
-  }
 
-  // ensure NULL values don't leak into properties
-  GHashTableIter iter;
-  char *name;
-  char *value;
-  g_hash_table_iter_init(&iter, osr->properties);
-  while (g_hash_table_iter_next(&iter, (void *) &name, (void *) &value)) {
-    if (!value) {
-      g_warning("Property \"%s\" has NULL value", name);
-      g_hash_table_iter_remove(&iter);
-    }
+  // fill in properties now, unless they can wait until they're needed
+  if (_openslide_lazy_properties()) {
+    osr->properties_deferred = true;
+  }
+  if (!osr->properties_deferred) {
+    finish_properties(osr);
+    osr->properties_loaded = 1;
   }
-
-  // fill in property names
-  osr->property_names = strv_from_hashtable_keys(osr->properties);
 
   // start cache if the backend hasn't already done it
   if (!osr->cache) {
     osr->cache = _openslide_cache_binding_create(DEFAULT_CACHE_SIZE);
   }
+  if (hash_str != NULL) {
+    int32_t stable_count;
+    struct _openslide_level **stable_levels =
+      _openslide_virtual_levels_get_stable(osr, &stable_count);
+    _openslide_cache_binding_set_identity(osr->cache, hash_str,
+                                          stable_levels, stable_count);
+  }
 
   return g_steal_pointer(&osr);
 }
 
 
 void openslide_close(openslide_t *osr) {
+  // drop pending prefetches and wait for asynchronous reads
+  g_atomic_int_set(&osr->prefetch_cancelled, 1);
+  g_mutex_lock(&osr->async_lock);
+  while (osr->async_pending) {
+    g_cond_wait(&osr->async_cond, &osr->async_lock);
+  }
+  g_mutex_unlock(&osr->async_lock);
+
   if (osr->ops) {
     (osr->ops->destroy)(osr);
   }
@@ -374,6 +538,9 @@ void openslide_close(openslide_t *osr) {
 
   g_free(osr->associated_image_names);
   g_free(osr->property_names);
+  g_ptr_array_unref(osr->dropped_associated_images);
+  g_ptr_array_unref(osr->dropped_associated_names);
+  g_mutex_clear(&osr->associated_lock);
 
   if (osr->cache) {
     _openslide_cache_binding_destroy(osr->cache);
@@ -381,6 +548,16 @@ void openslide_close(openslide_t *osr) {
 
   g_free(g_atomic_pointer_get(&osr->error));
 
+  g_mutex_clear(&osr->async_lock);
+  g_cond_clear(&osr->async_cond);
+  g_mutex_clear(&osr->read_ahead_lock);
+  tissue_mask_free(osr->tissue_mask);
+  g_mutex_clear(&osr->tissue_lock);
+  if (osr->color_transform) {
+    _openslide_color_transform_free(osr->color_transform);
+  }
+  g_free(osr->color_planes);
+  g_mutex_clear(&osr->color_lock);
   g_free(osr);
 }
 
@@ -449,12 +626,19 @@ double openslide_get_level_downsample(openslide_t *osr, int32_t level) {
 }
 
 
-static bool read_region_area(openslide_t *osr,
-                             uint32_t *dest, int64_t stride,
-                             int64_t x, int64_t y,
-                             int32_t level,
-                             int64_t w, int64_t h,
-                             GError **err) {
+static struct _openslide_level *get_level(openslide_t *osr, int32_t level) {
+  return level_in_range(osr, level) ? osr->levels[level] : NULL;
+}
+
+// l may be NULL, for a level out of range.  dest starts fx, fy level
+// pixels right of and below x, y; the fractions are less than 1.
+static bool paint_area(openslide_t *osr,
+                       uint32_t *dest, int64_t stride,
+                       int64_t x, int64_t y,
+                       double fx, double fy,
+                       struct _openslide_level *l,
+                       int64_t w, int64_t h,
+                       GError **err) {
   // create the cairo surface for the dest
   g_autoptr(cairo_surface_t) surface = NULL;
   if (dest) {
@@ -473,9 +657,7 @@ static bool read_region_area(openslide_t *osr,
   // saturate those seams away!
   cairo_set_operator(cr, CAIRO_OPERATOR_SATURATE);
 
-  if (level_in_range(osr, level)) {
-    struct _openslide_level *l = osr->levels[level];
-
+  if (l) {
     // offset if given negative coordinates
     double ds = l->downsample;
     int64_t tx = 0;
@@ -490,11 +672,12 @@ static bool read_region_area(openslide_t *osr,
       y = 0;
       h -= ty;
     }
-    cairo_translate(cr, tx, ty);
+    cairo_translate(cr, tx - fx, ty - fy);
 
-    // paint
+    // paint, covering the far edges if shifted
     if (w > 0 && h > 0) {
-      if (!osr->ops->paint_region(osr, cr, x, y, l, w, h, err)) {
+      if (!osr->ops->paint_region(osr, cr, x, y, l,
+                                  w + (fx > 0), h + (fy > 0), err)) {
         return false;
       }
     }
@@ -508,149 +691,1669 @@ static bool read_region_area(openslide_t *osr,
   return true;
 }
 
-void openslide_read_region(openslide_t *osr,
-			   uint32_t *dest,
-			   int64_t x, int64_t y,
-			   int32_t level,
-			   int64_t w, int64_t h) {
-  if (w < 0 || h < 0) {
-    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                                  "negative width (%"PRId64") "
-                                  "or negative height (%"PRId64") "
-                                  "not allowed", w, h);
-    _openslide_propagate_error(osr, tmp_err);
+// l may be NULL, for a level out of range
+static bool read_region_area(openslide_t *osr,
+                             uint32_t *dest, int64_t stride,
+                             int64_t x, int64_t y,
+                             struct _openslide_level *l,
+                             int64_t w, int64_t h,
+                             GError **err) {
+  return paint_area(osr, dest, stride, x, y, 0, 0, l, w, h, err);
+}
+
+static void clear_dest(void *dest, int64_t stride,
+                       openslide_pixel_format_t format,
+                       int64_t w, int64_t h) {
+  int64_t row_bytes = w * _openslide_pixel_format_bytes(format);
+  if (stride == row_bytes) {
+    memset(dest, 0, row_bytes * h);
     return;
   }
+  for (int64_t row = 0; row < h; row++) {
+    memset((uint8_t *) dest + row * stride, 0, row_bytes);
+  }
+}
 
-  // clear the dest
-  if (dest) {
-    memset(dest, 0, w * h * 4);
+// the conversion to sRGB, or NULL if color management is off
+static const struct _openslide_color_transform *
+get_color_transform(openslide_t *osr) {
+  if (!g_atomic_int_get(&osr->color_managed)) {
+    return NULL;
   }
+  return osr->color_transform;
+}
 
-  // now that it's cleared, return if an error occurred
-  if (openslide_get_error(osr)) {
+// convert ARGB dest to sRGB if color management is on
+static void convert_color(openslide_t *osr, uint32_t *dest, int64_t stride,
+                          int64_t w, int64_t h) {
+  const struct _openslide_color_transform *ct = get_color_transform(osr);
+  if (!ct || !dest) {
     return;
   }
+  for (int64_t row = 0; row < h; row++) {
+    _openslide_color_transform_apply(ct, (uint32_t *) ((uint8_t *) dest +
+                                                       row * stride), w);
+  }
+}
+
+// Get a tile from the backend, converted to sRGB if color management is
+// on.  Converted tiles are cached in their own planes, so each tile is
+// converted once.
+static const uint32_t *get_tile(openslide_t *osr, int32_t level,
+                                int64_t col, int64_t row,
+                                struct _openslide_cache_entry **entry,
+                                GError **err) {
+  struct _openslide_level *l = osr->levels[level];
+  const struct _openslide_color_transform *ct = get_color_transform(osr);
+  if (!ct) {
+    return osr->ops->get_tile(osr, l, col, row, entry, err);
+  }
+
+  void *plane = &osr->color_planes[level];
+  uint32_t *tiledata = _openslide_cache_get(osr->cache, plane, col, row,
+                                            entry);
+  if (tiledata) {
+    return tiledata;
+  }
+  g_autoptr(_openslide_cache_entry) src_entry = NULL;
+  const uint32_t *src = osr->ops->get_tile(osr, l, col, row, &src_entry,
+                                           err);
+  if (!src) {
+    // missing tile or error
+    return NULL;
+  }
+  uint64_t size = l->tile_w * l->tile_h * 4;
+  tiledata = _openslide_cache_alloc(osr->cache, size);
+  memcpy(tiledata, src, size);
+  _openslide_color_transform_apply(ct, tiledata, l->tile_w * l->tile_h);
+  _openslide_cache_put(osr->cache, plane, col, row, tiledata, size, entry);
+  return tiledata;
+}
+
+// Copy tiles straight from the backend into dest, bypassing cairo, if the
+// region is on an integer pixel offset of a level whose tiles can be
+// copied.  Every pixel of dest is written.
+static bool read_region_direct(openslide_t *osr,
+                               void *dest, int64_t stride,
+                               openslide_pixel_format_t format,
+                               int64_t x, int64_t y,
+                               int32_t level,
+                               int64_t w, int64_t h,
+                               bool *handled,
+                               GError **err) {
+  *handled = false;
+  if (!dest || !osr->ops->get_tile || !level_in_range(osr, level) ||
+      x < 0 || y < 0 || _openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    return true;
+  }
+  struct _openslide_level *l = osr->levels[level];
+  int64_t tw = l->tile_w;
+  int64_t th = l->tile_h;
+  double lx = x / l->downsample;
+  double ly = y / l->downsample;
+  if (tw <= 0 || th <= 0 || lx != floor(lx) || ly != floor(ly)) {
+    return true;
+  }
+  *handled = true;
+
+  int64_t bpp = _openslide_pixel_format_bytes(format);
+  int64_t ix = lx;
+  int64_t iy = ly;
+  for (int64_t row = iy / th; row * th < iy + h; row++) {
+    int64_t y0 = MAX(row * th, iy);
+    int64_t y1 = MIN((row + 1) * th, iy + h);
+    for (int64_t col = ix / tw; col * tw < ix + w; col++) {
+      int64_t x0 = MAX(col * tw, ix);
+      int64_t x1 = MIN((col + 1) * tw, ix + w);
+
+      g_autoptr(_openslide_cache_entry) entry = NULL;
+      const uint32_t *tiledata = NULL;
+      if (row * th < l->h && col * tw < l->w) {
+        if (!_openslide_worker_check_cancelled(err)) {
+          return false;
+        }
+        GError *tmp_err = NULL;
+        tiledata = get_tile(osr, level, col, row, &entry, &tmp_err);
+        if (tmp_err) {
+          g_propagate_error(err, tmp_err);
+          return false;
+        }
+      }
+
+      // convert while copying; there's no intermediate ARGB buffer
+      for (int64_t yy = y0; yy < y1; yy++) {
+        uint8_t *p = (uint8_t *) dest + (yy - iy) * stride + (x0 - ix) * bpp;
+        if (tiledata) {
+          _openslide_convert_pixels(tiledata + (yy - row * th) * tw +
+                                    (x0 - col * tw),
+                                    p, x1 - x0, format);
+        } else {
+          memset(p, 0, (x1 - x0) * bpp);
+        }
+      }
+    }
+  }
+  return true;
+}
 
+// ARGB only.  dest, if not NULL, must already be cleared.  l may be NULL.
+// dest holds the part of the region at x, y that starts ox, oy pixels
+// into it in the level plane.
+static bool read_region_cairo(openslide_t *osr,
+                              uint32_t *dest, int64_t stride,
+                              int64_t x, int64_t y,
+                              struct _openslide_level *l,
+                              int64_t ox, int64_t oy,
+                              int64_t w, int64_t h,
+                              GError **err) {
   // Break the work into smaller pieces if the region is large, because:
   // 1. Cairo will not allow surfaces larger than 32767 pixels on a side.
   // 2. cairo_image_surface_create_for_data() creates a surface backed by a
   //    pixman_image_t, and Pixman requires that every byte of that image
   //    be addressable in 31 bits.
   const int64_t d = 4096;
-  double ds = openslide_get_level_downsample(osr, level);
+  double ds = l ? l->downsample : 1;
   for (int64_t row = 0; row < (h + d - 1) / d; row++) {
     for (int64_t col = 0; col < (w + d - 1) / d; col++) {
-      // calculate surface coordinates and size
-      int64_t sx = x + col * d * ds;     // level 0 plane
-      int64_t sy = y + row * d * ds;     // level 0 plane
+      // calculate surface coordinates and size.  with a non-integer
+      // downsample, the piece's origin is rounded down to the level 0
+      // plane and the remainder is painted as a fractional offset.
+      double px = (ox + col * d) * ds;   // level 0 plane, from x
+      double py = (oy + row * d) * ds;   // level 0 plane, from y
+      int64_t sx = x + (int64_t) floor(px);
+      int64_t sy = y + (int64_t) floor(py);
+      double fx = (px - floor(px)) / ds;  // level plane
+      double fy = (py - floor(py)) / ds;  // level plane
       int64_t sw = MIN(w - col * d, d);  // level plane
       int64_t sh = MIN(h - row * d, d);  // level plane
 
       // paint
-      GError *tmp_err = NULL;
-      if (!read_region_area(osr,
-                            dest ? dest + w * row * d + col * d : NULL, w * 4,
-                            sx, sy, level, sw, sh,
-                            &tmp_err)) {
-        _openslide_propagate_error(osr, tmp_err);
-        if (dest) {
-          // ensure we don't return a partial result
-          memset(dest, 0, w * h * 4);
-        }
-        return;
+      uint32_t *sdest = NULL;
+      if (dest) {
+        sdest = (uint32_t *) ((uint8_t *) dest + stride * row * d) + col * d;
+      }
+      if (!paint_area(osr, sdest, stride,
+                      sx, sy, fx, fy, l, sw, sh,
+                      err)) {
+        return false;
       }
     }
   }
+  return true;
 }
 
-const char * const *openslide_get_property_names(openslide_t *osr) {
-  if (openslide_get_error(osr)) {
-    return EMPTY_STRING_ARRAY;
+// clears dest before painting.  stride is in bytes.
+static bool read_region(openslide_t *osr,
+                        void *dest, int64_t stride,
+                        openslide_pixel_format_t format,
+                        int64_t x, int64_t y,
+                        int32_t level,
+                        int64_t w, int64_t h,
+                        GError **err) {
+  bool handled;
+  if (!read_region_direct(osr, dest, stride, format, x, y, level, w, h,
+                          &handled, err)) {
+    return false;
+  }
+  if (handled) {
+    return true;
   }
 
-  return osr->property_names;
-}
-
-const char *openslide_get_property_value(openslide_t *osr, const char *name) {
-  if (openslide_get_error(osr)) {
-    return NULL;
+  if (!dest || format == OPENSLIDE_PIXEL_FORMAT_ARGB) {
+    if (dest) {
+      clear_dest(dest, stride, format, w, h);
+    }
+    if (!read_region_cairo(osr, dest, stride, x, y, get_level(osr, level),
+                           0, 0, w, h, err)) {
+      return false;
+    }
+    convert_color(osr, dest, stride, w, h);
+    return true;
   }
 
-  return g_hash_table_lookup(osr->properties, name);
+  // composite ARGB in bands of rows, then convert
+  const int64_t band_pixels = 4 << 20;
+  int64_t band_h = CLAMP(band_pixels / MAX(w, 1), 1, h);
+  g_autofree uint32_t *band = g_try_malloc(w * band_h * 4);
+  if (w && h && !band) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't allocate %"PRId64"x%"PRId64" band", w, band_h);
+    return false;
+  }
+  for (int64_t row = 0; row < h; row += band_h) {
+    int64_t rows = MIN(band_h, h - row);
+    memset(band, 0, w * rows * 4);
+    if (!read_region_cairo(osr, band, w * 4, x, y, get_level(osr, level),
+                           0, row, w, rows, err)) {
+      return false;
+    }
+    convert_color(osr, band, w * 4, w, rows);
+    for (int64_t r = 0; r < rows; r++) {
+      _openslide_convert_pixels(band + r * w,
+                                (uint8_t *) dest + (row + r) * stride,
+                                w, format);
+    }
+  }
+  return true;
 }
 
-int64_t openslide_get_icc_profile_size(openslide_t *osr) {
-  if (openslide_get_error(osr)) {
-    return -1;
-  }
+// one tile of the level's tile geometry, for batched reads
+struct batch_tile {
+  int32_t level;
+  int64_t col;
+  int64_t row;
+};
 
-  return osr->icc_profile_size;
-}
+struct batch_read {
+  openslide_t *osr;
+  const openslide_region_t *regions;
+  struct batch_tile *tiles;
+};
 
-void openslide_read_icc_profile(openslide_t *osr, void *dest) {
-  if (openslide_get_error(osr)) {
-    memset(dest, 0, osr->icc_profile_size);
-    return;
+static int cmp_batch_tile(const void *a, const void *b) {
+  const struct batch_tile *ta = a;
+  const struct batch_tile *tb = b;
+  if (ta->level != tb->level) {
+    return ta->level < tb->level ? -1 : 1;
   }
-  if (!osr->icc_profile_size) {
-    return;
+  if (ta->row != tb->row) {
+    return ta->row < tb->row ? -1 : 1;
   }
-  g_assert(osr->ops->read_icc_profile);
-
-  GError *tmp_err = NULL;
-  if (!osr->ops->read_icc_profile(osr, dest, &tmp_err)) {
-    _openslide_propagate_error(osr, tmp_err);
-    memset(dest, 0, osr->icc_profile_size);
+  if (ta->col != tb->col) {
+    return ta->col < tb->col ? -1 : 1;
   }
+  return 0;
 }
 
-const char * const *openslide_get_associated_image_names(openslide_t *osr) {
-  if (openslide_get_error(osr)) {
-    return EMPTY_STRING_ARRAY;
+// Collect the unique tiles covered by the regions, in levels that report
+// their tile geometry.  Returns the number of tiles, or 0 if prefetching
+// tiles individually isn't useful.
+static int64_t collect_batch_tiles(openslide_t *osr,
+                                   const openslide_region_t *regions,
+                                   int32_t count,
+                                   struct batch_tile **tiles_OUT) {
+  g_autoptr(GArray) tiles = g_array_new(false, false,
+                                        sizeof(struct batch_tile));
+  uint64_t bytes = 0;
+  for (int32_t i = 0; i < count; i++) {
+    const openslide_region_t *r = &regions[i];
+    if (!level_in_range(osr, r->level) || !r->w || !r->h) {
+      continue;
+    }
+    struct _openslide_level *l = osr->levels[r->level];
+    if (l->tile_w <= 0 || l->tile_h <= 0) {
+      continue;
+    }
+    double lx = r->x / l->downsample;
+    double ly = r->y / l->downsample;
+    int64_t start_col = MAX(floor(lx / l->tile_w), 0);
+    int64_t start_row = MAX(floor(ly / l->tile_h), 0);
+    int64_t end_col = MIN(ceil((lx + r->w) / l->tile_w),
+                          (l->w + l->tile_w - 1) / l->tile_w);
+    int64_t end_row = MIN(ceil((ly + r->h) / l->tile_h),
+                          (l->h + l->tile_h - 1) / l->tile_h);
+    for (int64_t row = start_row; row < end_row; row++) {
+      for (int64_t col = start_col; col < end_col; col++) {
+        struct batch_tile tile = {
+          .level = r->level,
+          .col = col,
+          .row = row,
+        };
+        g_array_append_val(tiles, tile);
+        bytes += l->tile_w * l->tile_h * 4;
+      }
+    }
+  }
+  if (tiles->len < 2) {
+    return 0;
+  }
+  // skip the prefetch if the tiles might evict each other before the
+  // regions are composited; an overestimate, since tiles may repeat
+  if (bytes > _openslide_cache_binding_get_capacity(osr->cache) / 2) {
+    return 0;
   }
 
-  return osr->associated_image_names;
-}
+  // uniquify
+  qsort(tiles->data, tiles->len, sizeof(struct batch_tile), cmp_batch_tile);
+  struct batch_tile *arr = (struct batch_tile *) tiles->data;
+  guint unique = 1;
+  for (guint i = 1; i < tiles->len; i++) {
+    if (cmp_batch_tile(&arr[unique - 1], &arr[i])) {
+      arr[unique++] = arr[i];
+    }
+  }
+  g_array_set_size(tiles, unique);
 
-void openslide_get_associated_image_dimensions(openslide_t *osr, const char *name,
-					       int64_t *w, int64_t *h) {
-  *w = -1;
-  *h = -1;
+  *tiles_OUT = (struct batch_tile *) g_array_free(g_steal_pointer(&tiles),
+                                                  false);
+  return unique;
+}
 
-  if (openslide_get_error(osr)) {
+// let the backend fetch the compressed data of the uncached tiles with a
+// few large reads
+static void prefetch_batch_tile_data(openslide_t *osr,
+                                     const struct batch_tile *tiles,
+                                     int64_t count) {
+  if (!osr->ops->prefetch_tile_data || count < 2) {
     return;
   }
-
-  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
-								name);
-  if (img) {
-    *w = img->w;
-    *h = img->h;
+  g_autofree struct _openslide_tile_position *positions =
+    g_new(struct _openslide_tile_position, count);
+  int64_t start = 0;
+  while (start < count) {
+    int32_t level = tiles[start].level;
+    struct _openslide_level *l = osr->levels[level];
+    int64_t missing = 0;
+    int64_t i;
+    for (i = start; i < count && tiles[i].level == level; i++) {
+      if (!_openslide_cache_contains(osr->cache, l, tiles[i].col,
+                                     tiles[i].row)) {
+        positions[missing++] = (struct _openslide_tile_position) {
+          .col = tiles[i].col,
+          .row = tiles[i].row,
+        };
+      }
+    }
+    if (missing > 1) {
+      osr->ops->prefetch_tile_data(osr, l, positions, missing);
+    }
+    start = i;
   }
 }
 
-void openslide_read_associated_image(openslide_t *osr,
-				     const char *name,
-				     uint32_t *dest) {
-  struct _openslide_associated_image *img =
-    g_hash_table_lookup(osr->associated_images, name);
-  if (!img) {
+// decode one tile into the cache, painting to a nil surface
+static bool batch_prefetch_tile(int64_t item, void *arg, GError **err) {
+  struct batch_read *batch = arg;
+  openslide_t *osr = batch->osr;
+  struct batch_tile *tile = &batch->tiles[item];
+  struct _openslide_level *l = osr->levels[tile->level];
+
+  // round the origin up, and shrink the area by a pixel, so that
+  // rounding errors don't pull in the neighboring tiles
+  int64_t x = ceil(tile->col * l->tile_w * l->downsample);
+  int64_t y = ceil(tile->row * l->tile_h * l->downsample);
+  int64_t w = MAX(l->tile_w - 1, 1);
+  int64_t h = MAX(l->tile_h - 1, 1);
+  return read_region_area(osr, NULL, 0, x, y, l, w, h, err);
+}
+
+// Fetch the compressed data of a large region's tiles together, and decode
+// the tiles in parallel before compositing them in the usual order.  Only
+// a hint; the read itself will report any errors.
+static void prefetch_region_tiles(openslide_t *osr,
+                                  int64_t x, int64_t y,
+                                  int32_t level,
+                                  int64_t w, int64_t h) {
+  if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
     return;
   }
-  size_t pixels = img->w * img->h;
-
-  if (openslide_get_error(osr)) {
-    memset(dest, 0, pixels * sizeof(uint32_t));
+  openslide_region_t region = {
+    .x = x,
+    .y = y,
+    .level = level,
+    .w = w,
+    .h = h,
+  };
+  g_autofree struct batch_tile *tiles = NULL;
+  int64_t tile_count = collect_batch_tiles(osr, &region, 1, &tiles);
+  struct batch_read batch = {
+    .osr = osr,
+    .regions = &region,
+    .tiles = tiles,
+  };
+  prefetch_batch_tile_data(osr, tiles, tile_count);
+  if (!_openslide_worker_get_thread_count()) {
     return;
   }
+  g_autoptr(GError) tmp_err = NULL;
+  _openslide_read_stats_set_prefetching(true);
+  _openslide_worker_run_batch(tile_count, batch_prefetch_tile, &batch,
+                              &tmp_err);
+  _openslide_read_stats_set_prefetching(false);
+}
 
-  GError *tmp_err = NULL;
-  if (!img->ops->get_argb_data(img, dest, &tmp_err)) {
+static bool read_region_parallel(openslide_t *osr,
+                                 void *dest, int64_t stride,
+                                 openslide_pixel_format_t format,
+                                 int64_t x, int64_t y,
+                                 int32_t level,
+                                 int64_t w, int64_t h,
+                                 GError **err) {
+  prefetch_region_tiles(osr, x, y, level, w, h);
+  return read_region(osr, dest, stride, format, x, y, level, w, h, err);
+}
+
+static bool check_read_args(openslide_t *osr,
+                            openslide_pixel_format_t format,
+                            int64_t w, int64_t h) {
+  if (w < 0 || h < 0) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "negative width (%"PRId64") "
+                                  "or negative height (%"PRId64") "
+                                  "not allowed", w, h);
     _openslide_propagate_error(osr, tmp_err);
-    // ensure we don't return a partial result
-    memset(dest, 0, pixels * sizeof(uint32_t));
+    return false;
+  }
+  if (!_openslide_pixel_format_bytes(format)) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid pixel format %d", format);
+    _openslide_propagate_error(osr, tmp_err);
+    return false;
   }
+  return true;
+}
+
+// track background work that openslide_close() must wait for
+static void async_begin(openslide_t *osr) {
+  g_mutex_lock(&osr->async_lock);
+  osr->async_pending++;
+  g_mutex_unlock(&osr->async_lock);
+}
+
+static void async_end(openslide_t *osr) {
+  g_mutex_lock(&osr->async_lock);
+  if (--osr->async_pending == 0) {
+    g_cond_broadcast(&osr->async_cond);
+  }
+  g_mutex_unlock(&osr->async_lock);
+}
+
+struct prefetch {
+  openslide_t *osr;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+};
+
+// decode tiles into the cache, painting to a nil surface
+static void prefetch_task(void *data) {
+  struct prefetch *p = data;
+  openslide_t *osr = p->osr;
+
+  _openslide_worker_set_cancel_flag(&osr->prefetch_cancelled);
+  GError *tmp_err = NULL;
+  if (!read_region_area(osr, NULL, 0, p->x, p->y, get_level(osr, p->level),
+                        p->w, p->h, &tmp_err)) {
+    // only a hint; the real read will report the error
+    g_clear_error(&tmp_err);
+  }
+  _openslide_worker_set_cancel_flag(NULL);
+
+  g_free(p);
+  async_end(osr);
+}
+
+static void prefetch(openslide_t *osr,
+                     int64_t x, int64_t y,
+                     int32_t level,
+                     int64_t w, int64_t h) {
+  if (!_openslide_worker_get_thread_count()) {
+    // only a hint, and not worth doing on the caller's thread
+    return;
+  }
+  struct prefetch *p = g_new0(struct prefetch, 1);
+  p->osr = osr;
+  p->x = x;
+  p->y = y;
+  p->level = level;
+  p->w = w;
+  p->h = h;
+  async_begin(osr);
+  _openslide_worker_submit(prefetch_task, p);
+}
+
+// prefetch tiles of a level, rounding the origin up and shrinking the
+// area by a pixel so that rounding errors don't pull in neighboring tiles
+static void prefetch_tiles(openslide_t *osr, int32_t level,
+                           int64_t col, int64_t row,
+                           int64_t cols, int64_t rows) {
+  struct _openslide_level *l = osr->levels[level];
+  prefetch(osr,
+           ceil(col * l->tile_w * l->downsample),
+           ceil(row * l->tile_h * l->downsample),
+           level,
+           MAX(cols * l->tile_w - 1, 1),
+           MAX(rows * l->tile_h - 1, 1));
+}
+
+// Detect reads walking along a row of tiles and prefetch the next tiles
+// of the row.  Reads from several threads may arrive slightly out of
+// order, so a read continues the sequence if it starts within the
+// read-ahead window behind the furthest column read.
+static void read_ahead(openslide_t *osr,
+                       int32_t level,
+                       int64_t col_start, int64_t col_end,
+                       int64_t row_start, int64_t row_end) {
+  struct _openslide_level *l = osr->levels[level];
+  int64_t tiles_across = (l->w + l->tile_w - 1) / l->tile_w;
+
+  g_mutex_lock(&osr->read_ahead_lock);
+  int64_t n = osr->read_ahead_tiles;
+  if (!n) {
+    g_mutex_unlock(&osr->read_ahead_lock);
+    return;
+  }
+  bool sequential = level == osr->read_ahead_level &&
+                    row_start == osr->read_ahead_row_start &&
+                    row_end == osr->read_ahead_row_end &&
+                    col_start >= osr->read_ahead_col_end - n &&
+                    col_start <= osr->read_ahead_col_end;
+  if (!sequential) {
+    osr->read_ahead_level = level;
+    osr->read_ahead_row_start = row_start;
+    osr->read_ahead_row_end = row_end;
+    osr->read_ahead_col_end = col_end;
+    osr->read_ahead_prefetched = col_end;
+    g_mutex_unlock(&osr->read_ahead_lock);
+    return;
+  }
+  osr->read_ahead_col_end = MAX(osr->read_ahead_col_end, col_end);
+  // keep the window well within the cache, so the prefetched columns
+  // aren't evicted before the reads reach them
+  uint64_t column_bytes = (uint64_t) l->tile_w * l->tile_h * 4 *
+                          MAX(row_end - row_start, 1);
+  uint64_t window = _openslide_cache_binding_get_capacity(osr->cache) / 4;
+  n = MIN((uint64_t) n, window / column_bytes);
+  int64_t start = MAX(osr->read_ahead_prefetched, osr->read_ahead_col_end);
+  int64_t end = MIN(osr->read_ahead_col_end + n, tiles_across);
+  osr->read_ahead_prefetched = MAX(osr->read_ahead_prefetched, end);
+  g_mutex_unlock(&osr->read_ahead_lock);
+
+  // one task per column, so the tiles decode in parallel
+  for (int64_t col = start; col < end; col++) {
+    prefetch_tiles(osr, level, col, row_start, 1, row_end - row_start);
+  }
+}
+
+static void read_ahead_region(openslide_t *osr,
+                              int64_t x, int64_t y,
+                              int32_t level,
+                              int64_t w, int64_t h) {
+  if (!level_in_range(osr, level) || x < 0 || y < 0 || !w || !h) {
+    return;
+  }
+  struct _openslide_level *l = osr->levels[level];
+  if (l->tile_w <= 0 || l->tile_h <= 0) {
+    return;
+  }
+  double lx = x / l->downsample;
+  double ly = y / l->downsample;
+  read_ahead(osr, level,
+             floor(lx / l->tile_w), ceil((lx + w) / l->tile_w),
+             floor(ly / l->tile_h), ceil((ly + h) / l->tile_h));
+}
+
+void openslide_prefetch_region(openslide_t *osr,
+                               int64_t x, int64_t y,
+                               int32_t level,
+                               int64_t w, int64_t h) {
+  if (openslide_get_error(osr) || !level_in_range(osr, level) ||
+      w <= 0 || h <= 0) {
+    return;
+  }
+  // don't evict the tiles we're fetching
+  if ((uint64_t) w >
+      _openslide_cache_binding_get_capacity(osr->cache) / 2 / 4 / h) {
+    return;
+  }
+  prefetch(osr, x, y, level, w, h);
+}
+
+void openslide_set_read_ahead(openslide_t *osr, int32_t tiles) {
+  g_mutex_lock(&osr->read_ahead_lock);
+  osr->read_ahead_tiles = MAX(tiles, 0);
+  osr->read_ahead_level = -1;
+  g_mutex_unlock(&osr->read_ahead_lock);
+}
+
+static void read_region_format(openslide_t *osr,
+                               void *dest, int64_t stride,
+                               openslide_pixel_format_t format,
+                               int64_t x, int64_t y,
+                               int32_t level,
+                               int64_t w, int64_t h) {
+  if (!check_read_args(osr, format, w, h)) {
+    return;
+  }
+  g_autoptr(_openslide_read_record) rs = _openslide_read_stats_begin();
+
+  // clear the dest and return if an error occurred
+  if (openslide_get_error(osr)) {
+    if (dest) {
+      clear_dest(dest, stride, format, w, h);
+    }
+    return;
+  }
+
+  // start decoding the following tiles while we read these
+  read_ahead_region(osr, x, y, level, w, h);
+
+  GError *tmp_err = NULL;
+  if (!read_region_parallel(osr, dest, stride, format, x, y, level, w, h,
+                            &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    if (dest) {
+      // ensure we don't return a partial result
+      clear_dest(dest, stride, format, w, h);
+    }
+  }
+}
+
+void openslide_read_region(openslide_t *osr,
+			   uint32_t *dest,
+			   int64_t x, int64_t y,
+			   int32_t level,
+			   int64_t w, int64_t h) {
+  read_region_format(osr, dest, w * 4, OPENSLIDE_PIXEL_FORMAT_ARGB,
+                     x, y, level, w, h);
+}
+
+void openslide_read_region_format(openslide_t *osr,
+                                  void *dest,
+                                  openslide_pixel_format_t format,
+                                  int64_t x, int64_t y,
+                                  int32_t level,
+                                  int64_t w, int64_t h) {
+  read_region_format(osr, dest, w * _openslide_pixel_format_bytes(format),
+                     format, x, y, level, w, h);
+}
+
+void openslide_read_region_strided(openslide_t *osr,
+                                   void *dest, int64_t stride,
+                                   openslide_pixel_format_t format,
+                                   int64_t x, int64_t y,
+                                   int32_t level,
+                                   int64_t w, int64_t h) {
+  int64_t bpp = _openslide_pixel_format_bytes(format);
+  // cairo needs 32-bit aligned rows
+  if (bpp && w >= 0 &&
+      (stride < w * bpp ||
+       (format == OPENSLIDE_PIXEL_FORMAT_ARGB && stride % 4))) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid stride %"PRId64" for width "
+                                  "%"PRId64, stride, w);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  read_region_format(osr, dest, stride, format, x, y, level, w, h);
+}
+
+// Copy tiles of a level, decoded at 1/scale size, into dest.  x and y are
+// in the scaled level plane.  dest must already be cleared.
+static bool read_scaled_tiles(openslide_t *osr,
+                              struct _openslide_level *l,
+                              int32_t scale,
+                              uint32_t *dest,
+                              int64_t x, int64_t y,
+                              int64_t w, int64_t h,
+                              GError **err) {
+  int64_t tw = l->tile_w / scale;
+  int64_t th = l->tile_h / scale;
+
+  // clip to the scaled level
+  int64_t x0 = MAX(x, 0);
+  int64_t y0 = MAX(y, 0);
+  int64_t x1 = MIN(x + w, (l->w + scale - 1) / scale);
+  int64_t y1 = MIN(y + h, (l->h + scale - 1) / scale);
+  if (x0 >= x1 || y0 >= y1) {
+    return true;
+  }
+
+  for (int64_t row = y0 / th; row * th < y1; row++) {
+    for (int64_t col = x0 / tw; col * tw < x1; col++) {
+      if (!_openslide_worker_check_cancelled(err)) {
+        return false;
+      }
+      GError *tmp_err = NULL;
+      g_autoptr(_openslide_cache_entry) entry = NULL;
+      const uint32_t *tiledata =
+        osr->ops->get_tile_scaled(osr, l, col, row, scale, &entry, &tmp_err);
+      if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+        return false;
+      }
+      if (!tiledata) {
+        // missing tile
+        continue;
+      }
+
+      int64_t cx0 = MAX(col * tw, x0);
+      int64_t cx1 = MIN((col + 1) * tw, x1);
+      int64_t cy1 = MIN((row + 1) * th, y1);
+      for (int64_t yy = MAX(row * th, y0); yy < cy1; yy++) {
+        memcpy(dest + (yy - y) * w + (cx0 - x),
+               tiledata + (yy - row * th) * tw + (cx0 - col * tw),
+               (cx1 - cx0) * 4);
+      }
+    }
+  }
+  convert_color(osr, dest, w * 4, w, h);
+  return true;
+}
+
+// Read from the best level for the downsample and scale the result with
+// cairo.  If the backend can decode the level's tiles at reduced size,
+// decode at the largest reduction that keeps at least the requested
+// resolution, so the source is as small as possible.
+static bool read_region_downsample(openslide_t *osr,
+                                   uint32_t *dest,
+                                   int64_t x, int64_t y,
+                                   double downsample,
+                                   int64_t w, int64_t h,
+                                   GError **err) {
+  int32_t level = openslide_get_best_level_for_downsample(osr, downsample);
+  struct _openslide_level *l = osr->levels[level];
+  double rel = downsample / l->downsample;
+  if (rel == 1) {
+    return read_region_parallel(osr, dest, w * 4, OPENSLIDE_PIXEL_FORMAT_ARGB,
+                                x, y, level, w, h, err);
+  }
+
+  int32_t scale = 1;
+  if (osr->ops->get_tile_scaled && l->scaled_tiles &&
+      !_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    while (scale < 8 && scale * 2 <= rel) {
+      scale *= 2;
+    }
+  }
+  double ds = l->downsample * scale;  // downsample of the source plane
+  double f = downsample / ds;         // remaining scale factor
+
+  // Work in chunks of dest so the source buffer stays small.  Each chunk's
+  // source has a margin so the filter sees the same pixels across chunk
+  // boundaries.
+  const int64_t d = CLAMP(4096 / MAX(f, 1), 1, 4096);
+  int64_t margin = ceil(f) + 1;
+  for (int64_t row = 0; row < h; row += d) {
+    for (int64_t col = 0; col < w; col += d) {
+      int64_t cw = MIN(d, w - col);
+      int64_t ch = MIN(d, h - row);
+
+      // source region, in the source plane
+      double sx = x / ds + col * f;
+      double sy = y / ds + row * f;
+      int64_t ox = floor(sx) - margin;
+      int64_t oy = floor(sy) - margin;
+      int64_t sw = ceil(cw * f) + 2 * margin + 1;
+      int64_t sh = ceil(ch * f) + 2 * margin + 1;
+
+      g_autofree uint32_t *src = g_try_malloc0(sw * sh * 4);
+      if (!src) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Couldn't allocate %"PRId64"x%"PRId64" source buffer",
+                    sw, sh);
+        return false;
+      }
+      if (scale > 1) {
+        if (!read_scaled_tiles(osr, l, scale, src, ox, oy, sw, sh, err)) {
+          return false;
+        }
+      } else {
+        if (!read_region_parallel(osr, src, sw * 4,
+                                  OPENSLIDE_PIXEL_FORMAT_ARGB,
+                                  ox * ds, oy * ds, level, sw, sh, err)) {
+          return false;
+        }
+      }
+      if (!dest) {
+        continue;
+      }
+
+      // scale into dest
+      g_autoptr(cairo_surface_t) src_surface =
+        cairo_image_surface_create_for_data((unsigned char *) src,
+                                            CAIRO_FORMAT_ARGB32,
+                                            sw, sh, sw * 4);
+      g_autoptr(cairo_surface_t) surface =
+        cairo_image_surface_create_for_data((unsigned char *)
+                                            (dest + row * w + col),
+                                            CAIRO_FORMAT_ARGB32,
+                                            cw, ch, w * 4);
+      g_autoptr(cairo_t) cr = cairo_create(surface);
+      cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+      cairo_scale(cr, 1 / f, 1 / f);
+      cairo_set_source_surface(cr, src_surface, ox - sx, oy - sy);
+      cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+      cairo_paint(cr);
+      if (!_openslide_check_cairo_status(cr, err)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void openslide_read_region_downsample(openslide_t *osr,
+                                      uint32_t *dest,
+                                      int64_t x, int64_t y,
+                                      double downsample,
+                                      int64_t w, int64_t h) {
+  if (!check_read_args(osr, OPENSLIDE_PIXEL_FORMAT_ARGB, w, h)) {
+    return;
+  }
+  if (!(downsample > 0) || isinf(downsample)) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid downsample %g", downsample);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+
+  g_autoptr(_openslide_read_record) rs = _openslide_read_stats_begin();
+
+  // clear the dest
+  if (dest) {
+    memset(dest, 0, w * h * 4);
+  }
+
+  // return if an error occurred
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  GError *tmp_err = NULL;
+  if (!read_region_downsample(osr, dest, x, y, downsample, w, h, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    if (dest) {
+      // ensure we don't return a partial result
+      memset(dest, 0, w * h * 4);
+    }
+  }
+}
+
+// Read from the best level for the smaller scale factor and resample into
+// dest one chunk at a time.  Each chunk's source is aligned to the box
+// factors and has a margin covering the filter support, so chunks join
+// seamlessly.  The source is box-reduced as it is read, block by block.
+static bool read_region_scaled(openslide_t *osr,
+                               uint32_t *dest,
+                               int64_t x, int64_t y,
+                               int64_t w, int64_t h,
+                               int64_t dest_w, int64_t dest_h,
+                               openslide_scale_filter_t filter,
+                               GError **err) {
+  double fx = (double) w / dest_w;
+  double fy = (double) h / dest_h;
+  double downsample = MIN(fx, fy);
+  int32_t level = openslide_get_best_level_for_downsample(osr, downsample);
+  struct _openslide_level *l = osr->levels[level];
+  double rel = downsample / l->downsample;
+
+  int32_t scale = 1;
+  if (osr->ops->get_tile_scaled && l->scaled_tiles &&
+      !_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    while (scale < 8 && scale * 2 <= rel) {
+      scale *= 2;
+    }
+  }
+  double ds = l->downsample * scale;  // downsample of the source plane
+  double rx = fx / ds;                // dest pixel size in the source plane
+  double ry = fy / ds;
+  int32_t kx = _openslide_resample_box_factor(rx);
+  int32_t ky = _openslide_resample_box_factor(ry);
+  int64_t mx = _openslide_resample_margin(filter, rx);
+  int64_t my = _openslide_resample_margin(filter, ry);
+
+  // Size chunks by their extent in the box plane, so the filter margin
+  // stays a small fraction of each, and read their source in blocks
+  const int64_t box_d = 512;
+  const int64_t block_d = 2048;
+  int64_t mbx = (mx + kx - 1) / kx;
+  int64_t mby = (my + ky - 1) / ky;
+  const int64_t dx = CLAMP((box_d - 2 * mbx - 2) / (rx / kx), 1, 2048);
+  const int64_t dy = CLAMP((box_d - 2 * mby - 2) / (ry / ky), 1, 2048);
+  g_autofree uint32_t *src = g_try_malloc(block_d * block_d * 4);
+  if (!src) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't allocate %"PRId64"x%"PRId64" source buffer",
+                block_d, block_d);
+    return false;
+  }
+  for (int64_t row = 0; row < dest_h; row += dy) {
+    for (int64_t col = 0; col < dest_w; col += dx) {
+      int64_t cw = MIN(dx, dest_w - col);
+      int64_t ch = MIN(dy, dest_h - row);
+
+      // source region, in the source plane
+      double sx = x / ds + col * rx;
+      double sy = y / ds + row * ry;
+      int64_t ox = floor((sx - mx) / kx) * kx;
+      int64_t oy = floor((sy - my) / ky) * ky;
+      int64_t sw = ceil((sx + cw * rx + mx - ox) / kx) * kx;
+      int64_t sh = ceil((sy + ch * ry + my - oy) / ky) * ky;
+
+      g_autoptr(_openslide_resample_box) box =
+        _openslide_resample_box_new(sw / kx, sh / ky, kx, ky, err);
+      if (!box) {
+        return false;
+      }
+      for (int64_t by = 0; by < sh; by += block_d) {
+        for (int64_t bx = 0; bx < sw; bx += block_d) {
+          int64_t bw = MIN(block_d, sw - bx);
+          int64_t bh = MIN(block_d, sh - by);
+          memset(src, 0, bw * bh * 4);
+          if (scale > 1) {
+            if (!read_scaled_tiles(osr, l, scale, src,
+                                   ox + bx, oy + by, bw, bh, err)) {
+              return false;
+            }
+          } else {
+            if (!read_region_parallel(osr, src, bw * 4,
+                                      OPENSLIDE_PIXEL_FORMAT_ARGB,
+                                      (ox + bx) * ds, (oy + by) * ds,
+                                      level, bw, bh, err)) {
+              return false;
+            }
+          }
+          _openslide_resample_box_add(box, src, bx, by, bw, bh);
+        }
+      }
+      if (dest) {
+        _openslide_resample_box_finish(box, sx - ox, sy - oy, rx, ry,
+                                       filter, dest + row * dest_w + col,
+                                       dest_w, cw, ch);
+      }
+    }
+  }
+  return true;
+}
+
+void openslide_read_region_scaled(openslide_t *osr,
+                                  uint32_t *dest,
+                                  int64_t x, int64_t y,
+                                  int64_t w, int64_t h,
+                                  int64_t dest_w, int64_t dest_h,
+                                  openslide_scale_filter_t filter) {
+  if (!check_read_args(osr, OPENSLIDE_PIXEL_FORMAT_ARGB, dest_w, dest_h)) {
+    return;
+  }
+  if (w <= 0 || h <= 0) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid source size %"PRId64"x%"PRId64,
+                                  w, h);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  if (filter != OPENSLIDE_SCALE_FILTER_FAST &&
+      filter != OPENSLIDE_SCALE_FILTER_BEST) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid scale filter %d", filter);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+
+  g_autoptr(_openslide_read_record) rs = _openslide_read_stats_begin();
+
+  // clear the dest
+  if (dest) {
+    memset(dest, 0, dest_w * dest_h * 4);
+  }
+
+  // return if an error occurred, or if there's nothing to do
+  if (openslide_get_error(osr) || !dest_w || !dest_h) {
+    return;
+  }
+
+  GError *tmp_err = NULL;
+  if (!read_region_scaled(osr, dest, x, y, w, h, dest_w, dest_h, filter,
+                          &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    if (dest) {
+      // ensure we don't return a partial result
+      memset(dest, 0, dest_w * dest_h * 4);
+    }
+  }
+}
+
+int32_t openslide_get_focal_plane_count(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return -1;
+  }
+  return osr->focal_planes ? osr->focal_planes->count : 1;
+}
+
+int32_t openslide_get_default_focal_plane(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return -1;
+  }
+  return osr->focal_planes ? osr->focal_planes->default_plane : 0;
+}
+
+static struct _openslide_level *get_focal_plane_level(openslide_t *osr,
+                                                      int32_t level,
+                                                      int32_t plane,
+                                                      GError **err) {
+  struct _openslide_focal_planes *fp = osr->focal_planes;
+  struct _openslide_level *l = osr->levels[level];
+  if (!fp || plane == fp->default_plane) {
+    return l;
+  }
+  // osr->levels may include virtual levels
+  for (int32_t i = 0; i < fp->level_count; i++) {
+    if (fp->levels[fp->default_plane][i] == l) {
+      return fp->levels[plane][i];
+    }
+  }
+  g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+              "Level %d has no focal planes", level);
+  return NULL;
+}
+
+void openslide_read_region_focal_plane(openslide_t *osr,
+                                       uint32_t *dest,
+                                       int64_t x, int64_t y,
+                                       int32_t level,
+                                       int32_t plane,
+                                       int64_t w, int64_t h) {
+  if (!check_read_args(osr, OPENSLIDE_PIXEL_FORMAT_ARGB, w, h)) {
+    return;
+  }
+  if (plane < 0 ||
+      plane >= (osr->focal_planes ? osr->focal_planes->count : 1)) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid focal plane %d", plane);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  g_autoptr(_openslide_read_record) rs = _openslide_read_stats_begin();
+
+  // clear the dest
+  if (dest) {
+    memset(dest, 0, w * h * 4);
+  }
+
+  // return if an error occurred, or if there's nothing to do
+  if (openslide_get_error(osr) || !level_in_range(osr, level)) {
+    return;
+  }
+
+  GError *tmp_err = NULL;
+  struct _openslide_level *l = get_focal_plane_level(osr, level, plane,
+                                                     &tmp_err);
+  if (!l || !read_region_cairo(osr, dest, w * 4, x, y, l, 0, 0, w, h,
+                                 &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    if (dest) {
+      // ensure we don't return a partial result
+      memset(dest, 0, w * h * 4);
+    }
+    return;
+  }
+  convert_color(osr, dest, w * 4, w, h);
+}
+
+static bool batch_read_region(int64_t item, void *arg, GError **err) {
+  struct batch_read *batch = arg;
+  const openslide_region_t *r = &batch->regions[item];
+  return read_region(batch->osr, r->dest, r->w * 4,
+                     OPENSLIDE_PIXEL_FORMAT_ARGB,
+                     r->x, r->y, r->level, r->w, r->h, err);
+}
+
+void openslide_read_regions(openslide_t *osr,
+                            const openslide_region_t *regions,
+                            int32_t count) {
+  for (int32_t i = 0; i < count; i++) {
+    const openslide_region_t *r = &regions[i];
+    if (r->w < 0 || r->h < 0) {
+      GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                    "negative width (%"PRId64") "
+                                    "or negative height (%"PRId64") "
+                                    "not allowed in region %d",
+                                    r->w, r->h, i);
+      _openslide_propagate_error(osr, tmp_err);
+      return;
+    }
+  }
+
+  g_autoptr(_openslide_read_record) rs = _openslide_read_stats_begin();
+
+  // clear the dests and return if an error occurred
+  if (openslide_get_error(osr)) {
+    for (int32_t i = 0; i < count; i++) {
+      const openslide_region_t *r = &regions[i];
+      if (r->dest) {
+        memset(r->dest, 0, r->w * r->h * 4);
+      }
+    }
+    return;
+  }
+
+  // Decode the tiles shared between regions exactly once, in parallel,
+  // then composite the regions from the cache in parallel.
+  g_autofree struct batch_tile *tiles = NULL;
+  struct batch_read batch = {
+    .osr = osr,
+    .regions = regions,
+  };
+  int64_t tile_count = collect_batch_tiles(osr, regions, count, &tiles);
+  batch.tiles = tiles;
+  prefetch_batch_tile_data(osr, tiles, tile_count);
+
+  GError *tmp_err = NULL;
+  _openslide_read_stats_set_prefetching(true);
+  bool prefetched = _openslide_worker_run_batch(tile_count,
+                                                batch_prefetch_tile,
+                                                &batch, &tmp_err);
+  _openslide_read_stats_set_prefetching(false);
+  if (!prefetched ||
+      !_openslide_worker_run_batch(count, batch_read_region,
+                                   &batch, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    // ensure we don't return a partial result
+    for (int32_t i = 0; i < count; i++) {
+      const openslide_region_t *r = &regions[i];
+      if (r->dest) {
+        memset(r->dest, 0, r->w * r->h * 4);
+      }
+    }
+  }
+}
+
+static uint32_t get_background_color(openslide_t *osr) {
+  const char *value =
+    openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BACKGROUND_COLOR);
+  if (value) {
+    char *endptr;
+    uint64_t color = g_ascii_strtoull(value, &endptr, 16);
+    if (endptr != value && *endptr == 0 && color <= 0xffffff) {
+      return color;
+    }
+  }
+  return 0xffffff;
+}
+
+static bool is_tissue(uint32_t pixel, uint32_t background) {
+  uint32_t a = pixel >> 24;
+  if (a < 128) {
+    return false;
+  }
+  for (int shift = 0; shift < 24; shift += 8) {
+    // un-premultiply
+    int32_t value = ((pixel >> shift) & 0xff) * 255 / a;
+    int32_t bg = (background >> shift) & 0xff;
+    if (ABS(value - bg) > TISSUE_THRESHOLD) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static struct _openslide_tissue_mask *tissue_mask_create(openslide_t *osr,
+                                                         GError **err) {
+  int64_t w0 = osr->levels[0]->w;
+  int64_t h0 = osr->levels[0]->h;
+  double downsample =
+    MAX((double) MAX(w0, h0) / TISSUE_MASK_MAX_SIZE, 1);
+
+  struct _openslide_tissue_mask *mask =
+    g_new0(struct _openslide_tissue_mask, 1);
+  mask->w = MAX(ceil(w0 / downsample), 1);
+  mask->h = MAX(ceil(h0 / downsample), 1);
+  mask->scale_x = (double) w0 / mask->w;
+  mask->scale_y = (double) h0 / mask->h;
+  mask->pixels = g_malloc0(mask->w * mask->h);
+  if (!w0 || !h0) {
+    return mask;
+  }
+
+  g_autofree uint32_t *buf = g_malloc0(mask->w * mask->h * 4);
+  if (!read_region_scaled(osr, buf, 0, 0, w0, h0, mask->w, mask->h,
+                          OPENSLIDE_SCALE_FILTER_FAST, err)) {
+    tissue_mask_free(mask);
+    return NULL;
+  }
+  uint32_t background = get_background_color(osr);
+  for (int64_t i = 0; i < mask->w * mask->h; i++) {
+    mask->pixels[i] = is_tissue(buf[i], background);
+  }
+  return mask;
+}
+
+static bool get_tissue_mask(openslide_t *osr,
+                            int32_t level,
+                            int64_t tile_w, int64_t tile_h,
+                            uint8_t *dest,
+                            GError **err) {
+  g_mutex_lock(&osr->tissue_lock);
+  if (!osr->tissue_mask) {
+    osr->tissue_mask = tissue_mask_create(osr, err);
+  }
+  struct _openslide_tissue_mask *mask = osr->tissue_mask;
+  g_mutex_unlock(&osr->tissue_lock);
+  if (!mask) {
+    return false;
+  }
+
+  // map each tile to the mask pixels it touches
+  struct _openslide_level *l = osr->levels[level];
+  int64_t tiles_across = (l->w + tile_w - 1) / tile_w;
+  int64_t tiles_down = (l->h + tile_h - 1) / tile_h;
+  double fx = l->downsample / mask->scale_x;
+  double fy = l->downsample / mask->scale_y;
+  for (int64_t row = 0; row < tiles_down; row++) {
+    int64_t my0 = CLAMP(floor(row * tile_h * fy), 0, mask->h - 1);
+    int64_t my1 = CLAMP(ceil((row + 1) * tile_h * fy), my0 + 1, mask->h);
+    for (int64_t col = 0; col < tiles_across; col++) {
+      int64_t mx0 = CLAMP(floor(col * tile_w * fx), 0, mask->w - 1);
+      int64_t mx1 = CLAMP(ceil((col + 1) * tile_w * fx), mx0 + 1, mask->w);
+      uint8_t tissue = 0;
+      for (int64_t my = my0; my < my1 && !tissue; my++) {
+        const uint8_t *p = mask->pixels + my * mask->w;
+        for (int64_t mx = mx0; mx < mx1; mx++) {
+          if (p[mx]) {
+            tissue = 1;
+            break;
+          }
+        }
+      }
+      dest[row * tiles_across + col] = tissue;
+    }
+  }
+  return true;
+}
+
+void openslide_get_tissue_mask(openslide_t *osr,
+                               int32_t level,
+                               int64_t tile_w, int64_t tile_h,
+                               uint8_t *dest) {
+  if (tile_w <= 0 || tile_h <= 0) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid tile size %"PRId64"x%"PRId64,
+                                  tile_w, tile_h);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  if (!level_in_range(osr, level)) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid level %d", level);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  struct _openslide_level *l = osr->levels[level];
+  int64_t size = ((l->w + tile_w - 1) / tile_w) *
+                 ((l->h + tile_h - 1) / tile_h);
+
+  // clear the dest and return if an error occurred
+  if (openslide_get_error(osr)) {
+    memset(dest, 0, size);
+    return;
+  }
+
+  GError *tmp_err = NULL;
+  if (!get_tissue_mask(osr, level, tile_w, tile_h, dest, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    memset(dest, 0, size);
+  }
+}
+
+struct _openslide_read_request {
+  openslide_t *osr;
+  uint32_t *dest;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+  openslide_read_callback_t callback;
+  void *user_data;
+
+  gint cancelled;  // atomic
+
+  GMutex lock;
+  GCond cond;
+  openslide_read_status_t status;
+  int refcount;    // caller + worker
+};
+
+static void read_request_unref(openslide_read_request_t *req) {
+  g_mutex_lock(&req->lock);
+  bool last = --req->refcount == 0;
+  g_mutex_unlock(&req->lock);
+  if (last) {
+    g_mutex_clear(&req->lock);
+    g_cond_clear(&req->cond);
+    g_free(req);
+  }
+}
+
+static openslide_read_status_t async_read_region(openslide_read_request_t *req) {
+  openslide_t *osr = req->osr;
+  if (g_atomic_int_get(&req->cancelled)) {
+    return OPENSLIDE_READ_CANCELLED;
+  }
+  if (!check_read_args(osr, OPENSLIDE_PIXEL_FORMAT_ARGB, req->w, req->h)) {
+    return OPENSLIDE_READ_FAILED;
+  }
+  if (openslide_get_error(osr)) {
+    return OPENSLIDE_READ_FAILED;
+  }
+
+  _openslide_worker_set_cancel_flag(&req->cancelled);
+  GError *tmp_err = NULL;
+  bool ok = read_region_parallel(osr, req->dest, req->w * 4,
+                                 OPENSLIDE_PIXEL_FORMAT_ARGB,
+                                 req->x, req->y, req->level, req->w, req->h,
+                                 &tmp_err);
+  _openslide_worker_set_cancel_flag(NULL);
+  if (ok) {
+    return OPENSLIDE_READ_SUCCEEDED;
+  }
+  if (g_error_matches(tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_CANCELLED)) {
+    g_error_free(tmp_err);
+    return OPENSLIDE_READ_CANCELLED;
+  }
+  _openslide_propagate_error(osr, tmp_err);
+  return OPENSLIDE_READ_FAILED;
+}
+
+static void async_read(void *data) {
+  openslide_read_request_t *req = data;
+  openslide_t *osr = req->osr;
+
+  openslide_read_status_t status = async_read_region(req);
+  if (status != OPENSLIDE_READ_SUCCEEDED && req->dest && req->w > 0 &&
+      req->h > 0) {
+    // ensure we don't return a partial result
+    memset(req->dest, 0, req->w * req->h * 4);
+  }
+
+  g_mutex_lock(&req->lock);
+  req->status = status;
+  g_cond_broadcast(&req->cond);
+  g_mutex_unlock(&req->lock);
+
+  if (req->callback) {
+    req->callback(req, req->user_data);
+  }
+  read_request_unref(req);
+  async_end(osr);
+}
+
+openslide_read_request_t *openslide_read_region_async(openslide_t *osr,
+                                                      uint32_t *dest,
+                                                      int64_t x, int64_t y,
+                                                      int32_t level,
+                                                      int64_t w, int64_t h,
+                                                      openslide_read_callback_t callback,
+                                                      void *user_data) {
+  openslide_read_request_t *req = g_new0(openslide_read_request_t, 1);
+  req->osr = osr;
+  req->dest = dest;
+  req->x = x;
+  req->y = y;
+  req->level = level;
+  req->w = w;
+  req->h = h;
+  req->callback = callback;
+  req->user_data = user_data;
+  g_mutex_init(&req->lock);
+  g_cond_init(&req->cond);
+  req->status = OPENSLIDE_READ_PENDING;
+  req->refcount = 2;
+
+  async_begin(osr);
+  _openslide_worker_submit(async_read, req);
+  return req;
+}
+
+void openslide_read_request_cancel(openslide_read_request_t *req) {
+  g_atomic_int_set(&req->cancelled, 1);
+}
+
+openslide_read_status_t openslide_read_request_get_status(openslide_read_request_t *req) {
+  g_mutex_lock(&req->lock);
+  openslide_read_status_t status = req->status;
+  g_mutex_unlock(&req->lock);
+  return status;
+}
+
+openslide_read_status_t openslide_read_request_wait(openslide_read_request_t *req) {
+  g_mutex_lock(&req->lock);
+  while (req->status == OPENSLIDE_READ_PENDING) {
+    g_cond_wait(&req->cond, &req->lock);
+  }
+  openslide_read_status_t status = req->status;
+  g_mutex_unlock(&req->lock);
+  return status;
+}
+
+void openslide_read_request_free(openslide_read_request_t *req) {
+  read_request_unref(req);
+}
+
+const uint32_t *openslide_get_tile(openslide_t *osr,
+                                   int32_t level,
+                                   int64_t col, int64_t row,
+                                   openslide_tile_t **tile) {
+  *tile = NULL;
+
+  if (openslide_get_error(osr) || !level_in_range(osr, level)) {
+    return NULL;
+  }
+  struct _openslide_level *l = osr->levels[level];
+  int64_t tw = l->tile_w;
+  int64_t th = l->tile_h;
+  if (tw <= 0 || th <= 0 || col < 0 || row < 0 ||
+      col * tw >= l->w || row * th >= l->h) {
+    return NULL;
+  }
+  read_ahead(osr, level, col, col + 1, row, row + 1);
+
+  GError *tmp_err = NULL;
+  g_autoptr(_openslide_cache_entry) entry = NULL;
+  if (osr->ops->get_tile && !_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    // borrow from the cache
+    const uint32_t *tiledata = get_tile(osr, level, col, row, &entry,
+                                        &tmp_err);
+    if (tiledata) {
+      *tile = g_steal_pointer(&entry);
+      return tiledata;
+    }
+    if (tmp_err) {
+      _openslide_propagate_error(osr, tmp_err);
+      return NULL;
+    }
+    // missing tile
+    uint32_t *buf = g_malloc0(tw * th * 4);
+    *tile = _openslide_cache_entry_new(buf, tw * th * 4);
+    return buf;
+  }
+
+  // read into a private buffer
+  uint32_t *buf = g_malloc(tw * th * 4);
+  entry = _openslide_cache_entry_new(buf, tw * th * 4);
+  if (!read_region(osr, buf, tw * 4, OPENSLIDE_PIXEL_FORMAT_ARGB,
+                   col * tw * l->downsample, row * th * l->downsample,
+                   level, tw, th, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    return NULL;
+  }
+  *tile = g_steal_pointer(&entry);
+  return buf;
+}
+
+void openslide_release_tile(openslide_tile_t *tile) {
+  if (tile) {
+    _openslide_cache_entry_unref(tile);
+  }
+}
+
+const void *openslide_get_raw_tile(openslide_t *osr,
+                                   int32_t level,
+                                   int64_t col, int64_t row,
+                                   openslide_tile_format_t *format,
+                                   int64_t *size,
+                                   openslide_tile_t **tile) {
+  *format = 0;
+  *size = 0;
+  *tile = NULL;
+
+  if (openslide_get_error(osr) || !level_in_range(osr, level) ||
+      !osr->ops->get_raw_tile || _openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    return NULL;
+  }
+  struct _openslide_level *l = osr->levels[level];
+  if (l->tile_w <= 0 || l->tile_h <= 0 || col < 0 || row < 0 ||
+      col * l->tile_w >= l->w || row * l->tile_h >= l->h) {
+    return NULL;
+  }
+
+  GError *tmp_err = NULL;
+  g_autoptr(_openslide_cache_entry) entry = NULL;
+  void *data = osr->ops->get_raw_tile(osr, l, col, row, format, size,
+                                      &entry, &tmp_err);
+  if (!data) {
+    if (tmp_err) {
+      _openslide_propagate_error(osr, tmp_err);
+    }
+    *format = 0;
+    *size = 0;
+    return NULL;
+  }
+  *tile = g_steal_pointer(&entry);
+  return data;
+}
+
+const char * const *openslide_get_property_names(openslide_t *osr) {
+  if (openslide_get_error(osr) || !ensure_properties(osr)) {
+    return EMPTY_STRING_ARRAY;
+  }
+
+  return osr->property_names;
+}
+
+const char *openslide_get_property_value(openslide_t *osr, const char *name) {
+  if (openslide_get_error(osr) || !ensure_properties(osr)) {
+    return NULL;
+  }
+
+  return g_hash_table_lookup(osr->properties, name);
+}
+
+int64_t openslide_get_icc_profile_size(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return -1;
+  }
+
+  return osr->icc_profile_size;
+}
+
+void openslide_read_icc_profile(openslide_t *osr, void *dest) {
+  if (openslide_get_error(osr)) {
+    memset(dest, 0, osr->icc_profile_size);
+    return;
+  }
+  if (!osr->icc_profile_size) {
+    return;
+  }
+  g_assert(osr->ops->read_icc_profile);
+
+  GError *tmp_err = NULL;
+  if (!osr->ops->read_icc_profile(osr, dest, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    memset(dest, 0, osr->icc_profile_size);
+  }
+}
+
+bool openslide_set_color_managed(openslide_t *osr, bool enabled) {
+  if (!enabled) {
+    g_atomic_int_set(&osr->color_managed, false);
+    return true;
+  }
+  if (openslide_get_error(osr) || !osr->icc_profile_size) {
+    return false;
+  }
+
+  g_mutex_lock(&osr->color_lock);
+  if (!osr->color_transform) {
+    g_autofree void *profile = g_malloc(osr->icc_profile_size);
+    g_autoptr(GError) tmp_err = NULL;
+    if (!osr->ops->read_icc_profile(osr, profile, &tmp_err)) {
+      g_mutex_unlock(&osr->color_lock);
+      return false;
+    }
+    struct _openslide_color_transform *ct =
+      _openslide_color_transform_new(profile, osr->icc_profile_size,
+                                     &tmp_err);
+    if (!ct) {
+      g_mutex_unlock(&osr->color_lock);
+      return false;
+    }
+    osr->color_planes = g_new0(uint8_t, osr->level_count);
+    osr->color_transform = ct;
+  }
+  g_mutex_unlock(&osr->color_lock);
+  g_atomic_int_set(&osr->color_managed, true);
+  return true;
+}
+
+const char * const *openslide_get_associated_image_names(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return EMPTY_STRING_ARRAY;
+  }
+
+  g_mutex_lock(&osr->associated_lock);
+  const char **names = osr->associated_image_names;
+  g_mutex_unlock(&osr->associated_lock);
+  return names;
+}
+
+void openslide_get_associated_image_dimensions(openslide_t *osr, const char *name,
+					       int64_t *w, int64_t *h) {
+  *w = -1;
+  *h = -1;
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  struct _openslide_associated_image *img =
+    lookup_associated_image(osr, name);
+  if (img && ensure_associated_image_dimensions(osr, img)) {
+    *w = img->w;
+    *h = img->h;
+  }
+}
+
+void openslide_read_associated_image(openslide_t *osr,
+				     const char *name,
+				     uint32_t *dest) {
+  struct _openslide_associated_image *img =
+    lookup_associated_image(osr, name);
+  if (!img || !ensure_associated_image_dimensions(osr, img)) {
+    return;
+  }
+  size_t pixels = img->w * img->h;
+
+  if (openslide_get_error(osr)) {
+    memset(dest, 0, pixels * sizeof(uint32_t));
+    return;
+  }
+
+  // decoded images are cached like tiles, keyed by the image
+  g_autoptr(_openslide_cache_entry) entry = NULL;
+  uint32_t *data = _openslide_cache_get(osr->cache, img, 0, 0, &entry);
+  if (!data) {
+    g_autofree uint32_t *buf = g_try_malloc(pixels * sizeof(uint32_t));
+    GError *tmp_err = NULL;
+    if (!buf) {
+      g_set_error(&tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't allocate %"PRIu64" bytes for associated image",
+                  (uint64_t) (pixels * sizeof(uint32_t)));
+    }
+    if (!buf || !img->ops->get_argb_data(img, buf, &tmp_err)) {
+      _openslide_propagate_error(osr, tmp_err);
+      // ensure we don't return a partial result
+      memset(dest, 0, pixels * sizeof(uint32_t));
+      return;
+    }
+    data = buf;
+    _openslide_cache_put(osr->cache, img, 0, 0, g_steal_pointer(&buf),
+                         pixels * sizeof(uint32_t), &entry);
+  }
+  memcpy(dest, data, pixels * sizeof(uint32_t));
 }
 
 int64_t openslide_get_associated_image_icc_profile_size(openslide_t *osr,
@@ -660,7 +2363,7 @@ int64_t openslide_get_associated_image_icc_profile_size(openslide_t *osr,
   }
 
   struct _openslide_associated_image *img =
-    g_hash_table_lookup(osr->associated_images, name);
+    lookup_associated_image(osr, name);
   if (!img) {
     return -1;
   }
@@ -671,7 +2374,7 @@ void openslide_read_associated_image_icc_profile(openslide_t *osr,
                                                  const char *name,
                                                  void *dest) {
   struct _openslide_associated_image *img =
-    g_hash_table_lookup(osr->associated_images, name);
+    lookup_associated_image(osr, name);
   if (!img) {
     return;
   }
@@ -707,6 +2410,116 @@ void openslide_cache_release(openslide_cache_t *cache) {
   _openslide_cache_release(cache);
 }
 
+void openslide_cache_set_compressed_capacity(openslide_cache_t *cache,
+                                             size_t capacity) {
+  _openslide_cache_set_compressed_capacity(cache, capacity);
+}
+
+void openslide_cache_set_persistent_dir(openslide_cache_t *cache,
+                                        const char *path) {
+  _openslide_cache_set_persistent_dir(cache, path);
+}
+
+void openslide_set_cache_quota(openslide_t *osr, size_t quota) {
+  if (openslide_get_error(osr)) {
+    return;
+  }
+  _openslide_cache_binding_set_quota(osr->cache, quota);
+}
+
+void openslide_set_cache_priority(openslide_t *osr,
+                                  openslide_cache_priority_t priority) {
+  if (openslide_get_error(osr)) {
+    return;
+  }
+  if (priority != OPENSLIDE_CACHE_PRIORITY_NORMAL &&
+      priority != OPENSLIDE_CACHE_PRIORITY_LOW) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "invalid cache priority %d", priority);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  _openslide_cache_binding_set_priority(osr->cache, priority);
+}
+
+void openslide_cache_get_stats(openslide_cache_t *cache,
+                               openslide_cache_stats_t *stats) {
+  _openslide_cache_get_stats(cache, stats);
+}
+
+void openslide_get_cache_stats(openslide_t *osr,
+                               openslide_cache_stats_t *stats) {
+  if (openslide_get_error(osr)) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  _openslide_cache_binding_get_stats(osr->cache, stats);
+}
+
+void openslide_set_instrumentation(bool enabled) {
+  _openslide_trace_set_enabled(enabled);
+}
+
+void openslide_get_instrumentation_stats(openslide_instrumentation_stats_t *stats) {
+  _openslide_trace_get_stats(stats);
+}
+
+void openslide_reset_instrumentation_stats(void) {
+  _openslide_trace_reset_stats();
+}
+
+void openslide_get_last_read_stats(openslide_read_stats_t *stats) {
+  _openslide_read_stats_get_last(stats);
+}
+
+void openslide_set_tiff_handle_cache_size(int32_t handles) {
+  _openslide_tiffcache_set_default_size(handles);
+}
+
+void openslide_get_tiff_handle_counts(uint64_t *opens, uint64_t *reuses) {
+  _openslide_tiffcache_get_counters(opens, reuses);
+}
+
+void openslide_set_file_mapping(bool enabled) {
+  _openslide_set_file_mapping(enabled);
+}
+
+void openslide_set_lazy_properties(bool enabled) {
+  g_atomic_int_set(&lazy_properties, enabled);
+}
+
+bool _openslide_lazy_properties(void) {
+  return g_atomic_int_get(&lazy_properties);
+}
+
+void openslide_set_virtual_levels(bool enabled) {
+  _openslide_virtual_levels_set_enabled(enabled);
+}
+
+void openslide_set_jp2k_decode_threads(int32_t threads) {
+  _openslide_jp2k_set_max_threads(threads);
+}
+
+void openslide_set_index_cache_dir(const char *path) {
+  _openslide_index_cache_set_dir(path);
+}
+
+void openslide_set_worker_threads(int32_t threads) {
+  _openslide_worker_set_max_threads(threads);
+}
+
+bool openslide_set_worker_cpus(const int32_t *cpus, int32_t count) {
+  return _openslide_worker_set_cpus(cpus, count);
+}
+
+bool openslide_set_worker_numa_node(int32_t node) {
+  return _openslide_worker_set_numa_node(node);
+}
+
+void openslide_set_worker_priority(openslide_worker_priority_t priority) {
+  _openslide_worker_set_priority(priority);
+}
+
 const char *openslide_get_version(void) {
   return SUFFIXED_VERSION;
 }
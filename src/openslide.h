@@ -59,6 +59,85 @@ typedef struct _openslide openslide_t;
  */
 typedef struct _openslide_cache openslide_cache_t;
 
+/**
+ * A registry of open OpenSlide objects, shared by path.
+ *
+ * An @ref openslide_registry_t object can be used concurrently from
+ * multiple threads without locking.
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_registry openslide_registry_t;
+
+/**
+ * A reference to the pixel or compressed data of one tile.
+ *
+ * The data remains valid until the reference is released with
+ * openslide_release_tile(), even if the tile is evicted from the cache
+ * or the OpenSlide object is closed.  An @ref openslide_tile_t can be
+ * released from any thread.
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_cache_entry openslide_tile_t;
+
+/**
+ * Pixel formats for openslide_read_region_format().
+ *
+ * @since 4.1.0
+ */
+typedef enum {
+  /** Pre-multiplied ARGB in 32-bit native-endian words, as produced by
+      openslide_read_region(). */
+  OPENSLIDE_PIXEL_FORMAT_ARGB = 0,
+  /** Non-premultiplied R, G, B, A bytes. */
+  OPENSLIDE_PIXEL_FORMAT_RGBA = 1,
+  /** Non-premultiplied R, G, B bytes.  Alpha is discarded, so fully
+      transparent pixels are black. */
+  OPENSLIDE_PIXEL_FORMAT_RGB = 2,
+  /** 8-bit ITU-R BT.601 luma of the non-premultiplied color.  Alpha is
+      discarded. */
+  OPENSLIDE_PIXEL_FORMAT_GRAY = 3,
+} openslide_pixel_format_t;
+
+/**
+ * An asynchronous read submitted with openslide_read_region_async().
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_read_request openslide_read_request_t;
+
+/**
+ * The state of an asynchronous read.
+ *
+ * @since 4.1.0
+ */
+typedef enum {
+  /** The read is queued or running. */
+  OPENSLIDE_READ_PENDING = 0,
+  /** The read finished and the destination buffer holds the region. */
+  OPENSLIDE_READ_SUCCEEDED = 1,
+  /** The read failed.  The error is available from openslide_get_error(),
+      and the destination buffer has been cleared. */
+  OPENSLIDE_READ_FAILED = 2,
+  /** The read was cancelled, and the destination buffer has been
+      cleared. */
+  OPENSLIDE_READ_CANCELLED = 3,
+} openslide_read_status_t;
+
+/**
+ * A function called when an asynchronous read completes.
+ *
+ * The callback runs on a library worker thread.  It must not call
+ * openslide_close() on the request's OpenSlide object.
+ *
+ * @param request The completed request.
+ * @param user_data The pointer passed to openslide_read_region_async().
+ * @since 4.1.0
+ */
+typedef void (*openslide_read_callback_t)(openslide_read_request_t *request,
+                                          void *user_data);
+
 
 /**
  * @name Basic Usage
@@ -94,6 +173,11 @@ const char *openslide_detect_vendor(const char *filename);
  * request.  Instead, it should maintain a cache of OpenSlide objects and
  * reuse them when possible.
  *
+ * Since 4.1.0, @p filename can also be an http:// or https:// URL, which
+ * is read with HTTP range requests.  The server must support range
+ * requests.  Formats that list directories, such as DICOM, can't be read
+ * this way.
+ *
  * @param filename The filename to open.  On Windows, this must be in UTF-8.
  * @return
  *         On success, a new OpenSlide object.
@@ -202,6 +286,498 @@ void openslide_read_region(openslide_t *osr,
 			   int64_t w, int64_t h);
 
 
+/**
+ * Copy pixel data from a whole slide image in the specified format.
+ *
+ * This function is equivalent to openslide_read_region(), except that the
+ * pixels are stored in @p dest in the layout given by @p format, packed
+ * without padding between rows.  @p dest must be a valid pointer to enough
+ * memory to hold the region, at least (@p w * @p h * bytes per pixel)
+ * bytes in length.  If an error occurs or has occurred, then the memory
+ * pointed to by @p dest will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the pixel data.
+ * @param format The pixel format for @p dest.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_format(openslide_t *osr,
+                                  void *dest,
+                                  openslide_pixel_format_t format,
+                                  int64_t x, int64_t y,
+                                  int32_t level,
+                                  int64_t w, int64_t h);
+
+
+/**
+ * Copy pixel data from a whole slide image into a buffer with an explicit
+ * row stride.
+ *
+ * This function is equivalent to openslide_read_region_format(), except
+ * that row @c r of the region starts at byte offset (@c r * @p stride)
+ * within @p dest, so the region can be written straight into part of a
+ * larger image or into one element of a batch.  Bytes between the end of
+ * one row and the start of the next are left untouched.  If an error
+ * occurs or has occurred, then the rows of the region will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the pixel data.
+ * @param stride The distance between the starts of consecutive rows, in
+ *               bytes.  Must be at least (@p w * bytes per pixel), and a
+ *               multiple of 4 for #OPENSLIDE_PIXEL_FORMAT_ARGB.
+ * @param format The pixel format for @p dest.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_strided(openslide_t *osr,
+                                   void *dest, int64_t stride,
+                                   openslide_pixel_format_t format,
+                                   int64_t x, int64_t y,
+                                   int32_t level,
+                                   int64_t w, int64_t h);
+
+
+/**
+ * Copy pre-multiplied ARGB data from a whole slide image at an arbitrary
+ * downsample.
+ *
+ * This function reads from the level given by
+ * openslide_get_best_level_for_downsample() and scales the result to
+ * @p downsample.  Where the slide format allows, tiles are decoded at
+ * reduced resolution rather than decoded at full size and then scaled,
+ * which makes reads far below the resolution of a stored level much
+ * cheaper.  @p dest must be a valid pointer to enough memory to hold the
+ * region, at least (@p w * @p h * 4) bytes in length.  If an error occurs
+ * or has occurred, then the memory pointed to by @p dest will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param downsample The desired downsample, relative to level 0.  Must be
+ *                   positive.
+ * @param w The width of the region, in pixels at @p downsample. Must be
+ *          non-negative.
+ * @param h The height of the region, in pixels at @p downsample. Must be
+ *          non-negative.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_downsample(openslide_t *osr,
+                                      uint32_t *dest,
+                                      int64_t x, int64_t y,
+                                      double downsample,
+                                      int64_t w, int64_t h);
+
+
+/**
+ * Filters for openslide_read_region_scaled().
+ *
+ * @since 4.1.0
+ */
+typedef enum {
+  /** Box averaging for whole factors, then a tent filter. */
+  OPENSLIDE_SCALE_FILTER_FAST = 0,
+  /** Box averaging for whole factors, then a Lanczos-3 filter. */
+  OPENSLIDE_SCALE_FILTER_BEST = 1,
+} openslide_scale_filter_t;
+
+/**
+ * Copy pre-multiplied ARGB data from a region of a whole slide image,
+ * scaled to a requested size.
+ *
+ * The region is read from the level given by
+ * openslide_get_best_level_for_downsample() for the smaller of the
+ * horizontal and vertical scale factors, using reduced-resolution tile
+ * decoding where the slide format allows.  Whole factors beyond that
+ * level are removed by box averaging and the remainder by @p filter.  The
+ * region is processed in pieces, so memory use doesn't grow with the size
+ * of the source region.  @p dest must be a valid pointer to enough memory
+ * to hold the result, at least (@p dest_w * @p dest_h * 4) bytes in
+ * length.  If an error occurs or has occurred, then the memory pointed to
+ * by @p dest will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param w The width of the region, in the level 0 reference frame.  Must
+ *          be positive.
+ * @param h The height of the region, in the level 0 reference frame.
+ *          Must be positive.
+ * @param dest_w The width of the result.  Must be non-negative.
+ * @param dest_h The height of the result.  Must be non-negative.
+ * @param filter The filter.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_scaled(openslide_t *osr,
+                                  uint32_t *dest,
+                                  int64_t x, int64_t y,
+                                  int64_t w, int64_t h,
+                                  int64_t dest_w, int64_t dest_h,
+                                  openslide_scale_filter_t filter);
+
+
+/**
+ * A region to be read by openslide_read_regions().
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_region {
+  /** The destination buffer for the ARGB data, or NULL. */
+  uint32_t *dest;
+  /** The top left x-coordinate, in the level 0 reference frame. */
+  int64_t x;
+  /** The top left y-coordinate, in the level 0 reference frame. */
+  int64_t y;
+  /** The desired level. */
+  int32_t level;
+  /** The width of the region. Must be non-negative. */
+  int64_t w;
+  /** The height of the region. Must be non-negative. */
+  int64_t h;
+} openslide_region_t;
+
+/**
+ * Copy pre-multiplied ARGB data for several regions of a whole slide image.
+ *
+ * This function is equivalent to calling openslide_read_region() for each
+ * element of @p regions, but tiles shared between regions are only
+ * decoded once, and the work is spread across an internal pool of worker
+ * threads.  The regions may be on different levels.  Each region's
+ * @p dest must be a valid pointer to at least (@p w * @p h * 4) bytes,
+ * and the destination buffers must not overlap.  If an error occurs or
+ * has occurred, then the memory pointed to by every @p dest will be
+ * cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param regions An array of regions to read.
+ * @param count The number of elements in @p regions.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_regions(openslide_t *osr,
+                            const openslide_region_t *regions,
+                            int32_t count);
+
+
+/**
+ * Get the number of focal planes in a whole slide image.
+ *
+ * Slides scanned without a Z-stack have one focal plane.  Functions that
+ * don't take a focal plane read the one given by
+ * openslide_get_default_focal_plane().
+ *
+ * @param osr The OpenSlide object.
+ * @return The number of focal planes, or -1 if an error occurred.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+int32_t openslide_get_focal_plane_count(openslide_t *osr);
+
+
+/**
+ * Get the focal plane read by functions that don't take one.
+ *
+ * @param osr The OpenSlide object.
+ * @return The index of the default focal plane, or -1 if an error
+ *         occurred.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+int32_t openslide_get_default_focal_plane(openslide_t *osr);
+
+
+/**
+ * Copy pre-multiplied ARGB data from a region of one focal plane of a
+ * whole slide image.
+ *
+ * This function is equivalent to openslide_read_region(), but reads the
+ * focal plane @p plane.  All focal planes share the OpenSlide object and
+ * its tile cache.  Focal planes other than the default are only
+ * available on levels stored in the slide file, not on levels added by
+ * openslide_set_virtual_levels().  If an error occurs or has occurred,
+ * then the memory pointed to by @p dest will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param plane The desired focal plane, from 0 to
+ *              openslide_get_focal_plane_count() - 1.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_focal_plane(openslide_t *osr,
+                                       uint32_t *dest,
+                                       int64_t x, int64_t y,
+                                       int32_t level,
+                                       int32_t plane,
+                                       int64_t w, int64_t h);
+
+
+/**
+ * Find the tiles of a level that contain tissue.
+ *
+ * The level is divided into tiles of @p tile_w by @p tile_h pixels,
+ * starting at its top left corner.  One byte is written to @p dest per
+ * tile, in row-major order: 1 if the tile contains tissue and 0 if it is
+ * background.  @p dest must be a valid pointer to at least
+ * (ceil(level width / @p tile_w) * ceil(level height / @p tile_h)) bytes.
+ *
+ * Tissue is found in a low-resolution image of the whole slide, no more
+ * than 2048 pixels on a side, which is read from the lowest-resolution
+ * suitable level on first use and kept with the OpenSlide object.  A
+ * pixel is tissue if it is mostly opaque and differs from
+ * #OPENSLIDE_PROPERTY_NAME_BACKGROUND_COLOR, or white if that property is
+ * absent, by more than about 10% in any channel.  A tile touching any
+ * tissue pixel is tissue, so small fragments may be kept but aren't
+ * missed.  If an error occurs or has occurred, then the memory pointed
+ * to by @p dest will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.
+ * @param tile_w The tile width.  Must be positive.
+ * @param tile_h The tile height.  Must be positive.
+ * @param dest The destination buffer for the mask.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_tissue_mask(openslide_t *osr,
+                               int32_t level,
+                               int64_t tile_w, int64_t tile_h,
+                               uint8_t *dest);
+
+
+/**
+ * Start reading pre-multiplied ARGB data from a whole slide image in the
+ * background.
+ *
+ * The read is equivalent to openslide_read_region() but runs on a worker
+ * pool owned by the library, sharing the OpenSlide object's tile cache.
+ * When it completes, successfully or not, @p callback is called if it is
+ * not NULL.  Completion can also be polled with
+ * openslide_read_request_get_status() or awaited with
+ * openslide_read_request_wait().
+ *
+ * @p dest must remain valid until the read completes.  The returned request
+ * must be released with openslide_read_request_free().
+ * openslide_close() waits for outstanding reads of the object.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @param callback A function to call on completion, or NULL.
+ * @param user_data An argument for @p callback.
+ * @return A request handle.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_read_request_t *openslide_read_region_async(openslide_t *osr,
+                                                      uint32_t *dest,
+                                                      int64_t x, int64_t y,
+                                                      int32_t level,
+                                                      int64_t w, int64_t h,
+                                                      openslide_read_callback_t callback,
+                                                      void *user_data);
+
+/**
+ * Cancel an asynchronous read.
+ *
+ * A read that hasn't started will not run.  A running read stops before
+ * decoding any further tiles.  A read that has already completed is
+ * unaffected.  Cancellation does not set an error on the OpenSlide object.
+ *
+ * @param request The request.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_request_cancel(openslide_read_request_t *request);
+
+/**
+ * Get the state of an asynchronous read without blocking.
+ *
+ * @param request The request.
+ * @return The state of the read.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_read_status_t openslide_read_request_get_status(openslide_read_request_t *request);
+
+/**
+ * Wait for an asynchronous read to complete.
+ *
+ * @param request The request.
+ * @return The final state of the read.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_read_status_t openslide_read_request_wait(openslide_read_request_t *request);
+
+/**
+ * Release an asynchronous read request.
+ *
+ * Releasing a request doesn't cancel it; a pending read still runs to
+ * completion and calls its callback.
+ *
+ * @param request The request.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_request_free(openslide_read_request_t *request);
+
+
+/**
+ * Hint that a region will be read soon.
+ *
+ * The tiles covering the region are decoded into the OpenSlide object's
+ * tile cache in the background, so a later openslide_read_region() of the
+ * region can be served from the cache.  Errors are not reported; the later
+ * read will report them.  Regions too large for the cache are ignored.
+ *
+ * @param osr The OpenSlide object.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_prefetch_region(openslide_t *osr,
+                               int64_t x, int64_t y,
+                               int32_t level,
+                               int64_t w, int64_t h);
+
+/**
+ * Enable or disable automatic read-ahead.
+ *
+ * When enabled, OpenSlide watches for reads that walk along a row of a
+ * level's tiles, as when processing every tile of a level in order, and
+ * decodes the next @p tiles tiles of the row in the background.  Reads by
+ * openslide_read_region(), openslide_read_region_format(), and
+ * openslide_get_tile() are considered.  The read-ahead window is
+ * limited to a quarter of the cache capacity.  Read-ahead is disabled by
+ * default.
+ *
+ * @param osr The OpenSlide object.
+ * @param tiles The number of tiles to read ahead, or 0 to disable.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_read_ahead(openslide_t *osr, int32_t tiles);
+
+
+/**
+ * Get read-only pre-multiplied ARGB data for one tile of a whole slide
+ * image, without copying it.
+ *
+ * The tile grid is given by the `openslide.level[N].tile-width` and
+ * `openslide.level[N].tile-height` properties.  The returned pixels are
+ * the same ones openslide_read_region() would produce for the tile's
+ * area, including transparent pixels beyond the right and bottom edges
+ * of the level, with a stride of (tile width * 4) bytes.  When possible,
+ * the pointer references the library's tile cache directly; otherwise
+ * the tile is read into a new buffer.
+ *
+ * The pixel data must not be modified.  It remains valid until @p tile
+ * is released with openslide_release_tile().
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.
+ * @param col The tile column.
+ * @param row The tile row.
+ * @param[out] tile A reference to release with openslide_release_tile(),
+ *                  or NULL if no pixel data was returned.
+ * @return The pixel data, or NULL if the level has no tile geometry,
+ *         the tile is out of range, or an error occurred.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+const uint32_t *openslide_get_tile(openslide_t *osr,
+                                   int32_t level,
+                                   int64_t col, int64_t row,
+                                   openslide_tile_t **tile);
+
+/**
+ * Release a tile reference returned by openslide_get_tile().
+ *
+ * @param tile The tile reference, or NULL.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_release_tile(openslide_tile_t *tile);
+
+/**
+ * Compressed tile formats returned by openslide_get_raw_tile().
+ *
+ * @since 4.1.0
+ */
+typedef enum {
+  /** A JPEG interchange stream, with any shared tables merged in. */
+  OPENSLIDE_TILE_FORMAT_JPEG = 1,
+} openslide_tile_format_t;
+
+/**
+ * Get the compressed data of one tile of a whole slide image, as stored
+ * in the slide file.
+ *
+ * The tile grid is the one openslide_get_tile() uses.  The data is a
+ * standalone image of the full tile width and height, which decodes to
+ * the pixels openslide_get_tile() would return, except that pixels beyond
+ * the right and bottom edges of the level hold whatever the slide stores
+ * there rather than being transparent.  Serving this data avoids decoding
+ * and re-encoding the tile.
+ *
+ * Raw tiles are available only where the slide stores tiles in a format
+ * that can be passed through unchanged, currently JPEG tiles in generic
+ * TIFF, Aperio, and DICOM slides.  Otherwise, or if the tile is missing,
+ * this function returns NULL without setting an error, and the tile can
+ * be read with openslide_get_tile() instead.
+ *
+ * The data must not be modified.  It remains valid until @p tile is
+ * released with openslide_release_tile().
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.
+ * @param col The tile column.
+ * @param row The tile row.
+ * @param[out] format The format of the data.
+ * @param[out] size The size of the data in bytes.
+ * @param[out] tile A reference to release with openslide_release_tile(),
+ *                  or NULL if no data was returned.
+ * @return The compressed data, or NULL if it isn't available or an error
+ *         occurred.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+const void *openslide_get_raw_tile(openslide_t *osr,
+                                   int32_t level,
+                                   int64_t col, int64_t row,
+                                   openslide_tile_format_t *format,
+                                   int64_t *size,
+                                   openslide_tile_t **tile);
+
+
 /**
  * Get the size in bytes of the ICC color profile for the whole slide image.
  *
@@ -231,9 +807,37 @@ OPENSLIDE_PUBLIC()
 void openslide_read_icc_profile(openslide_t *osr, void *dest);
 
 
+/**
+ * Enable or disable conversion of the pixels read from a slide to sRGB.
+ *
+ * When enabled, pixels returned by the read functions and by
+ * openslide_get_tile() are converted from the slide's ICC color profile
+ * to sRGB with a perceptual rendering intent.  The conversion is sampled
+ * from Little CMS into a lookup table when first enabled.  Where the
+ * slide format allows, openslide_get_tile() and reads at integer pixel
+ * offsets in a level use tiles that are converted once and kept in the
+ * cache.  Other reads, such as scaled reads, reads of focal planes, and
+ * reads at fractional offsets, convert their pixels each time.
+ * Associated images and raw tiles are not converted.  Disabled by
+ * default.
+ *
+ * If the slide has no ICC profile, the profile can't be used, or
+ * OpenSlide was built without Little CMS, enabling fails and reads stay
+ * unconverted.  This doesn't put @p osr into an error state.
+ *
+ * @param osr The OpenSlide object.
+ * @param enabled Whether to convert pixels to sRGB.
+ * @return true on success, false if conversion couldn't be enabled.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+bool openslide_set_color_managed(openslide_t *osr, bool enabled);
+
+
 /**
  * Close an OpenSlide object.
- * No other threads may be using the object.
+ * No other threads may be using the object.  Outstanding asynchronous
+ * reads are allowed to complete.
  * After this function returns, the object cannot be used anymore.
  *
  * @param osr The OpenSlide object.
@@ -493,6 +1097,9 @@ void openslide_get_associated_image_dimensions(openslide_t *osr,
  * openslide_read_associated_image_icc_profile() and used to transform the
  * pixels for display.
  *
+ * Since 4.1.0, decoded associated images are kept in the slide's tile
+ * cache, so reading the same image again is fast until it is evicted.
+ *
  * For more information about processing pre-multiplied pixel data, see
  * the [OpenSlide website](https://openslide.org/docs/premultiplied-argb/).
  *
@@ -588,6 +1195,266 @@ void openslide_set_cache(openslide_t *osr, openslide_cache_t *cache);
 OPENSLIDE_PUBLIC()
 void openslide_cache_release(openslide_cache_t *cache);
 
+/**
+ * Set the capacity of the cache's compressed tier.
+ *
+ * Tiles evicted from the cache can be kept zstd-compressed in memory, in
+ * addition to the capacity given to openslide_cache_create().  A read that
+ * misses the cache but finds a tile in the compressed tier decompresses it
+ * rather than decoding it from the slide again.  The compressed tier is
+ * disabled by default.
+ *
+ * @param cache The cache.
+ * @param capacity The capacity of the compressed tier, in compressed
+ *                 bytes, or 0 to disable it.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_set_compressed_capacity(openslide_cache_t *cache,
+                                             size_t capacity);
+
+/**
+ * Store tiles from the cache in a directory.
+ *
+ * Decoded tiles are written to files under @p path, keyed by the slide's
+ * quickhash, level, and tile position.  A read that misses the cache
+ * checks the directory before decoding the tile from the slide, so
+ * processes reading the same slide can share the directory and each tile
+ * is decoded only once.  Files are written in the background.  A
+ * directory on a RAM-backed filesystem such as /dev/shm shares tiles
+ * through memory.  OpenSlide never removes files from the directory.
+ *
+ * Slides without a quickhash are not stored.
+ *
+ * @param cache The cache.
+ * @param path The directory, which will be created if necessary, or NULL
+ *             to stop using it.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_set_persistent_dir(openslide_cache_t *cache,
+                                        const char *path);
+
+/**
+ * Cache priority classes for openslide_set_cache_priority().
+ *
+ * @since 4.1.0
+ */
+typedef enum {
+  /** The default class. */
+  OPENSLIDE_CACHE_PRIORITY_NORMAL,
+  /** Tiles are evicted before any tile in the normal class. */
+  OPENSLIDE_CACHE_PRIORITY_LOW,
+} openslide_cache_priority_t;
+
+/**
+ * Limit the cache space used by an OpenSlide object.
+ *
+ * When tiles read through this object would take more than @p quota bytes
+ * of its cache, its own least valuable tiles are evicted instead of tiles
+ * belonging to other objects sharing the cache.  The quota is kept when
+ * the object is attached to a different cache.
+ *
+ * @param osr The OpenSlide object.
+ * @param quota The quota in bytes, or 0 for no limit.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_cache_quota(openslide_t *osr, size_t quota);
+
+/**
+ * Set the cache priority class of an OpenSlide object.
+ *
+ * Bulk readers sharing a cache with interactive ones can be placed in
+ * @ref OPENSLIDE_CACHE_PRIORITY_LOW so that their tiles are evicted
+ * first.  The class applies to tiles as they are added or next read.
+ *
+ * @param osr The OpenSlide object.
+ * @param priority The priority class.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_cache_priority(openslide_t *osr,
+                                  openslide_cache_priority_t priority);
+
+/**
+ * Cache statistics, as returned by openslide_cache_get_stats() and
+ * openslide_get_cache_stats().
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_cache_stats {
+  /** Lookups that found a tile, in any tier. */
+  uint64_t hits;
+  /** Lookups that found nothing, causing the tile to be decoded. */
+  uint64_t misses;
+  /** Tiles added to the cache. */
+  uint64_t insertions;
+  /** Tiles evicted to make room for others. */
+  uint64_t evictions;
+  /** Tiles too large to fit in the cache at all. */
+  uint64_t rejected;
+  /** Current size of the cached tiles, in bytes. */
+  uint64_t bytes;
+  /** Current number of cached tiles. */
+  uint64_t entries;
+  /** Hits served by the compressed tier.  Included in @p hits. */
+  uint64_t compressed_hits;
+  /** Current size of the compressed tier, in compressed bytes. */
+  uint64_t compressed_bytes;
+  /** Current number of tiles in the compressed tier. */
+  uint64_t compressed_entries;
+  /** Hits served by the persistent directory.  Included in @p hits. */
+  uint64_t persistent_hits;
+} openslide_cache_stats_t;
+
+/**
+ * Get statistics for a cache.
+ *
+ * Event counts cover every OpenSlide object the cache has been attached
+ * to, since the cache was created.
+ *
+ * @param cache The cache.
+ * @param[out] stats The statistics.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_get_stats(openslide_cache_t *cache,
+                               openslide_cache_stats_t *stats);
+
+/**
+ * Get cache statistics for an OpenSlide object.
+ *
+ * The hit, miss, insertion, and rejection counts cover reads through this
+ * OpenSlide object since it was opened, across any caches it has been
+ * attached to.  Eviction counts and sizes describe the cache it is
+ * currently attached to, which may be shared with other objects.
+ *
+ * If the object is in error state, all statistics are zero.
+ *
+ * @param osr The OpenSlide object.
+ * @param[out] stats The statistics.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_cache_stats(openslide_t *osr,
+                               openslide_cache_stats_t *stats);
+
+//@}
+
+/**
+ * @name Instrumentation
+ * Attributing read latency to I/O, decoding, and other phases.
+ */
+//@{
+
+/**
+ * Statistics for one phase of tile reading.
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_phase_stats {
+  /** Number of times the phase ran. */
+  uint64_t count;
+  /** Total time spent in the phase, in nanoseconds. */
+  uint64_t nanoseconds;
+  /** Bytes read from storage or produced by decoding, if applicable. */
+  uint64_t bytes;
+} openslide_phase_stats_t;
+
+/**
+ * Instrumentation statistics, as returned by
+ * openslide_get_instrumentation_stats().
+ *
+ * Phases can nest: decoding through libtiff includes the I/O it performs.
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_instrumentation_stats {
+  /** Reads from slide files.  @p bytes counts bytes read. */
+  openslide_phase_stats_t io;
+  /** Tile decompression.  @p bytes counts decoded bytes. */
+  openslide_phase_stats_t decode;
+  /** Waits for a contended tile cache lock. */
+  openslide_phase_stats_t cache_wait;
+  /**
+   * Drawing tiles into the destination.  @p count is the number of tiles
+   * drawn, and @p nanoseconds excludes the other phases.
+   */
+  openslide_phase_stats_t composite;
+} openslide_instrumentation_stats_t;
+
+/**
+ * Enable or disable instrumentation.
+ *
+ * Instrumentation is off by default.  While it is on, OpenSlide times each
+ * phase of every read and accumulates process-wide statistics.  Setting
+ * the @c OPENSLIDE_TRACE environment variable to a file path turns it on
+ * at startup and also writes every timed phase to that file in Chrome
+ * trace event format, for viewing in Perfetto or chrome://tracing.  Where
+ * the system supports them, @c openslide:phase USDT probes fire as well.
+ *
+ * @param enabled Whether to collect statistics.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_instrumentation(bool enabled);
+
+/**
+ * Get the process-wide instrumentation statistics.
+ *
+ * Statistics accumulate while instrumentation is enabled, until reset
+ * with openslide_reset_instrumentation_stats().
+ *
+ * @param[out] stats The statistics.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_instrumentation_stats(openslide_instrumentation_stats_t *stats);
+
+/**
+ * Reset the process-wide instrumentation statistics to zero.
+ *
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_reset_instrumentation_stats(void);
+
+/**
+ * Statistics for a single read, as returned by
+ * openslide_get_last_read_stats().
+ *
+ * @since 4.1.0
+ */
+typedef struct _openslide_read_stats {
+  /** Number of tiles drawn into the destination. */
+  uint64_t tiles;
+  /** Number of tiles found in the tile cache. */
+  uint64_t cache_hits;
+  /** Number of tiles not found in the tile cache. */
+  uint64_t cache_misses;
+  /** Bytes read from slide files. */
+  uint64_t bytes_read;
+  /** Time spent decompressing tiles, in nanoseconds. */
+  uint64_t decode_nanoseconds;
+} openslide_read_stats_t;
+
+/**
+ * Get statistics for the last read made by the calling thread.
+ *
+ * Statistics are collected by openslide_read_region(),
+ * openslide_read_region_format(), openslide_read_region_downsample(),
+ * openslide_read_region_scaled(), and openslide_read_regions() while
+ * instrumentation is enabled, and include work done on OpenSlide's worker
+ * threads on behalf of the read.  Reads made while instrumentation is
+ * disabled leave the statistics unchanged.
+ *
+ * @param[out] stats The statistics.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_last_read_stats(openslide_read_stats_t *stats);
+
 //@}
 
 /**
@@ -605,6 +1472,303 @@ void openslide_cache_release(openslide_cache_t *cache);
 OPENSLIDE_PUBLIC()
 const char *openslide_get_version(void);
 
+/**
+ * Set the initial size of the TIFF handle cache of slides opened
+ * afterward.
+ *
+ * TIFF-based slides keep idle libtiff handles for reuse by later reads.
+ * Each slide's cache grows automatically to the largest number of reads
+ * that have been in progress at once, but callers that know their thread
+ * count can size it up front to avoid reopening handles while it grows.
+ *
+ * @param handles The number of idle handles to keep, or 0 for the default.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_tiff_handle_cache_size(int32_t handles);
+
+/**
+ * Get process-wide TIFF handle cache counters.
+ *
+ * @param[out] opens The number of TIFF handles opened.
+ * @param[out] reuses The number of times an idle TIFF handle was reused.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_tiff_handle_counts(uint64_t *opens, uint64_t *reuses);
+
+/**
+ * Enable or disable memory-mapping of slide files opened afterward.
+ *
+ * When enabled, tile data in TIFF, MIRAX, and Zeiss slides is read
+ * directly from a mapping of the file rather than copied into a buffer
+ * first.  This helps most for slides on fast local storage.  It is
+ * disabled by default because a mapped file that is truncated or becomes
+ * unreadable while open, for example on a network filesystem, crashes
+ * the process with SIGBUS rather than producing an error.
+ *
+ * @param enabled Whether to map files.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_file_mapping(bool enabled);
+
+/**
+ * Enable or disable lazy loading of properties for slides opened afterward.
+ *
+ * Some formats store a large amount of vendor metadata, which OpenSlide
+ * converts to properties when the slide is opened.  When lazy loading is
+ * enabled, DICOM, Philips, and Zeiss slides skip this at open and read
+ * their vendor properties the first time openslide_get_property_names()
+ * or openslide_get_property_value() is called.  Hamamatsu, MIRAX, and
+ * Trestle slides similarly wait to read the headers of JPEG associated
+ * images until their dimensions or properties are requested.  This speeds
+ * up opening slides that are only used for reading pixels.  Other
+ * properties with the "openslide." prefix are computed at open either way.
+ * If the deferred metadata can't be read, the OpenSlide object is put into
+ * an error state.
+ *
+ * Lazy loading is disabled by default.
+ *
+ * @param enabled Whether to defer loading vendor properties.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_lazy_properties(bool enabled);
+
+/**
+ * Enable or disable virtual levels for slides opened afterward.
+ *
+ * Some slides have only a few pyramid levels, or none besides level 0, so
+ * reading them at low resolution means decoding a large number of tiles.
+ * When virtual levels are enabled, OpenSlide fills gaps of more than 4x
+ * between levels with levels at 2x steps, and adds levels below the
+ * smallest one until a level fits in a single tile.  Virtual levels are
+ * reported like any other level.  Their pixels are computed on demand by
+ * averaging 2x2 blocks of the next larger level, and are kept in the tile
+ * cache, including any directory set with
+ * openslide_cache_set_persistent_dir().
+ *
+ * Virtual levels are disabled by default.
+ *
+ * @param enabled Whether to add virtual levels.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_virtual_levels(bool enabled);
+
+/**
+ * Set the maximum number of threads used to decode a single JPEG 2000
+ * tile.
+ *
+ * Large JPEG 2000 tiles are decoded with several threads when OpenJPEG
+ * supports it.  By default, the processors are divided among the JPEG
+ * 2000 decodes in progress, so concurrent reads don't oversubscribe the
+ * machine.  Callers that run their own parallel reads may want to reduce
+ * the limit, or set it to 1 to decode each tile on a single thread.
+ *
+ * @param threads The maximum number of threads per tile, or 0 for the
+ *                default.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_jp2k_decode_threads(int32_t threads);
+
+/**
+ * Store slide indexes in a directory.
+ *
+ * Some formats require OpenSlide to scan the slide for the information
+ * needed to read tiles efficiently.  Until the scan completes, reads may
+ * be slow.  If an index cache directory is set, the results of these
+ * scans are saved under @p path, keyed by the slide's quickhash, and are
+ * reused when the slide is opened again, even by another process.
+ * OpenSlide never removes files from the directory.
+ *
+ * This currently applies to Hamamatsu slides that lack a precomputed
+ * index.  The directory is checked when a slide is opened.
+ *
+ * @param path The directory, which will be created if necessary, or NULL
+ *             to stop using it.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_index_cache_dir(const char *path);
+
+//@}
+
+/**
+ * @name Slide Registry
+ * Sharing OpenSlide objects between users of the same slide.
+ *
+ * Opening a slide can be slow, and an open slide holds file descriptors
+ * and memory.  A registry opens each slide once and hands out the same
+ * OpenSlide object to every caller who acquires it, keeping a limited
+ * number of unused objects open for reuse.
+ */
+//@{
+
+/**
+ * Create a new slide registry.  Destroy it with openslide_registry_destroy()
+ * when done.
+ *
+ * @param max_slides The maximum number of slides to keep open.  Slides
+ *                   that are still acquired are never closed, so the
+ *                   registry can exceed this limit if that many slides
+ *                   are in use.
+ * @param cache_capacity The capacity, in bytes, of a tile cache shared by
+ *                       all slides in the registry, or 0 to give each
+ *                       slide its own default cache.
+ * @return A new registry.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_registry_t *openslide_registry_create(int32_t max_slides,
+                                                size_t cache_capacity);
+
+/**
+ * Acquire an OpenSlide object for a slide file.
+ *
+ * If the registry already has the file open, and the file's modification
+ * time and size haven't changed, the existing object is returned.
+ * Otherwise the file is opened with openslide_open().  Concurrent calls
+ * for the same file wait for a single open.  Files are identified by the
+ * exact @p filename string.
+ *
+ * If the object is in error, it is returned but not shared, so a later
+ * call will try the open again.  Every object returned must be released
+ * with openslide_registry_release(); do not call openslide_close() on it.
+ *
+ * @param registry The registry.
+ * @param filename The filename to open.
+ * @return An OpenSlide object, or NULL if the file is not recognized as a
+ *         slide, as with openslide_open().
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_t *openslide_registry_acquire(openslide_registry_t *registry,
+                                        const char *filename);
+
+/**
+ * Release an OpenSlide object acquired with openslide_registry_acquire().
+ * Once every caller who acquired the object has released it, the
+ * registry keeps it open for reuse until it is evicted to honor the
+ * registry's slide limit.
+ *
+ * @param registry The registry.
+ * @param osr The OpenSlide object.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_registry_release(openslide_registry_t *registry,
+                                openslide_t *osr);
+
+/**
+ * Close every slide in the registry that isn't currently acquired.
+ *
+ * @param registry The registry.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_registry_close_idle(openslide_registry_t *registry);
+
+/**
+ * Close every slide in the registry and free the registry.  All acquired
+ * OpenSlide objects must be released first.
+ *
+ * @param registry The registry.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_registry_destroy(openslide_registry_t *registry);
+
+//@}
+
+/**
+ * @name Worker Threads
+ * Configuring the threads OpenSlide uses internally.
+ *
+ * Large reads, batched reads, asynchronous reads, and read-ahead decode
+ * tiles on a pool of worker threads shared by every OpenSlide object.
+ * The pool is created on first use, with one thread per processor.
+ * Applications that run their own pool of reader threads can shrink it,
+ * or run everything on the calling thread, to avoid oversubscribing the
+ * CPU.  These settings can be changed at any time and take effect for
+ * work started afterward.  The worker threads are not shared with the
+ * application, even through GLib, so their affinity and priority don't
+ * leak into application threads.
+ */
+//@{
+
+/**
+ * Worker thread scheduling priority.
+ * @since 4.1.0
+ */
+typedef enum {
+  /** Normal priority. */
+  OPENSLIDE_WORKER_PRIORITY_NORMAL = 0,
+  /** Below normal, so worker threads yield to the application. */
+  OPENSLIDE_WORKER_PRIORITY_LOW = 1,
+} openslide_worker_priority_t;
+
+/**
+ * Set the maximum number of worker threads.
+ *
+ * With 0 threads, all work runs inline on the thread that requested it.
+ * Asynchronous reads complete, and run their callbacks, before
+ * openslide_read_region_async() returns.  Prefetch hints and read-ahead
+ * are ignored.  Hamamatsu VMS slides opened afterward skip their
+ * background scan for JPEG restart markers, and find them as tiles are
+ * read.
+ *
+ * @param threads The number of threads, 0 to run everything inline, or
+ *                -1 for one thread per processor.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_worker_threads(int32_t threads);
+
+/**
+ * Restrict worker threads to a set of CPUs.
+ *
+ * Threads pick up the change before starting their next task.
+ * Affinity is supported on Linux and Windows; on Windows, only CPUs in
+ * the calling thread's processor group can be named.
+ *
+ * @param cpus The CPU numbers, or NULL to lift the restriction.
+ * @param count The number of CPUs in @p cpus.
+ * @return false if the platform can't set thread affinity.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+bool openslide_set_worker_cpus(const int32_t *cpus, int32_t count);
+
+/**
+ * Restrict worker threads to the CPUs of a NUMA node.
+ *
+ * This is equivalent to openslide_set_worker_cpus() with the node's CPUs,
+ * and is only supported on Linux.
+ *
+ * @param node The NUMA node, or -1 to lift the restriction.
+ * @return false if the node's CPUs couldn't be found.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+bool openslide_set_worker_numa_node(int32_t node);
+
+/**
+ * Set the scheduling priority of worker threads.
+ *
+ * Threads pick up the change before starting their next task.  On Linux,
+ * low priority raises the threads' nice value, and an unprivileged
+ * process may be unable to lower it again.  Elsewhere except Windows the
+ * priority is ignored.
+ *
+ * @param priority The priority.
+ * @since 4.1.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_worker_priority(openslide_worker_priority_t priority);
+
 //@}
 
 /**
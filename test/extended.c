@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <inttypes.h>
@@ -31,6 +32,8 @@
 #endif
 
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <openslide.h>
 #include "openslide-common.h"
 #include "config.h"
@@ -50,6 +53,271 @@ static void test_image_fetch(openslide_t *osr,
                        x, y, w, h);
 }
 
+#define BATCH_REGIONS 6
+#define BATCH_TILE 256
+
+// batched reads must match individual ones
+static void test_batch_fetch(openslide_t *osr, int64_t x, int64_t y) {
+  openslide_region_t regions[BATCH_REGIONS];
+  g_autofree uint32_t *bufs =
+    g_new(uint32_t, BATCH_REGIONS * BATCH_TILE * BATCH_TILE);
+  g_autofree uint32_t *expected = g_new(uint32_t, BATCH_TILE * BATCH_TILE);
+  int32_t level_count = openslide_get_level_count(osr);
+  for (int i = 0; i < BATCH_REGIONS; i++) {
+    // overlapping tiles with a one-pixel border, as in DeepZoom
+    regions[i] = (openslide_region_t) {
+      .dest = bufs + i * BATCH_TILE * BATCH_TILE,
+      .x = x + (i % 3) * (BATCH_TILE - 2) - 1,
+      .y = y + (i / 3) * (BATCH_TILE - 2) - 1,
+      .level = i % MAX(level_count, 1),
+      .w = BATCH_TILE,
+      .h = BATCH_TILE,
+    };
+  }
+  openslide_read_regions(osr, regions, BATCH_REGIONS);
+  common_fail_on_error(osr, "Batch read failed: %"PRId64" %"PRId64, x, y);
+
+  for (int i = 0; i < BATCH_REGIONS; i++) {
+    openslide_region_t *r = &regions[i];
+    openslide_read_region(osr, expected, r->x, r->y, r->level, r->w, r->h);
+    common_fail_on_error(osr, "Read failed: %"PRId64" %"PRId64, r->x, r->y);
+    if (memcmp(expected, r->dest, r->w * r->h * 4)) {
+      common_fail("Batch read of region %d differs from single read", i);
+    }
+  }
+}
+
+// borrowed tiles must match read_region()
+static void test_tile_fetch(openslide_t *osr) {
+  for (int32_t level = 0; level < openslide_get_level_count(osr); level++) {
+    g_autofree char *tw_prop =
+      g_strdup_printf("openslide.level[%d].tile-width", level);
+    g_autofree char *th_prop =
+      g_strdup_printf("openslide.level[%d].tile-height", level);
+    const char *tw_str = openslide_get_property_value(osr, tw_prop);
+    const char *th_str = openslide_get_property_value(osr, th_prop);
+    if (!tw_str || !th_str) {
+      return;
+    }
+    int64_t tw = g_ascii_strtoll(tw_str, NULL, 10);
+    int64_t th = g_ascii_strtoll(th_str, NULL, 10);
+
+    openslide_tile_t *tile;
+    const uint32_t *tiledata = openslide_get_tile(osr, level, 0, 0, &tile);
+    common_fail_on_error(osr, "Getting tile failed on level %d", level);
+    if (!tiledata || !tile) {
+      common_fail("No tile on level %d", level);
+    }
+    g_autofree uint32_t *buf = g_new(uint32_t, tw * th);
+    openslide_read_region(osr, buf, 0, 0, level, tw, th);
+    if (memcmp(buf, tiledata, tw * th * 4)) {
+      common_fail("Borrowed tile differs from read_region() on level %d",
+                  level);
+    }
+    openslide_release_tile(tile);
+
+    // out of range
+    int64_t w, h;
+    openslide_get_level_dimensions(osr, level, &w, &h);
+    if (openslide_get_tile(osr, level, (w + tw - 1) / tw, 0, &tile) ||
+        tile) {
+      common_fail("Got out-of-range tile on level %d", level);
+    }
+  }
+}
+
+// other pixel formats must match ARGB for opaque pixels
+static void test_format_fetch(openslide_t *osr, int64_t x, int64_t y) {
+  const int64_t w = 300;
+  const int64_t h = 200;
+  g_autofree uint32_t *argb = g_new(uint32_t, w * h);
+  g_autofree uint8_t *rgba = g_new(uint8_t, w * h * 4);
+  g_autofree uint8_t *rgb = g_new(uint8_t, w * h * 3);
+  const int64_t stride = w * 3 + 5;
+  g_autofree uint8_t *strided = g_new(uint8_t, stride * h);
+  for (int32_t level = 0; level < openslide_get_level_count(osr); level++) {
+    openslide_read_region(osr, argb, x, y, level, w, h);
+    openslide_read_region_format(osr, rgba, OPENSLIDE_PIXEL_FORMAT_RGBA,
+                                 x, y, level, w, h);
+    openslide_read_region_format(osr, rgb, OPENSLIDE_PIXEL_FORMAT_RGB,
+                                 x, y, level, w, h);
+    common_fail_on_error(osr, "Format read failed: %"PRId64" %"PRId64" %d",
+                         x, y, level);
+    for (int64_t i = 0; i < w * h; i++) {
+      uint32_t p = argb[i];
+      if (p >> 24 != 255) {
+        continue;
+      }
+      uint8_t r = p >> 16;
+      uint8_t g = p >> 8;
+      uint8_t b = p;
+      if (rgba[4 * i] != r || rgba[4 * i + 1] != g || rgba[4 * i + 2] != b ||
+          rgba[4 * i + 3] != 255 ||
+          rgb[3 * i] != r || rgb[3 * i + 1] != g || rgb[3 * i + 2] != b) {
+        common_fail("Format read differs from ARGB at pixel %"PRId64
+                    " on level %d", i, level);
+      }
+    }
+
+    // strided reads leave the padding alone
+    memset(strided, 0xa5, stride * h);
+    openslide_read_region_strided(osr, strided, stride,
+                                  OPENSLIDE_PIXEL_FORMAT_RGB,
+                                  x, y, level, w, h);
+    common_fail_on_error(osr, "Strided read failed: %"PRId64" %"PRId64" %d",
+                         x, y, level);
+    for (int64_t row = 0; row < h; row++) {
+      uint8_t *p = strided + row * stride;
+      if (memcmp(p, rgb + row * w * 3, w * 3)) {
+        common_fail("Strided read differs at row %"PRId64" on level %d",
+                    row, level);
+      }
+      for (int64_t i = w * 3; i < stride; i++) {
+        if (p[i] != 0xa5) {
+          common_fail("Strided read wrote padding on level %d", level);
+        }
+      }
+    }
+  }
+}
+
+// mean of each byte of ARGB pixels, alpha first
+static void mean_argb(const uint32_t *buf, int64_t count, double *mean) {
+  uint64_t sum[4] = {0};
+  for (int64_t i = 0; i < count; i++) {
+    for (int c = 0; c < 4; c++) {
+      sum[c] += (buf[i] >> (24 - 8 * c)) & 0xff;
+    }
+  }
+  for (int c = 0; c < 4; c++) {
+    mean[c] = count ? (double) sum[c] / count : 0;
+  }
+}
+
+static void test_downsample_fetch(openslide_t *osr, int64_t x, int64_t y) {
+  const int64_t w = 200;
+  const int64_t h = 150;
+  g_autofree uint32_t *buf = g_new(uint32_t, w * h);
+  g_autofree uint32_t *buf2 = g_new(uint32_t, w * h);
+  int32_t levels = openslide_get_level_count(osr);
+  for (int32_t level = 0; level < levels; level++) {
+    // a level's own downsample reads the level
+    double ds = openslide_get_level_downsample(osr, level);
+    openslide_read_region(osr, buf, x, y, level, w, h);
+    openslide_read_region_downsample(osr, buf2, x, y, ds, w, h);
+    common_fail_on_error(osr, "Downsample read failed: %"PRId64" %"PRId64
+                         " %g", x, y, ds);
+    if (memcmp(buf, buf2, w * h * 4)) {
+      common_fail("Downsample read differs from level %d", level);
+    }
+
+    // between levels, and beyond the last.  the result should average
+    // to the same color as the level region it covers.
+    double next = level + 1 < levels ?
+      openslide_get_level_downsample(osr, level + 1) : ds * 16;
+    double mid = (ds + next) / 2;
+    openslide_read_region_downsample(osr, buf2, x, y, mid, w, h);
+    int64_t sw = w * mid / ds;
+    int64_t sh = h * mid / ds;
+    g_autofree uint32_t *src = g_new(uint32_t, sw * sh);
+    openslide_read_region(osr, src, x, y, level, sw, sh);
+    common_fail_on_error(osr, "Downsample read failed: %"PRId64" %"PRId64
+                         " %g", x, y, mid);
+    double expected[4];
+    double actual[4];
+    mean_argb(src, sw * sh, expected);
+    mean_argb(buf2, w * h, actual);
+    for (int c = 0; c < 4; c++) {
+      double diff = actual[c] - expected[c];
+      if (diff > 6 || diff < -6) {
+        common_fail("Downsample read at %g differs from level %d: "
+                    "channel %d mean %g, expected %g",
+                    mid, level, c, actual[c], expected[c]);
+      }
+    }
+
+    openslide_read_region_downsample(osr, buf2, x, y, next * 0.99, w, h);
+    common_fail_on_error(osr, "Downsample read failed: %"PRId64" %"PRId64
+                         " %g", x, y, next);
+  }
+}
+
+static void async_callback(openslide_read_request_t *req,
+                           void *user_data) {
+  gint *completions = user_data;
+  if (openslide_read_request_get_status(req) == OPENSLIDE_READ_PENDING) {
+    common_fail("Async read pending in callback");
+  }
+  g_atomic_int_inc(completions);
+}
+
+static void test_async_fetch(openslide_t *osr, int64_t x, int64_t y) {
+  const int64_t w = 256;
+  const int64_t h = 256;
+  openslide_read_request_t *reqs[8];
+  const int count = G_N_ELEMENTS(reqs);
+  int32_t level = openslide_get_level_count(osr) - 1;
+  double ds = openslide_get_level_downsample(osr, level);
+  g_autofree uint32_t *expected = g_new(uint32_t, w * h);
+  g_autofree uint32_t *bufs = g_new(uint32_t, count * w * h);
+  gint completions = 0;
+
+  openslide_read_region(osr, expected, x, y, level, w, h);
+  for (int i = 0; i < count; i++) {
+    reqs[i] = openslide_read_region_async(osr, bufs + i * w * h,
+                                          x, y, level, w, h,
+                                          async_callback, &completions);
+  }
+  // cancel every other read
+  for (int i = 1; i < count; i += 2) {
+    openslide_read_request_cancel(reqs[i]);
+  }
+  for (int i = 0; i < count; i++) {
+    openslide_read_status_t status = openslide_read_request_wait(reqs[i]);
+    if (status == OPENSLIDE_READ_FAILED || status == OPENSLIDE_READ_PENDING ||
+        (i % 2 == 0 && status != OPENSLIDE_READ_SUCCEEDED)) {
+      common_fail("Async read %d finished with status %d", i, status);
+    }
+    if (status == OPENSLIDE_READ_SUCCEEDED &&
+        memcmp(bufs + i * w * h, expected, w * h * 4)) {
+      common_fail("Async read %d differs from single read", i);
+    }
+    openslide_read_request_free(reqs[i]);
+  }
+  common_fail_on_error(osr, "Async read failed: %"PRId64" %"PRId64" %g",
+                       x, y, ds);
+
+  // a request may still be in its callback after wait() returns
+  while (g_atomic_int_get(&completions) != count) {
+    g_usleep(1000);
+  }
+}
+
+static void test_prefetch(openslide_t *osr, int64_t x, int64_t y) {
+  const int64_t tile = 256;
+  const int tiles = 8;
+  g_autofree uint32_t *expected = g_new(uint32_t, tile * tile * tiles);
+  g_autofree uint32_t *buf = g_new(uint32_t, tile * tile);
+
+  // walk a row of pixels with and without read-ahead
+  for (int i = 0; i < tiles; i++) {
+    openslide_read_region(osr, expected + i * tile * tile,
+                          x + i * tile, y, 0, tile, tile);
+  }
+  openslide_set_read_ahead(osr, 4);
+  openslide_prefetch_region(osr, x, y, 0, tile * tiles, tile);
+  for (int i = 0; i < tiles; i++) {
+    openslide_read_region(osr, buf, x + i * tile, y, 0, tile, tile);
+    if (memcmp(buf, expected + i * tile * tile, tile * tile * 4)) {
+      common_fail("Read with read-ahead differs at %"PRId64" %"PRId64,
+                  x + i * tile, y);
+    }
+  }
+  openslide_set_read_ahead(osr, 0);
+  common_fail_on_error(osr, "Read with read-ahead failed: %"PRId64
+                       " %"PRId64, x, y);
+}
+
 #if !defined(NONATOMIC_CLOEXEC) && !defined(_WIN32)
 static gint leak_test_running;  /* atomic ops only */
 
@@ -185,6 +453,944 @@ static void check_shared_cache(const char *slide) {
   }
 }
 
+// test round-tripping tiles through the compressed tier
+static void check_compressed_cache(const char *slide) {
+  const int64_t w = 1000;
+  const int64_t h = 1000;
+  openslide_t *osr = openslide_open(slide);
+  g_assert(osr);
+  openslide_cache_t *cache = openslide_cache_create(w * h * 4);
+  openslide_cache_set_compressed_capacity(cache, 64 << 20);
+  openslide_set_cache(osr, cache);
+  openslide_cache_release(cache);
+
+  int64_t sw, sh;
+  openslide_get_level0_dimensions(osr, &sw, &sh);
+  g_autofree uint32_t *expected = g_malloc(w * h * 4);
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+  openslide_read_region(osr, expected, sw / 2, sh / 2, 0, w, h);
+  // push the tiles out of the main tier
+  openslide_read_region(osr, buf, sw / 4, sh / 4, 0, w, h);
+  openslide_read_region(osr, buf, sw / 2, sh / 2, 0, w, h);
+  common_fail_on_error(osr, "Read with compressed cache failed");
+  if (memcmp(buf, expected, w * h * 4)) {
+    common_fail("Read with compressed cache differs");
+  }
+  openslide_close(osr);
+}
+
+static void check_cache_stats(const char *slide) {
+  openslide_t *osr = openslide_open(slide);
+  g_assert(osr);
+  openslide_cache_t *cache = openslide_cache_create(32 << 20);
+  openslide_set_cache(osr, cache);
+
+  g_autofree uint32_t *buf = g_malloc(500 * 500 * 4);
+  openslide_cache_stats_t before, after, osr_stats;
+  openslide_read_region(osr, buf, 0, 0, 0, 500, 500);
+  openslide_cache_get_stats(cache, &before);
+  openslide_read_region(osr, buf, 0, 0, 0, 500, 500);
+  openslide_cache_get_stats(cache, &after);
+  common_fail_on_error(osr, "Read for cache stats failed");
+  if (before.misses == 0 || before.insertions == 0 || before.entries == 0 ||
+      before.bytes == 0) {
+    common_fail("Cache stats missing first read");
+  }
+  if (after.misses != before.misses || after.hits <= before.hits) {
+    common_fail("Cached read didn't hit");
+  }
+  openslide_get_cache_stats(osr, &osr_stats);
+  if (osr_stats.hits != after.hits || osr_stats.misses != after.misses) {
+    common_fail("Slide cache stats differ from cache stats");
+  }
+  openslide_cache_release(cache);
+
+  // every tile is too large for this one
+  cache = openslide_cache_create(1);
+  openslide_set_cache(osr, cache);
+  openslide_read_region(osr, buf, 0, 0, 0, 500, 500);
+  openslide_cache_get_stats(cache, &after);
+  if (after.rejected == 0 || after.entries != 0) {
+    common_fail("Overlarge tiles not rejected");
+  }
+  openslide_cache_release(cache);
+  openslide_close(osr);
+}
+
+// a bulk reader with a quota shouldn't displace an interactive one
+static void check_cache_quota(const char *slide) {
+  const int64_t tile = 256;
+  openslide_t *viewer = openslide_open(slide);
+  openslide_t *bulk = openslide_open(slide);
+  g_assert(viewer && bulk);
+  openslide_cache_t *cache = openslide_cache_create(16 << 20);
+  openslide_set_cache(viewer, cache);
+  openslide_set_cache(bulk, cache);
+  openslide_set_cache_quota(bulk, 4 << 20);
+  openslide_set_cache_priority(bulk, OPENSLIDE_CACHE_PRIORITY_LOW);
+
+  int64_t sw, sh;
+  openslide_get_level0_dimensions(viewer, &sw, &sh);
+  g_autofree uint32_t *buf = g_malloc(1000 * 1000 * 4);
+  openslide_read_region(viewer, buf, 0, 0, 0, 1000, 1000);
+  openslide_cache_stats_t viewer_before, viewer_after, cache_stats;
+  openslide_get_cache_stats(viewer, &viewer_before);
+  if (viewer_before.bytes > (8 << 20)) {
+    // tiles too large for the test
+    openslide_cache_release(cache);
+    openslide_close(bulk);
+    openslide_close(viewer);
+    return;
+  }
+
+  for (int64_t y = 0; y < MIN(sh, 20 * tile); y += tile) {
+    for (int64_t x = 0; x < MIN(sw, 20 * tile); x += tile) {
+      openslide_read_region(bulk, buf, x + sw / 2 - 10 * tile,
+                            y + sh / 2 - 10 * tile, 0, tile, tile);
+    }
+  }
+  common_fail_on_error(bulk, "Bulk read failed");
+  openslide_read_region(viewer, buf, 0, 0, 0, 1000, 1000);
+  openslide_get_cache_stats(viewer, &viewer_after);
+  common_fail_on_error(viewer, "Viewer read failed");
+  if (viewer_after.misses != viewer_before.misses) {
+    common_fail("Bulk reader evicted viewer tiles");
+  }
+  openslide_cache_get_stats(cache, &cache_stats);
+  if (cache_stats.bytes > (16 << 20)) {
+    common_fail("Cache over capacity");
+  }
+
+  openslide_cache_release(cache);
+  openslide_close(bulk);
+  openslide_close(viewer);
+}
+
+static void check_file_mapping(const char *slide) {
+  const int64_t w = 1000;
+  const int64_t h = 1000;
+  g_autofree uint32_t *expected = g_malloc(w * h * 4);
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+
+  openslide_t *osr = openslide_open(slide);
+  g_assert(osr);
+  int64_t sw, sh;
+  openslide_get_level0_dimensions(osr, &sw, &sh);
+  openslide_read_region(osr, expected, sw / 2, sh / 2, 0, w, h);
+  openslide_close(osr);
+
+  openslide_set_file_mapping(true);
+  osr = openslide_open(slide);
+  g_assert(osr);
+  openslide_read_region(osr, buf, sw / 2, sh / 2, 0, w, h);
+  common_fail_on_error(osr, "Read with file mapping failed");
+  if (memcmp(buf, expected, w * h * 4)) {
+    common_fail("Read with file mapping differs");
+  }
+  openslide_close(osr);
+  openslide_set_file_mapping(false);
+}
+
+static void check_registry(const char *slide) {
+  openslide_registry_t *reg = openslide_registry_create(1, 16 << 20);
+
+  openslide_t *osr = openslide_registry_acquire(reg, slide);
+  common_fail_on_error(osr, "Registry open failed");
+  if (openslide_registry_acquire(reg, slide) != osr) {
+    common_fail("Registry didn't share open slide");
+  }
+  uint32_t buf[100 * 100];
+  openslide_read_region(osr, buf, 0, 0, 0, 100, 100);
+  common_fail_on_error(osr, "Registry read failed");
+  openslide_registry_release(reg, osr);
+  openslide_registry_release(reg, osr);
+
+  // idle slide should be reused
+  if (openslide_registry_acquire(reg, slide) != osr) {
+    common_fail("Registry didn't reuse idle slide");
+  }
+  openslide_registry_release(reg, osr);
+
+  openslide_registry_close_idle(reg);
+  openslide_registry_destroy(reg);
+}
+
+static void check_lazy_properties(const char *slide) {
+  openslide_t *eager = openslide_open(slide);
+  g_assert(eager);
+  openslide_set_lazy_properties(true);
+  openslide_t *lazy = openslide_open(slide);
+  openslide_set_lazy_properties(false);
+  g_assert(lazy);
+
+  const char * const *names = openslide_get_property_names(eager);
+  const char * const *lazy_names = openslide_get_property_names(lazy);
+  common_fail_on_error(lazy, "Loading lazy properties failed");
+  for (; *names && *lazy_names; names++, lazy_names++) {
+    if (strcmp(*names, *lazy_names) ||
+        strcmp(openslide_get_property_value(eager, *names),
+               openslide_get_property_value(lazy, *lazy_names))) {
+      common_fail("Lazy property %s differs", *names);
+    }
+  }
+  if (*names || *lazy_names) {
+    common_fail("Lazy property count differs");
+  }
+
+  openslide_close(lazy);
+  openslide_close(eager);
+}
+
+static void check_virtual_levels(const char *slide) {
+  openslide_set_virtual_levels(true);
+  openslide_t *osr = openslide_open(slide);
+  openslide_set_virtual_levels(false);
+  common_fail_on_error(osr, "Open with virtual levels failed");
+
+  int32_t levels = openslide_get_level_count(osr);
+  for (int32_t level = 1; level < levels; level++) {
+    double ratio = openslide_get_level_downsample(osr, level) /
+                   openslide_get_level_downsample(osr, level - 1);
+    if (ratio > 4.5) {
+      common_fail("Virtual levels left a %gx gap", ratio);
+    }
+  }
+
+  // read the smallest level, which is usually virtual
+  int64_t w, h;
+  openslide_get_level_dimensions(osr, levels - 1, &w, &h);
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+  openslide_read_region(osr, buf, 0, 0, levels - 1, w, h);
+  common_fail_on_error(osr, "Reading virtual level failed");
+  openslide_close(osr);
+}
+
+static void check_scaled_read(const char *slide) {
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  const int64_t w = 200;
+  const int64_t h = 150;
+  g_autofree uint32_t *buf = g_new(uint32_t, w * h);
+  g_autofree uint32_t *buf2 = g_new(uint32_t, w * h);
+
+  // unscaled reads are exact with either filter
+  openslide_read_region(osr, buf, 0, 0, 0, w, h);
+  for (int filter = 0; filter < 2; filter++) {
+    openslide_read_region_scaled(osr, buf2, 0, 0, w, h, w, h, filter);
+    common_fail_on_error(osr, "Scaled read failed");
+    if (memcmp(buf, buf2, w * h * 4)) {
+      common_fail("Unscaled read with filter %d differs", filter);
+    }
+  }
+
+  // a thumbnail of the whole slide, with unequal scale factors
+  int64_t sw, sh;
+  openslide_get_level0_dimensions(osr, &sw, &sh);
+  for (int filter = 0; filter < 2; filter++) {
+    openslide_read_region_scaled(osr, buf2, 0, 0, sw, sh, w, h, filter);
+    common_fail_on_error(osr, "Scaled thumbnail read failed");
+    for (int64_t i = 0; i < w * h; i++) {
+      uint32_t a = buf2[i] >> 24;
+      if (((buf2[i] >> 16) & 0xff) > a || ((buf2[i] >> 8) & 0xff) > a ||
+          (buf2[i] & 0xff) > a) {
+        common_fail("Scaled read produced invalid pixel %"PRIx32, buf2[i]);
+      }
+    }
+  }
+  openslide_close(osr);
+}
+
+static void check_raw_tiles(const char *slide) {
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  for (int32_t level = 0; level < openslide_get_level_count(osr); level++) {
+    openslide_tile_format_t format;
+    int64_t size;
+    openslide_tile_t *tile;
+    const uint8_t *data =
+      openslide_get_raw_tile(osr, level, 0, 0, &format, &size, &tile);
+    common_fail_on_error(osr, "Reading raw tile failed on level %d", level);
+    if (!data) {
+      continue;
+    }
+    if (format != OPENSLIDE_TILE_FORMAT_JPEG || size < 4 ||
+        data[0] != 0xFF || data[1] != 0xD8) {
+      common_fail("Bad raw tile on level %d", level);
+    }
+    openslide_release_tile(tile);
+  }
+  openslide_close(osr);
+}
+
+static void check_instrumentation(const char *slide) {
+  const int64_t w = 1000;
+  const int64_t h = 1000;
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+  openslide_instrumentation_stats_t stats;
+
+  // nothing is counted while disabled
+  openslide_reset_instrumentation_stats();
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  openslide_read_region(osr, buf, 0, 0, 0, w, h);
+  openslide_get_instrumentation_stats(&stats);
+  if (stats.io.count || stats.decode.count || stats.composite.count) {
+    common_fail("Instrumentation counted while disabled");
+  }
+  openslide_close(osr);
+
+  // a cold read does I/O or decoding
+  openslide_set_instrumentation(true);
+  osr = openslide_open(slide);
+  common_fail_on_error(osr, "Reopen failed");
+  openslide_read_region(osr, buf, 0, 0, 0, w, h);
+  common_fail_on_error(osr, "Read failed");
+  openslide_set_instrumentation(false);
+  openslide_get_instrumentation_stats(&stats);
+  if (!stats.io.count && !stats.decode.count) {
+    common_fail("No phases counted");
+  }
+  if (stats.io.count && !stats.io.bytes) {
+    common_fail("No I/O bytes counted");
+  }
+  openslide_close(osr);
+
+  openslide_reset_instrumentation_stats();
+  openslide_get_instrumentation_stats(&stats);
+  if (stats.io.count || stats.decode.nanoseconds) {
+    common_fail("Instrumentation stats not reset");
+  }
+}
+
+static void check_read_stats(const char *slide) {
+  const int64_t w = 1000;
+  const int64_t h = 1000;
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+  openslide_read_stats_t cold;
+  openslide_read_stats_t warm;
+
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  openslide_set_instrumentation(true);
+  openslide_read_region(osr, buf, 0, 0, 0, w, h);
+  openslide_get_last_read_stats(&cold);
+  openslide_read_region(osr, buf, 0, 0, 0, w, h);
+  openslide_get_last_read_stats(&warm);
+  openslide_set_instrumentation(false);
+  common_fail_on_error(osr, "Read failed");
+  openslide_close(osr);
+
+  if (!cold.tiles || cold.tiles != warm.tiles) {
+    common_fail("Inconsistent tile counts: %"PRIu64", %"PRIu64,
+                cold.tiles, warm.tiles);
+  }
+  if (!warm.cache_hits || warm.cache_misses >= cold.cache_misses ||
+      warm.bytes_read > cold.bytes_read) {
+    common_fail("Second read wasn't served from cache: %"PRIu64" hits, "
+                "%"PRIu64" misses, after %"PRIu64" misses",
+                warm.cache_hits, warm.cache_misses, cold.cache_misses);
+  }
+}
+
+#define TISSUE_MASK_ARG "--tissue-mask--"
+
+// OPENSLIDE_DEBUG for a child process, with a flag added
+static char **debug_environ(const char *flag) {
+  const char *debug = g_getenv("OPENSLIDE_DEBUG");
+  g_autofree char *value =
+    debug && *debug ? g_strdup_printf("%s,%s", debug, flag) : g_strdup(flag);
+  return g_environ_setenv(g_get_environ(), "OPENSLIDE_DEBUG", value, true);
+}
+
+// a generated slide whose empty tiles are background and whose stained
+// tiles are tissue, small enough that the mask has full resolution
+static void check_generated_tissue_mask(void) {
+  const int64_t tile = 256;
+  const int64_t across = 8;
+  const int64_t down = 4;
+  g_autofree char *params =
+    g_strdup_printf("synthetic:width=%"PRId64",height=%"PRId64","
+                    "tile-size=%"PRId64",levels=1,sparsity=0.5,"
+                    "compression=none", across * tile, down * tile, tile);
+  openslide_t *osr = openslide_open(params);
+  common_fail_on_error(osr, "Open of generated slide failed");
+  g_autofree uint8_t *expected = g_malloc(across * down);
+  g_autofree uint8_t *mask = g_malloc(across * down);
+  g_autofree uint8_t *halves = g_malloc(4 * across * down);
+  int64_t tissue = 0;
+  for (int64_t row = 0; row < down; row++) {
+    for (int64_t col = 0; col < across; col++) {
+      uint32_t pixel;
+      openslide_read_region(osr, &pixel, col * tile + tile / 2,
+                            row * tile + tile / 2, 0, 1, 1);
+      expected[row * across + col] = pixel >> 24 != 0;
+      tissue += expected[row * across + col];
+    }
+  }
+  openslide_get_tissue_mask(osr, 0, tile, tile, mask);
+  openslide_get_tissue_mask(osr, 0, tile / 2, tile / 2, halves);
+  common_fail_on_error(osr, "Computing tissue mask of generated slide failed");
+  if (!tissue || tissue == across * down) {
+    common_fail("Generated slide has no background or no tissue");
+  }
+  for (int64_t row = 0; row < 2 * down; row++) {
+    for (int64_t col = 0; col < 2 * across; col++) {
+      uint8_t want = expected[row / 2 * across + col / 2];
+      if (mask[row / 2 * across + col / 2] != want ||
+          halves[row * 2 * across + col] != want) {
+        common_fail("Tissue tile %"PRId64",%"PRId64" classified as %s",
+                    col / 2, row / 2, want ? "background" : "tissue");
+      }
+    }
+  }
+  openslide_close(osr);
+}
+
+static void check_tissue_mask(const char *slide, char *prog) {
+  const int64_t tile = 256;
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+
+  for (int32_t level = 0; level < openslide_get_level_count(osr); level++) {
+    int64_t w, h;
+    openslide_get_level_dimensions(osr, level, &w, &h);
+    int64_t count = ((w + tile - 1) / tile) * ((h + tile - 1) / tile);
+    g_autofree uint8_t *first = g_malloc(count + 1);
+    g_autofree uint8_t *second = g_malloc(count + 1);
+    first[count] = second[count] = 0xa5;
+    openslide_get_tissue_mask(osr, level, tile, tile, first);
+    openslide_get_tissue_mask(osr, level, tile, tile, second);
+    common_fail_on_error(osr, "Computing tissue mask failed");
+    if (first[count] != 0xa5 || second[count] != 0xa5) {
+      common_fail("Tissue mask overran its buffer on level %d", level);
+    }
+    if (memcmp(first, second, count)) {
+      common_fail("Tissue mask changed between calls on level %d", level);
+    }
+    for (int64_t i = 0; i < count; i++) {
+      if (first[i] > 1) {
+        common_fail("Bad tissue mask value %d on level %d", first[i], level);
+      }
+    }
+  }
+  openslide_close(osr);
+
+  // the generated slide needs the synthetic debug flag
+  g_auto(GStrv) env = debug_environ("synthetic");
+  char *argv[] = {prog, TISSUE_MASK_ARG, NULL};
+  g_autoptr(GError) tmp_err = NULL;
+  int status;
+  if (!g_spawn_sync(NULL, argv, env, G_SPAWN_SEARCH_PATH, NULL, NULL,
+                    NULL, NULL, &status, &tmp_err)) {
+    common_fail("Couldn't run generated tissue mask check: %s",
+                tmp_err->message);
+  }
+  if (!g_spawn_check_exit_status(status, &tmp_err)) {
+    common_fail("Generated tissue mask check failed: %s", tmp_err->message);
+  }
+}
+
+static void check_focal_planes(const char *slide) {
+  const int64_t w = 300;
+  const int64_t h = 200;
+  g_autofree uint32_t *expected = g_malloc(w * h * 4);
+  g_autofree uint32_t *actual = g_malloc(w * h * 4);
+
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  int32_t count = openslide_get_focal_plane_count(osr);
+  int32_t plane = openslide_get_default_focal_plane(osr);
+  if (count < 1 || plane < 0 || plane >= count) {
+    common_fail("Bad focal planes: default %d of %d", plane, count);
+  }
+
+  // the default plane is what openslide_read_region() reads
+  openslide_read_region(osr, expected, 100, 100, 0, w, h);
+  openslide_read_region_focal_plane(osr, actual, 100, 100, 0, plane, w, h);
+  common_fail_on_error(osr, "Reading default focal plane failed");
+  if (memcmp(expected, actual, w * h * 4)) {
+    common_fail("Default focal plane differs from read_region()");
+  }
+  for (int32_t i = 0; i < count; i++) {
+    openslide_read_region_focal_plane(osr, actual, 100, 100, 0, i, w, h);
+  }
+  common_fail_on_error(osr, "Reading focal planes failed");
+
+  // out of range
+  openslide_read_region_focal_plane(osr, actual, 0, 0, 0, count, w, h);
+  if (!openslide_get_error(osr)) {
+    common_fail("Reading nonexistent focal plane succeeded");
+  }
+  openslide_close(osr);
+}
+
+static void check_color_managed(const char *slide) {
+  const int64_t w = 300;
+  const int64_t h = 200;
+  g_autofree uint32_t *expected = g_malloc(w * h * 4);
+  g_autofree uint32_t *first = g_malloc(w * h * 4);
+  g_autofree uint32_t *second = g_malloc(w * h * 4);
+
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  openslide_read_region(osr, expected, 100, 100, 0, w, h);
+  bool enabled = openslide_set_color_managed(osr, true);
+  common_fail_on_error(osr, "Enabling color management failed");
+  if (enabled && openslide_get_icc_profile_size(osr) == 0) {
+    common_fail("Enabled color management without an ICC profile");
+  }
+
+  // converted tiles come back from the cache unchanged
+  openslide_read_region(osr, first, 100, 100, 0, w, h);
+  openslide_read_region(osr, second, 100, 100, 0, w, h);
+  common_fail_on_error(osr, "Color-managed read failed");
+  if (memcmp(first, second, w * h * 4)) {
+    common_fail("Color-managed reads differ");
+  }
+  if (!enabled && memcmp(expected, first, w * h * 4)) {
+    common_fail("Read changed when color management couldn't be enabled");
+  }
+  for (int64_t i = 0; i < w * h; i++) {
+    if ((expected[i] >> 24) != (first[i] >> 24)) {
+      common_fail("Color management changed alpha");
+    }
+  }
+
+  openslide_set_color_managed(osr, false);
+  openslide_read_region(osr, first, 100, 100, 0, w, h);
+  common_fail_on_error(osr, "Read after disabling color management failed");
+  if (memcmp(expected, first, w * h * 4)) {
+    common_fail("Read differs after disabling color management");
+  }
+  openslide_close(osr);
+}
+
+#define COLOR_CHECKSUM_ARG "--color-checksum--:"
+
+// checksum of a color-managed read, or NULL if color management isn't
+// available for the slide
+static char *color_managed_checksum(const char *slide) {
+  const int64_t w = 300;
+  const int64_t h = 200;
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  if (!openslide_set_color_managed(osr, true)) {
+    openslide_close(osr);
+    return NULL;
+  }
+  openslide_read_region(osr, buf, 100, 100, 0, w, h);
+  common_fail_on_error(osr, "Color-managed read failed");
+  openslide_close(osr);
+  return g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                     (const guchar *) buf, w * h * 4);
+}
+
+// the SIMD color conversion must match the scalar code exactly
+static void check_color_scalar(const char *slide, char *prog) {
+  g_autofree char *expected = color_managed_checksum(slide);
+  if (!expected) {
+    return;
+  }
+
+  g_auto(GStrv) env = debug_environ("scalar");
+  g_autofree char *arg = g_strdup_printf(COLOR_CHECKSUM_ARG "%s", slide);
+  char *argv[] = {prog, arg, NULL};
+  g_autofree char *out = NULL;
+  g_autoptr(GError) tmp_err = NULL;
+  int status;
+  if (!g_spawn_sync(NULL, argv, env, G_SPAWN_SEARCH_PATH, NULL, NULL,
+                    &out, NULL, &status, &tmp_err)) {
+    common_fail("Couldn't run scalar color conversion: %s",
+                tmp_err->message);
+  }
+  if (!g_spawn_check_exit_status(status, &tmp_err)) {
+    common_fail("Scalar color conversion failed: %s", tmp_err->message);
+  }
+  if (!g_str_equal(g_strstrip(out), expected)) {
+    common_fail("SIMD color conversion differs from scalar");
+  }
+}
+
+static void check_worker_config(const char *slide) {
+  const int64_t w = 1000;
+  const int64_t h = 1000;
+  g_autofree uint32_t *expected = g_malloc(w * h * 4);
+  g_autofree uint32_t *actual = g_malloc(w * h * 4);
+
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  openslide_read_region(osr, expected, 0, 0, 0, w, h);
+
+  // inline reads from a cold cache give the same pixels, and async reads
+  // finish at once
+  openslide_set_worker_threads(0);
+  openslide_set_worker_priority(OPENSLIDE_WORKER_PRIORITY_LOW);
+  openslide_cache_t *cache = openslide_cache_create(64 << 20);
+  openslide_set_cache(osr, cache);
+  openslide_cache_release(cache);
+  openslide_read_region(osr, actual, 0, 0, 0, w, h);
+  common_fail_on_error(osr, "Inline read failed");
+  if (memcmp(expected, actual, w * h * 4)) {
+    common_fail("Inline read differs");
+  }
+  openslide_read_request_t *req =
+    openslide_read_region_async(osr, actual, 0, 0, 0, w, h, NULL, NULL);
+  if (openslide_read_request_get_status(req) != OPENSLIDE_READ_SUCCEEDED) {
+    common_fail("Inline async read didn't complete");
+  }
+  openslide_read_request_free(req);
+  // no worker has run a task at low priority, so none has been reniced
+  openslide_set_worker_priority(OPENSLIDE_WORKER_PRIORITY_NORMAL);
+
+  openslide_set_worker_threads(2);
+  openslide_set_worker_cpus(NULL, 0);
+  openslide_read_region(osr, actual, 0, 0, 0, w, h);
+  common_fail_on_error(osr, "Read with two workers failed");
+  if (memcmp(expected, actual, w * h * 4)) {
+    common_fail("Read with two workers differs");
+  }
+  openslide_set_worker_threads(-1);
+  openslide_close(osr);
+}
+
+// cancelling a large read stops the worker threads helping with it
+static void check_async_cancel(const char *slide) {
+  openslide_t *osr = openslide_open(slide);
+  common_fail_on_error(osr, "Open failed");
+  int64_t w, h;
+  openslide_get_level0_dimensions(osr, &w, &h);
+  w = MIN(w, 4096);
+  h = MIN(h, 4096);
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+  openslide_cache_stats_t full, cancelled;
+
+  openslide_cache_t *cache = openslide_cache_create(256 << 20);
+  openslide_set_cache(osr, cache);
+  openslide_read_region(osr, buf, 0, 0, 0, w, h);
+  common_fail_on_error(osr, "Uncancelled read failed");
+  openslide_cache_get_stats(cache, &full);
+  openslide_cache_release(cache);
+
+  cache = openslide_cache_create(256 << 20);
+  openslide_set_cache(osr, cache);
+  openslide_read_request_t *req =
+    openslide_read_region_async(osr, buf, 0, 0, 0, w, h, NULL, NULL);
+  // wait for decoding to start
+  do {
+    g_usleep(100);
+    openslide_cache_get_stats(cache, &cancelled);
+  } while (!cancelled.misses &&
+           openslide_read_request_get_status(req) == OPENSLIDE_READ_PENDING);
+  openslide_read_request_cancel(req);
+  openslide_read_status_t status = openslide_read_request_wait(req);
+  openslide_read_request_free(req);
+  openslide_cache_get_stats(cache, &cancelled);
+  openslide_cache_release(cache);
+  common_fail_on_error(osr, "Cancelled read failed");
+  // the read may have finished before we cancelled it
+  if (status == OPENSLIDE_READ_CANCELLED && full.misses > 16 &&
+      cancelled.misses >= full.misses) {
+    common_fail("Cancelled read decoded every tile");
+  }
+  openslide_close(osr);
+}
+
+// A local HTTP server for one file.  The first path component picks the
+// behavior: "206" serves ranges, "200" ignores them, "416" claims the
+// file is empty, "short" truncates every range, and "r" redirects
+// "/r/x/NAME" to "../../206/NAME".  Connections carry one request,
+// except in "keep" mode, which serves ranges over keep-alive connections
+// and records the most requests served on one connection.
+struct http_server {
+  GMainContext *ctx;
+  GMainLoop *loop;
+  GSocketService *service;
+  GThread *thread;
+  uint16_t port;
+  const char *data;
+  int64_t size;
+  gint requests;
+  gint max_connection_requests;
+};
+
+// handle one request, returning true if the connection stays open
+static bool http_request(struct http_server *srv, GSocketConnection *conn,
+                         GDataInputStream *in, gint *served) {
+  g_autofree char *request = g_data_input_stream_read_line(in, NULL, NULL,
+                                                           NULL);
+  g_auto(GStrv) words = g_strsplit(request ? request : "", " ", 3);
+  if (g_strv_length(words) < 2) {
+    return false;
+  }
+  g_atomic_int_inc(&srv->requests);
+  gint count = ++*served;
+  gint max = g_atomic_int_get(&srv->max_connection_requests);
+  while (count > max &&
+         !g_atomic_int_compare_and_exchange(&srv->max_connection_requests,
+                                            max, count)) {
+    max = g_atomic_int_get(&srv->max_connection_requests);
+  }
+  int64_t start = 0;
+  int64_t end = srv->size - 1;
+  while (true) {
+    g_autofree char *line = g_data_input_stream_read_line(in, NULL, NULL,
+                                                          NULL);
+    if (!line || !line[0]) {
+      break;
+    }
+    if (!g_ascii_strncasecmp(line, "Range: bytes=", 13)) {
+      char *p;
+      start = g_ascii_strtoll(line + 13, &p, 10);
+      end = MIN(g_ascii_strtoll(p + 1, NULL, 10), srv->size - 1);
+    }
+  }
+
+  g_auto(GStrv) path = g_strsplit(words[1], "/", 0);
+  const char *mode = g_strv_length(path) > 1 ? path[1] : "";
+  g_autofree char *head = NULL;
+  int64_t len = 0;
+  if (g_str_equal(mode, "r") && g_strv_length(path) == 4) {
+    head = g_strdup_printf("HTTP/1.1 302 Found\r\n"
+                           "Location: ../../206/%s\r\n"
+                           "Content-Length: 0\r\n", path[3]);
+  } else if (g_str_equal(mode, "200")) {
+    head = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                           "Content-Length: %"PRId64"\r\n", srv->size);
+  } else if (g_str_equal(mode, "416") || start >= srv->size) {
+    head = g_strdup_printf("HTTP/1.1 416 Range Not Satisfiable\r\n"
+                           "Content-Range: bytes */%"PRId64"\r\n"
+                           "Content-Length: 0\r\n",
+                           g_str_equal(mode, "416") ? 0 : srv->size);
+  } else if (g_str_equal(mode, "206") || g_str_equal(mode, "short") ||
+             g_str_equal(mode, "keep")) {
+    len = end - start + 1;
+    if (g_str_equal(mode, "short")) {
+      len = MAX(len / 2, 1);
+    }
+    head = g_strdup_printf("HTTP/1.1 206 Partial Content\r\n"
+                           "Content-Range: bytes %"PRId64"-%"PRId64
+                           "/%"PRId64"\r\n"
+                           "Content-Length: %"PRId64"\r\n",
+                           start, start + len - 1, srv->size, len);
+  } else {
+    head = g_strdup("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n");
+  }
+  bool keep = g_str_equal(mode, "keep");
+  GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+  g_autofree char *response =
+    g_strdup_printf("%sConnection: %s\r\n\r\n", head,
+                    keep ? "keep-alive" : "close");
+  if (!g_output_stream_write_all(out, response, strlen(response), NULL, NULL,
+                                 NULL)) {
+    return false;
+  }
+  if (len && !g_output_stream_write_all(out, srv->data + start, len, NULL,
+                                        NULL, NULL)) {
+    return false;
+  }
+  return keep;
+}
+
+// runs on its own thread, so idle keep-alive connections don't block
+// the others
+static gboolean http_incoming(GThreadedSocketService *service G_GNUC_UNUSED,
+                              GSocketConnection *conn,
+                              GObject *source G_GNUC_UNUSED,
+                              gpointer user_data) {
+  struct http_server *srv = user_data;
+  // drop idle keep-alive connections, so the thread exits
+  g_socket_set_timeout(g_socket_connection_get_socket(conn), 2);
+  g_autoptr(GDataInputStream) in = g_data_input_stream_new(
+    g_io_stream_get_input_stream(G_IO_STREAM(conn)));
+  g_data_input_stream_set_newline_type(in, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+  gint served = 0;
+  while (http_request(srv, conn, in, &served)) {
+    continue;
+  }
+  g_io_stream_close(G_IO_STREAM(conn), NULL, NULL);
+  return true;
+}
+
+static void *http_server_thread(void *data) {
+  struct http_server *srv = data;
+  g_main_loop_run(srv->loop);
+  return NULL;
+}
+
+static void http_server_start(struct http_server *srv,
+                              const char *data, int64_t size) {
+  srv->data = data;
+  srv->size = size;
+  srv->ctx = g_main_context_new();
+  srv->loop = g_main_loop_new(srv->ctx, false);
+
+  // accept on the server thread's context
+  g_main_context_push_thread_default(srv->ctx);
+  srv->service = g_threaded_socket_service_new(-1);
+  g_autoptr(GInetAddress) loopback =
+    g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+  g_autoptr(GSocketAddress) addr = g_inet_socket_address_new(loopback, 0);
+  g_autoptr(GSocketAddress) bound = NULL;
+  g_autoptr(GError) err = NULL;
+  if (!g_socket_listener_add_address(G_SOCKET_LISTENER(srv->service), addr,
+                                     G_SOCKET_TYPE_STREAM,
+                                     G_SOCKET_PROTOCOL_TCP, NULL, &bound,
+                                     &err)) {
+    common_fail("Couldn't start HTTP server: %s", err->message);
+  }
+  srv->port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(bound));
+  g_signal_connect(srv->service, "run", G_CALLBACK(http_incoming), srv);
+  g_socket_service_start(srv->service);
+  g_main_context_pop_thread_default(srv->ctx);
+
+  srv->thread = g_thread_new("http-server", http_server_thread, srv);
+}
+
+static void http_server_stop(struct http_server *srv) {
+  g_socket_service_stop(srv->service);
+  g_socket_listener_close(G_SOCKET_LISTENER(srv->service));
+  g_main_loop_quit(srv->loop);
+  g_thread_join(srv->thread);
+  g_object_unref(srv->service);
+  g_main_loop_unref(srv->loop);
+  g_main_context_unref(srv->ctx);
+}
+
+static void check_http(const char *slide) {
+  g_autofree char *contents = NULL;
+  gsize size;
+  if (!g_file_get_contents(slide, &contents, &size, NULL)) {
+    // not a single file
+    return;
+  }
+  g_autofree char *name = g_path_get_basename(slide);
+  const char *vendor = openslide_detect_vendor(slide);
+  struct http_server srv = {0};
+  http_server_start(&srv, contents, size);
+
+  g_autofree char *url = g_strdup_printf("http://127.0.0.1:%u/206/%s",
+                                         srv.port, name);
+  g_autofree char *redirect = g_strdup_printf("http://127.0.0.1:%u/r/x/%s",
+                                              srv.port, name);
+  // formats with companion files may not be readable over HTTP
+  if (vendor && openslide_detect_vendor(url)) {
+    if (g_strcmp0(openslide_detect_vendor(url), vendor)) {
+      common_fail("Vendor differs over HTTP");
+    }
+    if (g_strcmp0(openslide_detect_vendor(redirect), vendor)) {
+      common_fail("Vendor differs after relative redirect");
+    }
+    const int64_t w = 500;
+    const int64_t h = 500;
+    g_autofree uint32_t *expected = g_malloc(w * h * 4);
+    g_autofree uint32_t *actual = g_malloc(w * h * 4);
+    openslide_t *osr = openslide_open(slide);
+    openslide_t *remote = openslide_open(redirect);
+    common_fail_on_error(remote, "Open over HTTP failed");
+    int64_t sw, sh;
+    openslide_get_level0_dimensions(osr, &sw, &sh);
+    openslide_read_region(osr, expected, sw / 2, sh / 2, 0, w, h);
+    openslide_read_region(remote, actual, sw / 2, sh / 2, 0, w, h);
+    common_fail_on_error(remote, "Read over HTTP failed");
+    if (memcmp(expected, actual, w * h * 4)) {
+      common_fail("Read over HTTP differs");
+    }
+    openslide_close(remote);
+    openslide_close(osr);
+
+    // the open request is served alone, so the next request must reuse
+    // its connection
+    g_autofree char *keep = g_strdup_printf("http://127.0.0.1:%u/keep/%s",
+                                            srv.port, name);
+    g_atomic_int_set(&srv.requests, 0);
+    g_atomic_int_set(&srv.max_connection_requests, 0);
+    remote = openslide_open(keep);
+    common_fail_on_error(remote, "Open over keep-alive HTTP failed");
+    openslide_read_region(remote, actual, 0, 0, 0, w, h);
+    openslide_read_region(remote, actual, sw - w, sh - h, 0, w, h);
+    common_fail_on_error(remote, "Read over keep-alive HTTP failed");
+    openslide_close(remote);
+    if (g_atomic_int_get(&srv.requests) > 1 &&
+        g_atomic_int_get(&srv.max_connection_requests) < 2) {
+      common_fail("Sequential HTTP requests didn't share a connection");
+    }
+  }
+
+  // servers that can't serve the ranges we asked for
+  const char *const modes[] = {"200", "416", "short"};
+  for (guint i = 0; i < G_N_ELEMENTS(modes); i++) {
+    g_autofree char *bad = g_strdup_printf("http://127.0.0.1:%u/%s/%s",
+                                           srv.port, modes[i], name);
+    if (openslide_detect_vendor(bad)) {
+      common_fail("Detected a vendor from HTTP server mode %s", modes[i]);
+    }
+  }
+  http_server_stop(&srv);
+}
+
+static void remove_tree(const char *path) {
+  g_autoptr(GDir) dir = g_dir_open(path, 0, NULL);
+  if (dir) {
+    const char *name;
+    while ((name = g_dir_read_name(dir))) {
+      g_autofree char *child = g_build_filename(path, name, NULL);
+      remove_tree(child);
+    }
+  }
+  g_remove(path);
+}
+
+static void check_persistent_cache(const char *slide) {
+  const int64_t w = 1000;
+  const int64_t h = 1000;
+  g_autofree char *dir = g_dir_make_tmp("openslide-test-XXXXXX", NULL);
+  g_assert(dir);
+  int64_t sw, sh;
+  g_autofree uint32_t *expected = g_malloc(w * h * 4);
+  g_autofree uint32_t *buf = g_malloc(w * h * 4);
+
+  // populate the directory
+  openslide_t *osr = openslide_open(slide);
+  g_assert(osr);
+  if (!openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_QUICKHASH1)) {
+    openslide_close(osr);
+    g_remove(dir);
+    return;
+  }
+  openslide_cache_t *cache = openslide_cache_create(32 << 20);
+  openslide_cache_set_persistent_dir(cache, dir);
+  openslide_set_cache(osr, cache);
+  openslide_cache_release(cache);
+  openslide_get_level0_dimensions(osr, &sw, &sh);
+  openslide_read_region(osr, expected, sw / 2, sh / 2, 0, w, h);
+  common_fail_on_error(osr, "Read with persistent cache failed");
+  openslide_close(osr);
+
+  // files are written in the background
+  g_autofree char *version_dir = g_build_filename(dir, "v1", NULL);
+  for (int i = 0; i < 100 && !g_file_test(version_dir, G_FILE_TEST_IS_DIR);
+       i++) {
+    g_usleep(50000);
+  }
+
+  // read through a second handle with a cold cache
+  osr = openslide_open(slide);
+  g_assert(osr);
+  cache = openslide_cache_create(32 << 20);
+  openslide_cache_set_persistent_dir(cache, dir);
+  openslide_set_cache(osr, cache);
+  openslide_cache_release(cache);
+  openslide_read_region(osr, buf, sw / 2, sh / 2, 0, w, h);
+  common_fail_on_error(osr, "Read from persistent cache failed");
+  if (memcmp(buf, expected, w * h * 4)) {
+    common_fail("Read from persistent cache differs");
+  }
+  openslide_close(osr);
+
+  remove_tree(dir);
+}
+
 int main(int argc, char **argv) {
   common_fix_argv(&argc, &argv);
   if (argc != 2) {
@@ -196,6 +1402,16 @@ int main(int argc, char **argv) {
     common_check_open_fds(NULL, "Leaked file descriptor to exec child");
     return 0;
   }
+  if (g_str_equal(path, TISSUE_MASK_ARG)) {
+    check_generated_tissue_mask();
+    return 0;
+  }
+  if (g_str_has_prefix(path, COLOR_CHECKSUM_ARG)) {
+    g_autofree char *checksum =
+      color_managed_checksum(path + strlen(COLOR_CHECKSUM_ARG));
+    printf("%s\n", checksum ? checksum : "");
+    return 0;
+  }
 
   g_autoptr(GHashTable) fds = common_get_open_fds();
 
@@ -301,6 +1517,17 @@ int main(int argc, char **argv) {
   test_image_fetch(osr, w - 20, 0, 40, 100);
   test_image_fetch(osr, 0, h - 20, 100, 40);
 
+  test_batch_fetch(osr, w/2, h/2);
+  test_tile_fetch(osr);
+  test_format_fetch(osr, w/2, h/2);
+  test_format_fetch(osr, w/3 + 1, h/3 + 1);
+
+  test_downsample_fetch(osr, w/2, h/2);
+
+  test_async_fetch(osr, w/2, h/2);
+
+  test_prefetch(osr, w/2, h/2);
+
   // active region
   const char *bounds_x = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_X);
   const char *bounds_y = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_Y);
@@ -320,5 +1547,25 @@ int main(int argc, char **argv) {
 
   check_shared_cache(path);
 
+  check_compressed_cache(path);
+  check_persistent_cache(path);
+  check_cache_stats(path);
+  check_cache_quota(path);
+  check_file_mapping(path);
+  check_registry(path);
+  check_lazy_properties(path);
+  check_virtual_levels(path);
+  check_scaled_read(path);
+  check_raw_tiles(path);
+  check_instrumentation(path);
+  check_read_stats(path);
+  check_tissue_mask(path, argv[0]);
+  check_focal_planes(path);
+  check_color_managed(path);
+  check_color_scalar(path, argv[0]);
+  check_worker_config(path);
+  check_async_cancel(path);
+  check_http(path);
+
   return 0;
 }
@@ -25,7 +25,9 @@
 #include "slidetool.h"
 
 #include <png.h>
+#include <zlib.h>
 #include <inttypes.h>
+#include <errno.h>
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,7 +37,10 @@
 static const char SOFTWARE[] = "Software";
 static const char OPENSLIDE[] = "OpenSlide <https://openslide.org/>";
 static const char ICC_PROFILE[] = "ICC";
-static const uint32_t BUFSIZE = 16 << 20;
+static const uint32_t STRIP_SIZE = 4 << 20;
+
+static int32_t jobs;
+static int32_t compression_level = Z_DEFAULT_COMPRESSION;
 
 #define ENSURE_NONNEG(i) \
   if (i < 0) {                               \
@@ -81,10 +86,9 @@ static void setup_png(png_structp png_ptr, png_infop info_ptr,
   png_set_text(png_ptr, info_ptr, text_ptr, 1);
 }
 
-static void write_lines_png(png_structp png_ptr, uint32_t *buf,
-                            int32_t w, int32_t h) {
-  // un-premultiply alpha and pack into expected format, modifying buf
-  for (int32_t i = 0; i < w * h; i++) {
+// un-premultiply alpha and pack into PNG RGBA order, in place
+static void pack_rgba(uint32_t *buf, int64_t count) {
+  for (int64_t i = 0; i < count; i++) {
     uint32_t p = buf[i];
 
     uint8_t a = p >> 24;
@@ -105,12 +109,187 @@ static void write_lines_png(png_structp png_ptr, uint32_t *buf,
       buf[i] = GUINT32_TO_BE(r << 24 | g << 16 | b << 8 | a);
     }
   }
+}
+
+static void write_lines_png(png_structp png_ptr, uint32_t *buf,
+                            int32_t w, int32_t h) {
+  // modifies buf
+  pack_rgba(buf, (int64_t) w * h);
 
   for (int32_t i = 0; i < h; i++) {
     png_write_row(png_ptr, (png_bytep) &buf[w * i]);
   }
 }
 
+static int32_t get_jobs(void) {
+  return jobs > 0 ? jobs : (int32_t) g_get_num_processors();
+}
+
+static void check_png_options(void) {
+  if (compression_level < -1 || compression_level > 9) {
+    common_fail("Compression level must be between 0 and 9");
+  }
+}
+
+// Region export encodes the image data itself, so compression can run in
+// parallel.  The region is split into strips, and each strip is read,
+// filtered, and deflated on a worker thread into raw deflate blocks ending
+// on a byte boundary, as pigz does.  The main thread writes the strips as
+// IDAT chunks in order, between a zlib header and the combined Adler-32
+// checksum.  Each worker also reads the row above its strip, so the
+// filters see the same data they would in a single stream.
+
+struct png_encoder {
+  openslide_t *osr;
+  int64_t x;
+  int64_t y;  // in the level
+  int32_t level;
+  double downsample;
+  int32_t w;
+  int32_t h;
+
+  GPtrArray *strips;
+  guint next_push;
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+};
+
+struct png_strip {
+  int32_t y;  // first row
+  int32_t rows;
+  uint8_t *data;  // deflated, once done
+  size_t len;
+  uLong adler;
+  size_t raw_len;
+  bool done;
+};
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+// filter a row into out, with the adaptive heuristic libpng uses: the
+// filter minimizing the sum of absolute signed residuals
+static void filter_row(const uint8_t *row, const uint8_t *prev,
+                       size_t len, uint8_t *out, uint8_t *scratch) {
+  const int bpp = 4;
+  uint64_t best_sum = UINT64_MAX;
+  int types = compression_level == 0 ? 1 : 5;
+  for (int type = 0; type < types; type++) {
+    uint8_t *dst = type == 0 ? out + 1 : scratch;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+      uint8_t a = i >= bpp ? row[i - bpp] : 0;
+      uint8_t b = prev ? prev[i] : 0;
+      uint8_t c = prev && i >= bpp ? prev[i - bpp] : 0;
+      uint8_t v = row[i];
+      switch (type) {
+      case 1:
+        v -= a;
+        break;
+      case 2:
+        v -= b;
+        break;
+      case 3:
+        v -= (a + b) / 2;
+        break;
+      case 4:
+        v -= paeth(a, b, c);
+        break;
+      }
+      dst[i] = v;
+      sum += v < 128 ? v : 256 - v;
+    }
+    if (type == 0) {
+      out[0] = 0;
+      best_sum = sum;
+    } else if (sum < best_sum) {
+      out[0] = type;
+      memcpy(out + 1, scratch, len);
+      best_sum = sum;
+    }
+  }
+}
+
+static void encode_strip(void *data, void *user_data) {
+  struct png_strip *strip = data;
+  struct png_encoder *enc = user_data;
+  const size_t stride = (size_t) enc->w * 4;
+
+  // read the strip and the row above it
+  int32_t first = MAX(strip->y - 1, 0);
+  int32_t rows = strip->y + strip->rows - first;
+  g_autofree uint32_t *buf = g_malloc(stride * rows);
+  openslide_read_region(enc->osr, buf, enc->x,
+                        (enc->y + first) * enc->downsample,
+                        enc->level, enc->w, rows);
+  common_fail_on_error(enc->osr, "Reading region");
+  pack_rgba(buf, (int64_t) enc->w * rows);
+
+  strip->raw_len = (stride + 1) * strip->rows;
+  g_autofree uint8_t *filtered = g_malloc(strip->raw_len);
+  g_autofree uint8_t *scratch = g_malloc(stride);
+  for (int32_t i = 0; i < strip->rows; i++) {
+    int32_t y = strip->y + i;
+    const uint8_t *row = (const uint8_t *) buf + (y - first) * stride;
+    filter_row(row, y ? row - stride : NULL, stride,
+               filtered + i * (stride + 1), scratch);
+  }
+
+  // deflate, ending on a byte boundary unless this is the last strip
+  bool last = strip->y + strip->rows == enc->h;
+  z_stream zs = {0};
+  if (deflateInit2(&zs, compression_level, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    common_fail("Could not initialize zlib");
+  }
+  size_t cap = deflateBound(&zs, strip->raw_len) + 16;
+  uint8_t *out = g_malloc(cap);
+  zs.next_in = filtered;
+  zs.avail_in = strip->raw_len;
+  int ret;
+  do {
+    if (zs.total_out == cap) {
+      cap *= 2;
+      out = g_realloc(out, cap);
+    }
+    zs.next_out = out + zs.total_out;
+    zs.avail_out = cap - zs.total_out;
+    ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (ret == Z_STREAM_ERROR) {
+      common_fail("Error compressing PNG");
+    }
+  } while (last ? ret != Z_STREAM_END : zs.avail_out == 0);
+  deflateEnd(&zs);
+
+  g_mutex_lock(&enc->lock);
+  strip->data = out;
+  strip->len = zs.total_out;
+  strip->adler = adler32(adler32(0, NULL, 0), filtered, strip->raw_len);
+  strip->done = true;
+  g_cond_broadcast(&enc->cond);
+  g_mutex_unlock(&enc->lock);
+}
+
+static void push_strip(struct png_encoder *enc) {
+  if (enc->next_push < enc->strips->len) {
+    g_thread_pool_push(enc->pool, enc->strips->pdata[enc->next_push++],
+                       NULL);
+  }
+}
+
+static void write_idat(png_structp png_ptr, const uint8_t *data, size_t len) {
+  png_write_chunk(png_ptr, (png_const_bytep) "IDAT", data, len);
+}
+
 static void write_png(openslide_t *osr, FILE *f,
                       int64_t x, int64_t y, int32_t level,
                       int32_t w, int32_t h) {
@@ -154,26 +333,66 @@ static void write_png(openslide_t *osr, FILE *f,
   // start writing
   png_write_info(png_ptr, info_ptr);
 
-  const int32_t lines_at_a_time = MAX(BUFSIZE / (w * 4), 1);
-  g_autofree uint32_t *dest = g_malloc(lines_at_a_time * w * 4);
-  int32_t lines_to_draw = h;
   double ds = openslide_get_level_downsample(osr, level);
-  int32_t yy = y / ds;
-  while (lines_to_draw) {
-    const int32_t lines = MIN(lines_at_a_time, lines_to_draw);
-    openslide_read_region(osr, dest,
-                          x, yy * ds, level, w, lines);
-
-    common_fail_on_error(osr, "Reading region");
+  struct png_encoder enc = {
+    .osr = osr,
+    .x = x,
+    .y = y / ds,
+    .level = level,
+    .downsample = ds,
+    .w = w,
+    .h = h,
+    .strips = g_ptr_array_new(),
+  };
+  const int32_t lines_per_strip = MAX(STRIP_SIZE / ((int64_t) w * 4), 1);
+  for (int32_t yy = 0; yy < h; yy += lines_per_strip) {
+    struct png_strip *strip = g_new0(struct png_strip, 1);
+    strip->y = yy;
+    strip->rows = MIN(lines_per_strip, h - yy);
+    g_ptr_array_add(enc.strips, strip);
+  }
+  g_mutex_init(&enc.lock);
+  g_cond_init(&enc.cond);
+  enc.pool = g_thread_pool_new(encode_strip, &enc, get_jobs(), true, NULL);
+  for (int32_t i = 0; i < 2 * get_jobs(); i++) {
+    push_strip(&enc);
+  }
 
-    write_lines_png(png_ptr, dest, w, lines);
+  // zlib header
+  int level_flags = compression_level < 0 ? 2 :
+                    compression_level < 2 ? 0 :
+                    compression_level < 6 ? 1 :
+                    compression_level == 6 ? 2 : 3;
+  uint16_t header = 0x7800 | level_flags << 6;
+  header += 31 - header % 31;
+  uint8_t header_bytes[2] = {header >> 8, header & 0xff};
+  write_idat(png_ptr, header_bytes, sizeof(header_bytes));
+
+  uLong adler = adler32(0, NULL, 0);
+  for (guint i = 0; i < enc.strips->len; i++) {
+    struct png_strip *strip = enc.strips->pdata[i];
+    g_mutex_lock(&enc.lock);
+    while (!strip->done) {
+      g_cond_wait(&enc.cond, &enc.lock);
+    }
+    g_mutex_unlock(&enc.lock);
+    push_strip(&enc);
 
-    yy += lines;
-    lines_to_draw -= lines;
+    write_idat(png_ptr, strip->data, strip->len);
+    adler = adler32_combine(adler, strip->adler, strip->raw_len);
+    g_free(strip->data);
+    g_free(strip);
   }
+  g_thread_pool_free(enc.pool, false, true);
+  g_cond_clear(&enc.cond);
+  g_mutex_clear(&enc.lock);
+  g_ptr_array_free(enc.strips, true);
 
-  // end
-  png_write_end(png_ptr, info_ptr);
+  uint8_t trailer[4] = {adler >> 24, adler >> 16, adler >> 8, adler};
+  write_idat(png_ptr, trailer, sizeof(trailer));
+
+  // end; we wrote the IDATs ourselves, so libpng can't write IEND
+  png_write_chunk(png_ptr, (png_const_bytep) "IEND", NULL, 0);
   png_destroy_write_struct(&png_ptr, &info_ptr);
 }
 
@@ -187,6 +406,7 @@ static int write_region_png(const char *slide, int64_t x, int64_t y,
   common_fail_on_error(osr, "%s", slide);
 
   // validate args
+  check_png_options();
   ENSURE_NONNEG(level);
   if (level > openslide_get_level_count(osr) - 1) {
     common_fail("level %d out of range (level count %d)",
@@ -236,6 +456,297 @@ static int do_region_read(int narg, char **args) {
   return write_region_png(slide, x, y, level, width, height, output);
 }
 
+// Deep Zoom export.  Level n of the Deep Zoom pyramid is slide level 0
+// and each lower level halves the one above.  The pyramid is built in
+// blocks of BLOCK_DEPTH levels: each block reads a region of level 0 on a
+// worker thread, writes its tiles and halves them down to one tile at
+// the block level.  The main thread assembles the levels above the
+// blocks, consuming blocks in the order it needs them while workers run
+// ahead within a bounded window.
+
+#define BLOCK_DEPTH 3
+
+static int32_t dzi_tile_size = 256;
+
+struct dzi {
+  openslide_t *osr;
+  char *dir;
+  int32_t levels;
+  int64_t *w;
+  int64_t *h;
+  int32_t block_level;
+
+  GPtrArray *blocks;  // struct dzi_block, in the order they're consumed
+  guint next_push;
+  guint next_take;
+  GThreadPool *pool;
+  GMutex lock;
+  GCond cond;
+};
+
+struct dzi_block {
+  int64_t col;
+  int64_t row;
+  uint32_t *buf;  // the block's tile, once done
+  int64_t w;
+  int64_t h;
+  bool done;
+};
+
+// average 2x2 boxes of premultiplied pixels, freeing buf
+static uint32_t *halve(uint32_t *buf, int64_t *w, int64_t *h) {
+  int64_t hw = (*w + 1) / 2;
+  int64_t hh = (*h + 1) / 2;
+  uint32_t *out = g_malloc(hw * hh * 4);
+  for (int64_t y = 0; y < hh; y++) {
+    for (int64_t x = 0; x < hw; x++) {
+      uint32_t sum[4] = {0};
+      uint32_t n = 0;
+      for (int64_t yy = 2 * y; yy < MIN(2 * y + 2, *h); yy++) {
+        for (int64_t xx = 2 * x; xx < MIN(2 * x + 2, *w); xx++) {
+          uint32_t p = buf[yy * *w + xx];
+          for (int c = 0; c < 4; c++) {
+            sum[c] += (p >> (8 * c)) & 0xff;
+          }
+          n++;
+        }
+      }
+      uint32_t p = 0;
+      for (int c = 0; c < 4; c++) {
+        p |= ((sum[c] + n / 2) / n) << (8 * c);
+      }
+      out[y * hw + x] = p;
+    }
+  }
+  g_free(buf);
+  *w = hw;
+  *h = hh;
+  return out;
+}
+
+static void write_tile_png(const char *path, uint32_t *buf,
+                           int32_t w, int32_t h) {
+  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                                                NULL, NULL, warning_callback);
+  if (!png_ptr) {
+    common_fail("Could not initialize PNG");
+  }
+
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (!info_ptr) {
+    common_fail("Could not initialize PNG");
+  }
+
+  g_auto(output) out = open_output(path);
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    common_fail("Error writing PNG");
+  }
+
+  setup_png(png_ptr, info_ptr, out.fp, w, h);
+  png_set_compression_level(png_ptr, compression_level);
+  png_write_info(png_ptr, info_ptr);
+  write_lines_png(png_ptr, buf, w, h);
+  png_write_end(png_ptr, info_ptr);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+}
+
+// write the tiles of a tile-aligned region of a level
+static void dzi_write_tiles(struct dzi *dzi, int32_t level,
+                            const uint32_t *buf, int64_t w, int64_t h,
+                            int64_t col0, int64_t row0) {
+  const int64_t ts = dzi_tile_size;
+  g_autofree uint32_t *tile = g_malloc(ts * ts * 4);
+  for (int64_t row = 0; row * ts < h; row++) {
+    for (int64_t col = 0; col * ts < w; col++) {
+      int64_t tw = MIN(ts, w - col * ts);
+      int64_t th = MIN(ts, h - row * ts);
+      for (int64_t y = 0; y < th; y++) {
+        memcpy(tile + y * tw, buf + (row * ts + y) * w + col * ts, tw * 4);
+      }
+      g_autofree char *path =
+        g_strdup_printf("%s/%d/%"PRId64"_%"PRId64".png", dzi->dir, level,
+                        col0 + col, row0 + row);
+      write_tile_png(path, tile, tw, th);
+    }
+  }
+}
+
+static void dzi_run_block(void *data, void *user_data) {
+  struct dzi_block *block = data;
+  struct dzi *dzi = user_data;
+  int32_t level = dzi->levels - 1;
+  int64_t span = (int64_t) dzi_tile_size << (level - dzi->block_level);
+  int64_t x = block->col * span;
+  int64_t y = block->row * span;
+  int64_t w = MIN(span, dzi->w[level] - x);
+  int64_t h = MIN(span, dzi->h[level] - y);
+
+  uint32_t *buf = g_malloc(w * h * 4);
+  openslide_read_region(dzi->osr, buf, x, y, 0, w, h);
+  common_fail_on_error(dzi->osr, "Reading region");
+  for (;;) {
+    dzi_write_tiles(dzi, level, buf, w, h,
+                    x / dzi_tile_size, y / dzi_tile_size);
+    if (level == dzi->block_level) {
+      break;
+    }
+    buf = halve(buf, &w, &h);
+    x /= 2;
+    y /= 2;
+    level--;
+  }
+
+  g_mutex_lock(&dzi->lock);
+  block->buf = buf;
+  block->w = w;
+  block->h = h;
+  block->done = true;
+  g_cond_broadcast(&dzi->cond);
+  g_mutex_unlock(&dzi->lock);
+}
+
+// list the blocks under a tile, in the order dzi_build() visits them
+static void dzi_enumerate(struct dzi *dzi, int32_t level,
+                          int64_t col, int64_t row) {
+  if (level == dzi->block_level) {
+    struct dzi_block *block = g_new0(struct dzi_block, 1);
+    block->col = col;
+    block->row = row;
+    g_ptr_array_add(dzi->blocks, block);
+    return;
+  }
+  const int64_t ts = dzi_tile_size;
+  for (int64_t r = 2 * row; r < 2 * row + 2 && r * ts < dzi->h[level + 1];
+       r++) {
+    for (int64_t c = 2 * col; c < 2 * col + 2 && c * ts < dzi->w[level + 1];
+         c++) {
+      dzi_enumerate(dzi, level + 1, c, r);
+    }
+  }
+}
+
+static void dzi_push_block(struct dzi *dzi) {
+  if (dzi->next_push < dzi->blocks->len) {
+    g_thread_pool_push(dzi->pool, dzi->blocks->pdata[dzi->next_push++],
+                       NULL);
+  }
+}
+
+static uint32_t *dzi_take_block(struct dzi *dzi, int64_t *w, int64_t *h) {
+  struct dzi_block *block = dzi->blocks->pdata[dzi->next_take++];
+  g_mutex_lock(&dzi->lock);
+  while (!block->done) {
+    g_cond_wait(&dzi->cond, &dzi->lock);
+  }
+  g_mutex_unlock(&dzi->lock);
+  dzi_push_block(dzi);
+
+  uint32_t *buf = block->buf;
+  *w = block->w;
+  *h = block->h;
+  g_free(block);
+  return buf;
+}
+
+// return a tile, having written it and everything below it
+static uint32_t *dzi_build(struct dzi *dzi, int32_t level,
+                           int64_t col, int64_t row,
+                           int64_t *w, int64_t *h) {
+  if (level == dzi->block_level) {
+    return dzi_take_block(dzi, w, h);
+  }
+
+  const int64_t ts = dzi_tile_size;
+  int64_t cw = MIN(2 * ts, dzi->w[level + 1] - 2 * col * ts);
+  int64_t ch = MIN(2 * ts, dzi->h[level + 1] - 2 * row * ts);
+  uint32_t *buf = g_malloc(cw * ch * 4);
+  for (int64_t r = 0; r < 2 && r * ts < ch; r++) {
+    for (int64_t c = 0; c < 2 && c * ts < cw; c++) {
+      int64_t tw, th;
+      g_autofree uint32_t *child =
+        dzi_build(dzi, level + 1, 2 * col + c, 2 * row + r, &tw, &th);
+      for (int64_t y = 0; y < th; y++) {
+        memcpy(buf + (r * ts + y) * cw + c * ts, child + y * tw, tw * 4);
+      }
+    }
+  }
+  buf = halve(buf, &cw, &ch);
+  dzi_write_tiles(dzi, level, buf, cw, ch, col, row);
+  *w = cw;
+  *h = ch;
+  return buf;
+}
+
+static int do_region_dzi(int narg, char **args) {
+  g_assert(narg == 2);
+  const char *slide = args[0];
+  const char *base = args[1];
+  if (dzi_tile_size < 1 || dzi_tile_size > 8192) {
+    common_fail("Tile size must be between 1 and 8192");
+  }
+  check_png_options();
+
+  g_autoptr(openslide_t) osr = openslide_open(slide);
+  common_fail_on_error(osr, "%s", slide);
+  int64_t w, h;
+  openslide_get_level0_dimensions(osr, &w, &h);
+  ENSURE_POS(w);
+  ENSURE_POS(h);
+
+  struct dzi dzi = {
+    .osr = osr,
+    .dir = g_strdup_printf("%s_files", base),
+  };
+  while ((int64_t) 1 << dzi.levels < MAX(w, h)) {
+    dzi.levels++;
+  }
+  dzi.levels++;
+  dzi.w = g_new(int64_t, dzi.levels);
+  dzi.h = g_new(int64_t, dzi.levels);
+  for (int32_t level = dzi.levels - 1; level >= 0; level--) {
+    dzi.w[level] = w;
+    dzi.h[level] = h;
+    g_autofree char *path = g_strdup_printf("%s/%d", dzi.dir, level);
+    if (g_mkdir_with_parents(path, 0777)) {
+      common_fail("Can't create %s: %s", path, g_strerror(errno));
+    }
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+  dzi.block_level = MAX(dzi.levels - 1 - BLOCK_DEPTH, 0);
+
+  dzi.blocks = g_ptr_array_new();
+  dzi_enumerate(&dzi, 0, 0, 0);
+  g_mutex_init(&dzi.lock);
+  g_cond_init(&dzi.cond);
+  dzi.pool = g_thread_pool_new(dzi_run_block, &dzi, get_jobs(), true, NULL);
+  for (int32_t i = 0; i < 2 * get_jobs(); i++) {
+    dzi_push_block(&dzi);
+  }
+  int64_t tw, th;
+  g_free(dzi_build(&dzi, 0, 0, 0, &tw, &th));
+  g_thread_pool_free(dzi.pool, false, true);
+  g_cond_clear(&dzi.cond);
+  g_mutex_clear(&dzi.lock);
+  g_ptr_array_free(dzi.blocks, true);
+
+  // descriptor last, so it only exists for a complete pyramid
+  g_autofree char *path = g_strdup_printf("%s.dzi", base);
+  g_auto(output) out = open_output(path);
+  fprintf(out.fp,
+          "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" "
+          "Format=\"png\" Overlap=\"0\" TileSize=\"%d\">\n"
+          "  <Size Width=\"%"PRId64"\" Height=\"%"PRId64"\"/>\n"
+          "</Image>\n",
+          dzi_tile_size, dzi.w[dzi.levels - 1], dzi.h[dzi.levels - 1]);
+
+  g_free(dzi.w);
+  g_free(dzi.h);
+  g_free(dzi.dir);
+  return 0;
+}
+
 static bool assoc_list(const char *file, int successes, int total) {
   g_autoptr(openslide_t) osr = openslide_open(file);
   if (common_warn_on_error(osr, "%s", file)) {
@@ -345,7 +856,35 @@ const struct command write_png_cmd = {
   .handler = do_write_png,
 };
 
+static const GOptionEntry region_dzi_opts[] = {
+  {"tile-size", 0, 0, G_OPTION_ARG_INT, &dzi_tile_size,
+   "Tile size (default: 256)", "PIXELS"},
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+   "Worker threads (default: one per CPU)", "COUNT"},
+  {"compression-level", 0, 0, G_OPTION_ARG_INT, &compression_level,
+   "zlib compression level, 0-9 (default: 6)", "LEVEL"},
+  {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+static const GOptionEntry region_read_opts[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+   "Worker threads (default: one per CPU)", "COUNT"},
+  {"compression-level", 0, 0, G_OPTION_ARG_INT, &compression_level,
+   "zlib compression level, 0-9 (default: 6)", "LEVEL"},
+  {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
 static const struct command region_subcmds[] = {
+  {
+    .name = "dzi",
+    .parameter_string = "<SLIDE> <OUTPUT-BASE>",
+    .summary = "Export a slide to a Deep Zoom pyramid",
+    .description = "Write a slide as a Deep Zoom pyramid of PNG tiles.",
+    .options = region_dzi_opts,
+    .min_positional = 2,
+    .max_positional = 2,
+    .handler = do_region_dzi,
+  },
   {
     .command = &region_icc_cmd,
   },
@@ -354,6 +893,7 @@ static const struct command region_subcmds[] = {
     .parameter_string = "<SLIDE> <X> <Y> <LEVEL> <WIDTH> <HEIGHT> [OUTPUT-PNG]",
     .summary = "Write a virtual slide region to a PNG",
     .description = "Write a region of a virtual slide to a PNG.",
+    .options = region_read_opts,
     .min_positional = 6,
     .max_positional = 7,
     .handler = do_region_read,